@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+# Copyright (c) 2021 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Log the transactions added to, removed from and rejected by the mempool.
+
+Attaches to the mempool:added, mempool:removed and mempool:rejected
+tracepoints of a running usdgd with BCC, and prints one line per event and a
+summary per removal and reject reason on exit.
+
+    USAGE: mempool_monitor.py path/to/usdgd
+
+Needs root (or CAP_BPF and CAP_PERFMON) and the BCC Python bindings.
+"""
+
+import sys
+from collections import Counter
+from datetime import datetime
+
+from bcc import BPF, USDT
+
+# BCC: The C program to be compiled to an eBPF program (by BCC) and loaded into
+# a sandboxed Linux kernel VM.
+program = """
+#include <uapi/linux/ptrace.h>
+
+#define MAX_REASON_LENGTH 120
+
+struct added_event
+{
+    u8      hash[32];
+    u64     vsize;
+    s64     fee;
+};
+
+struct removed_event
+{
+    u8      hash[32];
+    char    reason[MAX_REASON_LENGTH];
+    u64     vsize;
+    s64     fee;
+    s64     entry_time;
+};
+
+struct rejected_event
+{
+    u8      hash[32];
+    char    reason[MAX_REASON_LENGTH];
+};
+
+BPF_PERF_OUTPUT(added_events);
+BPF_PERF_OUTPUT(removed_events);
+BPF_PERF_OUTPUT(rejected_events);
+
+int trace_added(struct pt_regs *ctx) {
+    struct added_event added = {};
+    void *phash = NULL;
+
+    bpf_usdt_readarg(1, ctx, &phash);
+    bpf_probe_read_user(&added.hash, sizeof(added.hash), phash);
+    bpf_usdt_readarg(2, ctx, &added.vsize);
+    bpf_usdt_readarg(3, ctx, &added.fee);
+
+    added_events.perf_submit(ctx, &added, sizeof(added));
+    return 0;
+};
+
+int trace_removed(struct pt_regs *ctx) {
+    struct removed_event removed = {};
+    void *phash = NULL, *preason = NULL;
+
+    bpf_usdt_readarg(1, ctx, &phash);
+    bpf_probe_read_user(&removed.hash, sizeof(removed.hash), phash);
+    bpf_usdt_readarg(2, ctx, &preason);
+    bpf_probe_read_user_str(&removed.reason, sizeof(removed.reason), preason);
+    bpf_usdt_readarg(3, ctx, &removed.vsize);
+    bpf_usdt_readarg(4, ctx, &removed.fee);
+    bpf_usdt_readarg(5, ctx, &removed.entry_time);
+
+    removed_events.perf_submit(ctx, &removed, sizeof(removed));
+    return 0;
+};
+
+int trace_rejected(struct pt_regs *ctx) {
+    struct rejected_event rejected = {};
+    void *phash = NULL, *preason = NULL;
+
+    bpf_usdt_readarg(1, ctx, &phash);
+    bpf_probe_read_user(&rejected.hash, sizeof(rejected.hash), phash);
+    bpf_usdt_readarg(2, ctx, &preason);
+    bpf_probe_read_user_str(&rejected.reason, sizeof(rejected.reason), preason);
+
+    rejected_events.perf_submit(ctx, &rejected, sizeof(rejected));
+    return 0;
+};
+"""
+
+
+def txid(event):
+    """Hashes are passed in internal byte order, reverse them for display."""
+    return bytes(event.hash[::-1]).hex()
+
+
+def main(usdgd_path):
+    usdgd_with_usdts = USDT(path=str(usdgd_path))
+
+    # attaching the trace functions defined in the BPF program to the tracepoints
+    usdgd_with_usdts.enable_probe(probe="mempool:added", fn_name="trace_added")
+    usdgd_with_usdts.enable_probe(probe="mempool:removed", fn_name="trace_removed")
+    usdgd_with_usdts.enable_probe(probe="mempool:rejected", fn_name="trace_rejected")
+    bpf = BPF(text=program, usdt_contexts=[usdgd_with_usdts])
+
+    removed_reasons = Counter()
+    rejected_reasons = Counter()
+
+    def handle_added(_, data, size):
+        event = bpf["added_events"].event(data)
+        print(f"added    {txid(event)} vsize={event.vsize} fee={event.fee}")
+
+    def handle_removed(_, data, size):
+        event = bpf["removed_events"].event(data)
+        reason = event.reason.decode("utf-8")
+        removed_reasons[reason] += 1
+        entered = datetime.fromtimestamp(event.entry_time).isoformat()
+        print(f"removed  {txid(event)} reason={reason} vsize={event.vsize} fee={event.fee} entered={entered}")
+
+    def handle_rejected(_, data, size):
+        event = bpf["rejected_events"].event(data)
+        reason = event.reason.decode("utf-8")
+        rejected_reasons[reason] += 1
+        print(f"rejected {txid(event)} reason={reason}")
+
+    bpf["added_events"].open_perf_buffer(handle_added)
+    bpf["removed_events"].open_perf_buffer(handle_removed)
+    bpf["rejected_events"].open_perf_buffer(handle_rejected)
+
+    print("Logging mempool events. Ctrl-C to end...")
+    while True:
+        try:
+            bpf.perf_buffer_poll()
+        except KeyboardInterrupt:
+            break
+
+    for title, reasons in (("Removed", removed_reasons), ("Rejected", rejected_reasons)):
+        print(f"\n{title} transactions by reason:")
+        for reason, count in reasons.most_common():
+            print(f"  {reason:<40} {count}")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print("USAGE:", sys.argv[0], "path/to/usdgd")
+        sys.exit(1)
+    main(sys.argv[1])
@@ -17,6 +17,7 @@
 #include <sync.h>
 #include <timedata.h>
 #include <tinyformat.h>
+#include <util/asmap.h>
 #include <util/system.h>
 
 #include <iostream>
@@ -57,6 +58,16 @@ private:
     //! position in vRandom
     int nRandomPos{-1};
 
+    //! id of the asmap m_mapped_as and m_source_mapped_as were looked up in (memory only)
+    mutable uint64_t m_mapped_as_asmap{0};
+
+    //! AS this address and its source map to (memory only)
+    mutable uint32_t m_mapped_as{0};
+    mutable uint32_t m_source_mapped_as{0};
+
+    //! Look up the AS of this address and its source, unless cached for this asmap
+    void UpdateMappedAS(const CompiledASMap& asmap) const;
+
     friend class CAddrMan;
 
 public:
@@ -65,6 +76,7 @@ public:
     {
         READWRITEAS(CAddress, obj);
         READWRITE(obj.source, obj.nLastSuccess, obj.nAttempts);
+        SER_READ(obj, obj.m_mapped_as_asmap = 0);
     }
 
     CAddrInfo(const CAddress &addrIn, const CNetAddr &addrSource) : CAddress(addrIn), source(addrSource)
@@ -76,13 +88,13 @@ public:
     }
 
     //! Calculate in which "tried" bucket this entry belongs
-    int GetTriedBucket(const uint256 &nKey, const std::vector<bool> &asmap) const;
+    int GetTriedBucket(const uint256 &nKey, const CompiledASMap &asmap) const;
 
     //! Calculate in which "new" bucket this entry belongs, given a certain source
-    int GetNewBucket(const uint256 &nKey, const CNetAddr& src, const std::vector<bool> &asmap) const;
+    int GetNewBucket(const uint256 &nKey, const CNetAddr& src, const CompiledASMap &asmap) const;
 
     //! Calculate in which "new" bucket this entry belongs, using its default source
-    int GetNewBucket(const uint256 &nKey, const std::vector<bool> &asmap) const
+    int GetNewBucket(const uint256 &nKey, const CompiledASMap &asmap) const
     {
         return GetNewBucket(nKey, source, asmap);
     }
@@ -97,6 +109,36 @@ public:
     double GetChance(int64_t nNow = GetAdjustedTime()) const;
 };
 
+/**
+ * The occupied positions of a bucket table, numbered bucket * ADDRMAN_BUCKET_SIZE + position.
+ *
+ * Picking a uniformly random occupied position takes constant time, however
+ * sparse the table is.
+ */
+class CAddrTablePositions
+{
+    //! occupied positions, in no particular order
+    std::vector<int> m_occupied;
+
+    //! index in m_occupied of every position, or -1 if it is empty
+    std::vector<int> m_index;
+
+public:
+    explicit CAddrTablePositions(size_t nPositions) : m_index(nPositions, -1) {}
+
+    void Set(int nPosition, bool fOccupied);
+
+    void Clear();
+
+    size_t size() const { return m_occupied.size(); }
+
+    int GetRandom(FastRandomContext& rng) const
+    {
+        assert(!m_occupied.empty());
+        return m_occupied[rng.randrange(m_occupied.size())];
+    }
+};
+
 /** Stochastic address manager
  *
  * Design goals:
@@ -121,6 +163,8 @@ public:
  *      be observable by adversaries.
  *    * Several indexes are kept for high performance. Defining DEBUG_ADDRMAN will introduce frequent (and expensive)
  *      consistency checks for the entire data structure.
+ *    * Entries live in a vector indexed by nId. The slots of deleted entries are reused, so nIds stay small and
+ *      stable for as long as the entry exists.
  */
 
 //! total number of buckets for tried addresses
@@ -187,7 +231,20 @@ public:
     //
     // If a new asmap was provided, the existing records
     // would be re-bucketed accordingly.
-    std::vector<bool> m_asmap;
+    //
+    // The asmap must have passed SanityCheckASMap. It is compiled
+    // for lookups, and the AS of every known address and its source
+    // is cached alongside the address.
+    void SetAsmap(const std::vector<bool>& asmap)
+        EXCLUSIVE_LOCKS_REQUIRED(!cs)
+    {
+        LOCK(cs);
+        m_asmap = asmap.empty() ? CompiledASMap() : CompiledASMap(asmap);
+        m_asmap_checksum = asmap.empty() ? uint256() : SerializeHash(asmap);
+    }
+
+    //! The asmap used for bucketing. Set once at startup.
+    const CompiledASMap& GetAsmap() const { return m_asmap; }
 
     // Read asmap from provided binary file
     static std::vector<bool> DecodeAsmap(fs::path path);
@@ -220,7 +277,7 @@ public:
      * as incompatible. This is necessary because it did not check the version number on
      * deserialization.
      *
-     * vvNew, vvTried, mapInfo, mapAddr and vRandom are never encoded explicitly;
+     * vvNew, vvTried, vInfo, mapAddr and vRandom are never encoded explicitly;
      * they are instead reconstructed from the other information.
      *
      * This format is more complex, but significantly smaller (at most 1.5 MiB), and supports
@@ -252,20 +309,19 @@ public:
 
         int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT ^ (1 << 30);
         s << nUBuckets;
-        std::unordered_map<int, int> mapUnkIds;
+        std::vector<int> vUnkIds(vInfo.size(), -1);
         int nIds = 0;
-        for (const auto& entry : mapInfo) {
-            mapUnkIds[entry.first] = nIds;
-            const CAddrInfo &info = entry.second;
+        for (size_t nId = 0; nId < vInfo.size(); ++nId) {
+            const CAddrInfo &info = vInfo[nId];
             if (info.nRefCount) {
                 assert(nIds != nNew); // this means nNew was wrong, oh ow
+                vUnkIds[nId] = nIds;
                 s << info;
                 nIds++;
             }
         }
         nIds = 0;
-        for (const auto& entry : mapInfo) {
-            const CAddrInfo &info = entry.second;
+        for (const CAddrInfo &info : vInfo) {
             if (info.fInTried) {
                 assert(nIds != nTried); // this means nTried was wrong, oh ow
                 s << info;
@@ -281,18 +337,14 @@ public:
             s << nSize;
             for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
                 if (vvNew[bucket][i] != -1) {
-                    int nIndex = mapUnkIds[vvNew[bucket][i]];
+                    int nIndex = vUnkIds[vvNew[bucket][i]];
                     s << nIndex;
                 }
             }
         }
         // Store asmap checksum after bucket entries so that it
         // can be ignored by older clients for backward compatibility.
-        uint256 asmap_checksum;
-        if (m_asmap.size() != 0) {
-            asmap_checksum = SerializeHash(m_asmap);
-        }
-        s << asmap_checksum;
+        s << m_asmap_checksum;
     }
 
     template <typename Stream>
@@ -348,15 +400,19 @@ public:
                           ADDRMAN_TRIED_BUCKET_COUNT * ADDRMAN_BUCKET_SIZE));
         }
 
+        vInfo.reserve(nNew + nTried);
+        vRandom.reserve(nNew + nTried);
+        mapAddr.reserve(nNew + nTried);
+
         // Deserialize entries from the new table.
+        vInfo.resize(nNew);
         for (int n = 0; n < nNew; n++) {
-            CAddrInfo &info = mapInfo[n];
+            CAddrInfo &info = vInfo[n];
             s >> info;
             mapAddr[info] = n;
             info.nRandomPos = vRandom.size();
             vRandom.push_back(n);
         }
-        nIdCount = nNew;
 
         // Deserialize entries from the tried table.
         int nLost = 0;
@@ -366,13 +422,13 @@ public:
             int nKBucket = info.GetTriedBucket(nKey, m_asmap);
             int nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
             if (vvTried[nKBucket][nKBucketPos] == -1) {
+                const int nId = vInfo.size();
                 info.nRandomPos = vRandom.size();
                 info.fInTried = true;
-                vRandom.push_back(nIdCount);
-                mapInfo[nIdCount] = info;
-                mapAddr[info] = nIdCount;
-                vvTried[nKBucket][nKBucketPos] = nIdCount;
-                nIdCount++;
+                vRandom.push_back(nId);
+                mapAddr[info] = nId;
+                vInfo.push_back(std::move(info));
+                SetTried(nKBucket, nKBucketPos, nId);
             } else {
                 nLost++;
             }
@@ -383,6 +439,7 @@ public:
         // An entry may appear in up to ADDRMAN_NEW_BUCKETS_PER_ADDRESS buckets,
         // so we store all bucket-entry_index pairs to iterate through later.
         std::vector<std::pair<int, int>> bucket_entries;
+        bucket_entries.reserve(nNew);
 
         for (int bucket = 0; bucket < nUBuckets; ++bucket) {
             int num_entries{0};
@@ -399,10 +456,7 @@ public:
         // If the bucket count and asmap checksum haven't changed, then attempt
         // to restore the entries to the buckets/positions they were in before
         // serialization.
-        uint256 supplied_asmap_checksum;
-        if (m_asmap.size() != 0) {
-            supplied_asmap_checksum = SerializeHash(m_asmap);
-        }
+        const uint256& supplied_asmap_checksum = m_asmap_checksum;
         uint256 serialized_asmap_checksum;
         if (format >= Format::V2_ASMAP) {
             s >> serialized_asmap_checksum;
@@ -417,7 +471,7 @@ public:
         for (auto bucket_entry : bucket_entries) {
             int bucket{bucket_entry.first};
             const int entry_index{bucket_entry.second};
-            CAddrInfo& info = mapInfo[entry_index];
+            CAddrInfo& info = vInfo[entry_index];
 
             // The entry shouldn't appear in more than
             // ADDRMAN_NEW_BUCKETS_PER_ADDRESS. If it has already, just skip
@@ -427,7 +481,7 @@ public:
             int bucket_position = info.GetBucketPosition(nKey, true, bucket);
             if (restore_bucketing && vvNew[bucket][bucket_position] == -1) {
                 // Bucketing has not changed, using existing bucket positions for the new table
-                vvNew[bucket][bucket_position] = entry_index;
+                SetNew(bucket, bucket_position, entry_index);
                 ++info.nRefCount;
             } else {
                 // In case the new table data cannot be used (bucket count wrong or new asmap),
@@ -435,7 +489,7 @@ public:
                 bucket = info.GetNewBucket(nKey, m_asmap);
                 bucket_position = info.GetBucketPosition(nKey, true, bucket);
                 if (vvNew[bucket][bucket_position] == -1) {
-                    vvNew[bucket][bucket_position] = entry_index;
+                    SetNew(bucket, bucket_position, entry_index);
                     ++info.nRefCount;
                 }
             }
@@ -443,13 +497,11 @@ public:
 
         // Prune new entries with refcount 0 (as a result of collisions).
         int nLostUnk = 0;
-        for (auto it = mapInfo.cbegin(); it != mapInfo.cend(); ) {
-            if (it->second.fInTried == false && it->second.nRefCount == 0) {
-                const auto itCopy = it++;
-                Delete(itCopy->first);
+        for (int nId = 0; nId < (int)vInfo.size(); ++nId) {
+            const CAddrInfo& info = vInfo[nId];
+            if (IsValidId(nId) && info.fInTried == false && info.nRefCount == 0) {
+                Delete(nId);
                 ++nLostUnk;
-            } else {
-                ++it;
             }
         }
         if (nLost + nLostUnk > 0) {
@@ -478,11 +530,14 @@ public:
             }
         }
 
-        nIdCount = 0;
+        m_new_positions.Clear();
+        m_tried_positions.Clear();
+
         nTried = 0;
         nNew = 0;
         nLastGood = 1; //Initially at 1 so that "never" is strictly worse.
-        mapInfo.clear();
+        vInfo.clear();
+        vFreeIds.clear();
         mapAddr.clear();
     }
 
@@ -637,6 +692,12 @@ private:
     //! A mutex to protect the inner data structures.
     mutable Mutex cs;
 
+    //! Compiled asmap, see SetAsmap()
+    CompiledASMap m_asmap;
+
+    //! Hash of the asmap as loaded, stored in peers.dat to detect a changed asmap
+    uint256 m_asmap_checksum;
+
     //! Serialization versions.
     enum Format : uint8_t {
         V0_HISTORICAL = 0,    //!< historic format, before commit e6b343d88
@@ -659,11 +720,11 @@ private:
     //! @note Don't increment this. Increment `lowest_compatible` in `Serialize()` instead.
     static constexpr uint8_t INCOMPATIBILITY_BASE = 32;
 
-    //! last used nId
-    int nIdCount GUARDED_BY(cs);
+    //! table with information about all nIds, indexed by nId. Free slots have nRandomPos == -1.
+    std::vector<CAddrInfo> vInfo GUARDED_BY(cs);
 
-    //! table with information about all nIds
-    std::unordered_map<int, CAddrInfo> mapInfo GUARDED_BY(cs);
+    //! free slots in vInfo, to be reused before growing it
+    std::vector<int> vFreeIds GUARDED_BY(cs);
 
     //! find an nId based on its network address
     std::unordered_map<CNetAddr, int, CNetAddrHash> mapAddr GUARDED_BY(cs);
@@ -683,6 +744,10 @@ private:
     //! list of "new" buckets
     int vvNew[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE] GUARDED_BY(cs);
 
+    //! occupied positions of vvTried and vvNew, for Select_
+    CAddrTablePositions m_tried_positions GUARDED_BY(cs){ADDRMAN_TRIED_BUCKET_COUNT * ADDRMAN_BUCKET_SIZE};
+    CAddrTablePositions m_new_positions GUARDED_BY(cs){ADDRMAN_NEW_BUCKET_COUNT * ADDRMAN_BUCKET_SIZE};
+
     //! last time Good was called (memory only)
     int64_t nLastGood GUARDED_BY(cs);
 
@@ -699,6 +764,19 @@ private:
     //! Swap two elements in vRandom.
     void SwapRandom(unsigned int nRandomPos1, unsigned int nRandomPos2) EXCLUSIVE_LOCKS_REQUIRED(cs);
 
+    //! Whether nId refers to an existing entry.
+    bool IsValidId(int nId) const EXCLUSIVE_LOCKS_REQUIRED(cs)
+    {
+        return nId >= 0 && (size_t)nId < vInfo.size() && vInfo[nId].nRandomPos != -1;
+    }
+
+    //! Remove an entry from vRandom, mapAddr and vInfo, freeing its nId.
+    void Erase(int nId) EXCLUSIVE_LOCKS_REQUIRED(cs);
+
+    //! Set a position in a "tried" or "new" table to nId, or to -1 to empty it.
+    void SetTried(int nKBucket, int nKBucketPos, int nId) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    void SetNew(int nUBucket, int nUBucketPos, int nId) EXCLUSIVE_LOCKS_REQUIRED(cs);
+
     //! Move an entry from the "new" table(s) to the "tried" table
     void MakeTried(CAddrInfo& info, int nId) EXCLUSIVE_LOCKS_REQUIRED(cs);
 
@@ -19,6 +19,9 @@ BanMan::BanMan(fs::path ban_file, CClientUIInterface* client_interface, int64_t
 
     int64_t n_start = GetTimeMillis();
     if (m_ban_db.Read(m_banned, m_is_dirty)) {
+        for (const auto& [sub_net, ban_entry] : m_banned) {
+            m_banned_index.Insert(sub_net, ban_entry.nBanUntil);
+        }
         SweepBanned(); // sweep out unused entries
 
         LogPrint(BCLog::NET, "Loaded %d banned node addresses/subnets  %dms\n", m_banned.size(),
@@ -60,6 +63,7 @@ void BanMan::ClearBanned()
     {
         LOCK(m_cs_banned);
         m_banned.clear();
+        m_banned_index.Clear();
         m_is_dirty = true;
     }
     DumpBanlist(); //store banlist to disk
@@ -76,15 +80,7 @@ bool BanMan::IsBanned(const CNetAddr& net_addr)
 {
     auto current_time = GetTime();
     LOCK(m_cs_banned);
-    for (const auto& it : m_banned) {
-        CSubNet sub_net = it.first;
-        CBanEntry ban_entry = it.second;
-
-        if (current_time < ban_entry.nBanUntil && sub_net.Match(net_addr)) {
-            return true;
-        }
-    }
-    return false;
+    return m_banned_index.AnyMatch(net_addr, [&](int64_t ban_until) { return current_time < ban_until; });
 }
 
 bool BanMan::IsBanned(const CSubNet& sub_net)
@@ -129,6 +125,7 @@ void BanMan::Ban(const CSubNet& sub_net, int64_t ban_time_offset, bool since_uni
         LOCK(m_cs_banned);
         if (m_banned[sub_net].nBanUntil < ban_entry.nBanUntil) {
             m_banned[sub_net] = ban_entry;
+            m_banned_index.Insert(sub_net, ban_entry.nBanUntil);
             m_is_dirty = true;
         } else
             return;
@@ -150,6 +147,7 @@ bool BanMan::Unban(const CSubNet& sub_net)
     {
         LOCK(m_cs_banned);
         if (m_banned.erase(sub_net) == 0) return false;
+        m_banned_index.Erase(sub_net);
         m_is_dirty = true;
     }
     if (m_client_interface) m_client_interface->BannedListChanged();
@@ -176,6 +174,7 @@ void BanMan::SweepBanned()
             CSubNet sub_net = (*it).first;
             CBanEntry ban_entry = (*it).second;
             if (!sub_net.IsValid() || now > ban_entry.nBanUntil) {
+                m_banned_index.Erase(sub_net);
                 m_banned.erase(it++);
                 m_is_dirty = true;
                 notify_ui = true;
@@ -5,6 +5,7 @@
 #include <addrman.h>
 #include <bench/bench.h>
 #include <random.h>
+#include <util/asmap.h>
 #include <util/time.h>
 
 #include <optional>
@@ -52,6 +53,69 @@ static void CreateAddresses()
     }
 }
 
+/* An asmap that splits the address space on the first 12 bits, and then maps
+ * one /20 in each resulting range to its own AS. */
+
+static constexpr int ASMAP_JUMP_DEPTH = 12;
+
+static std::vector<bool> g_asmap;
+
+/** Append val in the variable-length encoding read by DecodeBits() in util/asmap.cpp. */
+static void EncodeBits(std::vector<bool>& bits, uint32_t val, uint32_t minval, const std::vector<uint8_t>& bit_sizes)
+{
+    val -= minval;
+    for (size_t i = 0; i < bit_sizes.size(); ++i) {
+        const bool last = i + 1 == bit_sizes.size();
+        if (last || val < (1U << bit_sizes[i])) {
+            if (!last) bits.push_back(false);
+            for (int b = bit_sizes[i] - 1; b >= 0; --b) {
+                bits.push_back((val >> b) & 1);
+            }
+            return;
+        }
+        bits.push_back(true);
+        val -= 1U << bit_sizes[i];
+    }
+}
+
+static std::vector<bool> EncodeAsmapTree(int depth, uint32_t& next_asn)
+{
+    static const std::vector<uint8_t> TYPE_BIT_SIZES{0, 0, 1};
+    static const std::vector<uint8_t> ASN_BIT_SIZES{15, 16, 17, 18, 19, 20, 21, 22, 23, 24};
+    static const std::vector<uint8_t> MATCH_BIT_SIZES{1, 2, 3, 4, 5, 6, 7, 8};
+    static const std::vector<uint8_t> JUMP_BIT_SIZES{5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30};
+
+    std::vector<bool> bits;
+    if (depth == 0) {
+        // DEFAULT asn, MATCH 8 bits, RETURN asn
+        EncodeBits(bits, 3, 0, TYPE_BIT_SIZES);
+        EncodeBits(bits, next_asn++, 1, ASN_BIT_SIZES);
+        EncodeBits(bits, 2, 0, TYPE_BIT_SIZES);
+        EncodeBits(bits, 0x100 | (next_asn & 0xFF), 2, MATCH_BIT_SIZES);
+        EncodeBits(bits, 0, 0, TYPE_BIT_SIZES);
+        EncodeBits(bits, next_asn++, 1, ASN_BIT_SIZES);
+        return bits;
+    }
+    const std::vector<bool> zero = EncodeAsmapTree(depth - 1, next_asn);
+    const std::vector<bool> one = EncodeAsmapTree(depth - 1, next_asn);
+    EncodeBits(bits, 1, 0, TYPE_BIT_SIZES);
+    EncodeBits(bits, zero.size(), 17, JUMP_BIT_SIZES);
+    bits.insert(bits.end(), zero.begin(), zero.end());
+    bits.insert(bits.end(), one.begin(), one.end());
+    return bits;
+}
+
+static void CreateAsmap()
+{
+    if (g_asmap.size() > 0) { // already created
+        return;
+    }
+
+    uint32_t next_asn = 1;
+    g_asmap = EncodeAsmapTree(ASMAP_JUMP_DEPTH, next_asn);
+    assert(SanityCheckASMap(g_asmap, 128));
+}
+
 static void AddAddressesToAddrMan(CAddrMan& addrman)
 {
     for (size_t source_i = 0; source_i < NUM_SOURCES; ++source_i) {
@@ -80,6 +144,20 @@ static void AddrManAdd(benchmark::Bench& bench)
     });
 }
 
+static void AddrManAddAsmap(benchmark::Bench& bench)
+{
+    CreateAddresses();
+    CreateAsmap();
+
+    CAddrMan addrman;
+    addrman.SetAsmap(g_asmap);
+
+    bench.run([&] {
+        AddAddressesToAddrMan(addrman);
+        addrman.Clear();
+    });
+}
+
 static void AddrManSelect(benchmark::Bench& bench)
 {
     CAddrMan addrman;
@@ -135,7 +213,53 @@ static void AddrManGood(benchmark::Bench& bench)
     });
 }
 
+static void ASMapInterpret(benchmark::Bench& bench)
+{
+    CreateAddresses();
+    CreateAsmap();
+
+    std::vector<std::vector<bool>> ips;
+    for (const auto& addresses : g_addresses) {
+        for (const CAddress& addr : addresses) {
+            const std::vector<unsigned char> bytes = addr.GetAddrBytes();
+            std::vector<bool>& ip = ips.emplace_back(bytes.size() * 8);
+            for (size_t bit = 0; bit < ip.size(); ++bit) {
+                ip[bit] = (bytes[bit / 8] >> (7 - bit % 8)) & 1;
+            }
+        }
+    }
+
+    bench.batch(ips.size()).unit("lookup").run([&] {
+        for (const auto& ip : ips) {
+            (void)Interpret(g_asmap, ip);
+        }
+    });
+}
+
+static void ASMapLookup(benchmark::Bench& bench)
+{
+    CreateAddresses();
+    CreateAsmap();
+
+    const CompiledASMap asmap{g_asmap};
+    std::vector<std::vector<unsigned char>> ips;
+    for (const auto& addresses : g_addresses) {
+        for (const CAddress& addr : addresses) {
+            ips.push_back(addr.GetAddrBytes());
+        }
+    }
+
+    bench.batch(ips.size()).unit("lookup").run([&] {
+        for (const auto& ip : ips) {
+            (void)asmap.Lookup(ip);
+        }
+    });
+}
+
 BENCHMARK(AddrManAdd);
+BENCHMARK(AddrManAddAsmap);
 BENCHMARK(AddrManSelect);
 BENCHMARK(AddrManGetAddr);
 BENCHMARK(AddrManGood);
+BENCHMARK(ASMapInterpret);
+BENCHMARK(ASMapLookup);
@@ -0,0 +1,69 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chainparams.h>
+#include <net.h>
+#include <netmessagemaker.h>
+#include <test/util/setup_common.h>
+#include <version.h>
+
+#include <cassert>
+#include <memory>
+#include <vector>
+
+/** Size of the message sent, about that of a full block */
+static constexpr size_t MESSAGE_SIZE{1000 * 1000};
+
+/** Send a message through serializer and receive it with deserializer */
+static void TransportRoundTrip(benchmark::Bench& bench, TransportSerializer& serializer, TransportDeserializer& deserializer)
+{
+    const CNetMsgMaker msg_maker{INIT_PROTO_VERSION};
+    const std::vector<uint8_t> data(MESSAGE_SIZE, 0x42);
+    bench.batch(MESSAGE_SIZE).unit("byte").run([&] {
+        CSerializedNetMsg msg{msg_maker.Make(NetMsgType::BLOCK, data)};
+        std::vector<unsigned char> header;
+        serializer.prepareForTransport(msg, header);
+        for (Span<const uint8_t> bytes : {Span<const uint8_t>{header}, msg.Payload()}) {
+            while (!bytes.empty()) {
+                const int ret{deserializer.Read(bytes)};
+                assert(ret >= 0);
+            }
+        }
+        assert(deserializer.Complete());
+        uint32_t err_raw_size{0};
+        const std::optional<CNetMessage> received{deserializer.GetMessage(std::chrono::microseconds{0}, err_raw_size)};
+        assert(received && received->m_message_size == MESSAGE_SIZE + GetSizeOfCompactSize(MESSAGE_SIZE));
+    });
+}
+
+static void P2PTransportV1(benchmark::Bench& bench)
+{
+    const auto testing_setup = MakeNoLogFileContext<const BasicTestingSetup>();
+    V1TransportSerializer serializer;
+    V1TransportDeserializer deserializer{Params(), /* node_id */ 0, SER_NETWORK, INIT_PROTO_VERSION};
+    TransportRoundTrip(bench, serializer, deserializer);
+}
+
+static void P2PTransportV2(benchmark::Bench& bench)
+{
+    const auto testing_setup = MakeNoLogFileContext<const BasicTestingSetup>();
+    auto initiator = std::make_shared<V2TransportSession>(Params(), /* initiator */ true);
+    auto responder = std::make_shared<V2TransportSession>(Params(), /* initiator */ false);
+    V2TransportSerializer initiator_serializer{initiator}, responder_serializer{responder};
+    V2TransportDeserializer initiator_deserializer{initiator, Params(), /* node_id */ 0, SER_NETWORK, INIT_PROTO_VERSION};
+    V2TransportDeserializer responder_deserializer{responder, Params(), /* node_id */ 1, SER_NETWORK, INIT_PROTO_VERSION};
+
+    // Exchange keys before measuring
+    std::vector<unsigned char> key;
+    initiator_serializer.GetTransportBytes(key);
+    for (Span<const uint8_t> bytes{key}; !bytes.empty();) assert(responder_deserializer.Read(bytes) >= 0);
+    responder_serializer.GetTransportBytes(key);
+    for (Span<const uint8_t> bytes{key}; !bytes.empty();) assert(initiator_deserializer.Read(bytes) >= 0);
+
+    TransportRoundTrip(bench, initiator_serializer, responder_deserializer);
+}
+
+BENCHMARK(P2PTransportV1);
+BENCHMARK(P2PTransportV2);
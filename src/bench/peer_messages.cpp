@@ -0,0 +1,116 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chainparams.h>
+#include <net.h>
+#include <net_processing.h>
+#include <netmessagemaker.h>
+#include <protocol.h>
+#include <random.h>
+#include <test/util/net.h>
+#include <test/util/setup_common.h>
+#include <version.h>
+
+#include <functional>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/** Number of synthetic peers */
+static constexpr int NUM_PEERS{128};
+/** Number of messages queued for each peer per iteration */
+static constexpr int MESSAGES_PER_PEER{10};
+
+/**
+ * Process messages queued by many peers, with every peer pinned to one of
+ * num_threads threads, as CConnman pins peers to its message handler threads.
+ */
+static void ProcessPeerMessages(benchmark::Bench& bench, int num_threads, std::function<CSerializedNetMsg()> make_msg)
+{
+    const auto testing_setup = MakeNoLogFileContext<const TestingSetup>();
+    const NodeContext& node = testing_setup->m_node;
+
+    auto connman = std::make_unique<ConnmanTestMsg>(0x1337, 0x1337, *node.addrman);
+    auto peerman = PeerManager::make(Params(), *connman, *node.addrman, nullptr,
+                                     *node.scheduler, *node.chainman, *node.mempool, false);
+    CConnman::Options options;
+    options.m_msgproc = peerman.get();
+    options.nReceiveFloodSize = 1000 * DEFAULT_MAXRECEIVEBUFFER;
+    options.nSendBufferMaxSize = 1000 * DEFAULT_MAXSENDBUFFER;
+    connman->Init(options);
+
+    FastRandomContext rng{/* fDeterministic */ true};
+    std::vector<std::unique_ptr<CNode>> peers;
+    for (NodeId id = 0; id < NUM_PEERS; ++id) {
+        in_addr ipv4;
+        ipv4.s_addr = rng.rand32();
+        const CAddress addr{CService{ipv4, 8333}, NODE_NONE};
+        peers.push_back(std::make_unique<CNode>(id, NODE_NETWORK, INVALID_SOCKET, addr, /* nKeyedNetGroupIn */ id,
+                                                /* nLocalHostNonceIn */ 0, CAddress(), /* pszDest */ "",
+                                                ConnectionType::INBOUND, /* inbound_onion */ false));
+        CNode& peer = *peers.back();
+        peer.nVersion = PROTOCOL_VERSION;
+        peer.SetCommonVersion(PROTOCOL_VERSION);
+        peerman->InitializeNode(&peer);
+        peer.fSuccessfullyConnected = true;
+    }
+
+    bench.run([&] {
+        for (const auto& peer : peers) {
+            {
+                // Replies can't be sent without a socket; drop them
+                LOCK(peer->cs_vSend);
+                peer->vSendMsg.clear();
+                peer->nSendSize = 0;
+            }
+            peer->fPauseSend = false;
+            for (int i = 0; i < MESSAGES_PER_PEER; ++i) {
+                CSerializedNetMsg msg{make_msg()};
+                connman->ReceiveMsgFrom(*peer, msg);
+            }
+        }
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; ++t) {
+            threads.emplace_back([&, t] {
+                for (int i = t; i < NUM_PEERS; i += num_threads) {
+                    for (int j = 0; j < MESSAGES_PER_PEER; ++j) {
+                        connman->ProcessMessagesOnce(*peers[i]);
+                    }
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    });
+
+    for (const auto& peer : peers) {
+        peerman->FinalizeNode(*peer);
+    }
+}
+
+static CSerializedNetMsg MakePing()
+{
+    return CNetMsgMaker{PROTOCOL_VERSION}.Make(NetMsgType::PING, GetRand(std::numeric_limits<uint64_t>::max()));
+}
+
+static CSerializedNetMsg MakeGetHeaders()
+{
+    return CNetMsgMaker{PROTOCOL_VERSION}.Make(NetMsgType::GETHEADERS, CBlockLocator{}, uint256{});
+}
+
+// ping does not take cs_main, so it scales with the number of threads
+static void PeerMessagesPing1Thread(benchmark::Bench& bench) { ProcessPeerMessages(bench, 1, MakePing); }
+static void PeerMessagesPing4Threads(benchmark::Bench& bench) { ProcessPeerMessages(bench, 4, MakePing); }
+// getheaders serializes on cs_main
+static void PeerMessagesGetHeaders1Thread(benchmark::Bench& bench) { ProcessPeerMessages(bench, 1, MakeGetHeaders); }
+static void PeerMessagesGetHeaders4Threads(benchmark::Bench& bench) { ProcessPeerMessages(bench, 4, MakeGetHeaders); }
+
+BENCHMARK(PeerMessagesPing1Thread);
+BENCHMARK(PeerMessagesPing4Threads);
+BENCHMARK(PeerMessagesGetHeaders1Thread);
+BENCHMARK(PeerMessagesGetHeaders4Threads);
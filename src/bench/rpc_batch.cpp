@@ -0,0 +1,57 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <rpc/request.h>
+#include <rpc/server.h>
+#include <test/util/setup_common.h>
+#include <util/time.h>
+
+#include <univalue.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/** Batch entry that waits for a while, like a method reading from disk */
+static const CRPCCommand g_bench_wait{"bench", "benchwait",
+    [](const JSONRPCRequest& request, UniValue& result, bool) {
+        UninterruptibleSleep(std::chrono::microseconds{200});
+        result = request.params;
+        return true;
+    },
+    {}, 0};
+
+static void RPCBatch(benchmark::Bench& bench, int max_parallel)
+{
+    const auto testing_setup = MakeNoLogFileContext<const BasicTestingSetup>();
+    static bool registered{false};
+    if (!registered) {
+        tableRPC.appendCommand("benchwait", &g_bench_wait);
+        registered = true;
+    }
+    if (RPCIsInWarmup(nullptr)) SetRPCWarmupFinished();
+
+    UniValue batch(UniValue::VARR);
+    for (int i = 0; i < 100; ++i) {
+        batch.push_back(JSONRPCRequestObj("benchwait", UniValue(UniValue::VARR), i));
+    }
+    std::vector<std::thread> threads;
+    const RPCTaskRunner run_task{[&](std::function<void()> task) {
+        threads.emplace_back(std::move(task));
+        return true;
+    }};
+    bench.run([&] {
+        const std::string reply{JSONRPCExecBatch(JSONRPCRequest{}, batch, run_task, max_parallel)};
+        for (auto& thread : threads) thread.join();
+        threads.clear();
+        ankerl::nanobench::doNotOptimizeAway(reply);
+    });
+}
+
+static void RPCBatchSequential(benchmark::Bench& bench) { RPCBatch(bench, 1); }
+static void RPCBatchParallel(benchmark::Bench& bench) { RPCBatch(bench, 4); }
+
+BENCHMARK(RPCBatchSequential);
+BENCHMARK(RPCBatchParallel);
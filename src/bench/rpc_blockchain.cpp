@@ -6,6 +6,7 @@
 #include <bench/data.h>
 
 #include <rpc/blockchain.h>
+#include <rpc/jsonwriter.h>
 #include <streams.h>
 #include <test/util/setup_common.h>
 #include <validation.h>
@@ -58,3 +59,17 @@ static void BlockToJsonVerboseWrite(benchmark::Bench& bench)
 }
 
 BENCHMARK(BlockToJsonVerboseWrite);
+
+static void BlockToJsonVerboseStream(benchmark::Bench& bench)
+{
+    TestBlockAndIndex data;
+    bench.run([&] {
+        size_t written{0};
+        JSONStreamWriter writer{[&](Span<const char> chunk) { written += chunk.size(); }};
+        blockToJSON(data.block, &data.blockindex, &data.blockindex, /*verbose*/ true, &writer);
+        written += writer.TakeBuffered().size();
+        ankerl::nanobench::doNotOptimizeAway(written);
+    });
+}
+
+BENCHMARK(BlockToJsonVerboseStream);
@@ -0,0 +1,114 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <netaddress.h>
+#include <random.h>
+#include <subnettrie.h>
+
+#include <cstring>
+#include <map>
+#include <vector>
+
+/* An imported blocklist: mostly IPv4 subnets and single addresses, and some IPv6 ones. */
+
+static constexpr size_t NUM_SUBNETS = 20000;
+static constexpr size_t NUM_LOOKUPS = 1000;
+
+static CNetAddr RandomAddr(FastRandomContext& rng, bool ipv4)
+{
+    if (ipv4) {
+        in_addr addr;
+        const uint32_t bits{rng.rand32()};
+        memcpy(&addr, &bits, sizeof(addr));
+        return CNetAddr{addr};
+    }
+    in6_addr addr;
+    memcpy(&addr, rng.randbytes(sizeof(addr)).data(), sizeof(addr));
+    // Global unicast, so that it is neither IPv4-mapped nor tunneled IPv4
+    addr.s6_addr[0] = 0x20;
+    return CNetAddr{addr};
+}
+
+static std::vector<CSubNet> RandomSubNets(FastRandomContext& rng)
+{
+    std::vector<CSubNet> subnets;
+    while (subnets.size() < NUM_SUBNETS) {
+        const bool ipv4{rng.randrange(10) < 8};
+        const uint8_t mask{uint8_t(ipv4 ? 16 + rng.randrange(17) : 32 + rng.randrange(97))};
+        subnets.emplace_back(RandomAddr(rng, ipv4), mask);
+    }
+    return subnets;
+}
+
+static std::vector<CNetAddr> RandomLookups(FastRandomContext& rng)
+{
+    std::vector<CNetAddr> addrs;
+    for (size_t i = 0; i < NUM_LOOKUPS; ++i) {
+        addrs.push_back(RandomAddr(rng, rng.randrange(10) < 8));
+    }
+    return addrs;
+}
+
+static void SubNetTrieMatch(benchmark::Bench& bench)
+{
+    FastRandomContext rng{true};
+    SubNetTrie<int64_t> trie;
+    for (const CSubNet& subnet : RandomSubNets(rng)) {
+        trie.Insert(subnet, 0);
+    }
+    const std::vector<CNetAddr> addrs{RandomLookups(rng)};
+
+    bench.batch(addrs.size()).unit("lookup").run([&] {
+        for (const CNetAddr& addr : addrs) {
+            ankerl::nanobench::doNotOptimizeAway(trie.AnyMatch(addr, [](int64_t) { return true; }));
+        }
+    });
+}
+
+/** What BanMan::IsBanned did before: test every subnet */
+static void SubNetLinearMatch(benchmark::Bench& bench)
+{
+    FastRandomContext rng{true};
+    std::map<CSubNet, int64_t> subnets;
+    for (const CSubNet& subnet : RandomSubNets(rng)) {
+        subnets.emplace(subnet, 0);
+    }
+    // Fewer lookups, as each one takes a while
+    std::vector<CNetAddr> addrs{RandomLookups(rng)};
+    addrs.resize(NUM_LOOKUPS / 20);
+
+    bench.batch(addrs.size()).unit("lookup").run([&] {
+        for (const CNetAddr& addr : addrs) {
+            bool match{false};
+            for (const auto& [subnet, value] : subnets) {
+                if (subnet.Match(addr)) {
+                    match = true;
+                    break;
+                }
+            }
+            ankerl::nanobench::doNotOptimizeAway(match);
+        }
+    });
+}
+
+static void SubNetTrieUpdate(benchmark::Bench& bench)
+{
+    FastRandomContext rng{true};
+    const std::vector<CSubNet> subnets{RandomSubNets(rng)};
+    SubNetTrie<int64_t> trie;
+
+    bench.batch(subnets.size() * 2).unit("update").run([&] {
+        for (const CSubNet& subnet : subnets) {
+            trie.Insert(subnet, 0);
+        }
+        for (const CSubNet& subnet : subnets) {
+            trie.Erase(subnet);
+        }
+    });
+}
+
+BENCHMARK(SubNetTrieMatch);
+BENCHMARK(SubNetLinearMatch);
+BENCHMARK(SubNetTrieUpdate);
@@ -18,17 +18,30 @@
 
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
         nonce(GetRand(std::numeric_limits<uint64_t>::max())),
-        shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block), vchBlockSig(block.vchBlockSig) {
+        header(block), vchBlockSig(block.vchBlockSig) {
     FillShortTxIDSelector();
     //TODO: Use our mempool prior to block acceptance to predictively fill more than just the coinbase
-    prefilledtxn[0] = {0, block.vtx[0]};
+    prefilledtxn.push_back({0, block.vtx[0]});
+    // The coinstake is prefilled too (right after the coinbase, so at offset 0),
+    // so that the proof of stake can be checked before the block is reconstructed
+    const size_t prefilled{block.IsProofOfStake() ? size_t{2} : size_t{1}};
+    if (prefilled == 2) prefilledtxn.push_back({0, block.vtx[1]});
     header.nFlags = block.nFlags;
-    for (size_t i = 1; i < block.vtx.size(); i++) {
+    shorttxids.resize(block.vtx.size() - prefilled);
+    for (size_t i = prefilled; i < block.vtx.size(); i++) {
         const CTransaction& tx = *block.vtx[i];
-        shorttxids[i - 1] = GetShortID(fUseWTXID ? tx.GetWitnessHash() : tx.GetHash());
+        shorttxids[i - prefilled] = GetShortID(fUseWTXID ? tx.GetWitnessHash() : tx.GetHash());
     }
 }
 
+CTransactionRef CBlockHeaderAndShortTxIDs::GetCoinStake() const
+{
+    // Prefilled indexes are offsets from the previous prefilled transaction
+    if (prefilledtxn.size() < 2 || prefilledtxn[0].index != 0 || prefilledtxn[1].index != 0) return nullptr;
+    if (!prefilledtxn[1].tx->IsCoinStake()) return nullptr;
+    return prefilledtxn[1].tx;
+}
+
 void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const {
     CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
     stream << header << nonce;
@@ -134,6 +147,7 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     }
 
     for (size_t i = 0; i < extra_txn.size(); i++) {
+        if (!extra_txn[i].second) continue;
         uint64_t shortid = cmpctblock.GetShortID(extra_txn[i].first);
         std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
         if (idit != shorttxids.end()) {
@@ -169,6 +183,42 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     return READ_STATUS_OK;
 }
 
+ExtraTxnPool::ExtraTxnPool(size_t max_count, size_t max_bytes) : m_max_count(max_count), m_max_bytes(max_bytes) {
+    m_txn.resize(m_max_count);
+}
+
+void ExtraTxnPool::EraseSlot(size_t slot) {
+    CTransactionRef& tx = m_txn[slot].second;
+    if (!tx) return;
+    m_bytes -= tx->GetTotalSize();
+    m_slots.erase(m_txn[slot].first);
+    m_txn[slot] = {};
+}
+
+void ExtraTxnPool::Add(const CTransactionRef& tx) {
+    const size_t size = tx->GetTotalSize();
+    if (m_max_count == 0 || size > m_max_bytes) return;
+    const uint256& wtxid = tx->GetWitnessHash();
+    if (m_slots.count(wtxid)) return;
+
+    // Make room by dropping the oldest transactions, starting with the one in
+    // the slot we're about to use
+    EraseSlot(m_next);
+    for (size_t i = 1; m_bytes + size > m_max_bytes; i++) {
+        EraseSlot((m_next + i) % m_max_count);
+    }
+
+    m_txn[m_next] = std::make_pair(wtxid, tx);
+    m_slots.emplace(wtxid, m_next);
+    m_bytes += size;
+    m_next = (m_next + 1) % m_max_count;
+}
+
+void ExtraTxnPool::Remove(const uint256& wtxid) {
+    auto it = m_slots.find(wtxid);
+    if (it != m_slots.end()) EraseSlot(it->second);
+}
+
 bool PartiallyDownloadedBlock::IsTxAvailable(size_t index) const {
     assert(!header.IsNull());
     assert(index < txn_available.size());
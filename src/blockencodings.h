@@ -6,7 +6,9 @@
 #define BITCOIN_BLOCKENCODINGS_H
 
 #include <primitives/block.h>
+#include <util/hasher.h>
 
+#include <unordered_map>
 
 class CTxMemPool;
 class ChainstateManager;
@@ -112,6 +114,9 @@ public:
 
     size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
 
+    /** The coinstake of a proof-of-stake block, if it is prefilled (as we do), or nullptr */
+    CTransactionRef GetCoinStake() const;
+
     SERIALIZE_METHODS(CBlockHeaderAndShortTxIDs, obj)
     {
         READWRITE(obj.header, obj.nonce, obj.vchBlockSig, Using<VectorFormatter<CustomUintFormatter<SHORTTXIDS_LENGTH>>>(obj.shorttxids), obj.prefilledtxn);
@@ -124,6 +129,41 @@ public:
     }
 };
 
+/**
+ * Transactions that are not in our mempool but may still show up in blocks
+ * (orphans, and rejected, replaced or evicted transactions), in
+ * <witness hash, reference> form for PartiallyDownloadedBlock::InitData.
+ *
+ * Bounded both in number and in total size: once full, the oldest
+ * transactions are dropped first. Transactions are indexed by witness hash, so
+ * they are stored once and can be removed when they enter the mempool.
+ */
+class ExtraTxnPool {
+    const size_t m_max_count;
+    const size_t m_max_bytes;
+    /** Ring of transactions, oldest first from m_next; unused slots have a null reference */
+    std::vector<std::pair<uint256, CTransactionRef>> m_txn;
+    /** Slot of the next transaction to be added */
+    size_t m_next = 0;
+    /** Slot of every transaction, by witness hash */
+    std::unordered_map<uint256, size_t, SaltedTxidHasher> m_slots;
+    size_t m_bytes = 0;
+
+    void EraseSlot(size_t slot);
+public:
+    ExtraTxnPool(size_t max_count, size_t max_bytes);
+
+    /** Add a transaction (unless it is present or too large), dropping the oldest ones as needed. */
+    void Add(const CTransactionRef& tx);
+    /** Remove the transaction with the given witness hash, if present. */
+    void Remove(const uint256& wtxid);
+
+    const std::vector<std::pair<uint256, CTransactionRef>>& GetTransactions() const { return m_txn; }
+    size_t Count() const { return m_slots.size(); }
+    /** Total serialized size of the transactions */
+    size_t Bytes() const { return m_bytes; }
+};
+
 class PartiallyDownloadedBlock {
 protected:
     std::vector<CTransactionRef> txn_available;
@@ -136,9 +176,16 @@ public:
     explicit PartiallyDownloadedBlock(CTxMemPool* poolIn, ChainstateManager* _chainman) : pool(poolIn), chainman(_chainman) {}
 
     // extra_txn is a list of extra transactions to look at, in <witness hash, reference> form
+    // (null references are skipped)
     ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn);
     bool IsTxAvailable(size_t index) const;
     ReadStatus FillBlock(CBlock& block, const std::vector<CTransactionRef>& vtx_missing);
+
+    size_t PrefilledCount() const { return prefilled_count; }
+    /** Transactions found in the mempool or in extra_txn */
+    size_t MempoolCount() const { return mempool_count; }
+    /** Transactions found in extra_txn */
+    size_t ExtraCount() const { return extra_count; }
 };
 
 #endif // BITCOIN_BLOCKENCODINGS_H
@@ -7,6 +7,8 @@
 #include <consensus/consensus.h>
 #include <logging.h>
 #include <random.h>
+#include <util/metrics.h>
+#include <util/trace.h>
 #include <version.h>
 
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
@@ -39,10 +41,30 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
 
 CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
     CCoinsMap::iterator it = cacheCoins.find(outpoint);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        if (m_hits) {
+            m_hits->Inc();
+            TRACE5(utxocache, hit,
+                outpoint.hash.data(),
+                outpoint.n,
+                (uint32_t)it->second.coin.nHeight,
+                it->second.coin.out.nValue,
+                it->second.coin.IsSpent()
+            );
+        }
         return it;
+    }
     Coin tmp;
-    if (!base->GetCoin(outpoint, tmp))
+    const bool found{base->GetCoin(outpoint, tmp)};
+    if (m_misses) {
+        m_misses->Inc();
+        TRACE3(utxocache, miss,
+            outpoint.hash.data(),
+            outpoint.n,
+            found
+        );
+    }
+    if (!found)
         return cacheCoins.end();
     CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp))).first;
     if (ret->second.coin.IsSpent()) {
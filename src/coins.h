@@ -20,6 +20,10 @@
 #include <functional>
 #include <unordered_map>
 
+namespace metrics {
+class Counter;
+}
+
 /**
  * A UTXO entry.
  *
@@ -240,9 +244,20 @@ protected:
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Lookups served from this cache, and lookups that went to the base view */
+    metrics::Counter* m_hits{nullptr};
+    metrics::Counter* m_misses{nullptr};
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
+    /** Count cache hits and misses in the given counters */
+    void SetLookupCounters(metrics::Counter* hits, metrics::Counter* misses)
+    {
+        m_hits = hits;
+        m_misses = misses;
+    }
+
     /**
      * By deleting the copy constructor, we prevent accidentally using it when one intends to create a cache on top of a base cache.
      */
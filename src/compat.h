@@ -97,6 +97,12 @@ typedef char* sockopt_arg_type;
 #define USE_POLL
 #endif
 
+// The socket handler keeps persistent, edge-triggered registrations in an
+// epoll instance where available and falls back to poll()/select() otherwise
+#if defined(__linux__)
+#define USE_EPOLL
+#endif
+
 bool static inline IsSelectableSocket(const SOCKET& s) {
 #if defined(USE_POLL) || defined(WIN32)
     return true;
@@ -7,9 +7,58 @@
 
 #include <crypto/common.h>
 #include <crypto/chacha20.h>
+#include <compat/cpuid.h>
 
 #include <string.h>
 
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+namespace chacha20_avx2
+{
+/** Process a multiple of 8 blocks at once; m may be nullptr to output the keystream. */
+void Crypt_8way(uint32_t input[16], const unsigned char* m, unsigned char* c, size_t blocks);
+}
+#endif
+
+namespace {
+typedef void (*Crypt8WayFn)(uint32_t input[16], const unsigned char* m, unsigned char* c, size_t blocks);
+
+Crypt8WayFn Crypt_8way = nullptr;
+
+#if defined(USE_ASM) && defined(HAVE_GETCPUID)
+/** Check whether the OS has enabled AVX registers. */
+bool AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
+} // namespace
+
+std::string ChaCha20AutoDetect()
+{
+    std::string ret = "standard";
+#if defined(USE_ASM) && defined(HAVE_GETCPUID)
+    uint32_t eax, ebx, ecx, edx;
+    GetCPUID(1, 0, eax, ebx, ecx, edx);
+    const bool have_xsave = (ecx >> 27) & 1;
+    const bool have_avx = (ecx >> 28) & 1;
+    const bool enabled_avx = have_xsave && have_avx && AVXEnabled();
+    GetCPUID(7, 0, eax, ebx, ecx, edx);
+    const bool have_avx2 = (ebx >> 5) & 1;
+    (void)enabled_avx;
+    (void)have_avx2;
+
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+    if (have_avx2 && enabled_avx) {
+        Crypt_8way = chacha20_avx2::Crypt_8way;
+        ret = "avx2(8way)";
+    }
+#endif
+#endif
+    return ret;
+}
+
 constexpr static inline uint32_t rotl32(uint32_t v, int c) { return (v << c) | (v >> (32 - c)); }
 
 #define QUARTERROUND(a,b,c,d) \
@@ -81,6 +130,14 @@ void ChaCha20::Keystream(unsigned char* c, size_t bytes)
 
     if (!bytes) return;
 
+    if (Crypt_8way && bytes >= 512) {
+        const size_t blocks = bytes / 512 * 8;
+        Crypt_8way(input, nullptr, c, blocks);
+        c += blocks * 64;
+        bytes -= blocks * 64;
+        if (!bytes) return;
+    }
+
     j0 = input[0];
     j1 = input[1];
     j2 = input[2];
@@ -189,6 +246,15 @@ void ChaCha20::Crypt(const unsigned char* m, unsigned char* c, size_t bytes)
 
     if (!bytes) return;
 
+    if (Crypt_8way && bytes >= 512) {
+        const size_t blocks = bytes / 512 * 8;
+        Crypt_8way(input, m, c, blocks);
+        m += blocks * 64;
+        c += blocks * 64;
+        bytes -= blocks * 64;
+        if (!bytes) return;
+    }
+
     j0 = input[0];
     j1 = input[1];
     j2 = input[2];
@@ -0,0 +1,114 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_AVX2
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <immintrin.h>
+
+namespace chacha20_avx2 {
+namespace {
+
+__m256i inline Add(__m256i x, __m256i y) { return _mm256_add_epi32(x, y); }
+__m256i inline Xor(__m256i x, __m256i y) { return _mm256_xor_si256(x, y); }
+__m256i inline RotL(__m256i x, int n) { return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n)); }
+
+/** Rotations by a multiple of 8 bits are byte shuffles. */
+__m256i inline RotL16(__m256i x)
+{
+    return _mm256_shuffle_epi8(x, _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                                                  13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+}
+__m256i inline RotL8(__m256i x)
+{
+    return _mm256_shuffle_epi8(x, _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3,
+                                                  14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3));
+}
+
+void inline __attribute__((always_inline)) QuarterRound(__m256i& a, __m256i& b, __m256i& c, __m256i& d)
+{
+    a = Add(a, b); d = RotL16(Xor(d, a));
+    c = Add(c, d); b = RotL(Xor(b, c), 12);
+    a = Add(a, b); d = RotL8(Xor(d, a));
+    c = Add(c, d); b = RotL(Xor(b, c), 7);
+}
+
+/** Transpose eight vectors holding one word of eight blocks each into eight consecutive words of each block. */
+void inline __attribute__((always_inline)) Transpose(__m256i& x0, __m256i& x1, __m256i& x2, __m256i& x3, __m256i& x4, __m256i& x5, __m256i& x6, __m256i& x7)
+{
+    const __m256i t0 = _mm256_unpacklo_epi32(x0, x1), t1 = _mm256_unpackhi_epi32(x0, x1);
+    const __m256i t2 = _mm256_unpacklo_epi32(x2, x3), t3 = _mm256_unpackhi_epi32(x2, x3);
+    const __m256i t4 = _mm256_unpacklo_epi32(x4, x5), t5 = _mm256_unpackhi_epi32(x4, x5);
+    const __m256i t6 = _mm256_unpacklo_epi32(x6, x7), t7 = _mm256_unpackhi_epi32(x6, x7);
+    const __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+    const __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+    const __m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+    const __m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+    x0 = _mm256_permute2x128_si256(u0, u4, 0x20);
+    x1 = _mm256_permute2x128_si256(u1, u5, 0x20);
+    x2 = _mm256_permute2x128_si256(u2, u6, 0x20);
+    x3 = _mm256_permute2x128_si256(u3, u7, 0x20);
+    x4 = _mm256_permute2x128_si256(u0, u4, 0x31);
+    x5 = _mm256_permute2x128_si256(u1, u5, 0x31);
+    x6 = _mm256_permute2x128_si256(u2, u6, 0x31);
+    x7 = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+/** Write 32 bytes of keystream, XORed with the message if there is one. */
+void inline __attribute__((always_inline)) Write(unsigned char* c, const unsigned char* m, __m256i x)
+{
+    if (m) x = Xor(x, _mm256_loadu_si256((const __m256i*)m));
+    _mm256_storeu_si256((__m256i*)c, x);
+}
+
+}
+
+void Crypt_8way(uint32_t input[16], const unsigned char* m, unsigned char* c, size_t blocks)
+{
+    for (; blocks >= 8; blocks -= 8) {
+        uint64_t counter = (uint64_t)input[13] << 32 | input[12];
+        alignas(32) uint32_t counter_lo[8], counter_hi[8];
+        for (int i = 0; i < 8; ++i) {
+            counter_lo[i] = counter + i;
+            counter_hi[i] = (counter + i) >> 32;
+        }
+        __m256i j[16];
+        for (int i = 0; i < 16; ++i) j[i] = _mm256_set1_epi32(input[i]);
+        j[12] = _mm256_load_si256((const __m256i*)counter_lo);
+        j[13] = _mm256_load_si256((const __m256i*)counter_hi);
+
+        __m256i x[16];
+        for (int i = 0; i < 16; ++i) x[i] = j[i];
+        for (int i = 0; i < 10; ++i) {
+            QuarterRound(x[0], x[4], x[8], x[12]);
+            QuarterRound(x[1], x[5], x[9], x[13]);
+            QuarterRound(x[2], x[6], x[10], x[14]);
+            QuarterRound(x[3], x[7], x[11], x[15]);
+            QuarterRound(x[0], x[5], x[10], x[15]);
+            QuarterRound(x[1], x[6], x[11], x[12]);
+            QuarterRound(x[2], x[7], x[8], x[13]);
+            QuarterRound(x[3], x[4], x[9], x[14]);
+        }
+        for (int i = 0; i < 16; ++i) x[i] = Add(x[i], j[i]);
+
+        // x[0..7] now hold the first half of each block, x[8..15] the second half.
+        Transpose(x[0], x[1], x[2], x[3], x[4], x[5], x[6], x[7]);
+        Transpose(x[8], x[9], x[10], x[11], x[12], x[13], x[14], x[15]);
+        for (int i = 0; i < 8; ++i) {
+            Write(c + 64 * i, m ? m + 64 * i : nullptr, x[i]);
+            Write(c + 64 * i + 32, m ? m + 64 * i + 32 : nullptr, x[i + 8]);
+        }
+
+        counter += 8;
+        input[12] = counter;
+        input[13] = counter >> 32;
+        c += 512;
+        if (m) m += 512;
+    }
+}
+
+}
+
+#endif
@@ -3,13 +3,117 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 // Based on the public domain implementation by Andrew Moon
-// poly1305-donna-unrolled.c from https://github.com/floodyberry/poly1305-donna
+// poly1305-donna-unrolled.c and poly1305-donna-64.h from https://github.com/floodyberry/poly1305-donna
+
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
 
 #include <crypto/common.h>
 #include <crypto/poly1305.h>
 
 #include <string.h>
 
+#ifdef HAVE___INT128
+/* With 128 bit products, three 44/44/42 bit limbs need a third of the multiplications of five 26 bit limbs. */
+void poly1305_auth(unsigned char out[POLY1305_TAGLEN], const unsigned char *m, size_t inlen, const unsigned char key[POLY1305_KEYLEN]) {
+    typedef unsigned __int128 uint128_t;
+    const uint64_t mask44 = 0xfffffffffff, mask42 = 0x3ffffffffff;
+    uint64_t r0,r1,r2,s1,s2;
+    uint64_t h0,h1,h2,c;
+    uint64_t t0,t1;
+    uint128_t d0,d1,d2;
+    uint64_t hibit = (uint64_t)1 << 40;
+    unsigned char mp[16];
+    size_t j;
+
+    /* clamp key */
+    t0 = ReadLE64(key+0);
+    t1 = ReadLE64(key+8);
+    r0 = t0 & 0xffc0fffffff;
+    r1 = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff;
+    r2 = (t1 >> 24) & 0x00ffffffc0f;
+
+    /* precompute multipliers */
+    s1 = r1 * (5 << 2);
+    s2 = r2 * (5 << 2);
+
+    /* init state */
+    h0 = 0;
+    h1 = 0;
+    h2 = 0;
+
+    while (inlen > 0) {
+        if (inlen < 16) {
+            /* final bytes */
+            for (j = 0; j < inlen; j++) mp[j] = m[j];
+            mp[j++] = 1;
+            for (; j < 16; j++) mp[j] = 0;
+            m = mp;
+            inlen = 16;
+            hibit = 0;
+        }
+        t0 = ReadLE64(m+0);
+        t1 = ReadLE64(m+8);
+
+        h0 += t0 & mask44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & mask44;
+        h2 += ((t1 >> 24) & mask42) | hibit;
+
+        d0 = (uint128_t)h0 * r0 + (uint128_t)h1 * s2 + (uint128_t)h2 * s1;
+        d1 = (uint128_t)h0 * r1 + (uint128_t)h1 * r0 + (uint128_t)h2 * s2;
+        d2 = (uint128_t)h0 * r2 + (uint128_t)h1 * r1 + (uint128_t)h2 * r0;
+
+                           c = (uint64_t)(d0 >> 44); h0 = (uint64_t)d0 & mask44;
+        d1 += c;           c = (uint64_t)(d1 >> 44); h1 = (uint64_t)d1 & mask44;
+        d2 += c;           c = (uint64_t)(d2 >> 42); h2 = (uint64_t)d2 & mask42;
+        h0 += c * 5;       c = h0 >> 44;             h0 &= mask44;
+        h1 += c;
+
+        m += 16;
+        inlen -= 16;
+    }
+
+    /* fully carry h */
+                 c = h1 >> 44; h1 &= mask44;
+    h2 += c;     c = h2 >> 42; h2 &= mask42;
+    h0 += c * 5; c = h0 >> 44; h0 &= mask44;
+    h1 += c;     c = h1 >> 44; h1 &= mask44;
+    h2 += c;     c = h2 >> 42; h2 &= mask42;
+    h0 += c * 5; c = h0 >> 44; h0 &= mask44;
+    h1 += c;
+
+    /* compute h + -p */
+    uint64_t g0 = h0 + 5; c = g0 >> 44; g0 &= mask44;
+    uint64_t g1 = h1 + c; c = g1 >> 44; g1 &= mask44;
+    uint64_t g2 = h2 + c - ((uint64_t)1 << 42);
+
+    /* select h if h < p, or h + -p if h >= p */
+    c = (g2 >> 63) - 1;
+    g0 &= c;
+    g1 &= c;
+    g2 &= c;
+    c = ~c;
+    h0 = (h0 & c) | g0;
+    h1 = (h1 & c) | g1;
+    h2 = (h2 & c) | g2;
+
+    /* h = (h + pad) */
+    t0 = ReadLE64(key+16);
+    t1 = ReadLE64(key+24);
+
+    h0 += t0 & mask44;                               c = h0 >> 44; h0 &= mask44;
+    h1 += (((t0 >> 44) | (t1 << 20)) & mask44) + c; c = h1 >> 44; h1 &= mask44;
+    h2 += (((t1 >> 24)) & mask42) + c;                             h2 &= mask42;
+
+    /* mac = h % (2^128) */
+    h0 = ((h0) | (h1 << 44));
+    h1 = ((h1 >> 20) | (h2 << 24));
+
+    WriteLE64(&out[0], h0);
+    WriteLE64(&out[8], h1);
+}
+#else
 #define mul32x32_64(a,b) ((uint64_t)(a) * (b))
 
 void poly1305_auth(unsigned char out[POLY1305_TAGLEN], const unsigned char *m, size_t inlen, const unsigned char key[POLY1305_KEYLEN]) {
@@ -139,3 +243,4 @@ poly1305_donna_finish:
     WriteLE32(&out[ 8], f2); f3 += (f2 >> 32);
     WriteLE32(&out[12], f3);
 }
+#endif
@@ -7,8 +7,11 @@
 #include <chainparams.h>
 #include <crypto/hmac_sha256.h>
 #include <httpserver.h>
+#include <logging.h>
+#include <rpc/jsonwriter.h>
 #include <rpc/protocol.h>
 #include <rpc/server.h>
+#include <util/metrics.h>
 #include <util/strencodings.h>
 #include <util/system.h>
 #include <util/translation.h>
@@ -73,6 +76,8 @@ static std::vector<std::vector<std::string>> g_rpcauth;
 /* RPC Auth Whitelist */
 static std::map<std::string, std::set<std::string>> g_rpc_whitelist;
 static bool g_rpc_whitelist_default = false;
+/* Number of entries of a batch request executed at the same time */
+static int g_rpc_batch_parallel = DEFAULT_RPC_BATCH_PARALLEL;
 
 static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const UniValue& id)
 {
@@ -91,6 +96,51 @@ static void JSONErrorReply(HTTPRequest* req, const UniValue& objError, const Uni
     req->WriteReply(nStatus, strReply);
 }
 
+/** Execute a single request and send the reply. Once the reply outgrows a
+ * chunk it is sent in parts as it is written, so a method that streams its
+ * result to the request's writer never has to hold all of it.
+ */
+static void JSONRPCExecStreamed(HTTPRequest* req, JSONRPCRequest& jreq)
+{
+    bool chunked{false};
+    JSONStreamWriter writer{[&](Span<const char> chunk) {
+        if (!chunked) {
+            req->WriteHeader("Content-Type", "application/json");
+            req->StartChunkedReply(HTTP_OK);
+            chunked = true;
+        }
+        req->WriteReplyChunk(chunk);
+    }};
+    writer.BeginObject();
+    writer.Key("result");
+    jreq.result_writer = &writer;
+    try {
+        const UniValue result = tableRPC.execute(jreq);
+        // Most methods return their result instead of writing it
+        if (writer.ExpectsValue()) writer.Value(result);
+    } catch (...) {
+        // Until the reply has started, the error can be sent as usual
+        if (!chunked) throw;
+        LogPrintf("RPC method %s failed after its reply was started, cutting the reply short\n", jreq.strMethod);
+        req->EndChunkedReply();
+        return;
+    }
+    writer.Key("error");
+    writer.Value(NullUniValue);
+    writer.Key("id");
+    writer.Value(jreq.id);
+    writer.EndObject();
+
+    const std::string rest = writer.TakeBuffered() + "\n";
+    if (chunked) {
+        req->WriteReplyChunk(rest);
+        req->EndChunkedReply();
+    } else {
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, rest);
+    }
+}
+
 //This function checks username and password against -rpcauth
 //entries from config file.
 static bool multiUserAuthorized(std::string strUserPass)
@@ -144,26 +194,16 @@ static bool RPCAuthorized(const std::string& strAuth, std::string& strAuthUserna
     return multiUserAuthorized(strUserPass);
 }
 
-static bool HTTPReq_JSONRPC(const std::any& context, HTTPRequest* req)
+bool HTTPRPCAuthorize(HTTPRequest* req, std::string& user)
 {
-    // JSONRPC handles only POST
-    if (req->GetRequestMethod() != HTTPRequest::POST) {
-        req->WriteReply(HTTP_BAD_METHOD, "JSONRPC server handles only POST requests");
-        return false;
-    }
-    // Check authorization
     std::pair<bool, std::string> authHeader = req->GetHeader("authorization");
     if (!authHeader.first) {
         req->WriteHeader("WWW-Authenticate", WWW_AUTH_HEADER_DATA);
         req->WriteReply(HTTP_UNAUTHORIZED);
         return false;
     }
-
-    JSONRPCRequest jreq;
-    jreq.context = context;
-    jreq.peerAddr = req->GetPeer().ToString();
-    if (!RPCAuthorized(authHeader.second, jreq.authUser)) {
-        LogPrintf("ThreadRPCServer incorrect password attempt from %s\n", jreq.peerAddr);
+    if (!RPCAuthorized(authHeader.second, user)) {
+        LogPrintf("ThreadRPCServer incorrect password attempt from %s\n", req->GetPeer().ToString());
 
         /* Deter brute-forcing
            If this results in a DoS the user really
@@ -174,6 +214,25 @@ static bool HTTPReq_JSONRPC(const std::any& context, HTTPRequest* req)
         req->WriteReply(HTTP_UNAUTHORIZED);
         return false;
     }
+    return true;
+}
+
+bool HTTPRPCUserRestricted(const std::string& user)
+{
+    return g_rpc_whitelist.count(user) || g_rpc_whitelist_default;
+}
+
+static bool HTTPReq_JSONRPC(const std::any& context, HTTPRequest* req)
+{
+    // JSONRPC handles only POST
+    if (req->GetRequestMethod() != HTTPRequest::POST) {
+        req->WriteReply(HTTP_BAD_METHOD, "JSONRPC server handles only POST requests");
+        return false;
+    }
+    JSONRPCRequest jreq;
+    jreq.context = context;
+    jreq.peerAddr = req->GetPeer().ToString();
+    if (!HTTPRPCAuthorize(req, jreq.authUser)) return false;
 
     try {
         // Parse request
@@ -199,10 +258,8 @@ static bool HTTPReq_JSONRPC(const std::any& context, HTTPRequest* req)
                 req->WriteReply(HTTP_FORBIDDEN);
                 return false;
             }
-            UniValue result = tableRPC.execute(jreq);
-
-            // Send reply
-            strReply = JSONRPCReply(result, NullUniValue, jreq.id);
+            JSONRPCExecStreamed(req, jreq);
+            return true;
 
         // array of requests
         } else if (valRequest.isArray()) {
@@ -222,7 +279,7 @@ static bool HTTPReq_JSONRPC(const std::any& context, HTTPRequest* req)
                     }
                 }
             }
-            strReply = JSONRPCExecBatch(jreq, valRequest.get_array());
+            strReply = JSONRPCExecBatch(jreq, valRequest.get_array(), RunOnIdleHTTPWorker, g_rpc_batch_parallel);
         }
         else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
@@ -289,12 +346,25 @@ static bool InitRPCAuthentication()
     return true;
 }
 
+static bool HTTPReq_Metrics(HTTPRequest* req)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET) {
+        req->WriteReply(HTTP_BAD_METHOD, "Metrics are only served for GET requests");
+        return false;
+    }
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+    req->WriteReply(HTTP_OK, metrics::Render());
+    return true;
+}
+
 bool StartHTTPRPC(const std::any& context)
 {
     LogPrint(BCLog::RPC, "Starting HTTP RPC server\n");
     if (!InitRPCAuthentication())
         return false;
 
+    g_rpc_batch_parallel = std::max<int>(gArgs.GetArg("-rpcbatchparallel", DEFAULT_RPC_BATCH_PARALLEL), 1);
+
     auto handle_rpc = [context](HTTPRequest* req, const std::string&) { return HTTPReq_JSONRPC(context, req); };
     RegisterHTTPHandler("/", true, handle_rpc);
     if (g_wallet_init_interface.HasWalletSupport()) {
@@ -324,3 +394,14 @@ void StopHTTPRPC()
         httpRPCTimerInterface.reset();
     }
 }
+
+void StartHTTPMetrics()
+{
+    LogPrint(BCLog::RPC, "Starting HTTP metrics endpoint\n");
+    RegisterHTTPHandler("/metrics", true, [](HTTPRequest* req, const std::string&) { return HTTPReq_Metrics(req); });
+}
+
+void StopHTTPMetrics()
+{
+    UnregisterHTTPHandler("/metrics", true);
+}
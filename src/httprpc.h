@@ -6,6 +6,9 @@
 #define BITCOIN_HTTPRPC_H
 
 #include <any>
+#include <string>
+
+class HTTPRequest;
 
 /** Start HTTP RPC subsystem.
  * Precondition; HTTP and RPC has been started.
@@ -19,6 +22,13 @@ void InterruptHTTPRPC();
  */
 void StopHTTPRPC();
 
+/** Check the RPC credentials sent with an HTTP request, and set user.
+ * Replies with an error and returns false if they are missing or wrong.
+ */
+bool HTTPRPCAuthorize(HTTPRequest* req, std::string& user);
+/** Whether user is limited to some RPC methods by -rpcwhitelist */
+bool HTTPRPCUserRestricted(const std::string& user);
+
 /** Start HTTP REST subsystem.
  * Precondition; HTTP and RPC has been started.
  */
@@ -31,4 +41,21 @@ void InterruptREST();
  */
 void StopREST();
 
+/** Start serving the metrics in the Prometheus text format at /metrics.
+ * Precondition; HTTP has been started.
+ */
+void StartHTTPMetrics();
+/** Stop serving the metrics.
+ */
+void StopHTTPMetrics();
+
+/** Start accepting WebSocket subscriptions to node events at /ws.
+ * Precondition; HTTP and RPC has been started.
+ */
+void StartWebSocket(const std::any& context);
+/** Stop the WebSocket subscriptions. Open connections are closed by
+ * InterruptHTTPServer().
+ */
+void StopWebSocket();
+
 #endif
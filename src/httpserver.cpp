@@ -6,18 +6,30 @@
 
 #include <chainparamsbase.h>
 #include <compat.h>
+#include <crypto/common.h>
+#include <crypto/sha1.h>
 #include <netbase.h>
 #include <node/ui_interface.h>
 #include <rpc/protocol.h> // For HTTP status codes
 #include <shutdown.h>
 #include <sync.h>
+#include <util/fairqueue.h>
+#include <util/mpmcqueue.h>
+#include <util/spanparsing.h>
 #include <util/strencodings.h>
+#include <util/string.h>
 #include <util/system.h>
 #include <util/threadnames.h>
+#include <util/time.h>
 #include <util/translation.h>
 
-#include <deque>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
 #include <memory>
+#include <optional>
+#include <set>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
@@ -56,64 +68,311 @@ private:
     HTTPRequestHandler func;
 };
 
-/** Simple work queue for distributing work over multiple threads.
+/** Work queue for distributing work over multiple threads.
  * Work items are simply callable objects.
+ *
+ * Worker threads take work from a small lock-free queue. Requests that do not
+ * fit in it wait in a queue per client, and whenever a worker frees up the
+ * clients take turns in handing over their next request, so that a client
+ * sending many requests at once cannot starve the others. The per-client
+ * queues are only used on the event loop thread.
+ *
+ * libevent reads nothing more from a connection until its request has been
+ * replied to, so waiting requests push back on their clients rather than
+ * being failed; only a client with more than maxDepth requests waiting gets
+ * further ones rejected.
  */
-template <typename WorkItem>
 class WorkQueue
 {
 private:
+    struct Work {
+        std::unique_ptr<HTTPClosure> item;
+        //! The request that item handles, if any
+        HTTPRequest* req{nullptr};
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    //! Work ready to be picked up by a worker thread
+    MPMCQueue<Work> m_ready;
+    //! Work waiting for room in m_ready, per client
+    FairQueue<CNetAddr, Work> m_waiting;
+    //! Whether new requests are accepted, cleared by Stop()
+    bool m_accepting{true};
+    struct event_base* const m_base;
+    //! Hands waiting work to the worker threads on the event loop thread
+    const std::unique_ptr<HTTPEvent> m_refill;
+
     Mutex cs;
     std::condition_variable cond GUARDED_BY(cs);
-    std::deque<std::unique_ptr<WorkItem>> queue GUARDED_BY(cs);
-    bool running GUARDED_BY(cs);
-    const size_t maxDepth;
+    bool running GUARDED_BY(cs){true};
+    //! Number of threads waiting for work
+    std::atomic<size_t> m_idle{0};
+
+    // Statistics, see HTTPWorkQueueStats
+    std::atomic<size_t> m_num_waiting{0};
+    std::atomic<size_t> m_num_clients{0};
+    std::atomic<uint64_t> m_executed{0};
+    std::atomic<uint64_t> m_rejected{0};
+    std::atomic<int64_t> m_total_wait{0};
+    std::atomic<int64_t> m_max_wait{0};
+    std::atomic<int64_t> m_total_exec{0};
+
+    /** Make work available to the worker threads, and wake one up if needed.
+     * Returns false, leaving work untouched, if there is no room. */
+    bool Push(Work& work)
+    {
+        if (!m_ready.TryPush(std::move(work))) return false;
+        // Pairs with the fence in Run(): either the worker sees the work, or we see it idle
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_idle.load() > 0) {
+            LOCK(cs);
+            cond.notify_one();
+        }
+        return true;
+    }
+
+    /** Hand waiting work over while there is room, one item per client in turn. Event loop thread only. */
+    void Refill()
+    {
+        while (m_waiting.PopIf([this](Work& work) { return Push(work); })) {}
+        m_num_waiting = m_waiting.Size();
+        m_num_clients = m_waiting.Clients();
+    }
+
+    /** Reject all waiting requests and let the worker threads exit. Event loop thread only. */
+    void Stop()
+    {
+        m_accepting = false;
+        m_waiting.Clear([](Work& work) { work.req->WriteReply(HTTP_SERVICE_UNAVAILABLE); });
+        m_num_waiting = 0;
+        m_num_clients = 0;
+        // Nothing is handed over anymore, so once the workers are done with
+        // m_ready it stays empty.
+        LOCK(cs);
+        running = false;
+        cond.notify_all();
+    }
 
 public:
-    explicit WorkQueue(size_t _maxDepth) : running(true),
-                                 maxDepth(_maxDepth)
+    WorkQueue(size_t _maxDepth, size_t threads, struct event_base* base) :
+        m_ready(threads), m_waiting(_maxDepth), m_base(base),
+        m_refill(std::make_unique<HTTPEvent>(base, false, [this] { Refill(); }))
     {
     }
-    /** Precondition: worker threads have all stopped (they have been joined).
+    /** Precondition: worker threads have all stopped (they have been joined),
+     * and the event loop thread has exited, but the event base still exists.
      */
     ~WorkQueue()
     {
     }
-    /** Enqueue a work item */
-    bool Enqueue(WorkItem* item)
+    /** Whether requests are accepted, which stops on shutdown. Event loop thread only. */
+    bool Accepting() const { return m_accepting; }
+    /** Enqueue a request from client. Event loop thread only.
+     * Returns false, leaving item untouched, if requests are not accepted or
+     * the client already has too many requests waiting.
+     */
+    bool Enqueue(const CNetAddr& client, std::unique_ptr<HTTPWorkItem>& item)
     {
-        LOCK(cs);
-        if (!running || queue.size() >= maxDepth) {
+        if (!m_accepting) return false;
+        HTTPRequest* req = item->req.get();
+        Work work{std::move(item), req, std::chrono::steady_clock::now()};
+        if (!m_waiting.Push(client, work)) {
+            item.reset(static_cast<HTTPWorkItem*>(work.item.release()));
+            ++m_rejected;
             return false;
         }
-        queue.emplace_back(std::unique_ptr<WorkItem>(item));
-        cond.notify_one();
+        m_num_waiting = m_waiting.Size();
+        Refill();
         return true;
     }
+    /** Enqueue a work item only if a thread is waiting to pick it up right away */
+    bool EnqueueIfIdle(std::unique_ptr<HTTPClosure> item)
+    {
+        if (m_ready.SizeApprox() >= m_idle.load()) return false;
+        Work work{std::move(item), nullptr, std::chrono::steady_clock::now()};
+        return Push(work);
+    }
     /** Thread function */
     void Run()
     {
         while (true) {
-            std::unique_ptr<WorkItem> i;
-            {
+            Work work;
+            if (!m_ready.TryPop(work)) {
                 WAIT_LOCK(cs, lock);
-                while (running && queue.empty())
+                ++m_idle;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                while (!m_ready.TryPop(work) && running)
                     cond.wait(lock);
-                if (!running && queue.empty())
+                --m_idle;
+                if (!work.item)
                     break;
-                i = std::move(queue.front());
-                queue.pop_front();
             }
-            (*i)();
+            const auto start{std::chrono::steady_clock::now()};
+            const int64_t wait{count_microseconds(std::chrono::duration_cast<std::chrono::microseconds>(start - work.queued))};
+            m_total_wait += wait;
+            int64_t max_wait{m_max_wait.load()};
+            while (wait > max_wait && !m_max_wait.compare_exchange_weak(max_wait, wait)) {}
+            ++m_executed;
+            (*work.item)();
+            work.item.reset();
+            m_total_exec += count_microseconds(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+            if (m_num_waiting.load() > 0) m_refill->trigger(nullptr);
         }
     }
-    /** Interrupt and exit loops */
+    /** Interrupt and exit loops. The event loop has to be running. */
     void Interrupt()
     {
-        LOCK(cs);
-        running = false;
-        cond.notify_all();
+        // The waiting requests belong to the event loop thread, so stop there
+        HTTPEvent* ev = new HTTPEvent(m_base, true, [this] { Stop(); });
+        ev->trigger(nullptr);
+    }
+    void GetStats(HTTPWorkQueueStats& stats) const
+    {
+        stats.depth = m_num_waiting.load() + m_ready.SizeApprox();
+        stats.clients = m_num_clients.load();
+        stats.executed = m_executed.load();
+        stats.rejected = m_rejected.load();
+        stats.total_wait = std::chrono::microseconds{m_total_wait.load()};
+        stats.max_wait = std::chrono::microseconds{m_max_wait.load()};
+        stats.total_exec = std::chrono::microseconds{m_total_exec.load()};
+    }
+};
+
+/** Task run on the work queue on behalf of a request that is being handled */
+class HTTPTaskItem final : public HTTPClosure
+{
+public:
+    explicit HTTPTaskItem(std::function<void()> task) : m_task(std::move(task)) {}
+    void operator()() override
+    {
+        m_task();
+    }
+
+private:
+    std::function<void()> m_task;
+};
+
+/** Largest message a WebSocket client may send, including fragments */
+static const size_t MAX_WEBSOCKET_MESSAGE_SIZE = 64 * 1024;
+/** Seconds to wait for a close frame to be written before dropping the connection */
+static const int WEBSOCKET_CLOSE_TIMEOUT = 5;
+
+// WebSocket opcodes, RFC 6455 section 5.2
+static const uint8_t WS_OP_CONTINUATION = 0x0;
+static const uint8_t WS_OP_TEXT = 0x1;
+static const uint8_t WS_OP_BINARY = 0x2;
+static const uint8_t WS_OP_CLOSE = 0x8;
+static const uint8_t WS_OP_PING = 0x9;
+static const uint8_t WS_OP_PONG = 0xa;
+
+/** Unfragmented, unmasked frame as sent by a server */
+static std::string WebSocketFrame(uint8_t opcode, const std::string& payload)
+{
+    std::string frame;
+    frame.reserve(payload.size() + 10);
+    frame += char(0x80 | opcode);
+    const uint64_t size{payload.size()};
+    if (size < 126) {
+        frame += char(size);
+    } else if (size <= 0xffff) {
+        frame += char(126);
+        frame += char(size >> 8);
+        frame += char(size);
+    } else {
+        frame += char(127);
+        for (int shift = 56; shift >= 0; shift -= 8) frame += char(size >> shift);
+    }
+    frame += payload;
+    return frame;
+}
+
+/** Whether str is valid UTF-8 (RFC 3629): no overlong encodings, surrogates or code points above U+10FFFF */
+static bool IsValidUTF8(const std::string& str)
+{
+    size_t i{0};
+    while (i < str.size()) {
+        const unsigned char c = str[i];
+        size_t len;
+        uint32_t code_point, min;
+        if (c < 0x80) {
+            ++i;
+            continue;
+        } else if ((c & 0xe0) == 0xc0) {
+            len = 2; code_point = c & 0x1f; min = 0x80;
+        } else if ((c & 0xf0) == 0xe0) {
+            len = 3; code_point = c & 0x0f; min = 0x800;
+        } else if ((c & 0xf8) == 0xf0) {
+            len = 4; code_point = c & 0x07; min = 0x10000;
+        } else {
+            return false;
+        }
+        if (str.size() - i < len) return false;
+        for (size_t j = 1; j < len; ++j) {
+            const unsigned char cont = str[i + j];
+            if ((cont & 0xc0) != 0x80) return false;
+            code_point = (code_point << 6) | (cont & 0x3f);
+        }
+        if (code_point < min || code_point > 0x10ffff || (code_point >= 0xd800 && code_point <= 0xdfff)) return false;
+        i += len;
+    }
+    return true;
+}
+
+/** Server side of a WebSocket connection, see HTTPRequest::AcceptWebSocket().
+ *
+ * When the handshake is accepted, the bufferevent of the connection is taken
+ * away from evhttp by replacing its callbacks; the evhttp_connection is only
+ * kept to free it when the WebSocket is done. Apart from the atomics, the
+ * members are only used on the event loop thread.
+ */
+class HTTPWebSocket final : public WebSocket, public std::enable_shared_from_this<HTTPWebSocket>
+{
+public:
+    HTTPWebSocket(size_t max_buffer, WebSocketMessageFn on_message, std::function<void()> on_close)
+        : m_max_buffer(max_buffer), m_on_message(std::move(on_message)), m_on_close(std::move(on_close))
+    {
     }
+
+    bool Send(const std::string& message) override;
+    void Close(uint16_t code, const std::string& reason) override;
+    size_t Queued() const override { return m_queued.load(); }
+
+    /** Take over the connection of req and complete the handshake */
+    void Start(evhttp_request* req, const std::string& accept);
+    /** Send a close frame, and drop the connection once it has been written */
+    void SendClose(uint16_t code, const std::string& reason);
+
+private:
+    const size_t m_max_buffer;
+    const WebSocketMessageFn m_on_message;
+    const std::function<void()> m_on_close;
+    //! Bytes of frames that were queued and have not been written to the socket yet
+    std::atomic<size_t> m_queued{0};
+    //! Set once a close frame was queued or the connection is gone, nothing is sent after that
+    std::atomic<bool> m_closing{false};
+
+    evhttp_connection* m_conn{nullptr};
+    bufferevent* m_bev{nullptr};
+    evbuffer_cb_entry* m_drain_cb{nullptr};
+    //! Text message that is being received in fragments
+    std::string m_message;
+    bool m_fragmented{false};
+
+    /** Account size bytes in m_queued. Returns false, accounting nothing, if they do not fit in the send buffer */
+    bool Reserve(size_t size);
+    /** Add a frame of which the size was already accounted in m_queued */
+    void Add(const std::string& frame);
+    /** Add a frame that is sent even while closing, like the close frame itself */
+    void Write(const std::string& frame);
+    void ReadFrames();
+    void HandleFrame(bool fin, uint8_t opcode, std::string payload);
+    /** Free the connection, after which the WebSocket is only kept alive by its users */
+    void Release();
+
+    static void ReadCallback(bufferevent*, void* arg);
+    static void WriteCallback(bufferevent*, void* arg);
+    static void EventCallback(bufferevent*, short events, void* arg);
+    static void DrainCallback(evbuffer*, const evbuffer_cb_info* info, void* arg);
 };
 
 struct HTTPPathHandler
@@ -136,12 +395,16 @@ static struct evhttp* eventHTTP = nullptr;
 //! List of subnets to allow RPC connections from
 static std::vector<CSubNet> rpc_allow_subnets;
 //! Work queue for handling longer requests off the event loop thread
-static std::unique_ptr<WorkQueue<HTTPClosure>> g_work_queue{nullptr};
+static std::unique_ptr<WorkQueue> g_work_queue{nullptr};
 //! Handlers for (sub)paths
 static Mutex g_httppathhandlers_mutex;
 static std::vector<HTTPPathHandler> pathHandlers GUARDED_BY(g_httppathhandlers_mutex);
 //! Bound listening sockets
 static std::vector<evhttp_bound_socket *> boundSockets;
+//! Open WebSocket connections, which keeps them alive. Event loop thread only.
+static std::set<std::shared_ptr<HTTPWebSocket>> g_websockets;
+//! Whether WebSocket connections are being closed for shutdown. Event loop thread only.
+static bool g_websockets_closing{false};
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -257,12 +520,15 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
 
     // Dispatch to worker thread
     if (i != iend) {
+        // Only the address, as credentials are not checked until a worker handles the request
+        const CNetAddr client{hreq->GetPeer()};
         std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(std::move(hreq), path, i->handler));
         assert(g_work_queue);
-        if (g_work_queue->Enqueue(item.get())) {
-            item.release(); /* if true, queue took ownership */
-        } else {
-            LogPrintf("WARNING: request rejected because http work queue depth exceeded, it can be increased with the -rpcworkqueue= setting\n");
+        if (!g_work_queue->Accepting()) {
+            LogPrint(BCLog::HTTP, "Rejecting request from %s while shutting down\n", client.ToString());
+            item->req->WriteReply(HTTP_SERVICE_UNAVAILABLE);
+        } else if (!g_work_queue->Enqueue(client, item)) {
+            LogPrintf("WARNING: request from %s rejected because it has too many requests waiting, the limit can be increased with the -rpcworkqueue= setting\n", client.ToString());
             item->req->WriteReply(HTTP_SERVICE_UNAVAILABLE, "Work queue depth exceeded");
         }
     } else {
@@ -331,7 +597,7 @@ static bool HTTPBindAddresses(struct evhttp* http)
 }
 
 /** Simple wrapper to set thread name and run work queue */
-static void HTTPWorkQueueRun(WorkQueue<HTTPClosure>* queue, int worker_num)
+static void HTTPWorkQueueRun(WorkQueue* queue, int worker_num)
 {
     util::ThreadRename(strprintf("httpworker.%i", worker_num));
     queue->Run();
@@ -392,9 +658,10 @@ bool InitHTTPServer()
 
     LogPrint(BCLog::HTTP, "Initialized HTTP server\n");
     int workQueueDepth = std::max((long)gArgs.GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
-    LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
+    int rpcThreads = std::max((long)gArgs.GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
+    LogPrintf("HTTP: creating work queue of depth %d per client\n", workQueueDepth);
 
-    g_work_queue = std::make_unique<WorkQueue<HTTPClosure>>(workQueueDepth);
+    g_work_queue = std::make_unique<WorkQueue>(workQueueDepth, rpcThreads, base_ctr.get());
     // transfer ownership to eventBase/HTTP via .release()
     eventBase = base_ctr.release();
     eventHTTP = http_ctr.release();
@@ -440,6 +707,16 @@ void InterruptHTTPServer()
     if (g_work_queue) {
         g_work_queue->Interrupt();
     }
+    if (eventBase) {
+        // WebSocket connections would keep the event loop running
+        HTTPEvent* ev = new HTTPEvent(eventBase, true, [] {
+            g_websockets_closing = true;
+            for (const auto& websocket : std::set<std::shared_ptr<HTTPWebSocket>>{g_websockets}) {
+                websocket->SendClose(WS_CLOSE_GOING_AWAY, "Shutting down");
+            }
+        });
+        ev->trigger(nullptr);
+    }
 }
 
 void StopHTTPServer()
@@ -462,6 +739,10 @@ void StopHTTPServer()
         LogPrint(BCLog::HTTP, "Waiting for HTTP event thread to exit\n");
         if (g_thread_http.joinable()) g_thread_http.join();
     }
+    // The work queue's events have to be freed before the event base
+    g_work_queue.reset();
+    g_websockets.clear();
+    g_websockets_closing = false;
     if (eventHTTP) {
         evhttp_free(eventHTTP);
         eventHTTP = nullptr;
@@ -470,7 +751,6 @@ void StopHTTPServer()
         event_base_free(eventBase);
         eventBase = nullptr;
     }
-    g_work_queue.reset();
     LogPrint(BCLog::HTTP, "Stopped HTTP server\n");
 }
 
@@ -511,7 +791,11 @@ HTTPRequest::HTTPRequest(struct evhttp_request* _req, bool _replySent) : req(_re
 
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (!replySent && m_chunked) {
+        // The status is sent already, all we can do is cut the reply short
+        LogPrintf("%s: Unfinished chunked reply\n", __func__);
+        EndChunkedReply();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL_SERVER_ERROR, "Unhandled request");
@@ -557,6 +841,22 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
     evhttp_add_header(headers, hdr.c_str(), value.c_str());
 }
 
+/** Re-enable reading from the socket of a request that is being replied to.
+ * This is the second part of the libevent workaround in http_request_cb.
+ */
+static void EnableReading(evhttp_request* req)
+{
+    if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
+        evhttp_connection* conn = evhttp_request_get_connection(req);
+        if (conn) {
+            bufferevent* bev = evhttp_connection_get_bufferevent(conn);
+            if (bev) {
+                bufferevent_enable(bev, EV_READ | EV_WRITE);
+            }
+        }
+    }
+}
+
 /** Closure sent to main thread to request a reply to be sent to
  * a HTTP request.
  * Replies must be sent in the main loop in the main http thread,
@@ -575,17 +875,90 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     auto req_copy = req;
     HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, nStatus]{
         evhttp_send_reply(req_copy, nStatus, nullptr, nullptr);
-        // Re-enable reading from the socket. This is the second part of the libevent
-        // workaround above.
-        if (event_get_version_number() >= 0x02010600 && event_get_version_number() < 0x02020001) {
-            evhttp_connection* conn = evhttp_request_get_connection(req_copy);
-            if (conn) {
-                bufferevent* bev = evhttp_connection_get_bufferevent(conn);
-                if (bev) {
-                    bufferevent_enable(bev, EV_READ | EV_WRITE);
-                }
-            }
+        EnableReading(req_copy);
+    });
+    ev->trigger(nullptr);
+    replySent = true;
+    req = nullptr; // transferred back to main thread
+}
+
+/* The parts of a chunked reply are sent by events like the one WriteReply
+ * uses. The event loop runs events in the order they were triggered, so the
+ * parts go out in order.
+ */
+void HTTPRequest::StartChunkedReply(int nStatus)
+{
+    assert(!replySent && !m_chunked && req);
+    if (ShutdownRequested()) {
+        WriteHeader("Connection", "close");
+    }
+    auto req_copy = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, nStatus]{
+        evhttp_send_reply_start(req_copy, nStatus, nullptr);
+    });
+    ev->trigger(nullptr);
+    m_chunked = true;
+}
+
+/** The bytes waiting to be sent on the connection of a request, or nullopt if it
+ * was closed. Must be called in the main http thread.
+ */
+static std::optional<size_t> GetPendingOutput(evhttp_request* req)
+{
+    // libevent keeps a request whose reply is unfinished, without its connection
+    evhttp_connection* conn = evhttp_request_get_connection(req);
+    bufferevent* bev = conn ? evhttp_connection_get_bufferevent(conn) : nullptr;
+    if (!bev) return std::nullopt;
+    return evbuffer_get_length(bufferevent_get_output(bev));
+}
+
+void HTTPRequest::WriteReplyChunk(Span<const char> chunk)
+{
+    assert(!replySent && m_chunked && req);
+    if (chunk.empty() || m_chunked_closed) return;
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, chunk.data(), chunk.size());
+    auto req_copy = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy, evb]{
+        evhttp_send_reply_chunk(req_copy, evb);
+        evbuffer_free(evb);
+    });
+    ev->trigger(nullptr);
+
+    m_chunked_pending += chunk.size();
+    // Only ask the main http thread how much is still waiting when it may be too much
+    while (m_chunked_pending >= MAX_CHUNKED_REPLY_PENDING) {
+        // A client that stops reading would otherwise hold the lock for as long as it likes
+        assert(LockStackEmpty());
+        std::promise<std::optional<size_t>> pending_promise;
+        std::future<std::optional<size_t>> pending_future{pending_promise.get_future()};
+        // Events run in order, so this sees every chunk sent before
+        HTTPEvent* probe = new HTTPEvent(eventBase, true, [req_copy, &pending_promise] {
+            pending_promise.set_value(GetPendingOutput(req_copy));
+        });
+        probe->trigger(nullptr);
+        const std::optional<size_t> pending{pending_future.get()};
+        if (!pending) {
+            LogPrint(BCLog::HTTP, "Connection closed during chunked reply, discarding the rest\n");
+            m_chunked_closed = true;
+            return;
         }
+        m_chunked_pending = *pending;
+        // Don't hold up shutdown for a slow reader
+        if (m_chunked_pending < MAX_CHUNKED_REPLY_PENDING || ShutdownRequested()) return;
+        UninterruptibleSleep(std::chrono::milliseconds{20});
+    }
+}
+
+void HTTPRequest::EndChunkedReply()
+{
+    assert(!replySent && m_chunked && req);
+    auto req_copy = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [req_copy]{
+        // Once ended, the request may be freed (if the connection is gone)
+        EnableReading(req_copy);
+        evhttp_send_reply_end(req_copy);
     });
     ev->trigger(nullptr);
     replySent = true;
@@ -632,6 +1005,275 @@ HTTPRequest::RequestMethod HTTPRequest::GetRequestMethod() const
     }
 }
 
+bool HTTPWebSocket::Send(const std::string& message)
+{
+    if (m_closing) return false;
+    std::string frame{WebSocketFrame(WS_OP_TEXT, message)};
+    if (!Reserve(frame.size())) return false;
+    auto self{shared_from_this()};
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [self, frame = std::move(frame)] { self->Add(frame); });
+    ev->trigger(nullptr);
+    return true;
+}
+
+void HTTPWebSocket::Close(uint16_t code, const std::string& reason)
+{
+    auto self{shared_from_this()};
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [self, code, reason] { self->SendClose(code, reason); });
+    ev->trigger(nullptr);
+}
+
+void HTTPWebSocket::Start(evhttp_request* req, const std::string& accept)
+{
+    evhttp_connection* conn = evhttp_request_get_connection(req);
+    bufferevent* bev = conn ? evhttp_connection_get_bufferevent(conn) : nullptr;
+    if (!bev) {
+        m_closing = true;
+        m_on_close();
+        return;
+    }
+    m_conn = conn;
+    m_bev = bev;
+    g_websockets.insert(shared_from_this());
+    bufferevent_setcb(m_bev, ReadCallback, WriteCallback, EventCallback, this);
+    m_drain_cb = evbuffer_add_cb(bufferevent_get_output(m_bev), DrainCallback, this);
+    // The connection stays open for as long as the client likes
+    bufferevent_set_timeouts(m_bev, nullptr, nullptr);
+    Write(strprintf("HTTP/1.1 101 Switching Protocols\r\n"
+                    "Upgrade: websocket\r\n"
+                    "Connection: Upgrade\r\n"
+                    "Sec-WebSocket-Accept: %s\r\n\r\n", accept));
+    bufferevent_enable(m_bev, EV_READ | EV_WRITE);
+    if (g_websockets_closing) {
+        SendClose(WS_CLOSE_GOING_AWAY, "Shutting down");
+        return;
+    }
+    // The client may have sent frames right after the handshake
+    ReadFrames();
+}
+
+void HTTPWebSocket::SendClose(uint16_t code, const std::string& reason)
+{
+    if (m_closing || !m_bev) return;
+    std::string payload{char(code >> 8), char(code)};
+    payload += reason.substr(0, 123);
+    Write(WebSocketFrame(WS_OP_CLOSE, payload));
+    m_closing = true;
+    // Nothing is read anymore, and the connection is dropped in WriteCallback
+    // once the close frame is out, or after a timeout if the client stalls.
+    bufferevent_disable(m_bev, EV_READ);
+    struct timeval tv{WEBSOCKET_CLOSE_TIMEOUT, 0};
+    bufferevent_set_timeouts(m_bev, nullptr, &tv);
+}
+
+bool HTTPWebSocket::Reserve(size_t size)
+{
+    size_t queued{m_queued.load()};
+    do {
+        if (queued + size > m_max_buffer) return false;
+    } while (!m_queued.compare_exchange_weak(queued, queued + size));
+    return true;
+}
+
+void HTTPWebSocket::Add(const std::string& frame)
+{
+    if (!m_bev || m_closing) {
+        m_queued -= frame.size();
+        return;
+    }
+    evbuffer_add(bufferevent_get_output(m_bev), frame.data(), frame.size());
+}
+
+void HTTPWebSocket::Write(const std::string& frame)
+{
+    if (!m_bev) return;
+    m_queued += frame.size();
+    evbuffer_add(bufferevent_get_output(m_bev), frame.data(), frame.size());
+}
+
+void HTTPWebSocket::ReadFrames()
+{
+    evbuffer* input = bufferevent_get_input(m_bev);
+    while (m_bev && !m_closing) {
+        const size_t available{evbuffer_get_length(input)};
+        unsigned char header[14];
+        if (available < 2) return;
+        evbuffer_copyout(input, header, std::min(available, sizeof(header)));
+        const bool fin = header[0] & 0x80;
+        const uint8_t opcode = header[0] & 0x0f;
+        // Extensions are never negotiated, so the reserved bits must be clear, and clients have to mask
+        if ((header[0] & 0x70) || !(header[1] & 0x80)) {
+            return SendClose(WS_CLOSE_PROTOCOL_ERROR, "Invalid frame header");
+        }
+        uint64_t size = header[1] & 0x7f;
+        size_t header_size{2};
+        if (size == 126) {
+            if (available < 4) return;
+            size = ReadBE16(header + 2);
+            header_size = 4;
+        } else if (size == 127) {
+            if (available < 10) return;
+            size = ReadBE64(header + 2);
+            header_size = 10;
+        }
+        if (size > MAX_WEBSOCKET_MESSAGE_SIZE) {
+            return SendClose(WS_CLOSE_TOO_BIG, "Message too big");
+        }
+        if (available < header_size + 4 + size) return;
+        unsigned char mask[4];
+        std::copy(header + header_size, header + header_size + 4, mask);
+        evbuffer_drain(input, header_size + 4);
+        std::string payload(size, '\0');
+        evbuffer_remove(input, payload.data(), size);
+        for (size_t i = 0; i < payload.size(); ++i) {
+            payload[i] ^= mask[i % 4];
+        }
+        HandleFrame(fin, opcode, std::move(payload));
+    }
+}
+
+void HTTPWebSocket::HandleFrame(bool fin, uint8_t opcode, std::string payload)
+{
+    if ((opcode & 0x8) && (!fin || payload.size() > 125)) {
+        return SendClose(WS_CLOSE_PROTOCOL_ERROR, "Invalid control frame");
+    }
+    switch (opcode) {
+    case WS_OP_CONTINUATION:
+        if (!m_fragmented) return SendClose(WS_CLOSE_PROTOCOL_ERROR, "Unexpected continuation frame");
+        if (m_message.size() + payload.size() > MAX_WEBSOCKET_MESSAGE_SIZE) {
+            return SendClose(WS_CLOSE_TOO_BIG, "Message too big");
+        }
+        m_message += payload;
+        if (fin) {
+            m_fragmented = false;
+            if (!IsValidUTF8(m_message)) return SendClose(WS_CLOSE_INVALID_DATA, "Invalid UTF-8");
+            m_on_message(m_message);
+            m_message.clear();
+        }
+        return;
+    case WS_OP_TEXT:
+        if (m_fragmented) return SendClose(WS_CLOSE_PROTOCOL_ERROR, "Expected a continuation frame");
+        if (fin) {
+            if (!IsValidUTF8(payload)) return SendClose(WS_CLOSE_INVALID_DATA, "Invalid UTF-8");
+            m_on_message(payload);
+        } else {
+            m_message = std::move(payload);
+            m_fragmented = true;
+        }
+        return;
+    case WS_OP_BINARY:
+        return SendClose(WS_CLOSE_UNSUPPORTED, "Binary messages are not supported");
+    case WS_OP_CLOSE:
+        // Echo the status code of the client, as RFC 6455 section 5.5.1 asks
+        return SendClose(payload.size() >= 2 ? ReadBE16(reinterpret_cast<const unsigned char*>(payload.data())) : WS_CLOSE_NORMAL, "");
+    case WS_OP_PING: {
+        // Pongs count against the send buffer like messages, so a client that
+        // pings without reading cannot make it grow without bound
+        std::string pong{WebSocketFrame(WS_OP_PONG, payload)};
+        if (!Reserve(pong.size())) return SendClose(WS_CLOSE_POLICY_VIOLATION, "Send buffer full");
+        return Add(pong);
+    }
+    case WS_OP_PONG:
+        return;
+    default:
+        return SendClose(WS_CLOSE_PROTOCOL_ERROR, "Unknown opcode");
+    }
+}
+
+void HTTPWebSocket::Release()
+{
+    if (!m_conn) return;
+    auto self{shared_from_this()};
+    bufferevent_setcb(m_bev, nullptr, nullptr, nullptr, nullptr);
+    evbuffer_remove_cb_entry(bufferevent_get_output(m_bev), m_drain_cb);
+    // Also frees the request that was upgraded, and closes the socket
+    evhttp_connection_free(m_conn);
+    m_conn = nullptr;
+    m_bev = nullptr;
+    m_closing = true;
+    g_websockets.erase(self);
+    m_on_close();
+}
+
+void HTTPWebSocket::ReadCallback(bufferevent*, void* arg)
+{
+    // Handling a frame can release the connection, so keep the object alive meanwhile
+    auto self{static_cast<HTTPWebSocket*>(arg)->shared_from_this()};
+    self->ReadFrames();
+}
+
+void HTTPWebSocket::WriteCallback(bufferevent*, void* arg)
+{
+    auto self{static_cast<HTTPWebSocket*>(arg)->shared_from_this()};
+    // Everything is written, including the close frame if one was queued
+    if (self->m_closing) self->Release();
+}
+
+void HTTPWebSocket::EventCallback(bufferevent*, short events, void* arg)
+{
+    auto self{static_cast<HTTPWebSocket*>(arg)->shared_from_this()};
+    if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR | BEV_EVENT_TIMEOUT)) self->Release();
+}
+
+void HTTPWebSocket::DrainCallback(evbuffer*, const evbuffer_cb_info* info, void* arg)
+{
+    static_cast<HTTPWebSocket*>(arg)->m_queued -= info->n_deleted;
+}
+
+/** Whether a comma separated header value contains token, ignoring case */
+static bool HeaderHasToken(const std::string& value, const std::string& token)
+{
+    for (const auto& part : spanparsing::Split(value, ',')) {
+        if (ToLower(TrimString(std::string(part.begin(), part.end()))) == token) return true;
+    }
+    return false;
+}
+
+std::shared_ptr<WebSocket> HTTPRequest::AcceptWebSocket(size_t max_buffer, WebSocketMessageFn on_message, std::function<void()> on_close)
+{
+    assert(!replySent && !m_chunked && req);
+    const auto [has_key, key] = GetHeader("Sec-WebSocket-Key");
+    if (GetRequestMethod() != GET || !has_key ||
+        !HeaderHasToken(GetHeader("Upgrade").second, "websocket") ||
+        !HeaderHasToken(GetHeader("Connection").second, "upgrade")) {
+        WriteReply(HTTP_BAD_REQUEST, "Expected a WebSocket handshake");
+        return nullptr;
+    }
+    if (GetHeader("Sec-WebSocket-Version").second != "13") {
+        WriteHeader("Sec-WebSocket-Version", "13");
+        WriteReply(HTTP_BAD_REQUEST, "Unsupported WebSocket version");
+        return nullptr;
+    }
+    // RFC 6455 section 4.2.2: the key with a fixed GUID appended, hashed and encoded
+    const std::string accept_input{key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"};
+    unsigned char hash[CSHA1::OUTPUT_SIZE];
+    CSHA1().Write(reinterpret_cast<const unsigned char*>(accept_input.data()), accept_input.size()).Finalize(hash);
+    const std::string accept{EncodeBase64(hash)};
+
+    auto websocket{std::make_shared<HTTPWebSocket>(max_buffer, std::move(on_message), std::move(on_close))};
+    auto req_copy = req;
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, [websocket, req_copy, accept] {
+        websocket->Start(req_copy, accept);
+    });
+    ev->trigger(nullptr);
+    replySent = true;
+    req = nullptr; // transferred to the WebSocket on the main thread
+    return websocket;
+}
+
+bool RunOnIdleHTTPWorker(std::function<void()> task)
+{
+    if (!g_work_queue) return false;
+    return g_work_queue->EnqueueIfIdle(std::make_unique<HTTPTaskItem>(std::move(task)));
+}
+
+bool GetHTTPWorkQueueStats(HTTPWorkQueueStats& stats)
+{
+    if (!g_work_queue) return false;
+    g_work_queue->GetStats(stats);
+    return true;
+}
+
 void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler)
 {
     LogPrint(BCLog::HTTP, "Registering HTTP handler for %s (exactmatch %d)\n", prefix, exactMatch);
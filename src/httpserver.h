@@ -5,8 +5,13 @@
 #ifndef BITCOIN_HTTPSERVER_H
 #define BITCOIN_HTTPSERVER_H
 
+#include <span.h>
+
+#include <chrono>
+#include <cstdint>
 #include <string>
 #include <functional>
+#include <memory>
 
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
@@ -17,6 +22,9 @@ struct event_base;
 class CService;
 class HTTPRequest;
 
+/** Bytes of a chunked reply that can wait to be sent before WriteReplyChunk blocks */
+static constexpr size_t MAX_CHUNKED_REPLY_PENDING{1 << 20};
+
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
  */
@@ -45,11 +53,67 @@ void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPR
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
+/** Run a task on an HTTP worker thread that is idle, for example to help
+ * with a request that can be split up. The task never waits in the queue, so
+ * it cannot hold up other requests; returns false if no worker is idle.
+ */
+bool RunOnIdleHTTPWorker(std::function<void()> task);
+
+/** Statistics of the HTTP work queue */
+struct HTTPWorkQueueStats {
+    //! Requests and tasks waiting for a worker thread
+    size_t depth{0};
+    //! Clients that have requests waiting
+    size_t clients{0};
+    //! Requests and tasks handed to a worker thread so far
+    uint64_t executed{0};
+    //! Requests rejected because their client had too many waiting
+    uint64_t rejected{0};
+    //! Time spent waiting for a worker thread, in total and at most
+    std::chrono::microseconds total_wait{0};
+    std::chrono::microseconds max_wait{0};
+    //! Time spent running on a worker thread, in total
+    std::chrono::microseconds total_exec{0};
+};
+
+/** Get statistics of the HTTP work queue. Returns false if the HTTP server is not initialized. */
+bool GetHTTPWorkQueueStats(HTTPWorkQueueStats& stats);
+
 /** Return evhttp event base. This can be used by submodules to
  * queue timers or custom events.
  */
 struct event_base* EventBase();
 
+/** Called with each text message received on a WebSocket */
+typedef std::function<void(const std::string& message)> WebSocketMessageFn;
+
+// WebSocket close status codes, RFC 6455 section 7.4.1
+static const uint16_t WS_CLOSE_NORMAL = 1000;
+static const uint16_t WS_CLOSE_GOING_AWAY = 1001;
+static const uint16_t WS_CLOSE_PROTOCOL_ERROR = 1002;
+static const uint16_t WS_CLOSE_UNSUPPORTED = 1003;
+static const uint16_t WS_CLOSE_INVALID_DATA = 1007;
+static const uint16_t WS_CLOSE_POLICY_VIOLATION = 1008;
+static const uint16_t WS_CLOSE_TOO_BIG = 1009;
+
+/** WebSocket connection (RFC 6455) that was accepted on the HTTP server.
+ * Send and Close can be called from any thread.
+ */
+class WebSocket
+{
+public:
+    virtual ~WebSocket() {}
+
+    /** Queue a text message. Returns false, sending nothing, if the
+     * connection is closing or the message does not fit in the send buffer.
+     */
+    virtual bool Send(const std::string& message) = 0;
+    /** Close the connection with one of the WS_CLOSE_* status codes. */
+    virtual void Close(uint16_t code, const std::string& reason) = 0;
+    /** Number of bytes queued and not yet written to the socket */
+    virtual size_t Queued() const = 0;
+};
+
 /** In-flight HTTP request.
  * Thin C++ wrapper around evhttp_request.
  */
@@ -58,6 +122,11 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    bool m_chunked{false};
+    /** Bytes of a chunked reply that may still be waiting to be sent, as far as we know */
+    size_t m_chunked_pending{0};
+    /** Whether the connection of a chunked reply was closed, so further chunks are discarded */
+    bool m_chunked_closed{false};
 
 public:
     explicit HTTPRequest(struct evhttp_request* req, bool replySent = false);
@@ -113,6 +182,41 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a reply whose body is sent in parts, using chunked transfer
+     * encoding. Write the parts with WriteReplyChunk() and finish with
+     * EndChunkedReply() instead of calling WriteReply().
+     *
+     * @note call WriteHeader before this, the headers are sent right away.
+     */
+    void StartChunkedReply(int nStatus);
+    /**
+     * Send the next part of a chunked reply. Blocks while the client has not
+     * read MAX_CHUNKED_REPLY_PENDING bytes of the parts sent before, so a slow
+     * reader holds up the producer instead of the reply piling up in memory.
+     * Must not be called while holding a lock.
+     */
+    void WriteReplyChunk(Span<const char> chunk);
+    /**
+     * Finish a chunked reply.
+     *
+     * @note As with WriteReply, do not call any other HTTPRequest methods after this.
+     */
+    void EndChunkedReply();
+
+    /**
+     * Accept a WebSocket handshake and take over the connection of the request.
+     * At most max_buffer bytes are queued for sending at any time.
+     * on_message is called with every text message received, and on_close once
+     * the connection is gone, both on the HTTP event thread.
+     *
+     * Returns nullptr, after replying with an error, if the request is not a
+     * valid handshake.
+     *
+     * @note As with WriteReply, do not call any other HTTPRequest methods after this.
+     */
+    std::shared_ptr<WebSocket> AcceptWebSocket(size_t max_buffer, WebSocketMessageFn on_message, std::function<void()> on_close);
 };
 
 /** Event handler closure.
@@ -52,6 +52,8 @@ protected:
     const char* GetName() const override { return m_name.c_str(); }
 
 public:
+    const char* SubscriberName() const override { return "blockfilterindex"; }
+
     /** Constructs the index, which becomes available to be queried. */
     explicit BlockFilterIndex(BlockFilterType filter_type,
                               size_t n_cache_size, bool f_memory = false, bool f_wipe = false);
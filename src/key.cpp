@@ -11,6 +11,7 @@
 #include <random.h>
 
 #include <secp256k1.h>
+#include <secp256k1_ecdh.h>
 #include <secp256k1_extrakeys.h>
 #include <secp256k1_recovery.h>
 #include <secp256k1_schnorrsig.h>
@@ -311,6 +312,14 @@ bool CKey::Derive(CKey& keyChild, ChainCode &ccChild, unsigned int nChild, const
     return ret;
 }
 
+bool CKey::ComputeECDHSecret(const CPubKey& pubkey, uint256& secret) const
+{
+    assert(fValid);
+    secp256k1_pubkey point;
+    if (!secp256k1_ec_pubkey_parse(secp256k1_context_sign, &point, pubkey.data(), pubkey.size())) return false;
+    return secp256k1_ecdh(secp256k1_context_sign, secret.begin(), &point, begin(), nullptr, nullptr);
+}
+
 bool CExtKey::Derive(CExtKey &out, unsigned int _nChild) const {
     out.nDepth = nDepth + 1;
     CKeyID id = key.GetPubKey().GetID();
@@ -143,6 +143,9 @@ public:
     //! Derive BIP32 child key.
     bool Derive(CKey& keyChild, ChainCode &ccChild, unsigned int nChild, const ChainCode& cc) const;
 
+    //! Compute the secret shared with the owner of pubkey (ECDH): the SHA256 of the compressed shared point.
+    bool ComputeECDHSecret(const CPubKey& pubkey, uint256& secret) const;
+
     /**
      * Verify thoroughly whether a private key and a public key match.
      * This is done using a different mechanism than just regenerating it.
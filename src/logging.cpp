@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <logging.h>
+#include <util/metrics.h>
 #include <util/threadnames.h>
 #include <util/string.h>
 #include <util/time.h>
@@ -35,6 +36,12 @@ BCLog::Logger& LogInstance()
 
 bool fLogIPs = DEFAULT_LOGIPS;
 
+static metrics::Counter& g_metric_log_dropped{metrics::Add<metrics::Counter>(
+    "usdg_log_dropped_total", "Log messages dropped because the log writer thread was too far behind")};
+
+//! Records the writer thread formats and writes with one write to each output
+static constexpr size_t LOG_WRITE_BATCH{256};
+
 static int FileWriteStr(const std::string &str, FILE *fp)
 {
     return fwrite(str.data(), 1, str.size(), fp);
@@ -81,6 +88,7 @@ bool BCLog::Logger::StartLogging()
 
 void BCLog::Logger::DisconnectTestLogger()
 {
+    StopAsync();
     StdLockGuard scoped_lock(m_cs);
     m_buffering = true;
     if (m_fileout != nullptr) fclose(m_fileout);
@@ -193,7 +201,7 @@ std::vector<LogCategory> BCLog::Logger::LogCategoriesList() const
     return ret;
 }
 
-std::string BCLog::Logger::LogTimestampStr(const std::string& str)
+std::string BCLog::Logger::LogTimestampStr(const std::string& str, int64_t time_micros, std::chrono::seconds mocktime)
 {
     std::string strStamped;
 
@@ -201,13 +209,11 @@ std::string BCLog::Logger::LogTimestampStr(const std::string& str)
         return str;
 
     if (m_started_new_line) {
-        int64_t nTimeMicros = GetTimeMicros();
-        strStamped = FormatISO8601DateTime(nTimeMicros/1000000);
+        strStamped = FormatISO8601DateTime(time_micros/1000000);
         if (m_log_time_micros) {
             strStamped.pop_back();
-            strStamped += strprintf(".%06dZ", nTimeMicros%1000000);
+            strStamped += strprintf(".%06dZ", time_micros%1000000);
         }
-        std::chrono::seconds mocktime = GetMockTime();
         if (mocktime > 0s) {
             strStamped += " (mocktime: " + FormatISO8601DateTime(count_seconds(mocktime)) + ")";
         }
@@ -240,37 +246,47 @@ namespace BCLog {
     }
 }
 
-void BCLog::Logger::LogPrintStr(const std::string& str, const std::string& logging_function, const std::string& source_file, const int source_line)
+BCLog::LogRecord BCLog::Logger::MakeRecord(const std::string& logging_function, const std::string& source_file, int source_line) const
 {
-    StdLockGuard scoped_lock(m_cs);
-    std::string str_prefixed = LogEscapeMessage(str);
-
-    if (m_log_sourcelocations && m_started_new_line) {
-        str_prefixed.insert(0, "[" + RemovePrefix(source_file, "./") + ":" + ToString(source_line) + "] [" + logging_function + "] ");
+    LogRecord record;
+    if (m_log_timestamps) {
+        record.time_micros = GetTimeMicros();
+        record.mocktime = GetMockTime();
     }
-
-    if (m_log_threadnames && m_started_new_line) {
-        str_prefixed.insert(0, "[" + util::ThreadGetInternalName() + "] ");
+    if (m_log_threadnames) {
+        record.prefix = "[" + util::ThreadGetInternalName() + "] ";
+    }
+    if (m_log_sourcelocations) {
+        record.prefix += "[" + RemovePrefix(source_file, "./") + ":" + ToString(source_line) + "] [" + logging_function + "] ";
     }
+    return record;
+}
 
-    str_prefixed = LogTimestampStr(str_prefixed);
+std::string BCLog::Logger::FormatRecord(LogRecord& record)
+{
+    if (record.format) record.msg = record.format();
 
-    m_started_new_line = !str.empty() && str[str.size()-1] == '\n';
+    std::string str_prefixed = LogEscapeMessage(record.msg);
+    if (m_started_new_line) str_prefixed.insert(0, record.prefix);
+    str_prefixed = LogTimestampStr(str_prefixed, record.time_micros, record.mocktime);
 
+    m_started_new_line = !record.msg.empty() && record.msg.back() == '\n';
+    return str_prefixed;
+}
+
+void BCLog::Logger::WriteToOutputs(const std::string& str)
+{
     if (m_buffering) {
         // buffer if we haven't started logging yet
-        m_msgs_before_open.push_back(str_prefixed);
+        m_msgs_before_open.push_back(str);
         return;
     }
 
     if (m_print_to_console) {
         // print to console
-        fwrite(str_prefixed.data(), 1, str_prefixed.size(), stdout);
+        fwrite(str.data(), 1, str.size(), stdout);
         fflush(stdout);
     }
-    for (const auto& cb : m_print_callbacks) {
-        cb(str_prefixed);
-    }
     if (m_print_to_file) {
         assert(m_fileout != nullptr);
 
@@ -284,8 +300,131 @@ void BCLog::Logger::LogPrintStr(const std::string& str, const std::string& loggi
                 m_fileout = new_fileout;
             }
         }
-        FileWriteStr(str_prefixed, m_fileout);
+        FileWriteStr(str, m_fileout);
+    }
+}
+
+void BCLog::Logger::LogPrintStr(const std::string& str, const std::string& logging_function, const std::string& source_file, const int source_line)
+{
+    LogRecord record{MakeRecord(logging_function, source_file, source_line)};
+    record.msg = str;
+    Output(std::move(record));
+}
+
+void BCLog::Logger::LogPrintDeferred(std::function<std::string()> format, const std::string& logging_function, const std::string& source_file, const int source_line)
+{
+    LogRecord record{MakeRecord(logging_function, source_file, source_line)};
+    record.format = std::move(format);
+    Output(std::move(record));
+}
+
+void BCLog::Logger::Output(LogRecord&& record)
+{
+    if (m_async.load(std::memory_order_relaxed)) {
+        Enqueue(std::move(record));
+        return;
+    }
+
+    StdLockGuard scoped_lock(m_cs);
+    const std::string str_prefixed{FormatRecord(record)};
+    for (const auto& cb : m_print_callbacks) {
+        cb(str_prefixed);
+    }
+    WriteToOutputs(str_prefixed);
+}
+
+void BCLog::Logger::Enqueue(LogRecord&& record)
+{
+    if (!m_queue->TryPush(std::move(record))) {
+        // Never wait for the writer: a caller may hold locks the node needs
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        g_metric_log_dropped.Inc();
+        return;
+    }
+    m_writer_cv.notify_one();
+}
+
+size_t BCLog::Logger::WriteQueued()
+{
+    std::vector<LogRecord> records;
+    LogRecord record;
+    while (records.size() < LOG_WRITE_BATCH && m_queue->TryPop(record)) {
+        records.push_back(std::move(record));
+    }
+
+    const uint64_t dropped{m_dropped.load(std::memory_order_relaxed)};
+    if (records.empty() && dropped == m_dropped_reported) return 0;
+
+    StdLockGuard scoped_lock(m_cs);
+    std::string out;
+    for (LogRecord& r : records) {
+        const std::string str_prefixed{FormatRecord(r)};
+        for (const auto& cb : m_print_callbacks) {
+            cb(str_prefixed);
+        }
+        out += str_prefixed;
+    }
+    if (dropped != m_dropped_reported) {
+        LogRecord report{MakeRecord(__func__, __FILE__, __LINE__)};
+        report.msg = strprintf("Log buffer full, dropped %u messages\n", dropped - m_dropped_reported);
+        m_dropped_reported = dropped;
+        const std::string str_prefixed{FormatRecord(report)};
+        for (const auto& cb : m_print_callbacks) {
+            cb(str_prefixed);
+        }
+        out += str_prefixed;
+    }
+    WriteToOutputs(out);
+    return records.size();
+}
+
+void BCLog::Logger::WriterThread()
+{
+    while (true) {
+        if (WriteQueued() > 0) continue;
+
+        std::unique_lock<std::mutex> lock(m_writer_mutex);
+        if (m_stop_writer) {
+            // Everything queued before StopAsync cleared m_async has been written
+            if (m_queue->SizeApprox() == 0) break;
+            continue;
+        }
+        // Producers notify without taking m_writer_mutex, so a wakeup can be
+        // missed: bound how long a message then waits for the writer.
+        m_writer_cv.wait_for(lock, std::chrono::milliseconds{100}, [this] {
+            return m_stop_writer || m_queue->SizeApprox() > 0;
+        });
+    }
+}
+
+void BCLog::Logger::StartAsync()
+{
+    if (m_async) return;
+    if (!m_queue) m_queue = std::make_unique<MPMCQueue<LogRecord>>(LOG_BUFFER_MESSAGES);
+    {
+        std::lock_guard<std::mutex> lock(m_writer_mutex);
+        m_stop_writer = false;
+    }
+    // Not a TraceThread: its start and exit messages would be logged through this thread
+    m_writer = std::thread([this] {
+        util::ThreadRename("logwriter");
+        WriterThread();
+    });
+    m_async = true;
+}
+
+void BCLog::Logger::StopAsync()
+{
+    if (!m_async) return;
+    m_async = false;
+    {
+        std::lock_guard<std::mutex> lock(m_writer_mutex);
+        m_stop_writer = true;
     }
+    m_writer_cv.notify_one();
+    m_writer.join();
+    // Callers that saw m_async set just before it was cleared may have queued after the writer exited
+    while (WriteQueued() > 0) {}
 }
 
 void BCLog::Logger::ShrinkDebugFile()
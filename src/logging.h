@@ -9,13 +9,20 @@
 #include <fs.h>
 #include <tinyformat.h>
 #include <threadsafety.h>
+#include <util/mpmcqueue.h>
 #include <util/string.h>
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 static const bool DEFAULT_LOGTIMEMICROS = false;
@@ -23,6 +30,9 @@ static const bool DEFAULT_LOGIPS        = false;
 static const bool DEFAULT_LOGTIMESTAMPS = true;
 static const bool DEFAULT_LOGTHREADNAMES = false;
 static const bool DEFAULT_LOGSOURCELOCATIONS = false;
+static const bool DEFAULT_LOGASYNC = true;
+//! Messages the writer thread can fall behind by before new ones are dropped
+static constexpr size_t LOG_BUFFER_MESSAGES{8192};
 extern const char * const DEFAULT_DEBUGLOGFILE;
 
 extern bool fLogIPs;
@@ -63,6 +73,33 @@ namespace BCLog {
         ALL         = ~(uint32_t)0,
     };
 
+    /** A message on its way to the outputs, with what the caller's context adds to it */
+    struct LogRecord {
+        //! The message, unless formatting it was left to the writer thread
+        std::string msg;
+        std::function<std::string()> format;
+        int64_t time_micros{0};
+        std::chrono::seconds mocktime{0};
+        //! Thread name and source location, added if the message starts a line
+        std::string prefix;
+    };
+
+    /** Arguments that are copied by value, so formatting them can be left to the writer thread */
+    template <typename T>
+    constexpr bool IS_DEFERRABLE = std::is_arithmetic_v<T> || std::is_enum_v<T> || std::is_same_v<T, std::string> ||
+                                   (std::is_array_v<T> && std::is_same_v<std::remove_cv_t<std::remove_extent_t<T>>, char>);
+
+    template <typename... Args>
+    std::string FormatLogMessage(const char* fmt, const Args&... args)
+    {
+        try {
+            return tfm::format(fmt, args...);
+        } catch (tinyformat::format_error& fmterr) {
+            /* Original format string will have newline so don't add one here */
+            return "Error \"" + std::string(fmterr.what()) + "\" while formatting log message: " + fmt;
+        }
+    }
+
     class Logger
     {
     private:
@@ -82,11 +119,39 @@ namespace BCLog {
         /** Log categories bitfield. */
         std::atomic<uint32_t> m_categories{0};
 
-        std::string LogTimestampStr(const std::string& str);
+        std::string LogTimestampStr(const std::string& str, int64_t time_micros, std::chrono::seconds mocktime);
 
         /** Slots that connect to the print signal */
         std::list<std::function<void(const std::string&)>> m_print_callbacks GUARDED_BY(m_cs) {};
 
+        /**
+         * Messages for the writer thread, while logging asynchronously.
+         * Created by the first StartAsync and never destroyed, as callers may
+         * still push to it while the writer stops.
+         */
+        std::unique_ptr<MPMCQueue<LogRecord>> m_queue;
+        std::atomic<bool> m_async{false};
+        std::atomic<uint64_t> m_dropped{0};
+        //! Drops already reported in the log, only used by the writer thread
+        uint64_t m_dropped_reported{0};
+        std::thread m_writer;
+        std::mutex m_writer_mutex;
+        std::condition_variable m_writer_cv;
+        //! Guarded by m_writer_mutex
+        bool m_stop_writer{false};
+
+        LogRecord MakeRecord(const std::string& logging_function, const std::string& source_file, int source_line) const;
+        /** Turn a record into the text to output, with the timestamp and prefix if it starts a line */
+        std::string FormatRecord(LogRecord& record) EXCLUSIVE_LOCKS_REQUIRED(m_cs);
+        void WriteToOutputs(const std::string& str) EXCLUSIVE_LOCKS_REQUIRED(m_cs);
+        /** Hand a record to the writer thread, or write it on this thread if not logging asynchronously */
+        void Output(LogRecord&& record);
+        void Enqueue(LogRecord&& record);
+        /** Write queued messages until StopAsync */
+        void WriterThread();
+        /** Write the messages in the queue, returns how many */
+        size_t WriteQueued();
+
     public:
         bool m_print_to_console = false;
         bool m_print_to_file = false;
@@ -101,10 +166,14 @@ namespace BCLog {
 
         /** Send a string to the log output */
         void LogPrintStr(const std::string& str, const std::string& logging_function, const std::string& source_file, const int source_line);
+        /** Send a message to the log output, formatted by format, on the writer thread if Async() */
+        void LogPrintDeferred(std::function<std::string()> format, const std::string& logging_function, const std::string& source_file, const int source_line);
 
         /** Returns whether logs will be written to any output */
         bool Enabled() const
         {
+            // Messages are only queued while there is an output, and queuing must not wait for the writer
+            if (m_async.load(std::memory_order_relaxed)) return true;
             StdLockGuard scoped_lock(m_cs);
             return m_buffering || m_print_to_console || m_print_to_file || !m_print_callbacks.empty();
         }
@@ -129,6 +198,20 @@ namespace BCLog {
         /** Only for testing */
         void DisconnectTestLogger();
 
+        /**
+         * From now on, hand messages to a writer thread instead of writing
+         * them on the calling thread, so that logging never waits for the
+         * disk, the console or another thread that is logging. While the
+         * writer is LOG_BUFFER_MESSAGES behind, new messages are dropped and
+         * counted. Messages still queued when the process crashes are lost.
+         */
+        void StartAsync();
+        /** Write all queued messages and stop the writer thread. Later messages are written by the caller again. */
+        void StopAsync();
+        bool Async() const { return m_async.load(std::memory_order_relaxed); }
+        /** Messages dropped because the writer thread was too far behind */
+        uint64_t DroppedMessages() const { return m_dropped.load(std::memory_order_relaxed); }
+
         void ShrinkDebugFile();
 
         uint32_t GetCategoryMask() const { return m_categories.load(); }
@@ -167,19 +250,19 @@ bool GetLogCategory(BCLog::LogFlags& flag, const std::string& str);
 // unconditionally log to debug.log! It should not be the case that an inbound
 // peer can fill up a user's disk with debug.log entries.
 
-template <typename... Args>
-static inline void LogPrintf_(const std::string& logging_function, const std::string& source_file, const int source_line, const char* fmt, const Args&... args)
+template <typename Fmt, typename... Args>
+static inline void LogPrintf_(const std::string& logging_function, const std::string& source_file, const int source_line, const Fmt& fmt, const Args&... args)
 {
-    if (LogInstance().Enabled()) {
-        std::string log_msg;
-        try {
-            log_msg = tfm::format(fmt, args...);
-        } catch (tinyformat::format_error& fmterr) {
-            /* Original format string will have newline so don't add one here */
-            log_msg = "Error \"" + std::string(fmterr.what()) + "\" while formatting log message: " + fmt;
+    BCLog::Logger& logger = LogInstance();
+    if (!logger.Enabled()) return;
+    // With the format and the arguments copied, the writer thread can do the formatting
+    if constexpr ((BCLog::IS_DEFERRABLE<Args> && ...)) {
+        if (logger.Async()) {
+            logger.LogPrintDeferred([format = std::string{fmt}, args...] { return BCLog::FormatLogMessage(format.c_str(), args...); }, logging_function, source_file, source_line);
+            return;
         }
-        LogInstance().LogPrintStr(log_msg, logging_function, source_file, source_line);
     }
+    logger.LogPrintStr(BCLog::FormatLogMessage(fmt, args...), logging_function, source_file, source_line);
 }
 
 #define LogPrintf(...) LogPrintf_(__func__, __FILE__, __LINE__, __VA_ARGS__)
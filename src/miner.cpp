@@ -26,10 +26,12 @@
 #include <primitives/transaction.h>
 #include <shutdown.h> // ShutdownRequested()
 #include <timedata.h>
+#include <util/metrics.h>
 #include <util/moneystr.h>
 #include <util/system.h>
 #include <util/thread.h>
 #include <util/threadnames.h>
+#include <util/trace.h>
 #include <wallet/wallet.h>
 #include <warnings.h>
 
@@ -552,6 +554,14 @@ static bool ProcessBlockFound(const CBlock* pblock, ChainstateManager* chainman,
 }
 
 #ifdef ENABLE_WALLET
+static metrics::Histogram& g_metric_stake_search{metrics::Add<metrics::Histogram>(
+    "usdg_staking_search_seconds", "Time spent searching for a kernel and assembling a block template per staking attempt",
+    metrics::Histogram::DurationBuckets())};
+static metrics::Counter& g_metric_stake_attempts{metrics::Add<metrics::Counter>(
+    "usdg_staking_attempts_total", "Staking attempts")};
+static metrics::Counter& g_metric_stake_found{metrics::Add<metrics::Counter>(
+    "usdg_staking_blocks_found_total", "Proof-of-stake blocks found and signed by this node")};
+
 void PoSMiner(std::shared_ptr<CWallet> pwallet, ChainstateManager* chainman, CChainState* chainstate, CConnman* connman, CTxMemPool* mempool)
 {
     LogPrintf("PoSMiner started for proof-of-stake\n");
@@ -653,10 +663,19 @@ void PoSMiner(std::shared_ptr<CWallet> pwallet, ChainstateManager* chainman, CCh
             CBlock *pblock;
             std::unique_ptr<CBlockTemplate> pblocktemplate;
 
+            const auto search_start{std::chrono::steady_clock::now()};
             {
                 LOCK(pwallet->cs_wallet);
                 pblocktemplate = BlockAssembler(*chainstate, *mempool, Params()).CreateNewBlock(scriptPubKey, pwallet.get(), &fPoSCancel);
             }
+            const auto search_duration{std::chrono::steady_clock::now() - search_start};
+            g_metric_stake_search.ObserveDuration(search_duration);
+            g_metric_stake_attempts.Inc();
+            TRACE3(staking, attempt,
+                pindexPrev->nHeight + 1,
+                pblocktemplate != nullptr,
+                std::chrono::duration_cast<std::chrono::microseconds>(search_duration).count() // in microseconds (µs)
+            );
 
             if (!pblocktemplate.get())
             {
@@ -689,6 +708,16 @@ void PoSMiner(std::shared_ptr<CWallet> pwallet, ChainstateManager* chainman, CCh
                     }
                 }
                 LogPrintf("PoSMiner: proof-of-stake block found %s\n", pblock->GetHash().ToString());
+                g_metric_stake_found.Inc();
+                TRACE7(staking, kernel_found,
+                    pblock->GetHash().data(),
+                    pindexPrev->nHeight + 1,
+                    pblock->vtx[1]->GetHash().data(),
+                    pblock->vtx[1]->vin[0].prevout.hash.data(),
+                    pblock->vtx[1]->vin[0].prevout.n,
+                    pblock->nTime,
+                    pblock->nBits
+                );
                 ProcessBlockFound(pblock, chainman, chainstate);
                 // Blackcoin ToDo: !!!
                 // Rest for ~3 minutes after successful block to preserve close quick
@@ -13,24 +13,30 @@
 #include <clientversion.h>
 #include <compat.h>
 #include <consensus/consensus.h>
+#include <crypto/hkdf_sha256_32.h>
 #include <crypto/sha256.h>
 #include <i2p.h>
 #include <net_permissions.h>
+#include <net_recvbuffer.h>
 #include <netaddress.h>
 #include <netbase.h>
 #include <node/ui_interface.h>
 #include <protocol.h>
 #include <random.h>
 #include <scheduler.h>
+#include <support/cleanse.h>
+#include <util/metrics.h>
 #include <util/sock.h>
 #include <util/strencodings.h>
 #include <util/thread.h>
+#include <util/trace.h>
 #include <util/translation.h>
 
 #ifdef WIN32
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
 #endif
 
 #if HAVE_DECL_GETIFADDRS && HAVE_DECL_FREEIFADDRS
@@ -41,6 +47,11 @@
 #include <poll.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 #include <algorithm>
 #include <array>
 #include <cstdint>
@@ -97,8 +108,33 @@ enum BindFlags {
 // The sleep time needs to be small to avoid new sockets stalling
 static const uint64_t SELECT_TIMEOUT_MILLISECONDS = 50;
 
+#ifdef USE_EPOLL
+/** Maximum number of events to collect per epoll_wait() call; the rest are returned by the next call */
+static constexpr int MAX_SOCKET_EVENTS = 256;
+#endif
+
+#ifndef WIN32
+/** Maximum number of queued buffers to hand to a single sendmsg() call (well below IOV_MAX) */
+static constexpr size_t MAX_SEND_IOV = 64;
+#endif
+
 const std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
 
+// Created on first use, as the list of message types is itself a global
+static metrics::Family<metrics::Counter>& RecvBytesMetric()
+{
+    static auto& metric{metrics::Add<metrics::Family<metrics::Counter>>(
+        "usdg_net_recv_bytes_total", "Bytes received from peers, by message type", "type", getAllNetMessageTypes())};
+    return metric;
+}
+
+static metrics::Family<metrics::Counter>& SentBytesMetric()
+{
+    static auto& metric{metrics::Add<metrics::Family<metrics::Counter>>(
+        "usdg_net_sent_bytes_total", "Bytes sent to peers, by message type", "type", getAllNetMessageTypes())};
+    return metric;
+}
+
 static const uint64_t RANDOMIZER_ID_NETGROUP = 0x6c0edd8036ef4036ULL; // SHA256("netgroup")[0:8]
 static const uint64_t RANDOMIZER_ID_LOCALHOSTNONCE = 0xd93e69e2bbfa5735ULL; // SHA256("localhostnonce")[0:8]
 static const uint64_t RANDOMIZER_ID_ADDRCACHE = 0x1cf2e4ddd306dda9ULL; // SHA256("addrcache")[0:8]
@@ -487,7 +523,9 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
     if (!addr_bind.IsValid()) {
         addr_bind = GetBindAddress(sock->Get());
     }
-    CNode* pnode = new CNode(id, nLocalServices, sock->Release(), addrConnect, CalculateKeyedNetGroup(addrConnect), nonce, addr_bind, pszDest ? pszDest : "", conn_type, /* inbound_onion */ false);
+    // Encrypt the connection if both we and the peer advertise support for it
+    const bool use_v2transport = (nLocalServices & NODE_P2P_V2) && (addrConnect.nServices & NODE_P2P_V2);
+    CNode* pnode = new CNode(id, nLocalServices, sock->Release(), addrConnect, CalculateKeyedNetGroup(addrConnect), nonce, addr_bind, pszDest ? pszDest : "", conn_type, /* inbound_onion */ false, use_v2transport);
     pnode->AddRef();
 
     // We're making a new connection, harvest entropy from the time (and our peer count)
@@ -566,7 +604,7 @@ Network CNode::ConnectedThroughNetwork() const
 
 #undef X
 #define X(name) stats.name = name
-void CNode::copyStats(CNodeStats &stats, const std::vector<bool> &m_asmap)
+void CNode::copyStats(CNodeStats &stats, const CompiledASMap &m_asmap)
 {
     stats.nodeid = this->GetId();
     X(nServices);
@@ -620,6 +658,8 @@ void CNode::copyStats(CNodeStats &stats, const std::vector<bool> &m_asmap)
     stats.addrLocal = addrLocalUnlocked.IsValid() ? addrLocalUnlocked.ToString() : "";
 
     X(m_conn_type);
+    stats.m_transport_type = m_serializer->GetTransportType();
+    stats.m_session_id = m_serializer->GetSessionId();
 }
 #undef X
 
@@ -646,6 +686,7 @@ bool CNode::ReceiveMsgBytes(Span<const uint8_t> msg_bytes, bool& complete)
                 // Message deserialization failed.  Drop the message but don't disconnect the peer.
                 // store the size of the corrupt message
                 mapRecvBytesPerMsgCmd.find(NET_MESSAGE_COMMAND_OTHER)->second += out_err_raw_size;
+                RecvBytesMetric().Get(NET_MESSAGE_COMMAND_OTHER).Inc(out_err_raw_size);
                 continue;
             }
 
@@ -656,6 +697,7 @@ bool CNode::ReceiveMsgBytes(Span<const uint8_t> msg_bytes, bool& complete)
                 i = mapRecvBytesPerMsgCmd.find(NET_MESSAGE_COMMAND_OTHER);
             assert(i != mapRecvBytesPerMsgCmd.end());
             i->second += result->m_raw_message_size;
+            RecvBytesMetric().Get(i->first).Inc(result->m_raw_message_size);
 
             // push the message to the process queue,
             vRecvMsg.push_back(std::move(*result));
@@ -664,9 +706,25 @@ bool CNode::ReceiveMsgBytes(Span<const uint8_t> msg_bytes, bool& complete)
         }
     }
 
+    if (m_serializer->HasTransportBytes()) {
+        // The transport has something to send, like the rest of a key exchange
+        std::vector<unsigned char> transport_bytes;
+        LOCK(cs_vSend);
+        m_serializer->GetTransportBytes(transport_bytes);
+        if (!transport_bytes.empty()) {
+            nSendSize += transport_bytes.size();
+            vSendMsg.emplace_back(std::move(transport_bytes));
+        }
+    }
+
     return true;
 }
 
+CNetMessage::~CNetMessage()
+{
+    g_recv_buffer_pool.Release(std::move(m_recv));
+}
+
 int V1TransportDeserializer::readHeader(Span<const uint8_t> msg_bytes)
 {
     // copy data to temporary parsing buffer
@@ -704,6 +762,11 @@ int V1TransportDeserializer::readHeader(Span<const uint8_t> msg_bytes)
     // switch state to reading message data
     in_data = true;
 
+    // take a buffer for the whole payload from the pool, if one is available
+    if (vRecv.capacity() < hdr.nMessageSize) {
+        m_recv_reused = g_recv_buffer_pool.Acquire(hdr.nMessageSize, vRecv);
+    }
+
     return nCopy;
 }
 
@@ -712,9 +775,8 @@ int V1TransportDeserializer::readData(Span<const uint8_t> msg_bytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min<unsigned int>(nRemaining, msg_bytes.size());
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+    if (RecvBufferPool::Grow(vRecv, nDataPos + nCopy, hdr.nMessageSize)) {
+        ++m_recv_allocations;
     }
 
     hasher.Write(msg_bytes.first(nCopy));
@@ -762,6 +824,8 @@ std::optional<CNetMessage> V1TransportDeserializer::GetMessage(const std::chrono
                  SanitizeString(hdr.GetCommand()), msg->m_message_size, m_node_id);
         out_err_raw_size = msg->m_raw_message_size;
         msg.reset();
+    } else {
+        g_recv_buffer_pool.RecordMessage(msg->m_command, m_recv_reused, m_recv_allocations);
     }
 
     // Always reset the network deserializer (prepare for the next message)
@@ -770,11 +834,11 @@ std::optional<CNetMessage> V1TransportDeserializer::GetMessage(const std::chrono
 }
 
 void V1TransportSerializer::prepareForTransport(CSerializedNetMsg& msg, std::vector<unsigned char>& header) {
-    // create dbl-sha256 checksum
-    uint256 hash = Hash(msg.data);
+    // create dbl-sha256 checksum; shared payloads carry theirs
+    uint256 hash = msg.m_shared_data ? msg.m_shared_data->hash : Hash(msg.data);
 
     // create header
-    CMessageHeader hdr(Params().MessageStart(), msg.m_type.c_str(), msg.data.size());
+    CMessageHeader hdr(Params().MessageStart(), msg.m_type.c_str(), msg.Payload().size());
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
     // serialize header
@@ -782,33 +846,363 @@ void V1TransportSerializer::prepareForTransport(CSerializedNetMsg& msg, std::vec
     CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, header, 0, hdr};
 }
 
+V2TransportSession::V2TransportSession(const CChainParams& chain_params, bool initiator)
+    : m_initiator(initiator),
+      m_salt(std::string("usdg_v2_shared_secret") + std::string((const char*)chain_params.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+{
+    CMessageHeader hdr(chain_params.MessageStart(), NetMsgType::VERSION, 0);
+    m_v1_prefix.assign(hdr.pchMessageStart, hdr.pchMessageStart + CMessageHeader::MESSAGE_START_SIZE);
+    m_v1_prefix.insert(m_v1_prefix.end(), hdr.pchCommand, hdr.pchCommand + CMessageHeader::COMMAND_SIZE);
+
+    m_key.MakeNewKey(/* fCompressed */ true);
+    if (m_initiator) {
+        const CPubKey pubkey = m_key.GetPubKey();
+        LOCK(m_mutex);
+        m_send_bytes.assign(pubkey.begin(), pubkey.end());
+        m_has_send_bytes = true;
+    }
+}
+
+V2TransportSession::State V2TransportSession::GetState() const
+{
+    LOCK(m_mutex);
+    return m_state;
+}
+
+uint256 V2TransportSession::GetSessionId() const
+{
+    LOCK(m_mutex);
+    return m_session_id;
+}
+
+bool V2TransportSession::SetTheirKey(Span<const uint8_t> key, std::unique_ptr<ChaCha20Poly1305AEAD>& recv_aead)
+{
+    const CPubKey their_pubkey{key.begin(), key.end()};
+    uint256 ecdh_secret;
+    if (!their_pubkey.IsFullyValid() || !their_pubkey.IsCompressed() || !m_key.ComputeECDHSecret(their_pubkey, ecdh_secret)) {
+        return false;
+    }
+
+    // Bind the keys to both public keys, in initiator-responder order
+    const CPubKey our_pubkey = m_key.GetPubKey();
+    std::vector<unsigned char, secure_allocator<unsigned char>> ikm(ecdh_secret.begin(), ecdh_secret.end());
+    ikm.insert(ikm.end(), m_initiator ? our_pubkey.begin() : their_pubkey.begin(), m_initiator ? our_pubkey.end() : their_pubkey.end());
+    ikm.insert(ikm.end(), m_initiator ? their_pubkey.begin() : our_pubkey.begin(), m_initiator ? their_pubkey.end() : our_pubkey.end());
+    memory_cleanse(ecdh_secret.begin(), ecdh_secret.size());
+
+    CHKDF_HMAC_SHA256_L32 hkdf(ikm.data(), ikm.size(), m_salt);
+    unsigned char k1_a[CHACHA20_POLY1305_AEAD_KEY_LEN], k2_a[CHACHA20_POLY1305_AEAD_KEY_LEN];
+    unsigned char k1_b[CHACHA20_POLY1305_AEAD_KEY_LEN], k2_b[CHACHA20_POLY1305_AEAD_KEY_LEN];
+    hkdf.Expand32("initiator_K1", k1_a);
+    hkdf.Expand32("initiator_K2", k2_a);
+    hkdf.Expand32("responder_K1", k1_b);
+    hkdf.Expand32("responder_K2", k2_b);
+    uint256 session_id;
+    hkdf.Expand32("session_id", session_id.begin());
+
+    // The initiator sends with the A keys, the responder with the B keys
+    recv_aead = m_initiator ? std::make_unique<ChaCha20Poly1305AEAD>(k1_b, sizeof(k1_b), k2_b, sizeof(k2_b)) :
+                              std::make_unique<ChaCha20Poly1305AEAD>(k1_a, sizeof(k1_a), k2_a, sizeof(k2_a));
+    auto send_aead = m_initiator ? std::make_unique<ChaCha20Poly1305AEAD>(k1_a, sizeof(k1_a), k2_a, sizeof(k2_a)) :
+                                   std::make_unique<ChaCha20Poly1305AEAD>(k1_b, sizeof(k1_b), k2_b, sizeof(k2_b));
+    memory_cleanse(k1_a, sizeof(k1_a));
+    memory_cleanse(k2_a, sizeof(k2_a));
+    memory_cleanse(k1_b, sizeof(k1_b));
+    memory_cleanse(k2_b, sizeof(k2_b));
+
+    LOCK(m_mutex);
+    assert(m_state == State::KEY_EXCHANGE);
+    m_send_aead = std::move(send_aead);
+    m_session_id = session_id;
+    m_state = State::READY;
+    if (!m_initiator) {
+        m_send_bytes.insert(m_send_bytes.end(), our_pubkey.begin(), our_pubkey.end());
+    }
+    for (const CSerializedNetMsg& msg : m_pending) {
+        EncryptMessage(msg, m_send_bytes);
+    }
+    m_pending.clear();
+    m_has_send_bytes = !m_send_bytes.empty();
+    return true;
+}
+
+void V2TransportSession::SetV1()
+{
+    LOCK(m_mutex);
+    assert(!m_initiator && m_state == State::KEY_EXCHANGE && m_pending.empty());
+    m_state = State::V1;
+}
+
+void V2TransportSession::EncryptMessage(const CSerializedNetMsg& msg, std::vector<unsigned char>& out)
+{
+    AssertLockHeld(m_mutex);
+
+    const Span<const unsigned char> data = msg.Payload();
+    assert(msg.m_type.size() <= CMessageHeader::COMMAND_SIZE);
+    const uint32_t payload_size = 1 + msg.m_type.size() + data.size();
+    assert(payload_size <= 0xffffff);
+
+    const size_t start = out.size();
+    out.resize(start + LENGTH_SIZE + payload_size + TAG_SIZE);
+    unsigned char* packet = out.data() + start;
+    packet[0] = payload_size;
+    packet[1] = payload_size >> 8;
+    packet[2] = payload_size >> 16;
+    packet[LENGTH_SIZE] = msg.m_type.size();
+    memcpy(packet + LENGTH_SIZE + 1, msg.m_type.data(), msg.m_type.size());
+    if (!data.empty()) memcpy(packet + LENGTH_SIZE + 1 + msg.m_type.size(), data.data(), data.size());
+
+    const bool ret = m_send_aead->Crypt(m_send_seqnr, GetLengthSeqNr(m_send_seqnr), GetLengthPos(m_send_seqnr),
+                                        packet, LENGTH_SIZE + payload_size + TAG_SIZE, packet, LENGTH_SIZE + payload_size, /* is_encrypt */ true);
+    assert(ret);
+    ++m_send_seqnr;
+}
+
+bool V2TransportSession::PrepareForTransport(CSerializedNetMsg& msg, std::vector<unsigned char>& header)
+{
+    LOCK(m_mutex);
+    if (m_state == State::V1) return false;
+
+    // Anything not sent yet goes first
+    header = std::move(m_send_bytes);
+    m_send_bytes.clear();
+    m_has_send_bytes = false;
+
+    if (m_state == State::KEY_EXCHANGE) {
+        CSerializedNetMsg pending;
+        pending.m_type = msg.m_type;
+        pending.data = std::move(msg.data);
+        pending.m_shared_data = std::move(msg.m_shared_data);
+        m_pending.push_back(std::move(pending));
+    } else {
+        EncryptMessage(msg, header);
+    }
+    // The packet is all in header now
+    msg.data.clear();
+    msg.m_shared_data.reset();
+    return true;
+}
+
+void V2TransportSession::GetSendBytes(std::vector<unsigned char>& bytes)
+{
+    LOCK(m_mutex);
+    bytes = std::move(m_send_bytes);
+    m_send_bytes.clear();
+    m_has_send_bytes = false;
+}
+
+int V2TransportDeserializer::Read(Span<const uint8_t>& msg_bytes)
+{
+    int ret{-1};
+    switch (m_session->GetState()) {
+    case V2TransportSession::State::V1:
+        return m_v1.Read(msg_bytes);
+    case V2TransportSession::State::KEY_EXCHANGE:
+        ret = readKey(msg_bytes);
+        break;
+    case V2TransportSession::State::READY:
+        ret = readPacket(msg_bytes);
+        break;
+    }
+    if (ret < 0) {
+        Reset();
+    } else {
+        msg_bytes = msg_bytes.subspan(ret);
+    }
+    return ret;
+}
+
+int V2TransportDeserializer::readKey(Span<const uint8_t> msg_bytes)
+{
+    const std::vector<uint8_t>& v1_prefix = m_session->GetV1Prefix();
+    const bool detect_v1 = !m_session->IsInitiator() && m_their_key.size() < v1_prefix.size();
+
+    // A responder looks at the first bytes on their own, so it can hand them to m_v1 if need be
+    const size_t wanted = (detect_v1 ? v1_prefix.size() : V2TransportSession::KEY_SIZE) - m_their_key.size();
+    const size_t nCopy = std::min(wanted, msg_bytes.size());
+    m_their_key.insert(m_their_key.end(), msg_bytes.begin(), msg_bytes.begin() + nCopy);
+
+    if (detect_v1 && std::equal(m_their_key.begin(), m_their_key.end(), v1_prefix.begin())) {
+        if (m_their_key.size() < v1_prefix.size()) return nCopy;
+        LogPrint(BCLog::NET, "V2 transport: peer=%d speaks v1\n", m_node_id);
+        m_session->SetV1();
+        Span<const uint8_t> prefix{m_their_key};
+        if (m_v1.Read(prefix) < 0 || !prefix.empty()) return -1;
+        return nCopy;
+    }
+
+    if (m_their_key.size() < V2TransportSession::KEY_SIZE) return nCopy;
+    if (!m_session->SetTheirKey(m_their_key, m_aead)) {
+        LogPrint(BCLog::NET, "V2 transport: invalid public key from peer=%d\n", m_node_id);
+        return -1;
+    }
+    LogPrint(BCLog::NET, "V2 transport: key exchange with peer=%d complete\n", m_node_id);
+    return nCopy;
+}
+
+int V2TransportDeserializer::readPacket(Span<const uint8_t> msg_bytes)
+{
+    if (m_packet_size == 0) {
+        // Read and decrypt the length first
+        const uint32_t nCopy = std::min<size_t>(V2TransportSession::LENGTH_SIZE - m_recv_pos, msg_bytes.size());
+        m_recv.resize(V2TransportSession::LENGTH_SIZE);
+        memcpy(&m_recv[m_recv_pos], msg_bytes.data(), nCopy);
+        m_recv_pos += nCopy;
+        if (m_recv_pos < V2TransportSession::LENGTH_SIZE) return nCopy;
+
+        uint32_t payload_size;
+        m_aead->GetLength(&payload_size, V2TransportSession::GetLengthSeqNr(m_seqnr), V2TransportSession::GetLengthPos(m_seqnr), (const uint8_t*)m_recv.data());
+        if (payload_size == 0 || payload_size > V2TransportSession::MAX_PAYLOAD_SIZE) {
+            LogPrint(BCLog::NET, "V2 transport: invalid packet size %u, peer=%d\n", payload_size, m_node_id);
+            return -1;
+        }
+        m_packet_size = V2TransportSession::LENGTH_SIZE + payload_size + V2TransportSession::TAG_SIZE;
+
+        // take a buffer for the whole packet from the pool, if one is available,
+        // keeping the encrypted length, which is authenticated with the rest
+        if (m_recv.capacity() < m_packet_size) {
+            char length[V2TransportSession::LENGTH_SIZE];
+            memcpy(length, m_recv.data(), sizeof(length));
+            m_recv.clear();
+            m_recv_reused = g_recv_buffer_pool.Acquire(m_packet_size, m_recv);
+            m_recv.write(length, sizeof(length));
+        }
+        return nCopy;
+    }
+
+    const uint32_t nCopy = std::min<size_t>(m_packet_size - m_recv_pos, msg_bytes.size());
+    if (RecvBufferPool::Grow(m_recv, m_recv_pos + nCopy, m_packet_size)) {
+        ++m_recv_allocations;
+    }
+    memcpy(&m_recv[m_recv_pos], msg_bytes.data(), nCopy);
+    m_recv_pos += nCopy;
+    if (m_recv_pos < m_packet_size) return nCopy;
+
+    // An invalid MAC means the connection can't be trusted anymore
+    unsigned char* packet = (unsigned char*)m_recv.data();
+    if (!m_aead->Crypt(m_seqnr, V2TransportSession::GetLengthSeqNr(m_seqnr), V2TransportSession::GetLengthPos(m_seqnr),
+                       packet, m_packet_size, packet, m_packet_size, /* is_encrypt */ false)) {
+        LogPrint(BCLog::NET, "V2 transport: invalid MAC, peer=%d\n", m_node_id);
+        return -1;
+    }
+    ++m_seqnr;
+    return nCopy;
+}
+
+std::optional<CNetMessage> V2TransportDeserializer::GetMessage(const std::chrono::microseconds time, uint32_t& out_err_raw_size)
+{
+    if (m_session->GetState() == V2TransportSession::State::V1) return m_v1.GetMessage(time, out_err_raw_size);
+    assert(Complete());
+
+    // Drop the length and the MAC; the payload starts with the message type
+    const uint32_t packet_size = m_packet_size;
+    m_recv.resize(packet_size - V2TransportSession::TAG_SIZE);
+    m_recv.ignore(V2TransportSession::LENGTH_SIZE);
+    const uint8_t type_size = m_recv[0];
+    m_recv.ignore(1);
+    std::string type;
+    if (type_size <= CMessageHeader::COMMAND_SIZE && type_size <= m_recv.size()) {
+        type.assign(m_recv.begin(), m_recv.begin() + type_size);
+        m_recv.ignore(type_size);
+    }
+    if (type.empty() || !std::all_of(type.begin(), type.end(), [](char c) { return c >= ' ' && c <= 0x7E; })) {
+        LogPrint(BCLog::NET, "V2 transport: invalid message type, peer=%d\n", m_node_id);
+        out_err_raw_size = packet_size;
+        Reset();
+        return std::nullopt;
+    }
+
+    std::optional<CNetMessage> msg(std::move(m_recv));
+    msg->m_command = std::move(type);
+    msg->m_time = time;
+    msg->m_message_size = msg->m_recv.size();
+    msg->m_raw_message_size = packet_size;
+    g_recv_buffer_pool.RecordMessage(msg->m_command, m_recv_reused, m_recv_allocations);
+
+    // Always reset the network deserializer (prepare for the next message)
+    Reset();
+    return msg;
+}
+
+void V2TransportSerializer::prepareForTransport(CSerializedNetMsg& msg, std::vector<unsigned char>& header)
+{
+    if (!m_session->PrepareForTransport(msg, header)) {
+        m_v1.prepareForTransport(msg, header);
+    }
+}
+
+std::string V2TransportSerializer::GetTransportType() const
+{
+    return m_session->GetState() == V2TransportSession::State::V1 ? "v1" : "v2";
+}
+
+std::string V2TransportSerializer::GetSessionId() const
+{
+    if (m_session->GetState() != V2TransportSession::State::READY) return "";
+    return m_session->GetSessionId().GetHex();
+}
+
 size_t CConnman::SocketSendData(CNode& node) const
 {
     auto it = node.vSendMsg.begin();
     size_t nSentSize = 0;
 
     while (it != node.vSendMsg.end()) {
-        const auto& data = *it;
-        assert(data.size() > node.nSendOffset);
-        int nBytes = 0;
+        // Gather as many queued buffers as possible into a single send
+#ifdef WIN32
+        const Span<const unsigned char> data{it->Data().subspan(node.nSendOffset)};
+        size_t batch_size = data.size();
+#else
+        std::array<iovec, MAX_SEND_IOV> iov;
+        size_t iov_count = 0;
+        size_t batch_size = 0;
+        for (auto batch_it = it; batch_it != node.vSendMsg.end() && iov_count < iov.size(); ++batch_it) {
+            const Span<const unsigned char> data{batch_it->Data().subspan(batch_it == it ? node.nSendOffset : 0)};
+            assert(!data.empty());
+            iov[iov_count].iov_base = const_cast<unsigned char*>(data.data());
+            iov[iov_count].iov_len = data.size();
+            ++iov_count;
+            batch_size += data.size();
+        }
+#endif
+        ssize_t nBytes = 0;
         {
             LOCK(node.cs_hSocket);
             if (node.hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(node.hSocket, reinterpret_cast<const char*>(data.data()) + node.nSendOffset, data.size() - node.nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+            node.m_sock_send_ready = false;
+#ifdef WIN32
+            nBytes = send(node.hSocket, reinterpret_cast<const char*>(data.data()), data.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+            msghdr header{};
+            header.msg_iov = iov.data();
+            header.msg_iovlen = iov_count;
+            nBytes = sendmsg(node.hSocket, &header, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
         if (nBytes > 0) {
             node.nLastSend = GetTimeSeconds();
             node.nSendBytes += nBytes;
-            node.nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (node.nSendOffset == data.size()) {
+            // Drop the buffers that were sent completely
+            size_t remaining = nBytes;
+            while (remaining > 0) {
+                const size_t buffer_left = it->Data().size() - node.nSendOffset;
+                if (remaining < buffer_left) {
+                    node.nSendOffset += remaining;
+                    break;
+                }
+                remaining -= buffer_left;
                 node.nSendOffset = 0;
-                node.nSendSize -= data.size();
-                node.fPauseSend = node.nSendSize > nSendBufferMaxSize;
+                node.nSendSize -= it->Data().size();
                 it++;
+            }
+            node.fPauseSend = node.nSendSize > nSendBufferMaxSize;
+            if (size_t(nBytes) == batch_size) {
+                // Everything was accepted, so the socket is still writable
+                node.m_sock_send_ready = true;
             } else {
-                // could not send full message; stop sending more
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -1193,7 +1587,9 @@ void CConnman::CreateNodeFromAcceptedSocket(SOCKET hSocket,
     }
 
     const bool inbound_onion = std::find(m_onion_binds.begin(), m_onion_binds.end(), addr_bind) != m_onion_binds.end();
-    CNode* pnode = new CNode(id, nodeServices, hSocket, addr, CalculateKeyedNetGroup(addr), nonce, addr_bind, "", ConnectionType::INBOUND, inbound_onion);
+    // Inbound v2 connections are told apart from v1 ones by their first bytes
+    const bool use_v2transport = nLocalServices & NODE_P2P_V2;
+    CNode* pnode = new CNode(id, nodeServices, hSocket, addr, CalculateKeyedNetGroup(addr), nonce, addr_bind, "", ConnectionType::INBOUND, inbound_onion, use_v2transport);
     pnode->AddRef();
     pnode->m_permissionFlags = permissionFlags;
     pnode->m_prefer_evict = discouraged;
@@ -1201,6 +1597,7 @@ void CConnman::CreateNodeFromAcceptedSocket(SOCKET hSocket,
 
     LogPrint(BCLog::NET, "connection from %s accepted\n", addr.ToString());
 
+    AddSocketEvents(pnode);
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
@@ -1268,6 +1665,19 @@ void CConnman::DisconnectNodes()
                 // remove from vNodes
                 vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
+                // The peer may have stopped supporting v2 since it was advertised to us. Stop
+                // expecting it to, and retry over v1 in the outbound slot the connection held.
+                if (pnode->m_deserializer->ShouldReconnectV1()) {
+                    CAddress addr_v1{pnode->addr, ServiceFlags(pnode->addr.nServices & ~NODE_P2P_V2)};
+                    addrman.SetServices(addr_v1, addr_v1.nServices);
+                    LogPrint(BCLog::NET, "V2 transport: peer=%d closed the connection during the key exchange, retrying over v1\n", pnode->GetId());
+                    LOCK(m_reconnections_mutex);
+                    ReconnectionInfo& reconnection{m_reconnections.emplace_back()};
+                    reconnection.addr_connect = addr_v1;
+                    reconnection.conn_type = pnode->m_conn_type;
+                    pnode->grantOutbound.MoveTo(reconnection.grant);
+                }
+
                 // release outbound grant (if any)
                 pnode->grantOutbound.Release();
 
@@ -1509,10 +1919,144 @@ void CConnman::SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_s
 }
 #endif
 
+#ifdef USE_EPOLL
+void CConnman::SocketEventsEpoll(std::set<SOCKET>& recv_set)
+{
+    // Don't block if a peer was left with unread data by the previous pass;
+    // edge-triggered registrations won't report it again.
+    const int timeout = m_sockets_pending ? 0 : SELECT_TIMEOUT_MILLISECONDS;
+    std::array<struct epoll_event, MAX_SOCKET_EVENTS> events;
+    const int nEvents = epoll_wait(m_epoll_fd, events.data(), events.size(), timeout);
+
+    if (interruptNet) return;
+
+    if (nEvents < 0) {
+        const int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        }
+        return;
+    }
+
+    for (int i = 0; i < nEvents; ++i) {
+        const struct epoll_event& event = events[i];
+        if (event.data.ptr == nullptr) {
+            // Wakeup request; reset the eventfd counter
+            uint64_t count;
+            while (read(m_wakeup_fd, &count, sizeof(count)) > 0) {}
+            continue;
+        }
+        const auto listen_it = std::find_if(vhListenSocket.begin(), vhListenSocket.end(),
+            [&](const ListenSocket& listen_socket) { return &listen_socket == event.data.ptr; });
+        if (listen_it != vhListenSocket.end()) {
+            recv_set.insert(listen_it->socket);
+            continue;
+        }
+        // Nodes are only deleted by this thread, after their socket has been
+        // closed (which removes it from the epoll set), so the pointer is valid.
+        CNode* pnode = static_cast<CNode*>(event.data.ptr);
+        // Hangups and errors are surfaced by the next recv() or send()
+        if (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) pnode->m_sock_recv_ready = true;
+        if (event.events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) pnode->m_sock_send_ready = true;
+    }
+}
+#endif
+
+void CConnman::StartSocketEvents()
+{
+#ifdef USE_EPOLL
+    assert(m_epoll_fd == -1);
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epoll_fd == -1) {
+        LogPrintf("Failed to create epoll instance, using poll() instead: %s\n", NetworkErrorString(WSAGetLastError()));
+        return;
+    }
+    m_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeup_fd == -1) {
+        LogPrintf("Failed to create eventfd, using poll() instead: %s\n", NetworkErrorString(WSAGetLastError()));
+        StopSocketEvents();
+        return;
+    }
+
+    struct epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    bool registered = epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wakeup_fd, &event) == 0;
+    // Listening sockets stay level-triggered; each pass accepts one connection per socket
+    for (ListenSocket& hListenSocket : vhListenSocket) {
+        event.data.ptr = &hListenSocket;
+        registered = registered && epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, hListenSocket.socket, &event) == 0;
+    }
+    if (!registered) {
+        LogPrintf("Failed to register sockets with epoll, using poll() instead: %s\n", NetworkErrorString(WSAGetLastError()));
+        StopSocketEvents();
+        return;
+    }
+    m_sockets_pending = false;
+    LogPrint(BCLog::NET, "Using epoll for socket events\n");
+#endif
+}
+
+void CConnman::StopSocketEvents()
+{
+#ifdef USE_EPOLL
+    if (m_wakeup_fd != -1) {
+        close(m_wakeup_fd);
+        m_wakeup_fd = -1;
+    }
+    if (m_epoll_fd != -1) {
+        close(m_epoll_fd);
+        m_epoll_fd = -1;
+    }
+#endif
+}
+
+void CConnman::AddSocketEvents(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (m_epoll_fd == -1) return;
+
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET) return;
+
+    // The registration lasts until the socket is closed, at which point the
+    // kernel drops it from the epoll set.
+    struct epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("Failed to register socket for peer=%d with epoll: %s\n", pnode->GetId(), NetworkErrorString(WSAGetLastError()));
+        pnode->fDisconnect = true;
+    }
+#endif
+}
+
+void CConnman::WakeSocketHandler()
+{
+#ifdef USE_EPOLL
+    if (m_wakeup_fd == -1) return;
+
+    const uint64_t one = 1;
+    if (write(m_wakeup_fd, &one, sizeof(one)) != sizeof(one)) {
+        // The counter can only overflow if the socket handler stopped
+        // draining it, in which case it is already awake.
+    }
+#endif
+}
+
 void CConnman::SocketHandler()
 {
     std::set<SOCKET> recv_set, send_set, error_set;
+#ifdef USE_EPOLL
+    if (m_epoll_fd != -1) {
+        SocketEventsEpoll(recv_set);
+    } else {
+        SocketEvents(recv_set, send_set, error_set);
+    }
+#else
     SocketEvents(recv_set, send_set, error_set);
+#endif
 
     if (interruptNet) return;
 
@@ -1537,6 +2081,7 @@ void CConnman::SocketHandler()
         for (CNode* pnode : vNodesCopy)
             pnode->AddRef();
     }
+    m_sockets_pending = false;
     for (CNode* pnode : vNodesCopy)
     {
         if (interruptNet)
@@ -1548,7 +2093,13 @@ void CConnman::SocketHandler()
         bool recvSet = false;
         bool sendSet = false;
         bool errorSet = false;
-        {
+        if (m_epoll_fd != -1) {
+            // Same policy as GenerateSelectSet(): drain pending sends before
+            // receiving more, and don't receive while the process queue is full.
+            const bool send_pending = WITH_LOCK(pnode->cs_vSend, return !pnode->vSendMsg.empty());
+            sendSet = send_pending && pnode->m_sock_send_ready;
+            recvSet = !send_pending && !pnode->fPauseRecv && pnode->m_sock_recv_ready;
+        } else {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
@@ -1565,10 +2116,14 @@ void CConnman::SocketHandler()
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
+                pnode->m_sock_recv_ready = false;
                 nBytes = recv(pnode->hSocket, (char*)pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
             }
             if (nBytes > 0)
             {
+                // There may be more; keep reading until recv() would block
+                pnode->m_sock_recv_ready = true;
+                m_sockets_pending |= m_epoll_fd != -1;
                 bool notify = false;
                 if (!pnode->ReceiveMsgBytes(Span<const uint8_t>(pchBuf, nBytes), notify))
                     pnode->CloseSocketDisconnect();
@@ -1587,7 +2142,7 @@ void CConnman::SocketHandler()
                         pnode->nProcessQueueSize += nSizeAdded;
                         pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
                     }
-                    WakeMessageHandler();
+                    WakeMessageHandler(pnode->GetId());
                 }
             }
             else if (nBytes == 0)
@@ -1639,11 +2194,18 @@ void CConnman::ThreadSocketHandler()
 
 void CConnman::WakeMessageHandler()
 {
-    {
-        LOCK(mutexMsgProc);
-        fMsgProcWake = true;
+    for (int i = 0; i < m_num_msghand_threads; ++i) {
+        MessageHandlerThread& msghand = m_msghand_threads[i];
+        WITH_LOCK(msghand.mutex, msghand.wake = true);
+        msghand.cond.notify_one();
     }
-    condMsgProc.notify_one();
+}
+
+void CConnman::WakeMessageHandler(NodeId id)
+{
+    MessageHandlerThread& msghand = m_msghand_threads[MessageHandlerIndex(id)];
+    WITH_LOCK(msghand.mutex, msghand.wake = true);
+    msghand.cond.notify_one();
 }
 
 void CConnman::ThreadDNSAddressSeed()
@@ -1934,7 +2496,7 @@ void CConnman::ThreadOpenConnections(const std::vector<std::string> connect)
                     case ConnectionType::BLOCK_RELAY:
                     case ConnectionType::ADDR_FETCH:
                     case ConnectionType::FEELER:
-                        setConnected.insert(pnode->addr.GetGroup(addrman.m_asmap));
+                        setConnected.insert(pnode->addr.GetGroup(addrman.GetAsmap()));
                 } // no default case, so the compiler can warn about missing cases
             }
         }
@@ -2008,7 +2570,7 @@ void CConnman::ThreadOpenConnections(const std::vector<std::string> connect)
                 m_anchors.pop_back();
                 if (!addr.IsValid() || IsLocal(addr) || !IsReachable(addr) ||
                     !HasAllDesirableServiceFlags(addr.nServices) ||
-                    setConnected.count(addr.GetGroup(addrman.m_asmap))) continue;
+                    setConnected.count(addr.GetGroup(addrman.GetAsmap()))) continue;
                 addrConnect = addr;
                 LogPrint(BCLog::NET, "Trying to make an anchor connection to %s\n", addrConnect.ToString());
                 break;
@@ -2048,7 +2610,7 @@ void CConnman::ThreadOpenConnections(const std::vector<std::string> connect)
             }
 
             // Require outbound connections, other than feelers, to be to distinct network groups
-            if (!fFeeler && setConnected.count(addr.GetGroup(addrman.m_asmap))) {
+            if (!fFeeler && setConnected.count(addr.GetGroup(addrman.GetAsmap()))) {
                 break;
             }
 
@@ -2192,6 +2754,24 @@ void CConnman::ThreadOpenAddedConnections()
         // Retry every 60 seconds if a connection was attempted, otherwise two seconds
         if (!interruptNet.sleep_for(std::chrono::seconds(tried ? 60 : 2)))
             return;
+        PerformReconnections();
+    }
+}
+
+void CConnman::PerformReconnections()
+{
+    while (true) {
+        ReconnectionInfo reconnection;
+        {
+            LOCK(m_reconnections_mutex);
+            if (m_reconnections.empty()) break;
+            ReconnectionInfo& front{m_reconnections.front()};
+            reconnection.addr_connect = front.addr_connect;
+            reconnection.conn_type = front.conn_type;
+            front.grant.MoveTo(reconnection.grant);
+            m_reconnections.pop_front();
+        }
+        OpenNetworkConnection(reconnection.addr_connect, false, &reconnection.grant, nullptr, reconnection.conn_type);
     }
 }
 
@@ -2225,23 +2805,26 @@ void CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
         grantOutbound->MoveTo(pnode->grantOutbound);
 
     m_msgproc->InitializeNode(pnode);
+    AddSocketEvents(pnode);
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(int index)
 {
+    MessageHandlerThread& msghand = m_msghand_threads[index];
     FastRandomContext rng;
     while (!flagInterruptMsgProc)
     {
         std::vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy) {
+            for (CNode* pnode : vNodes) {
+                if (MessageHandlerIndex(pnode->GetId()) != index) continue;
                 pnode->AddRef();
+                vNodesCopy.push_back(pnode);
             }
         }
 
@@ -2252,17 +2835,26 @@ void CConnman::ThreadMessageHandler()
         // consecutive connections in the vNodes list.
         Shuffle(vNodesCopy.begin(), vNodesCopy.end(), rng);
 
+        // Receive messages from all peers before sending to any of them.
+        // Sending takes cs_main, so this way a peer's ping or addr is not
+        // held up behind another thread's peer that holds cs_main.
         for (CNode* pnode : vNodesCopy)
         {
             if (pnode->fDisconnect)
                 continue;
 
-            // Receive messages
             bool fMoreNodeWork = m_msgproc->ProcessMessages(pnode, flagInterruptMsgProc);
             fMoreWork |= (fMoreNodeWork && !pnode->fPauseSend);
             if (flagInterruptMsgProc)
                 return;
-            // Send messages
+        }
+
+        // Send messages
+        for (CNode* pnode : vNodesCopy)
+        {
+            if (pnode->fDisconnect)
+                continue;
+
             {
                 LOCK(pnode->cs_sendProcessing);
                 m_msgproc->SendMessages(pnode);
@@ -2278,11 +2870,11 @@ void CConnman::ThreadMessageHandler()
                 pnode->Release();
         }
 
-        WAIT_LOCK(mutexMsgProc, lock);
+        WAIT_LOCK(msghand.mutex, lock);
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this]() EXCLUSIVE_LOCKS_REQUIRED(mutexMsgProc) { return fMsgProcWake; });
+            msghand.cond.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [&msghand]() EXCLUSIVE_LOCKS_REQUIRED(msghand.mutex) { return msghand.wake; });
         }
-        fMsgProcWake = false;
+        msghand.wake = false;
     }
 }
 
@@ -2454,6 +3046,9 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In, CAddrMan& addrman_in, b
     : addrman(addrman_in), nSeed0(nSeed0In), nSeed1(nSeed1In)
 {
     SetTryNewOutboundPeer(false);
+    // Export the traffic metrics before the first message
+    RecvBytesMetric();
+    SentBytesMetric();
 
     Options connOptions;
     Init(connOptions);
@@ -2576,11 +3171,13 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
     interruptNet.reset();
     flagInterruptMsgProc = false;
 
-    {
-        LOCK(mutexMsgProc);
-        fMsgProcWake = false;
+    for (MessageHandlerThread& msghand : m_msghand_threads) {
+        LOCK(msghand.mutex);
+        msghand.wake = false;
     }
 
+    StartSocketEvents();
+
     // Send and receive from sockets, accept connections
     threadSocketHandler = std::thread(&util::TraceThread, "net", [this] { ThreadSocketHandler(); });
 
@@ -2607,7 +3204,14 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
     }
 
     // Process messages
-    threadMessageHandler = std::thread(&util::TraceThread, "msghand", [this] { ThreadMessageHandler(); });
+    for (int i = 0; i < m_num_msghand_threads; ++i) {
+        MessageHandlerThread& msghand = m_msghand_threads[i];
+        msghand.name = i == 0 ? "msghand" : strprintf("msghand.%d", i);
+        msghand.thread = std::thread(&util::TraceThread, msghand.name.c_str(), [this, i] { ThreadMessageHandler(i); });
+    }
+    if (m_num_msghand_threads > 1) {
+        LogPrintf("Using %d message handler threads\n", m_num_msghand_threads);
+    }
 
     if (connOptions.m_i2p_accept_incoming && m_i2p_sam_session.get() != nullptr) {
         threadI2PAcceptIncoming =
@@ -2637,13 +3241,15 @@ static CNetCleanup instance_of_cnetcleanup;
 
 void CConnman::Interrupt()
 {
-    {
-        LOCK(mutexMsgProc);
-        flagInterruptMsgProc = true;
+    flagInterruptMsgProc = true;
+    for (MessageHandlerThread& msghand : m_msghand_threads) {
+        // Taking the mutex ensures the flag is seen by a thread about to wait
+        WITH_LOCK(msghand.mutex, msghand.wake = true);
+        msghand.cond.notify_all();
     }
-    condMsgProc.notify_all();
 
     interruptNet();
+    WakeSocketHandler();
     InterruptSocks5(true);
 
     if (semOutbound) {
@@ -2664,8 +3270,11 @@ void CConnman::StopThreads()
     if (threadI2PAcceptIncoming.joinable()) {
         threadI2PAcceptIncoming.join();
     }
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    for (MessageHandlerThread& msghand : m_msghand_threads) {
+        if (msghand.thread.joinable()) {
+            msghand.thread.join();
+        }
+    }
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2713,6 +3322,8 @@ void CConnman::StopNodes()
         DeleteNode(pnode);
     }
     vNodesDisconnected.clear();
+    WITH_LOCK(m_reconnections_mutex, m_reconnections.clear());
+    StopSocketEvents();
     vhListenSocket.clear();
     semOutbound.reset();
     semAddnode.reset();
@@ -2750,6 +3361,7 @@ std::vector<CAddress> CConnman::GetAddresses(CNode& requestor, size_t max_addres
         .Write(local_socket_bytes.data(), local_socket_bytes.size())
         .Finalize();
     const auto current_time = GetTime<std::chrono::microseconds>();
+    LOCK(m_addr_response_caches_mutex);
     auto r = m_addr_response_caches.emplace(cache_id, CachedAddrResponse{});
     CachedAddrResponse& cache_entry = r.first->second;
     if (cache_entry.m_cache_entry_expiration < current_time) { // If emplace() added new one it has expiration 0.
@@ -2829,7 +3441,7 @@ void CConnman::GetNodeStats(std::vector<CNodeStats>& vstats) const
     vstats.reserve(vNodes.size());
     for (CNode* pnode : vNodes) {
         vstats.emplace_back();
-        pnode->copyStats(vstats.back(), addrman.m_asmap);
+        pnode->copyStats(vstats.back(), addrman.GetAsmap());
     }
 }
 
@@ -2972,7 +3584,7 @@ ServiceFlags CConnman::GetLocalServices() const
 
 unsigned int CConnman::GetReceiveFloodSize() const { return nReceiveFloodSize; }
 
-CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, SOCKET hSocketIn, const CAddress& addrIn, uint64_t nKeyedNetGroupIn, uint64_t nLocalHostNonceIn, const CAddress& addrBindIn, const std::string& addrNameIn, ConnectionType conn_type_in, bool inbound_onion)
+CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, SOCKET hSocketIn, const CAddress& addrIn, uint64_t nKeyedNetGroupIn, uint64_t nLocalHostNonceIn, const CAddress& addrBindIn, const std::string& addrNameIn, ConnectionType conn_type_in, bool inbound_onion, bool use_v2transport)
     : nTimeConnected(GetTimeSeconds()),
       addr(addrIn),
       addrBind(addrBindIn),
@@ -3000,8 +3612,14 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, SOCKET hSocketIn, const
         LogPrint(BCLog::NET, "Added connection peer=%d\n", id);
     }
 
-    m_deserializer = std::make_unique<V1TransportDeserializer>(V1TransportDeserializer(Params(), GetId(), SER_NETWORK, INIT_PROTO_VERSION));
-    m_serializer = std::make_unique<V1TransportSerializer>(V1TransportSerializer());
+    if (use_v2transport) {
+        auto session = std::make_shared<V2TransportSession>(Params(), /* initiator */ !IsInboundConn());
+        m_deserializer = std::make_unique<V2TransportDeserializer>(session, Params(), GetId(), SER_NETWORK, INIT_PROTO_VERSION);
+        m_serializer = std::make_unique<V2TransportSerializer>(session);
+    } else {
+        m_deserializer = std::make_unique<V1TransportDeserializer>(V1TransportDeserializer(Params(), GetId(), SER_NETWORK, INIT_PROTO_VERSION));
+        m_serializer = std::make_unique<V1TransportSerializer>(V1TransportSerializer());
+    }
 }
 
 CNode::~CNode()
@@ -3016,33 +3634,58 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
 
 void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 {
-    size_t nMessageSize = msg.data.size();
+    size_t nMessageSize = msg.Payload().size();
     LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.m_type), nMessageSize, pnode->GetId());
     if (gArgs.GetBoolArg("-capturemessages", false)) {
-        CaptureMessage(pnode->addr, msg.m_type, msg.data, /* incoming */ false);
+        CaptureMessage(pnode->addr, msg.m_type, msg.Payload(), /* incoming */ false);
     }
 
-    // make sure we use the appropriate network transport format
-    std::vector<unsigned char> serializedHeader;
-    pnode->m_serializer->prepareForTransport(msg, serializedHeader);
-    size_t nTotalSize = nMessageSize + serializedHeader.size();
+    TRACE6(net, outbound_message,
+        pnode->GetId(),
+        pnode->GetAddrName().c_str(),
+        pnode->ConnectionTypeAsString().c_str(),
+        msg.m_type.c_str(),
+        msg.Payload().size(),
+        msg.Payload().data()
+    );
 
     size_t nBytesSent = 0;
+    bool wake_socket_handler = false;
     {
         LOCK(pnode->cs_vSend);
         bool optimisticSend(pnode->vSendMsg.empty());
 
+        // make sure we use the appropriate network transport format. This happens
+        // under cs_vSend, as an encrypting transport must see messages in send order.
+        std::vector<unsigned char> serializedHeader;
+        pnode->m_serializer->prepareForTransport(msg, serializedHeader);
+        // the transport may have moved the payload into the header, or held it back
+        nMessageSize = msg.Payload().size();
+        size_t nTotalSize = nMessageSize + serializedHeader.size();
+
         //log total amount of bytes per message type
         pnode->mapSendBytesPerMsgCmd[msg.m_type] += nTotalSize;
+        SentBytesMetric().Get(msg.m_type).Inc(nTotalSize);
         pnode->nSendSize += nTotalSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize) pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize) pnode->vSendMsg.push_back(std::move(msg.data));
+        if (!serializedHeader.empty()) pnode->vSendMsg.emplace_back(std::move(serializedHeader));
+        if (nMessageSize) {
+            if (msg.m_shared_data) {
+                pnode->vSendMsg.emplace_back(std::move(msg.m_shared_data));
+            } else {
+                pnode->vSendMsg.emplace_back(std::move(msg.data));
+            }
+        }
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend) nBytesSent = SocketSendData(*pnode);
+
+        // Otherwise the socket handler sends it, but unless the socket is
+        // known to be full it may be sleeping rather than waiting for EPOLLOUT
+        wake_socket_handler = !pnode->vSendMsg.empty() && pnode->m_sock_send_ready;
     }
+    if (wake_socket_handler) WakeSocketHandler();
     if (nBytesSent) RecordBytesSent(nBytesSent);
 }
 
@@ -3083,7 +3726,7 @@ CSipHasher CConnman::GetDeterministicRandomizer(uint64_t id) const
 
 uint64_t CConnman::CalculateKeyedNetGroup(const CAddress& ad) const
 {
-    std::vector<unsigned char> vchNetGroup(ad.GetGroup(addrman.m_asmap));
+    std::vector<unsigned char> vchNetGroup(ad.GetGroup(addrman.GetAsmap()));
 
     return GetDeterministicRandomizer(RANDOMIZER_ID_NETGROUP).Write(vchNetGroup.data(), vchNetGroup.size()).Finalize();
 }
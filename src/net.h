@@ -12,9 +12,12 @@
 #include <bloom.h>
 #include <chainparams.h>
 #include <compat.h>
+#include <crypto/chacha_poly_aead.h>
+#include <crypto/poly1305.h>
 #include <crypto/siphash.h>
 #include <hash.h>
 #include <i2p.h>
+#include <key.h>
 #include <net_permissions.h>
 #include <netaddress.h>
 #include <netbase.h>
@@ -28,6 +31,8 @@
 #include <uint256.h>
 #include <util/check.h>
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <condition_variable>
 #include <cstdint>
@@ -79,11 +84,18 @@ static const int64_t DEFAULT_PEER_CONNECT_TIMEOUT = 60;
 /** Number of file descriptors required for message capture **/
 static const int NUM_FDS_MESSAGE_CAPTURE = 1;
 
+/** Default for -v2transport, encrypting connections with peers that support it */
+static const bool DEFAULT_V2_TRANSPORT = false;
+
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const bool DEFAULT_DNSSEED = true;
 static const bool DEFAULT_FIXEDSEEDS = true;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** Default number of message handler threads; each peer is handled by exactly one of them */
+static const int DEFAULT_MSGHAND_THREADS = 4;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHAND_THREADS = 16;
 
 typedef int64_t NodeId;
 
@@ -98,6 +110,16 @@ struct AddedNodeInfo
 class CNodeStats;
 class CClientUIInterface;
 
+/** Serialized message payload that can be queued for sending to many peers without copying */
+struct SharedNetPayload
+{
+    explicit SharedNetPayload(std::vector<unsigned char>&& data_in) : data(std::move(data_in)), hash(Hash(data)) {}
+
+    const std::vector<unsigned char> data;
+    /** Double-SHA256 of data, computed once for the transport checksum of every peer */
+    const uint256 hash;
+};
+
 struct CSerializedNetMsg
 {
     CSerializedNetMsg() = default;
@@ -109,6 +131,37 @@ struct CSerializedNetMsg
 
     std::vector<unsigned char> data;
     std::string m_type;
+    /** If set, the payload, shared with other messages (data is then empty) */
+    std::shared_ptr<const SharedNetPayload> m_shared_data;
+
+    Span<const unsigned char> Payload() const { return m_shared_data ? Span<const unsigned char>{m_shared_data->data} : Span<const unsigned char>{data}; }
+
+    /**
+     * Move the payload into shared storage (if it isn't there already) and
+     * return another message of the same type referencing it. This lets one
+     * serialization be pushed to many peers.
+     */
+    CSerializedNetMsg Share()
+    {
+        if (!m_shared_data) m_shared_data = std::make_shared<const SharedNetPayload>(std::move(data));
+        data.clear();
+        CSerializedNetMsg msg;
+        msg.m_type = m_type;
+        msg.m_shared_data = m_shared_data;
+        return msg;
+    }
+};
+
+/** A buffer in a peer's send queue: either owned, or a payload shared with other peers */
+struct CSendBuffer
+{
+    std::vector<unsigned char> owned;
+    std::shared_ptr<const SharedNetPayload> shared;
+
+    explicit CSendBuffer(std::vector<unsigned char>&& data) : owned(std::move(data)) {}
+    explicit CSendBuffer(std::shared_ptr<const SharedNetPayload> data) : shared(std::move(data)) {}
+
+    Span<const unsigned char> Data() const { return shared ? Span<const unsigned char>{shared->data} : Span<const unsigned char>{owned}; }
 };
 
 /** Different types of connections to a peer. This enum encapsulates the
@@ -273,6 +326,8 @@ public:
     Network m_network;
     uint32_t m_mapped_as;
     ConnectionType m_conn_type;
+    std::string m_transport_type;
+    std::string m_session_id;
 };
 
 
@@ -289,6 +344,10 @@ public:
     std::string m_command;
 
     CNetMessage(CDataStream&& recv_in) : m_recv(std::move(recv_in)) {}
+    CNetMessage(CNetMessage&&) = default;
+    CNetMessage& operator=(CNetMessage&&) = default;
+    /** Returns the receive buffer to g_recv_buffer_pool */
+    ~CNetMessage();
 
     void SetVersion(int nVersionIn)
     {
@@ -310,6 +369,8 @@ public:
     virtual int Read(Span<const uint8_t>& msg_bytes) = 0;
     // decomposes a message from the context
     virtual std::optional<CNetMessage> GetMessage(std::chrono::microseconds time, uint32_t& out_err) = 0;
+    // whether a connection closed now should be retried over v1, as the peer never answered our key
+    virtual bool ShouldReconnectV1() const { return false; }
     virtual ~TransportDeserializer() {}
 };
 
@@ -326,6 +387,8 @@ private:
     CDataStream vRecv;              // received message data
     unsigned int nHdrPos;
     unsigned int nDataPos;
+    bool m_recv_reused;             // vRecv was taken from g_recv_buffer_pool
+    uint32_t m_recv_allocations;    // number of times vRecv was (re)allocated for this message
 
     const uint256& GetMessageHash() const;
     int readHeader(Span<const uint8_t> msg_bytes);
@@ -338,6 +401,8 @@ private:
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
+        m_recv_reused = false;
+        m_recv_allocations = 0;
         data_hash.SetNull();
         hasher.Reset();
     }
@@ -382,6 +447,13 @@ class TransportSerializer {
 public:
     // prepare message for transport (header construction, error-correction computation, payload encryption, etc.)
     virtual void prepareForTransport(CSerializedNetMsg& msg, std::vector<unsigned char>& header) = 0;
+    // whether the transport has bytes of its own to send, like its part of a key exchange
+    virtual bool HasTransportBytes() const { return false; }
+    // move those bytes out, to be queued after all messages prepared so far
+    virtual void GetTransportBytes(std::vector<unsigned char>& bytes) {}
+    // name of the protocol in use and session id (if encrypted), for getpeerinfo
+    virtual std::string GetTransportType() const { return "v1"; }
+    virtual std::string GetSessionId() const { return ""; }
     virtual ~TransportSerializer() {}
 };
 
@@ -390,6 +462,151 @@ public:
     void prepareForTransport(CSerializedNetMsg& msg, std::vector<unsigned char>& header) override;
 };
 
+/** The key exchange and send cipher of an encrypted (v2) connection, shared by its
+ * serializer and deserializer.
+ *
+ * Either side starts by sending an ephemeral compressed public key; the initiator
+ * right away, the responder once it has received the initiator's. The keys for both
+ * directions are derived from their ECDH secret with HKDF. After that, every message
+ * is sent as a ChaCha20Poly1305AEAD packet: the encrypted 3 byte length of the
+ * payload, the encrypted payload (the message type as a one byte length and
+ * characters, followed by the message data) and a 16 byte MAC.
+ *
+ * Messages pushed before the key exchange completes are held back until it does.
+ * A responder whose peer starts with a v1 version message header falls back to v1.
+ */
+class V2TransportSession
+{
+public:
+    enum class State {
+        KEY_EXCHANGE, //!< waiting for the peer's public key
+        READY,        //!< keys derived, messages are encrypted
+        V1,           //!< the peer speaks v1 (responder only)
+    };
+
+    static constexpr size_t KEY_SIZE = CPubKey::COMPRESSED_SIZE;
+    static constexpr size_t LENGTH_SIZE = CHACHA20_POLY1305_AEAD_AAD_LEN;
+    static constexpr size_t TAG_SIZE = POLY1305_TAGLEN;
+    //! Maximum payload: a message type (1 + COMMAND_SIZE bytes) and MAX_PROTOCOL_MESSAGE_LENGTH bytes of data
+    static constexpr uint32_t MAX_PAYLOAD_SIZE = 1 + CMessageHeader::COMMAND_SIZE + MAX_PROTOCOL_MESSAGE_LENGTH;
+
+    V2TransportSession(const CChainParams& chain_params, bool initiator);
+
+    bool IsInitiator() const { return m_initiator; }
+    State GetState() const;
+    uint256 GetSessionId() const;
+
+    /** The first bytes a v1 peer sends: the header of a version message */
+    const std::vector<uint8_t>& GetV1Prefix() const { return m_v1_prefix; }
+
+    /** Complete the key exchange with the peer's public key, and set up recv_aead to
+     *  decrypt what it sends. Returns false if the key is invalid. */
+    bool SetTheirKey(Span<const uint8_t> key, std::unique_ptr<ChaCha20Poly1305AEAD>& recv_aead);
+
+    /** Fall back to v1 */
+    void SetV1();
+
+    /** Encrypt msg into header, or hold it back until the key exchange completes.
+     *  Returns false (leaving msg untouched) if the session fell back to v1. */
+    bool PrepareForTransport(CSerializedNetMsg& msg, std::vector<unsigned char>& header);
+
+    bool HasSendBytes() const { return m_has_send_bytes; }
+    void GetSendBytes(std::vector<unsigned char>& bytes);
+
+    /** Position of a packet's length in the keystream of the length cipher */
+    static uint64_t GetLengthSeqNr(uint64_t seqnr) { return seqnr / AAD_PACKAGES_PER_ROUND; }
+    static int GetLengthPos(uint64_t seqnr) { return (seqnr % AAD_PACKAGES_PER_ROUND) * LENGTH_SIZE; }
+
+private:
+    const bool m_initiator;
+    const std::string m_salt;
+    std::vector<uint8_t> m_v1_prefix;
+    CKey m_key;
+
+    mutable Mutex m_mutex;
+    State m_state GUARDED_BY(m_mutex){State::KEY_EXCHANGE};
+    uint256 m_session_id GUARDED_BY(m_mutex);
+    std::unique_ptr<ChaCha20Poly1305AEAD> m_send_aead GUARDED_BY(m_mutex);
+    uint64_t m_send_seqnr GUARDED_BY(m_mutex){0};
+    //! messages pushed during the key exchange
+    std::vector<CSerializedNetMsg> m_pending GUARDED_BY(m_mutex);
+    //! bytes to send that no message was prepared for yet, like our public key
+    std::vector<unsigned char> m_send_bytes GUARDED_BY(m_mutex);
+    std::atomic<bool> m_has_send_bytes{false};
+
+    void EncryptMessage(const CSerializedNetMsg& msg, std::vector<unsigned char>& out) EXCLUSIVE_LOCKS_REQUIRED(m_mutex);
+};
+
+class V2TransportDeserializer final : public TransportDeserializer
+{
+private:
+    const std::shared_ptr<V2TransportSession> m_session;
+    const NodeId m_node_id; // Only for logging
+    V1TransportDeserializer m_v1;                 // used once the session fell back to v1
+    std::vector<uint8_t> m_their_key;             // partially received public key
+    std::unique_ptr<ChaCha20Poly1305AEAD> m_aead; // decrypts received packets
+    uint64_t m_seqnr{0};                          // sequence number of the packet being received
+    CDataStream m_recv;                           // packet being received
+    uint32_t m_packet_size{0};                    // size of that packet, 0 while its length is incomplete
+    uint32_t m_recv_pos{0};
+    bool m_recv_reused{false};                    // m_recv was taken from g_recv_buffer_pool
+    uint32_t m_recv_allocations{0};               // number of times m_recv was (re)allocated for this packet
+
+    int readKey(Span<const uint8_t> msg_bytes);
+    int readPacket(Span<const uint8_t> msg_bytes);
+
+    void Reset()
+    {
+        m_recv.clear();
+        m_packet_size = 0;
+        m_recv_pos = 0;
+        m_recv_reused = false;
+        m_recv_allocations = 0;
+    }
+
+public:
+    V2TransportDeserializer(std::shared_ptr<V2TransportSession> session, const CChainParams& chain_params, const NodeId node_id, int nTypeIn, int nVersionIn)
+        : m_session(std::move(session)),
+          m_node_id(node_id),
+          m_v1(chain_params, node_id, nTypeIn, nVersionIn),
+          m_recv(nTypeIn, nVersionIn)
+    {
+        Reset();
+    }
+
+    bool Complete() const override
+    {
+        if (m_session->GetState() == V2TransportSession::State::V1) return m_v1.Complete();
+        return m_packet_size != 0 && m_recv_pos == m_packet_size;
+    }
+    void SetVersion(int nVersionIn) override
+    {
+        m_v1.SetVersion(nVersionIn);
+        m_recv.SetVersion(nVersionIn);
+    }
+    int Read(Span<const uint8_t>& msg_bytes) override;
+    std::optional<CNetMessage> GetMessage(std::chrono::microseconds time, uint32_t& out_err_raw_size) override;
+    bool ShouldReconnectV1() const override
+    {
+        return m_session->IsInitiator() && m_session->GetState() == V2TransportSession::State::KEY_EXCHANGE && m_their_key.empty();
+    }
+};
+
+class V2TransportSerializer : public TransportSerializer {
+private:
+    const std::shared_ptr<V2TransportSession> m_session;
+    V1TransportSerializer m_v1;
+
+public:
+    explicit V2TransportSerializer(std::shared_ptr<V2TransportSession> session) : m_session(std::move(session)) {}
+
+    void prepareForTransport(CSerializedNetMsg& msg, std::vector<unsigned char>& header) override;
+    bool HasTransportBytes() const override { return m_session->HasSendBytes(); }
+    void GetTransportBytes(std::vector<unsigned char>& bytes) override { m_session->GetSendBytes(bytes); }
+    std::string GetTransportType() const override;
+    std::string GetSessionId() const override;
+};
+
 /** Information about a peer */
 class CNode
 {
@@ -408,8 +625,8 @@ public:
     /** Offset inside the first vSendMsg already sent */
     size_t nSendOffset GUARDED_BY(cs_vSend){0};
     uint64_t nSendBytes GUARDED_BY(cs_vSend){0};
-    std::deque<std::vector<unsigned char>> vSendMsg GUARDED_BY(cs_vSend);
-    Mutex cs_vSend;
+    std::deque<CSendBuffer> vSendMsg GUARDED_BY(cs_vSend);
+    Mutex cs_vSend{"CNode::cs_vSend"};
     Mutex cs_hSocket;
     Mutex cs_vRecv;
 
@@ -456,6 +673,13 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv{false};
     std::atomic_bool fPauseSend{false};
+    /**
+     * Socket readiness as reported by the edge-triggered epoll backend. Set
+     * when an event arrives and cleared right before each recv()/send()
+     * attempt, so an edge that races with the attempt is never lost.
+     */
+    std::atomic_bool m_sock_recv_ready{false};
+    std::atomic_bool m_sock_send_ready{false};
 
     bool IsOutboundOrBlockRelayConn() const {
         switch (m_conn_type) {
@@ -577,7 +801,7 @@ public:
      * criterium in CConnman::AttemptToEvictConnection. */
     std::atomic<std::chrono::microseconds> m_min_ping_time{std::chrono::microseconds::max()};
 
-    CNode(NodeId id, ServiceFlags nLocalServicesIn, SOCKET hSocketIn, const CAddress& addrIn, uint64_t nKeyedNetGroupIn, uint64_t nLocalHostNonceIn, const CAddress& addrBindIn, const std::string& addrNameIn, ConnectionType conn_type_in, bool inbound_onion);
+    CNode(NodeId id, ServiceFlags nLocalServicesIn, SOCKET hSocketIn, const CAddress& addrIn, uint64_t nKeyedNetGroupIn, uint64_t nLocalHostNonceIn, const CAddress& addrBindIn, const std::string& addrNameIn, ConnectionType conn_type_in, bool inbound_onion, bool use_v2transport = false);
     ~CNode();
     CNode(const CNode&) = delete;
     CNode& operator=(const CNode&) = delete;
@@ -651,7 +875,7 @@ public:
 
     void CloseSocketDisconnect();
 
-    void copyStats(CNodeStats &stats, const std::vector<bool> &m_asmap);
+    void copyStats(CNodeStats &stats, const CompiledASMap &m_asmap);
 
     ServiceFlags GetLocalServices() const
     {
@@ -776,6 +1000,7 @@ public:
         std::vector<std::string> m_added_nodes;
         std::vector<bool> m_asmap;
         bool m_i2p_accept_incoming;
+        int m_msghand_threads = DEFAULT_MSGHAND_THREADS;
     };
 
     void Init(const Options& connOptions) {
@@ -793,6 +1018,7 @@ public:
         nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
         nReceiveFloodSize = connOptions.nReceiveFloodSize;
         m_peer_connect_timeout = connOptions.m_peer_connect_timeout;
+        m_num_msghand_threads = std::clamp(connOptions.m_msghand_threads, 1, MAX_MSGHAND_THREADS);
         {
             LOCK(cs_totalBytesSent);
             nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
@@ -862,7 +1088,7 @@ public:
      * A non-malicious call (from RPC or a peer with addr permission) should
      * call the function without a parameter to avoid using the cache.
      */
-    std::vector<CAddress> GetAddresses(CNode& requestor, size_t max_addresses, size_t max_pct);
+    std::vector<CAddress> GetAddresses(CNode& requestor, size_t max_addresses, size_t max_pct) LOCKS_EXCLUDED(m_addr_response_caches_mutex);
 
     // This allows temporarily exceeding m_max_outbound_full_relay, with the goal of finding
     // a peer that is better than all our current peers.
@@ -941,7 +1167,10 @@ public:
 
     unsigned int GetReceiveFloodSize() const;
 
+    /** Wake all message handler threads. */
     void WakeMessageHandler();
+    /** Wake the message handler thread that processes messages for this peer. */
+    void WakeMessageHandler(NodeId id);
 
     /** Attempts to obfuscate tx time through exponentially distributed emitting.
         Works assuming that a single interval is used.
@@ -949,7 +1178,7 @@ public:
     */
     std::chrono::microseconds PoissonNextSendInbound(std::chrono::microseconds now, std::chrono::seconds average_interval);
 
-    void SetAsmap(std::vector<bool> asmap) { addrman.m_asmap = std::move(asmap); }
+    void SetAsmap(const std::vector<bool>& asmap) { addrman.SetAsmap(asmap); }
 
     /** Return true if we should disconnect the peer for failing an inactivity check. */
     bool ShouldRunInactivityChecks(const CNode& node, std::optional<int64_t> now=std::nullopt) const;
@@ -977,10 +1206,15 @@ private:
     bool InitBinds(const Options& options);
 
     void ThreadOpenAddedConnections();
+    /** Retry the outbound connections queued in m_reconnections */
+    void PerformReconnections() LOCKS_EXCLUDED(m_reconnections_mutex);
     void AddAddrFetch(const std::string& strDest);
     void ProcessAddrFetch();
     void ThreadOpenConnections(std::vector<std::string> connect);
-    void ThreadMessageHandler();
+    /** Process messages for the peers pinned to message handler thread `index`. */
+    void ThreadMessageHandler(int index);
+    /** Index of the message handler thread that processes messages for this peer. */
+    int MessageHandlerIndex(NodeId id) const { return id % m_num_msghand_threads; }
     void ThreadI2PAcceptIncoming();
     void AcceptConnection(const ListenSocket& hListenSocket);
 
@@ -1003,6 +1237,20 @@ private:
     bool InactivityCheck(const CNode& node) const;
     bool GenerateSelectSet(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
     void SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+#ifdef USE_EPOLL
+    /**
+     * Wait on the epoll instance. Readiness of peer sockets is recorded on
+     * the CNode itself; only ready listening sockets are added to recv_set.
+     */
+    void SocketEventsEpoll(std::set<SOCKET>& recv_set);
+#endif
+    /** Create the epoll instance and register the listening sockets. */
+    void StartSocketEvents();
+    void StopSocketEvents();
+    /** Register a new peer's socket with the epoll instance, if in use. */
+    void AddSocketEvents(CNode* pnode);
+    /** Interrupt a pending wait for socket events. */
+    void WakeSocketHandler();
     void SocketHandler();
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
@@ -1089,6 +1337,20 @@ private:
         std::chrono::microseconds m_cache_entry_expiration{0};
     };
 
+    /** An outbound connection to retry over v1, with the outbound slot it held */
+    struct ReconnectionInfo {
+        CAddress addr_connect;
+        CSemaphoreGrant grant;
+        ConnectionType conn_type;
+    };
+
+    Mutex m_reconnections_mutex;
+    /** v2 connections whose peer closed the connection before sending its key */
+    std::list<ReconnectionInfo> m_reconnections GUARDED_BY(m_reconnections_mutex);
+
+    /** Protects m_addr_response_caches, as peers on different message handler threads may ask at once */
+    Mutex m_addr_response_caches_mutex;
+
     /**
      * Addr responses stored in different caches
      * per (network, local socket) prevent cross-network node identification.
@@ -1103,7 +1365,7 @@ private:
      * resulting in at most ~196 KB. Every separate local socket may
      * add up to ~196 KB extra.
      */
-    std::map<uint64_t, CachedAddrResponse> m_addr_response_caches;
+    std::map<uint64_t, CachedAddrResponse> m_addr_response_caches GUARDED_BY(m_addr_response_caches_mutex);
 
     /**
      * Services this instance offers.
@@ -1148,11 +1410,35 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake GUARDED_BY(mutexMsgProc);
+    /**
+     * A message handler thread. Every peer is pinned to one of them (see
+     * MessageHandlerIndex), so messages from and to a given peer are still
+     * processed in order, while slow messages from one peer do not hold up
+     * peers handled by the other threads.
+     */
+    struct MessageHandlerThread {
+        std::string name;
+        std::thread thread;
+        std::condition_variable cond;
+        Mutex mutex;
+        /** flag for waking the message processor. */
+        bool wake GUARDED_BY(mutex){false};
+    };
+    /** Number of message handler threads, set at startup. */
+    std::atomic<int> m_num_msghand_threads{DEFAULT_MSGHAND_THREADS};
+    /** Preallocated, so WakeMessageHandler() may be called before Start(). */
+    std::array<MessageHandlerThread, MAX_MSGHAND_THREADS> m_msghand_threads;
+
+    /**
+     * epoll instance holding persistent registrations for the listening
+     * and peer sockets, or -1 if SocketHandler falls back to poll()/select().
+     */
+    int m_epoll_fd{-1};
+    /** eventfd used to interrupt epoll_wait(), e.g. when PushMessage queues data. */
+    int m_wakeup_fd{-1};
+    /** Whether a peer socket still had data to read after the last SocketHandler pass. */
+    bool m_sockets_pending{false};
 
-    std::condition_variable condMsgProc;
-    Mutex mutexMsgProc;
     std::atomic<bool> flagInterruptMsgProc{false};
 
     /**
@@ -1165,7 +1451,6 @@ private:
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
     std::thread threadI2PAcceptIncoming;
 
     /** flag for deciding to connect to an extra outbound peer,
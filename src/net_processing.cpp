@@ -33,13 +33,18 @@
 #include <tinyformat.h>
 #include <txmempool.h>
 #include <txorphanage.h>
+#include <txreconciliation.h>
 #include <txrequest.h>
 #include <util/check.h> // For NDEBUG compile time check
+#include <util/metrics.h>
 #include <util/strencodings.h>
 #include <util/system.h>
+#include <util/trace.h>
 #include <validation.h>
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <memory>
 #include <optional>
 #include <typeinfo>
@@ -103,8 +108,18 @@ static constexpr auto OVERLOADED_PEER_TX_DELAY = std::chrono::seconds{2};
 static constexpr std::chrono::microseconds GETDATA_TX_INTERVAL{std::chrono::seconds{60}};
 /** Limit to avoid sending big packets. Not used in processing incoming GETDATA for compatibility */
 static const unsigned int MAX_GETDATA_SZ = 1000;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Number of blocks that can be requested at any given time from a single peer whose download rate is not known yet. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds of the number of blocks in flight from a single peer, once its download rate is known. */
+static constexpr int MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static constexpr int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 64;
+/** How long the blocks in flight from a peer should keep it busy, at its measured download rate. */
+static constexpr std::chrono::duration<double> BLOCK_DOWNLOAD_TARGET_BUFFER{4s};
+/** Weight of each new sample in the per-peer block download rate and response time averages. */
+static constexpr double BLOCK_DOWNLOAD_SAMPLE_WEIGHT = 0.2;
+/** Minimum time the block holding back the download window must have been in flight before it is
+ *  requested from a faster peer instead. */
+static constexpr auto BLOCK_REASSIGN_MIN_TIME = 1s;
 /** Time during which a peer must stall block download progress before being disconnected. */
 static constexpr auto BLOCK_STALLING_TIMEOUT = 2s;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -181,6 +196,8 @@ struct QueuedBlock {
     const CBlockIndex* pindex;
     /** Optional, used for CMPCTBLOCK downloads */
     std::unique_ptr<PartiallyDownloadedBlock> partialBlock;
+    /** When the block was requested */
+    std::chrono::microseconds m_time_requested;
 };
 
 /**
@@ -192,6 +209,10 @@ struct QueuedBlock {
  *
  * Mutexes inside this struct must not be held when locking m_peer_mutex.
  *
+ * Members that are neither atomic nor guarded by a mutex are only accessed
+ * when processing messages from or to this peer, which happens on the one
+ * message handler thread the peer is pinned to.
+ *
  * TODO: move most members from CNodeState to this structure.
  * TODO: move remaining application-layer data members from CNode to this structure.
  */
@@ -232,8 +253,11 @@ struct Peer {
     /** Whether a ping has been requested by the user */
     std::atomic<bool> m_ping_queued{false};
 
+    /** Protects m_addrs_to_send and the contents of m_addr_known, which
+     *  other peers' message handler threads update when relaying addresses. */
+    Mutex m_addr_send_mutex;
     /** A vector of addresses to send to the peer, limited to MAX_ADDR_TO_SEND. */
-    std::vector<CAddress> m_addrs_to_send;
+    std::vector<CAddress> m_addrs_to_send GUARDED_BY(m_addr_send_mutex);
     /** Probabilistic filter of addresses that this peer already knows.
      *  Used to avoid relaying addresses to this peer more than once. */
     const std::unique_ptr<CRollingBloomFilter> m_addr_known;
@@ -268,6 +292,11 @@ struct Peer {
     /** Work queue of items requested by this peer **/
     std::deque<CInv> m_getdata_requests GUARDED_BY(m_getdata_requests_mutex);
 
+    /** Protects m_msg_processing, which RPC threads read */
+    mutable Mutex m_msg_processing_mutex;
+    /** The cost of processing this peer's messages, by message type */
+    MsgProcessingStatsMap m_msg_processing GUARDED_BY(m_msg_processing_mutex);
+
     explicit Peer(NodeId id, bool addr_relay)
         : m_id(id)
         , m_addr_known{addr_relay ? std::make_unique<CRollingBloomFilter>(5000, 0.001) : nullptr}
@@ -289,6 +318,8 @@ public:
     void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
     void BlockChecked(const CBlock& block, const BlockValidationState& state) override;
     void NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) override;
+    void TransactionAddedToMempool(const CTransactionRef& tx, uint64_t mempool_sequence) override;
+    void TransactionRemovedFromMempool(const CTransactionRef& tx, MemPoolRemovalReason reason, uint64_t mempool_sequence) override;
 
     /** Implement NetEventsInterface */
     void InitializeNode(CNode* pnode) override;
@@ -299,6 +330,8 @@ public:
     /** Implement PeerManager */
     void CheckForStaleTipAndEvictPeers() override;
     bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats) const override;
+    CompactBlockStats GetCompactBlockStats() const override;
+    MsgProcessingStatsMap GetMsgProcessingStats() const override;
     bool IgnoresIncomingTxs() override { return m_ignore_incoming_txs; }
     void SendPings() override;
     void RelayTransaction(const uint256& txid, const uint256& wtxid) override;
@@ -407,6 +440,12 @@ private:
     CTxMemPool& m_mempool;
     TxRequestTracker m_txrequest GUARDED_BY(::cs_main);
 
+    /** Transaction reconciliation state, if -txreconciliation is enabled */
+    std::unique_ptr<TxReconciliationTracker> m_txreconciliation;
+
+    /** Announce transactions found by reconciliation, unless the peer already knows them. */
+    void AnnounceReconciledTxs(CNode& peer, const std::vector<uint256>& wtxids);
+
     /** The height of the best chain */
     std::atomic<int> m_best_height{-1};
 
@@ -516,6 +555,20 @@ private:
      */
     void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
+    /**
+     * Announce a new block to the peers that asked for high-bandwidth compact
+     * block relay and know its parent (and nothing newer). Blocks are announced
+     * at most once per height.
+     */
+    void AnnounceCompactBlock(const CBlockIndex& index, const CBlockHeaderAndShortTxIDs& cmpctblock, bool fWitnessEnabled) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+    /** Height of the last block announced by AnnounceCompactBlock */
+    int m_highest_fast_announce GUARDED_BY(cs_main){0};
+    /** Last block announced as soon as its proof of stake was checked, before it was connected */
+    const CBlockIndex* m_fast_relayed_block GUARDED_BY(cs_main){nullptr};
+
+    /** Update a peer's download rate and response time with a block it sent us upon request. */
+    void RecordBlockDownload(NodeId nodeid, const QueuedBlock& queued_block, size_t size) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight GUARDED_BY(cs_main);
 
     /** When our tip was last updated. */
@@ -553,13 +606,22 @@ private:
     TxOrphanage m_orphanage;
 
     void AddToCompactExtraTransactions(const CTransactionRef& tx) EXCLUSIVE_LOCKS_REQUIRED(g_cs_orphans);
+    /** Account for the transactions a compact block was matched with, and the time it took */
+    void RecordCompactBlockMatch(const PartiallyDownloadedBlock& partial_block, std::chrono::microseconds match_time) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
-    /** Orphan/conflicted/etc transactions that are kept for compact block reconstruction.
+    /** Orphan/conflicted/evicted/etc transactions that are kept for compact block reconstruction.
      *  The last -blockreconstructionextratxn/DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN of
-     *  these are kept in a ring buffer */
-    std::vector<std::pair<uint256, CTransactionRef>> vExtraTxnForCompact GUARDED_BY(g_cs_orphans);
-    /** Offset into vExtraTxnForCompact to insert the next tx */
-    size_t vExtraTxnForCompactIt GUARDED_BY(g_cs_orphans) = 0;
+     *  these are kept, up to -blockreconstructionextratxnsize kilobytes */
+    ExtraTxnPool m_extra_txn_for_compact GUARDED_BY(g_cs_orphans);
+
+    CompactBlockStats m_compact_block_stats GUARDED_BY(cs_main);
+
+    mutable Mutex m_msg_processing_mutex;
+    /** The cost of processing messages from all peers, including disconnected ones */
+    MsgProcessingStatsMap m_msg_processing GUARDED_BY(m_msg_processing_mutex);
+
+    /** Account for the time ProcessMessage took for a message from peer. */
+    void RecordMsgProcessing(Peer& peer, const std::string& msg_type, std::chrono::microseconds time, const LockWaitTracker& cs_main_wait);
 
     /** Check whether the last unknown block a peer advertised is not yet known. */
     void ProcessBlockAvailability(NodeId nodeid) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
@@ -749,6 +811,27 @@ struct CNodeState {
     //! When the first entry in vBlocksInFlight started downloading. Don't care when vBlocksInFlight is empty.
     std::chrono::microseconds m_downloading_since{0us};
     int nBlocksInFlight{0};
+    //! When we last received a block we requested from this peer.
+    std::chrono::microseconds m_last_block_received{0us};
+    //! Moving average of the time between blocks received from this peer while downloading, or 0 if unknown.
+    std::chrono::duration<double> m_block_interval{0};
+    //! Moving average of the download rate of blocks from this peer, in bytes per second.
+    double m_block_download_rate{0};
+    //! Moving average of the time between requesting a block from this peer and receiving it.
+    std::chrono::duration<double> m_block_response_time{0};
+
+    /**
+     * Number of blocks that may be in flight from this peer: enough to keep it
+     * busy for BLOCK_DOWNLOAD_TARGET_BUFFER at its measured rate, so fast
+     * peers get more requests and slow ones hold fewer blocks of the window.
+     */
+    int BlocksInFlightLimit() const
+    {
+        if (m_block_interval.count() <= 0) return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+        return std::clamp<int>(std::ceil(BLOCK_DOWNLOAD_TARGET_BUFFER / m_block_interval),
+                               MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    }
+
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload{false};
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -869,18 +952,20 @@ static bool IsAddrCompatible(const Peer& peer, const CAddress& addr)
     return peer.m_wants_addrv2 || addr.IsAddrV1Compatible();
 }
 
-static void AddAddressKnown(Peer& peer, const CAddress& addr)
+static void AddAddressKnown(Peer& peer, const CAddress& addr) LOCKS_EXCLUDED(peer.m_addr_send_mutex)
 {
     assert(peer.m_addr_known);
+    LOCK(peer.m_addr_send_mutex);
     peer.m_addr_known->insert(addr.GetKey());
 }
 
-static void PushAddress(Peer& peer, const CAddress& addr, FastRandomContext& insecure_rand)
+static void PushAddress(Peer& peer, const CAddress& addr, FastRandomContext& insecure_rand) LOCKS_EXCLUDED(peer.m_addr_send_mutex)
 {
     // Known checking here is only to save space from duplicates.
     // Before sending, we'll filter it again for known addresses that were
     // added after addresses were pushed.
     assert(peer.m_addr_known);
+    LOCK(peer.m_addr_send_mutex);
     if (addr.IsValid() && !peer.m_addr_known->contains(addr.GetKey()) && IsAddrCompatible(peer, addr)) {
         if (peer.m_addrs_to_send.size() >= MAX_ADDR_TO_SEND) {
             peer.m_addrs_to_send[insecure_rand.randrange(peer.m_addrs_to_send.size())] = addr;
@@ -952,7 +1037,7 @@ bool PeerManagerImpl::BlockRequested(NodeId nodeid, const CBlockIndex& block, st
     RemoveBlockRequest(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {&block, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&m_mempool, &m_chainman) : nullptr)});
+            {&block, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&m_mempool, &m_chainman) : nullptr), GetTime<std::chrono::microseconds>()});
     state->nBlocksInFlight++;
     if (state->nBlocksInFlight == 1) {
         // We're starting a block download (batch) from this peer.
@@ -966,6 +1051,30 @@ bool PeerManagerImpl::BlockRequested(NodeId nodeid, const CBlockIndex& block, st
     return true;
 }
 
+void PeerManagerImpl::RecordBlockDownload(NodeId nodeid, const QueuedBlock& queued_block, size_t size)
+{
+    CNodeState* state = State(nodeid);
+    assert(state != nullptr);
+
+    const auto now{GetTime<std::chrono::microseconds>()};
+    // Blocks requested together arrive one after another; each one took the
+    // time since the previous one (or since it was requested, if later).
+    const std::chrono::duration<double> interval{std::max(now - std::max(queued_block.m_time_requested, state->m_last_block_received), 1000us)};
+    const std::chrono::duration<double> response_time{now - queued_block.m_time_requested};
+    const double rate{size / interval.count()};
+    state->m_last_block_received = now;
+
+    if (state->m_block_interval.count() <= 0) {
+        state->m_block_interval = interval;
+        state->m_block_download_rate = rate;
+        state->m_block_response_time = response_time;
+    } else {
+        state->m_block_interval += BLOCK_DOWNLOAD_SAMPLE_WEIGHT * (interval - state->m_block_interval);
+        state->m_block_download_rate += BLOCK_DOWNLOAD_SAMPLE_WEIGHT * (rate - state->m_block_download_rate);
+        state->m_block_response_time += BLOCK_DOWNLOAD_SAMPLE_WEIGHT * (response_time - state->m_block_response_time);
+    }
+}
+
 void PeerManagerImpl::MaybeSetPeerAsAnnouncingHeaderAndIDs(NodeId nodeid)
 {
     AssertLockHeld(cs_main);
@@ -1159,7 +1268,25 @@ void PeerManagerImpl::FindNextBlocksToDownload(NodeId nodeid, unsigned int count
                 }
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
-                waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                const auto& [waiting_node, queued_it] = mapBlocksInFlight[pindex->GetBlockHash()];
+                waitingfor = waiting_node;
+                // It holds back the download window. If it is taking much longer
+                // than usual for the peer it was requested from, and this peer is
+                // faster, request it from this peer instead, rather than waiting
+                // for the window to stall.
+                const CNodeState* waiting_state = State(waitingfor);
+                if (waitingfor != nodeid && state->m_block_interval.count() > 0 &&
+                    (waiting_state->m_block_interval.count() <= 0 || state->m_block_interval < waiting_state->m_block_interval)) {
+                    const std::chrono::duration<double> in_flight{GetTime<std::chrono::microseconds>() - queued_it->m_time_requested};
+                    if (in_flight > std::max<std::chrono::duration<double>>(BLOCK_REASSIGN_MIN_TIME, 2 * waiting_state->m_block_response_time)) {
+                        LogPrint(BCLog::NET, "Requesting block %s from peer=%d instead of slow peer=%d\n",
+                                 pindex->GetBlockHash().ToString(), nodeid, waitingfor);
+                        vBlocks.push_back(pindex);
+                        if (vBlocks.size() == count) {
+                            return;
+                        }
+                    }
+                }
             }
         }
     }
@@ -1395,6 +1522,7 @@ void PeerManagerImpl::FinalizeNode(const CNode& node)
         assert(m_txrequest.Size() == 0);
     }
     } // cs_main
+    if (m_txreconciliation) m_txreconciliation->ForgetPeer(nodeid);
     if (node.fSuccessfullyConnected && misbehavior == 0 &&
         !node.IsBlockOnlyConn() && !node.IsInboundConn()) {
         // Only change visible addrman state for full outbound peers.  We don't
@@ -1437,6 +1565,9 @@ bool PeerManagerImpl::GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats) c
             if (queue.pindex)
                 stats.vHeightInFlight.push_back(queue.pindex->nHeight);
         }
+        stats.m_blocks_in_flight_limit = state->BlocksInFlightLimit();
+        stats.m_block_download_rate = state->m_block_download_rate;
+        stats.m_block_response_time = state->m_block_response_time;
     }
 
     PeerRef peer = GetPeerRef(nodeid);
@@ -1456,19 +1587,112 @@ bool PeerManagerImpl::GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats) c
     stats.m_ping_wait = ping_wait;
     stats.m_addr_processed = peer->m_addr_processed.load();
     stats.m_addr_rate_limited = peer->m_addr_rate_limited.load();
+    stats.m_msg_processing = WITH_LOCK(peer->m_msg_processing_mutex, return peer->m_msg_processing);
 
     return true;
 }
 
+void MsgProcessingStats::Add(std::chrono::microseconds time, std::chrono::microseconds cs_main_wait, uint64_t cs_main_contended)
+{
+    ++m_count;
+    m_time += time;
+    m_max_time = std::max(m_max_time, time);
+    m_cs_main_wait += cs_main_wait;
+    m_cs_main_contended += cs_main_contended;
+    const auto bucket = std::upper_bound(TIME_BUCKETS.begin(), TIME_BUCKETS.end(), time);
+    ++m_time_histogram[bucket - TIME_BUCKETS.begin()];
+}
+
+MsgProcessingStats& MsgProcessingStats::operator+=(const MsgProcessingStats& other)
+{
+    m_count += other.m_count;
+    m_time += other.m_time;
+    m_max_time = std::max(m_max_time, other.m_max_time);
+    m_cs_main_wait += other.m_cs_main_wait;
+    m_cs_main_contended += other.m_cs_main_contended;
+    for (size_t i = 0; i < m_time_histogram.size(); ++i) {
+        m_time_histogram[i] += other.m_time_histogram[i];
+    }
+    return *this;
+}
+
+static metrics::Histogram& g_metric_ping{metrics::Add<metrics::Histogram>(
+    "usdg_net_ping_seconds", "Round trip time of pings to peers", metrics::Histogram::DurationBuckets())};
+
+// Created on first use, as the list of message types is itself a global
+static metrics::Family<metrics::Histogram>& MsgProcessingMetric()
+{
+    static auto& metric{metrics::Add<metrics::Family<metrics::Histogram>>(
+        "usdg_net_message_processing_seconds", "Time to process a message received from a peer, by message type",
+        "type", getAllNetMessageTypes(), metrics::Histogram::DurationBuckets())};
+    return metric;
+}
+
+void PeerManagerImpl::RecordMsgProcessing(Peer& peer, const std::string& msg_type, std::chrono::microseconds time, const LockWaitTracker& cs_main_wait)
+{
+    const auto cs_main_waited{std::chrono::duration_cast<std::chrono::microseconds>(cs_main_wait.Waited())};
+    std::string type;
+    {
+        LOCK(peer.m_msg_processing_mutex);
+        auto it = peer.m_msg_processing.find(msg_type);
+        if (it == peer.m_msg_processing.end()) {
+            // Unknown message types are accounted together, as for the bytes received
+            const std::vector<std::string>& known_types{getAllNetMessageTypes()};
+            const bool known{std::find(known_types.begin(), known_types.end(), msg_type) != known_types.end()};
+            it = peer.m_msg_processing.try_emplace(known ? msg_type : NET_MESSAGE_COMMAND_OTHER).first;
+        }
+        it->second.Add(time, cs_main_waited, cs_main_wait.Contended());
+        type = it->first;
+    }
+    MsgProcessingMetric().Get(type).ObserveDuration(time);
+    LOCK(m_msg_processing_mutex);
+    m_msg_processing[type].Add(time, cs_main_waited, cs_main_wait.Contended());
+}
+
+MsgProcessingStatsMap PeerManagerImpl::GetMsgProcessingStats() const
+{
+    LOCK(m_msg_processing_mutex);
+    return m_msg_processing;
+}
+
 void PeerManagerImpl::AddToCompactExtraTransactions(const CTransactionRef& tx)
 {
-    size_t max_extra_txn = gArgs.GetArg("-blockreconstructionextratxn", DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN);
-    if (max_extra_txn <= 0)
-        return;
-    if (!vExtraTxnForCompact.size())
-        vExtraTxnForCompact.resize(max_extra_txn);
-    vExtraTxnForCompact[vExtraTxnForCompactIt] = std::make_pair(tx->GetWitnessHash(), tx);
-    vExtraTxnForCompactIt = (vExtraTxnForCompactIt + 1) % max_extra_txn;
+    m_extra_txn_for_compact.Add(tx);
+}
+
+void PeerManagerImpl::RecordCompactBlockMatch(const PartiallyDownloadedBlock& partial_block, std::chrono::microseconds match_time)
+{
+    ++m_compact_block_stats.m_blocks;
+    m_compact_block_stats.m_txn_prefilled += partial_block.PrefilledCount();
+    m_compact_block_stats.m_txn_from_mempool += partial_block.MempoolCount() - partial_block.ExtraCount();
+    m_compact_block_stats.m_txn_from_extra += partial_block.ExtraCount();
+    m_compact_block_stats.m_match_time += match_time;
+}
+
+CompactBlockStats PeerManagerImpl::GetCompactBlockStats() const
+{
+    CompactBlockStats stats = WITH_LOCK(cs_main, return m_compact_block_stats);
+    LOCK(g_cs_orphans);
+    stats.m_extra_txn_count = m_extra_txn_for_compact.Count();
+    stats.m_extra_txn_bytes = m_extra_txn_for_compact.Bytes();
+    return stats;
+}
+
+void PeerManagerImpl::TransactionAddedToMempool(const CTransactionRef& tx, uint64_t mempool_sequence)
+{
+    // Compact blocks find it in the mempool now
+    LOCK(g_cs_orphans);
+    m_extra_txn_for_compact.Remove(tx->GetWitnessHash());
+}
+
+void PeerManagerImpl::TransactionRemovedFromMempool(const CTransactionRef& tx, MemPoolRemovalReason reason, uint64_t mempool_sequence)
+{
+    // Transactions we evicted may still be mined by others (replaced
+    // transactions are added when processing their replacement)
+    if (reason == MemPoolRemovalReason::EXPIRY || reason == MemPoolRemovalReason::SIZELIMIT) {
+        LOCK(g_cs_orphans);
+        AddToCompactExtraTransactions(tx);
+    }
 }
 
 void PeerManagerImpl::Misbehaving(const NodeId pnode, const int howmuch, const std::string& message)
@@ -1597,10 +1821,17 @@ PeerManagerImpl::PeerManagerImpl(const CChainParams& chainparams, CConnman& conn
       m_chainman(chainman),
       m_mempool(pool),
       m_stale_tip_check_time(0),
-      m_ignore_incoming_txs(ignore_incoming_txs)
+      m_ignore_incoming_txs(ignore_incoming_txs),
+      m_extra_txn_for_compact(std::max<int64_t>(0, gArgs.GetArg("-blockreconstructionextratxn", DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN)),
+                              std::max<int64_t>(0, gArgs.GetArg("-blockreconstructionextratxnsize", DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN_SIZE)) * 1000)
 {
     // Initialize global variables that cannot be constructed at startup.
     recentRejects.reset(new CRollingBloomFilter(120000, 0.000001));
+    MsgProcessingMetric();
+
+    if (gArgs.GetBoolArg("-txreconciliation", DEFAULT_TXRECONCILIATION_ENABLE)) {
+        m_txreconciliation = std::make_unique<TxReconciliationTracker>();
+    }
 
     // Blocks don't typically have more than 4000 transactions, so this should
     // be at least six blocks (~1 hr) worth of transactions that we can store,
@@ -1625,16 +1856,31 @@ PeerManagerImpl::PeerManagerImpl(const CChainParams& chainparams, CConnman& conn
     scheduler.scheduleFromNow([&] { ReattemptInitialBroadcast(scheduler); }, delta);
 }
 
+// All of the following cache a recent block, and are protected by cs_most_recent_block
+static RecursiveMutex cs_most_recent_block;
+static std::shared_ptr<const CBlock> most_recent_block GUARDED_BY(cs_most_recent_block);
+static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block GUARDED_BY(cs_most_recent_block);
+static uint256 most_recent_block_hash GUARDED_BY(cs_most_recent_block);
+static bool fWitnessesPresentInMostRecentCompactBlock GUARDED_BY(cs_most_recent_block);
+//! Whether most_recent_block has been connected, so it can be served without checking its validity under cs_main
+static bool most_recent_block_connected GUARDED_BY(cs_most_recent_block){false};
+
 /**
  * Evict orphan txn pool entries based on a newly connected
  * block, remember the recently confirmed transactions, and delete tracked
- * announcements for them. Also save the time of the last tip update.
+ * announcements for them. Also save the time of the last tip update, and
+ * note whether the cached most recent block is now connected.
  */
 void PeerManagerImpl::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex)
 {
     m_orphanage.EraseForBlock(*pblock);
     m_last_tip_update = GetTime();
 
+    {
+        LOCK(cs_most_recent_block);
+        if (pblock->GetHash() == most_recent_block_hash) most_recent_block_connected = true;
+    }
+
     {
         LOCK(m_recent_confirmed_transactions_mutex);
         for (const auto& ptx : pblock->vtx) {
@@ -1663,17 +1909,14 @@ void PeerManagerImpl::BlockDisconnected(const std::shared_ptr<const CBlock> &blo
     // block's worth of transactions in it, but that should be fine, since
     // presumably the most common case of relaying a confirmed transaction
     // should be just after a new block containing it is found.
-    LOCK(m_recent_confirmed_transactions_mutex);
-    m_recent_confirmed_transactions->reset();
+    {
+        LOCK(m_recent_confirmed_transactions_mutex);
+        m_recent_confirmed_transactions->reset();
+    }
+    LOCK(cs_most_recent_block);
+    if (block->GetHash() == most_recent_block_hash) most_recent_block_connected = false;
 }
 
-// All of the following cache a recent block, and are protected by cs_most_recent_block
-static RecursiveMutex cs_most_recent_block;
-static std::shared_ptr<const CBlock> most_recent_block GUARDED_BY(cs_most_recent_block);
-static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block GUARDED_BY(cs_most_recent_block);
-static uint256 most_recent_block_hash GUARDED_BY(cs_most_recent_block);
-static bool fWitnessesPresentInMostRecentCompactBlock GUARDED_BY(cs_most_recent_block);
-
 /**
  * Maintain state about the best-seen block and fast-announce a compact block
  * to compatible peers.
@@ -1681,14 +1924,14 @@ static bool fWitnessesPresentInMostRecentCompactBlock GUARDED_BY(cs_most_recent_
 void PeerManagerImpl::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock)
 {
     std::shared_ptr<CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<CBlockHeaderAndShortTxIDs> (*pblock, true);
-    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
 
     LOCK(cs_main);
 
-    static int nHighestFastAnnounce = 0;
-    if (pindex->nHeight <= nHighestFastAnnounce)
+    // A block whose compact block we relayed early has been announced already,
+    // but it still becomes the most recent block
+    const bool fast_relayed{pindex == m_fast_relayed_block};
+    if (pindex->nHeight <= m_highest_fast_announce && !fast_relayed)
         return;
-    nHighestFastAnnounce = pindex->nHeight;
 
     bool fWitnessEnabled = DeploymentActiveAt(*pindex, m_chainparams.GetConsensus(), Consensus::DEPLOYMENT_SEGWIT);
     uint256 hashBlock(pblock->GetHash());
@@ -1699,12 +1942,26 @@ void PeerManagerImpl::NewPoWValidBlock(const CBlockIndex *pindex, const std::sha
         most_recent_block = pblock;
         most_recent_compact_block = pcmpctblock;
         fWitnessesPresentInMostRecentCompactBlock = fWitnessEnabled;
+        most_recent_block_connected = false;
     }
 
-    m_connman.ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) EXCLUSIVE_LOCKS_REQUIRED(::cs_main) {
+    if (!fast_relayed) AnnounceCompactBlock(*pindex, *pcmpctblock, fWitnessEnabled);
+}
+
+void PeerManagerImpl::AnnounceCompactBlock(const CBlockIndex& index, const CBlockHeaderAndShortTxIDs& cmpctblock, bool fWitnessEnabled)
+{
+    const CBlockIndex* pindex = &index;
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    const uint256 hashBlock(pindex->GetBlockHash());
+    m_highest_fast_announce = std::max(m_highest_fast_announce, pindex->nHeight);
+
+    // Serialize the compact block once per serialization format (which depends
+    // on the peer's version) and push the same payload to every peer
+    std::map<bool, CSerializedNetMsg> ser_cmpctblock;
+
+    m_connman.ForEachNode([this, &cmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock, &ser_cmpctblock](CNode* pnode) EXCLUSIVE_LOCKS_REQUIRED(::cs_main) {
         AssertLockHeld(::cs_main);
 
-        // TODO: Avoid the repeated-serialization here
         if (pnode->GetCommonVersion() < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -1714,10 +1971,15 @@ void PeerManagerImpl::NewPoWValidBlock(const CBlockIndex *pindex, const std::sha
         if (state.fPreferHeaderAndIDs && (!fWitnessEnabled || state.fWantsCmpctWitness) &&
                 !PeerHasHeader(&state, pindex) && PeerHasHeader(&state, pindex->pprev)) {
 
-            LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerManager::NewPoWValidBlock",
+            LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerManager::AnnounceCompactBlock",
                     hashBlock.ToString(), pnode->GetId());
             // Blackcoin ToDo: revert after nodes upgrade to current version
-            m_connman.PushMessage(pnode, msgMaker.MakeForSpecificClient(pnode->GetCommonVersion(), NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            const bool old_version{pnode->GetCommonVersion() <= OLD_VERSION};
+            auto it = ser_cmpctblock.find(old_version);
+            if (it == ser_cmpctblock.end()) {
+                it = ser_cmpctblock.emplace(old_version, msgMaker.MakeForSpecificClient(pnode->GetCommonVersion(), NetMsgType::CMPCTBLOCK, cmpctblock)).first;
+            }
+            m_connman.PushMessage(pnode, it->second.Share());
             state.pindexBestHeaderSent = pindex;
         }
     });
@@ -1858,6 +2120,29 @@ void PeerManagerImpl::_RelayTransaction(const uint256& txid, const uint256& wtxi
     });
 }
 
+void PeerManagerImpl::AnnounceReconciledTxs(CNode& peer, const std::vector<uint256>& wtxids)
+{
+    if (peer.m_tx_relay == nullptr) return;
+    const CNetMsgMaker msgMaker(peer.GetCommonVersion());
+    std::vector<CInv> invs;
+    LOCK(peer.m_tx_relay->cs_tx_inventory);
+    for (const uint256& wtxid : wtxids) {
+        if (peer.m_tx_relay->filterInventoryKnown.contains(wtxid)) continue;
+        const auto txinfo = m_mempool.info(GenTxid{/* is_wtxid=*/true, wtxid});
+        if (!txinfo.tx) continue;
+        invs.emplace_back(MSG_WTX, wtxid);
+        // These were added to m_recently_announced_invs and mapRelay when added
+        // to the reconciliation set, so the peer can request them
+        peer.m_tx_relay->filterInventoryKnown.insert(wtxid);
+        peer.m_tx_relay->filterInventoryKnown.insert(txinfo.tx->GetHash());
+        if (invs.size() == MAX_INV_SZ) {
+            m_connman.PushMessage(&peer, msgMaker.Make(NetMsgType::INV, invs));
+            invs.clear();
+        }
+    }
+    if (!invs.empty()) m_connman.PushMessage(&peer, msgMaker.Make(NetMsgType::INV, invs));
+}
+
 void PeerManagerImpl::RelayAddress(NodeId originator,
                                    const CAddress& addr,
                                    bool fReachable)
@@ -1908,11 +2193,23 @@ void PeerManagerImpl::ProcessGetBlockData(CNode& pfrom, Peer& peer, const CInv&
     std::shared_ptr<const CBlock> a_recent_block;
     std::shared_ptr<const CBlockHeaderAndShortTxIDs> a_recent_compact_block;
     bool fWitnessesPresentInARecentCompactBlock;
+    bool a_recent_block_connected;
     {
         LOCK(cs_most_recent_block);
         a_recent_block = most_recent_block;
         a_recent_compact_block = most_recent_compact_block;
         fWitnessesPresentInARecentCompactBlock = fWitnessesPresentInMostRecentCompactBlock;
+        a_recent_block_connected = most_recent_block_connected;
+    }
+
+    // Serve the new tip, which every peer asks for at about the same time,
+    // without cs_main. Having been connected it is valid, and as the most
+    // recent block it is neither historical nor below the pruning threshold.
+    if (a_recent_block_connected && a_recent_block->GetHash() == inv.hash && (inv.IsMsgBlk() || inv.IsMsgWitnessBlk()) &&
+        WITH_LOCK(peer.m_block_inv_mutex, return inv.hash != peer.m_continuation_block)) {
+        const CNetMsgMaker msgMaker(pfrom.GetCommonVersion());
+        m_connman.PushMessage(&pfrom, msgMaker.Make(inv.IsMsgBlk() ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::BLOCK, *a_recent_block));
+        return;
     }
 
     bool need_activate_chain = false;
@@ -2212,7 +2509,20 @@ void PeerManagerImpl::ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
         return;
     }
 
+    // Check that the headers connect to each other. This needs no lock, so
+    // headers from peers on other message handler threads are checked
+    // concurrently; only their acceptance below is serialized by cs_main.
+    uint256 hashLastBlock;
+    for (const CBlockHeader& header : headers) {
+        if (!hashLastBlock.IsNull() && header.hashPrevBlock != hashLastBlock) {
+            Misbehaving(pfrom.GetId(), 20, "non-continuous headers sequence");
+            return;
+        }
+        hashLastBlock = header.GetHash();
+    }
+
     bool received_new_header = false;
+    bool requested_more_headers = false;
     const CBlockIndex *pindexLast = nullptr;
     {
         LOCK(cs_main);
@@ -2245,20 +2555,24 @@ void PeerManagerImpl::ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
             return;
         }
 
-        uint256 hashLastBlock;
-        for (const CBlockHeader& header : headers) {
-            if (!hashLastBlock.IsNull() && header.hashPrevBlock != hashLastBlock) {
-                Misbehaving(pfrom.GetId(), 20, "non-continuous headers sequence");
-                return;
-            }
-            hashLastBlock = header.GetHash();
-        }
-
         // If we don't have the last header, then they'll have given us
         // something new (if these headers are valid).
         if (!m_chainman.m_blockman.LookupBlockIndex(hashLastBlock)) {
             received_new_header = true;
         }
+
+        if (nCount == MAX_HEADERS_RESULTS && received_new_header && m_chainman.m_blockman.LookupBlockIndex(headers[0].hashPrevBlock)) {
+            // Headers message had its maximum size; the peer may have more headers.
+            // Ask for them before validating these, so that the next batch is
+            // on its way while this one is being accepted. The peer knows the
+            // last header it sent us, so it can continue from there.
+            CBlockLocator locator{m_chainman.ActiveChain().GetLocator(pindexBestHeader)};
+            locator.vHave.insert(locator.vHave.begin(), hashLastBlock);
+            LogPrint(BCLog::NET, "more getheaders (%s) to end to peer=%d (startheight:%d)\n",
+                                 hashLastBlock.ToString(), pfrom.GetId(), peer.m_starting_height);
+            m_connman.PushMessage(&pfrom, msgMaker.Make(NetMsgType::GETHEADERS, locator, uint256()));
+            requested_more_headers = true;
+        }
     }
 
     BlockValidationState state;
@@ -2288,7 +2602,7 @@ void PeerManagerImpl::ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
             nodestate->m_last_block_announcement = GetTime();
         }
 
-        if (nCount == MAX_HEADERS_RESULTS) {
+        if (nCount == MAX_HEADERS_RESULTS && !requested_more_headers) {
             // Headers message had its maximum size; the peer may have more headers.
             // TODO: optimize: if pindexLast is an ancestor of m_chainman.ActiveChain().Tip or pindexBestHeader, continue
             // from there instead.
@@ -2303,7 +2617,7 @@ void PeerManagerImpl::ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
             std::vector<const CBlockIndex*> vToFetch;
             const CBlockIndex *pindexWalk = pindexLast;
             // Calculate all the blocks we'd need to switch to pindexLast, up to a limit.
-            while (pindexWalk && !m_chainman.ActiveChain().Contains(pindexWalk) && vToFetch.size() <= MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+            while (pindexWalk && !m_chainman.ActiveChain().Contains(pindexWalk) && vToFetch.size() <= (size_t)nodestate->BlocksInFlightLimit()) {
                 if (!(pindexWalk->nStatus & BLOCK_HAVE_DATA) &&
                         !IsBlockRequested(pindexWalk->GetBlockHash()) &&
                         (!DeploymentActiveAt(*pindexWalk, m_chainparams.GetConsensus(), Consensus::DEPLOYMENT_SEGWIT) || State(pfrom.GetId())->fHaveWitness)) {
@@ -2324,7 +2638,7 @@ void PeerManagerImpl::ProcessHeadersMessage(CNode& pfrom, const Peer& peer,
                 std::vector<CInv> vGetData;
                 // Download as much as possible, from earliest to latest.
                 for (const CBlockIndex *pindex : reverse_iterate(vToFetch)) {
-                    if (nodestate->nBlocksInFlight >= MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                    if (nodestate->nBlocksInFlight >= nodestate->BlocksInFlightLimit()) {
                         // Can't download any more from this peer
                         break;
                     }
@@ -2750,6 +3064,14 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
             m_connman.PushMessage(&pfrom, msg_maker.Make(NetMsgType::SENDADDRV2));
         }
 
+        // Offer transaction reconciliation (BIP330) to peers that support it
+        // and want transactions from us. It only works with wtxid relay.
+        if (m_txreconciliation && (nServices & NODE_TXRECONCILIATION) && fRelay && pfrom.m_tx_relay != nullptr &&
+            greatest_common_version >= WTXID_RELAY_VERSION) {
+            const uint64_t recon_salt{m_txreconciliation->PreRegisterPeer(pfrom.GetId())};
+            m_connman.PushMessage(&pfrom, msg_maker.Make(NetMsgType::SENDTXRCNCL, TXRECONCILIATION_VERSION, recon_salt));
+        }
+
         m_connman.PushMessage(&pfrom, msg_maker.Make(NetMsgType::VERACK));
 
         pfrom.nServices = nServices;
@@ -2971,6 +3293,32 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
         return;
     }
 
+    // BIP330 defines feature negotiation of transaction reconciliation, which
+    // must happen between VERSION and VERACK.
+    if (msg_type == NetMsgType::SENDTXRCNCL) {
+        if (pfrom.fSuccessfullyConnected) {
+            // Disconnect peers that send a SENDTXRCNCL message after VERACK.
+            LogPrint(BCLog::NET, "sendtxrcncl received after verack from peer=%d; disconnecting\n", pfrom.GetId());
+            pfrom.fDisconnect = true;
+            return;
+        }
+        if (!m_txreconciliation) {
+            LogPrint(BCLog::NET, "ignoring sendtxrcncl from peer=%d, as reconciliation is disabled\n", pfrom.GetId());
+            return;
+        }
+        if (!WITH_LOCK(cs_main, return State(pfrom.GetId())->m_wtxid_relay)) {
+            LogPrint(BCLog::NET, "ignoring sendtxrcncl from peer=%d, which did not send wtxidrelay first\n", pfrom.GetId());
+            return;
+        }
+        uint32_t peer_recon_version;
+        uint64_t remote_salt;
+        vRecv >> peer_recon_version >> remote_salt;
+        if (m_txreconciliation->RegisterPeer(pfrom.GetId(), pfrom.IsInboundConn(), peer_recon_version, remote_salt)) {
+            LogPrint(BCLog::NET, "reconciling transactions with peer=%d\n", pfrom.GetId());
+        }
+        return;
+    }
+
     if (!pfrom.fSuccessfullyConnected) {
         LogPrint(BCLog::NET, "Unsupported message \"%s\" prior to verack from peer=%d\n", SanitizeString(msg_type), pfrom.GetId());
         return;
@@ -3128,6 +3476,7 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
                 LogPrint(BCLog::NET, "got inv: %s  %s peer=%d\n", inv.ToString(), fAlreadyHave ? "have" : "new", pfrom.GetId());
 
                 pfrom.AddKnownTx(inv.hash);
+                if (m_txreconciliation && inv.IsMsgWtx()) m_txreconciliation->TryRemoveFromSet(pfrom.GetId(), inv.hash);
                 if (fBlocksOnly) {
                     LogPrint(BCLog::NET, "transaction (%s) inv sent in violation of protocol, disconnecting peer=%d\n", inv.hash.ToString(), pfrom.GetId());
                     pfrom.fDisconnect = true;
@@ -3148,6 +3497,53 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
         return;
     }
 
+    if (msg_type == NetMsgType::REQRECON || msg_type == NetMsgType::SKETCH || msg_type == NetMsgType::RECONCILDIFF) {
+        if (!m_txreconciliation || !m_txreconciliation->IsPeerRegistered(pfrom.GetId())) {
+            LogPrint(BCLog::NET, "%s received from peer=%d we don't reconcile with; disconnecting\n", msg_type, pfrom.GetId());
+            pfrom.fDisconnect = true;
+            return;
+        }
+
+        // Answers to a round we gave up on are not the peer's fault, as it may just be slow
+        if (msg_type != NetMsgType::REQRECON && m_txreconciliation->HandleLateResponse(pfrom.GetId(), /* is_sketch */ msg_type == NetMsgType::SKETCH)) {
+            LogPrint(BCLog::NET, "%s received from peer=%d after the reconciliation timed out; ignoring\n", msg_type, pfrom.GetId());
+            return;
+        }
+
+        if (msg_type == NetMsgType::REQRECON) {
+            uint16_t peer_set_size, peer_q;
+            vRecv >> peer_set_size >> peer_q;
+            const auto sketch{m_txreconciliation->HandleReconciliationRequest(pfrom.GetId(), peer_set_size, peer_q, GetTime<std::chrono::microseconds>())};
+            if (sketch) {
+                m_connman.PushMessage(&pfrom, msgMaker.Make(NetMsgType::SKETCH, *sketch));
+                return;
+            }
+        } else if (msg_type == NetMsgType::SKETCH) {
+            std::vector<unsigned char> sketch;
+            vRecv >> sketch;
+            const auto difference{m_txreconciliation->HandleSketch(pfrom.GetId(), sketch)};
+            if (difference) {
+                LogPrint(BCLog::NET, "reconciliation with peer=%d %s: announcing %u, asking for %u transactions\n", pfrom.GetId(),
+                         difference->m_success ? "succeeded" : "failed", difference->m_announce_wtxids.size(), difference->m_ask_shortids.size());
+                m_connman.PushMessage(&pfrom, msgMaker.Make(NetMsgType::RECONCILDIFF, uint8_t{difference->m_success}, difference->m_ask_shortids));
+                AnnounceReconciledTxs(pfrom, difference->m_announce_wtxids);
+                return;
+            }
+        } else {
+            uint8_t success;
+            std::vector<uint32_t> ask_shortids;
+            vRecv >> success >> ask_shortids;
+            const auto wtxids{m_txreconciliation->HandleReconciliationDifference(pfrom.GetId(), success, ask_shortids)};
+            if (wtxids) {
+                AnnounceReconciledTxs(pfrom, *wtxids);
+                return;
+            }
+        }
+        LogPrint(BCLog::NET, "unexpected %s received from peer=%d; disconnecting\n", msg_type, pfrom.GetId());
+        pfrom.fDisconnect = true;
+        return;
+    }
+
     if (msg_type == NetMsgType::GETDATA) {
         std::vector<CInv> vInv;
         vRecv >> vInv;
@@ -3657,10 +4053,30 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
             return;
         }
 
+        // When stakers compete for the same slot, propagation speed decides
+        // which block gets orphaned. So relay a proof-of-stake block extending
+        // our tip to high-bandwidth peers as soon as its block signature and
+        // kernel are valid, before reconstructing and connecting it. Its
+        // header has been validated above; as with BIP 152 high-bandwidth
+        // relay, peers don't punish us if the block turns out to be invalid.
+        if (pindex->pprev == m_chainman.ActiveChain().Tip() && pindex->nHeight > m_highest_fast_announce &&
+            !m_chainman.ActiveChainstate().IsInitialBlockDownload()) {
+            if (const CTransactionRef coinstake{cmpctblock.GetCoinStake()}) {
+                BlockValidationState stake_state;
+                if (CheckBlockStake(cmpctblock.header, cmpctblock.vchBlockSig, *coinstake, m_chainman.ActiveChainstate(), stake_state)) {
+                    LogPrint(BCLog::NET, "relaying compact block %s from peer=%d before reconstruction\n", pindex->GetBlockHash().ToString(), pfrom.GetId());
+                    m_fast_relayed_block = pindex;
+                    AnnounceCompactBlock(*pindex, cmpctblock, DeploymentActiveAt(*pindex, m_chainparams.GetConsensus(), Consensus::DEPLOYMENT_SEGWIT));
+                } else {
+                    LogPrint(BCLog::NET, "not relaying compact block %s from peer=%d before reconstruction: %s\n", pindex->GetBlockHash().ToString(), pfrom.GetId(), stake_state.ToString());
+                }
+            }
+        }
+
         // We want to be a bit conservative just to be extra careful about DoS
         // possibilities in compact block processing...
         if (pindex->nHeight <= m_chainman.ActiveChain().Height() + 2) {
-            if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) ||
+            if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < nodestate->BlocksInFlightLimit()) ||
                  (fAlreadyInFlight && blockInFlightIt->second.first == pfrom.GetId())) {
                 std::list<QueuedBlock>::iterator* queuedBlockIt = nullptr;
                 if (!BlockRequested(pfrom.GetId(), *pindex, &queuedBlockIt)) {
@@ -3674,13 +4090,17 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
                 }
 
                 PartiallyDownloadedBlock& partialBlock = *(*queuedBlockIt)->partialBlock;
-                ReadStatus status = partialBlock.InitData(cmpctblock, vExtraTxnForCompact);
+                const auto match_start{std::chrono::steady_clock::now()};
+                ReadStatus status = partialBlock.InitData(cmpctblock, m_extra_txn_for_compact.GetTransactions());
                 if (status == READ_STATUS_INVALID) {
                     RemoveBlockRequest(pindex->GetBlockHash()); // Reset in-flight state in case Misbehaving does not result in a disconnect
                     Misbehaving(pfrom.GetId(), 100, "invalid compact block");
                     return;
-                } else if (status == READ_STATUS_FAILED) {
+                }
+                RecordCompactBlockMatch(partialBlock, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - match_start));
+                if (status == READ_STATUS_FAILED) {
                     // Duplicate txindexes, the block is now in-flight, so just request it
+                    ++m_compact_block_stats.m_failed;
                     std::vector<CInv> vInv(1);
                     vInv[0] = CInv(MSG_BLOCK | GetFetchFlags(pfrom), cmpctblock.header.GetHash());
                     m_connman.PushMessage(&pfrom, msgMaker.Make(NetMsgType::GETDATA, vInv));
@@ -3699,6 +4119,7 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
                     blockTxnMsg << txn;
                     fProcessBLOCKTXN = true;
                 } else {
+                    m_compact_block_stats.m_txn_requested += req.indexes.size();
                     req.blockhash = pindex->GetBlockHash();
                     m_connman.PushMessage(&pfrom, msgMaker.Make(NetMsgType::GETBLOCKTXN, req));
                 }
@@ -3709,14 +4130,17 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
                 // Optimistically try to reconstruct anyway since we might be
                 // able to without any round trips.
                 PartiallyDownloadedBlock tempBlock(&m_mempool, &m_chainman);
-                ReadStatus status = tempBlock.InitData(cmpctblock, vExtraTxnForCompact);
+                const auto match_start{std::chrono::steady_clock::now()};
+                ReadStatus status = tempBlock.InitData(cmpctblock, m_extra_txn_for_compact.GetTransactions());
                 if (status != READ_STATUS_OK) {
                     // TODO: don't ignore failures
                     return;
                 }
+                RecordCompactBlockMatch(tempBlock, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - match_start));
                 std::vector<CTransactionRef> dummy;
                 status = tempBlock.FillBlock(*pblock, dummy);
                 if (status == READ_STATUS_OK) {
+                    ++m_compact_block_stats.m_reconstructed;
                     fBlockReconstructed = true;
                 }
             }
@@ -3808,6 +4232,7 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
                 return;
             } else if (status == READ_STATUS_FAILED) {
                 // Might have collided, fall back to getdata now :(
+                ++m_compact_block_stats.m_failed;
                 std::vector<CInv> invs;
                 invs.push_back(CInv(MSG_BLOCK | GetFetchFlags(pfrom), resp.blockhash));
                 m_connman.PushMessage(&pfrom, msgMaker.Make(NetMsgType::GETDATA, invs));
@@ -3829,6 +4254,7 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
                 // though the block was successfully read, and rely on the
                 // handling in ProcessNewBlock to ensure the block index is
                 // updated, etc.
+                ++(resp.txn.empty() ? m_compact_block_stats.m_reconstructed : m_compact_block_stats.m_reconstructed_after_request);
                 RemoveBlockRequest(resp.blockhash); // it is now an empty pointer
                 fBlockRead = true;
                 // mapBlockSource is used for potentially punishing peers and
@@ -3886,6 +4312,7 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
             return;
         }
 
+        const size_t block_size{vRecv.size()};
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
         vRecv >> *pblock;
 
@@ -3898,6 +4325,10 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
             // Always process the block if we requested it, since we may
             // need it even when it's not a candidate for a new best tip.
             forceProcessing = IsBlockRequested(hash);
+            if (forceProcessing) {
+                const auto& [requested_from, queued_it] = mapBlocksInFlight.at(hash);
+                if (requested_from == pfrom.GetId()) RecordBlockDownload(pfrom.GetId(), *queued_it, block_size);
+            }
             RemoveBlockRequest(hash);
             // mapBlockSource is only used for punishing peers and setting
             // which peers send us compact blocks, so the race between here and
@@ -3927,7 +4358,7 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
         }
         peer->m_getaddr_recvd = true;
 
-        peer->m_addrs_to_send.clear();
+        WITH_LOCK(peer->m_addr_send_mutex, peer->m_addrs_to_send.clear());
         std::vector<CAddress> vAddr;
         if (pfrom.HasPermission(NetPermissionFlags::Addr)) {
             vAddr = m_connman.GetAddresses(MAX_ADDR_TO_SEND, MAX_PCT_ADDR_TO_SEND, /* network */ std::nullopt);
@@ -4008,6 +4439,7 @@ void PeerManagerImpl::ProcessMessage(CNode& pfrom, const std::string& msg_type,
                     if (ping_time.count() >= 0) {
                         // Let connman know about this successful ping-pong
                         pfrom.PongReceived(ping_time);
+                        g_metric_ping.ObserveDuration(ping_time);
                     } else {
                         // This should never happen
                         sProblem = "Timing mishap";
@@ -4214,11 +4646,11 @@ bool PeerManagerImpl::ProcessMessages(CNode* pfrom, std::atomic<bool>& interrupt
         }
     }
 
-    {
+    // Only take cs_main if there is orphan work, so that messages which don't
+    // need it are not held up by other message handler threads holding it
+    if (WITH_LOCK(g_cs_orphans, return !peer->m_orphan_work_set.empty())) {
         LOCK2(cs_main, g_cs_orphans);
-        if (!peer->m_orphan_work_set.empty()) {
-            ProcessOrphanTx(peer->m_orphan_work_set);
-        }
+        ProcessOrphanTx(peer->m_orphan_work_set);
     }
 
     if (pfrom->fDisconnect)
@@ -4255,12 +4687,23 @@ bool PeerManagerImpl::ProcessMessages(CNode* pfrom, std::atomic<bool>& interrupt
         CaptureMessage(pfrom->addr, msg.m_command, MakeUCharSpan(msg.m_recv), /* incoming */ true);
     }
 
+    TRACE6(net, inbound_message,
+        pfrom->GetId(),
+        pfrom->GetAddrName().c_str(),
+        pfrom->ConnectionTypeAsString().c_str(),
+        msg.m_command.c_str(),
+        msg.m_recv.size(),
+        msg.m_recv.data()
+    );
+
     msg.SetVersion(pfrom->GetCommonVersion());
     const std::string& msg_type = msg.m_command;
 
     // Message size
     unsigned int nMessageSize = msg.m_message_size;
 
+    const auto processing_start{std::chrono::steady_clock::now()};
+    LockWaitTracker cs_main_wait{&cs_main};
     try {
         ProcessMessage(*pfrom, msg_type, msg.m_recv, msg.m_time, interruptMsgProc);
         if (interruptMsgProc) return false;
@@ -4273,6 +4716,7 @@ bool PeerManagerImpl::ProcessMessages(CNode* pfrom, std::atomic<bool>& interrupt
     } catch (...) {
         LogPrint(BCLog::NET, "%s(%s, %u bytes): Unknown exception caught\n", __func__, SanitizeString(msg_type), nMessageSize);
     }
+    RecordMsgProcessing(*peer, msg_type, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - processing_start), cs_main_wait);
 
     return fMoreWork;
 }
@@ -4513,7 +4957,7 @@ void PeerManagerImpl::MaybeSendAddr(CNode& node, Peer& peer, std::chrono::micros
         // bandwidth cost that we can incur by doing this (which happens
         // once a day on average).
         if (peer.m_next_local_addr_send != 0us) {
-            peer.m_addr_known->reset();
+            WITH_LOCK(peer.m_addr_send_mutex, peer.m_addr_known->reset());
         }
         if (std::optional<CAddress> local_addr = GetLocalAddrForPeer(&node)) {
             FastRandomContext insecure_rand;
@@ -4527,6 +4971,7 @@ void PeerManagerImpl::MaybeSendAddr(CNode& node, Peer& peer, std::chrono::micros
 
     peer.m_next_addr_send = PoissonNextSend(current_time, AVG_ADDRESS_BROADCAST_INTERVAL);
 
+    LOCK(peer.m_addr_send_mutex);
     if (!Assume(peer.m_addrs_to_send.size() <= MAX_ADDR_TO_SEND)) {
         // Should be impossible since we always check size before adding to
         // m_addrs_to_send. Recover by trimming the vector.
@@ -4535,7 +4980,7 @@ void PeerManagerImpl::MaybeSendAddr(CNode& node, Peer& peer, std::chrono::micros
 
     // Remove addr records that the peer already knows about, and add new
     // addrs to the m_addr_known filter on the same pass.
-    auto addr_already_known = [&peer](const CAddress& addr) {
+    auto addr_already_known = [&peer](const CAddress& addr) EXCLUSIVE_LOCKS_REQUIRED(peer.m_addr_send_mutex) {
         bool ret = peer.m_addr_known->contains(addr.GetKey());
         if (!ret) peer.m_addr_known->insert(addr.GetKey());
         return ret;
@@ -4575,7 +5020,8 @@ void PeerManagerImpl::MaybeSendFeefilter(CNode& pto, std::chrono::microseconds c
     if (pto.HasPermission(NetPermissionFlags::ForceRelay)) return;
 
     CAmount currentFilter = Params().GetConsensus().IsProtocolV3_1(GetAdjustedTime()) ? MIN_TX_FEE : DEFAULT_MIN_RELAY_TX_FEE;
-    static FeeFilterRounder g_filter_rounder{CFeeRate{DEFAULT_MIN_RELAY_TX_FEE}};
+    // Not shared between message handler threads, as rounding draws from a FastRandomContext
+    static thread_local FeeFilterRounder g_filter_rounder{CFeeRate{DEFAULT_MIN_RELAY_TX_FEE}};
 
     if (m_chainman.ActiveChainstate().IsInitialBlockDownload()) {
         // Received tx-inv messages are discarded when the active
@@ -4916,6 +5362,9 @@ bool PeerManagerImpl::SendMessages(CNode* pto)
                     // A heap is used so that not all items need sorting if only a few are being sent.
                     CompareInvMempoolOrder compareInvMempoolOrder(&m_mempool, state.m_wtxid_relay);
                     std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
+                    // Transactions for peers we reconcile with are only announced
+                    // once reconciliation finds that the peer is missing them.
+                    const bool reconcile_txs{m_txreconciliation && state.m_wtxid_relay && m_txreconciliation->IsPeerRegistered(pto->GetId())};
                     // No reason to drain out at many times the network's capacity,
                     // especially since we have many peers and some will draw much shorter delays.
                     unsigned int nRelayedTransactions = 0;
@@ -4947,7 +5396,8 @@ bool PeerManagerImpl::SendMessages(CNode* pto)
                         if (pto->m_tx_relay->pfilter && !pto->m_tx_relay->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
                         // Send
                         State(pto->GetId())->m_recently_announced_invs.insert(hash);
-                        vInv.push_back(inv);
+                        const bool reconciled{reconcile_txs && m_txreconciliation->AddToSet(pto->GetId(), wtxid)};
+                        if (!reconciled) vInv.push_back(inv);
                         nRelayedTransactions++;
                         {
                             // Expire old relay messages
@@ -4971,6 +5421,7 @@ bool PeerManagerImpl::SendMessages(CNode* pto)
                             m_connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
                             vInv.clear();
                         }
+                        if (reconciled) continue;
                         pto->m_tx_relay->filterInventoryKnown.insert(hash);
                         if (hash != txid) {
                             // Insert txid into filterInventoryKnown, even for
@@ -4986,6 +5437,17 @@ bool PeerManagerImpl::SendMessages(CNode* pto)
         if (!vInv.empty())
             m_connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
 
+        if (m_txreconciliation) {
+            const std::vector<uint256> expired{m_txreconciliation->ExpireReconciliation(pto->GetId(), current_time)};
+            if (!expired.empty()) {
+                LogPrint(BCLog::NET, "reconciliation with peer=%d timed out: announcing %u transactions\n", pto->GetId(), expired.size());
+                AnnounceReconciledTxs(*pto, expired);
+            }
+            if (const auto request{m_txreconciliation->MaybeRequestReconciliation(pto->GetId(), current_time)}) {
+                m_connman.PushMessage(pto, msgMaker.Make(NetMsgType::REQRECON, request->first, request->second));
+            }
+        }
+
         // Detect whether we're stalling
         if (state.m_stalling_since.count() && state.m_stalling_since < current_time - BLOCK_STALLING_TIMEOUT) {
             // Stalling only triggers when the block download window cannot move. During normal steady state,
@@ -5050,10 +5512,10 @@ bool PeerManagerImpl::SendMessages(CNode* pto)
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && ((fFetch && !pto->m_limited_node) || !m_chainman.ActiveChainstate().IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        if (!pto->fClient && ((fFetch && !pto->m_limited_node) || !m_chainman.ActiveChainstate().IsInitialBlockDownload()) && state.nBlocksInFlight < state.BlocksInFlightLimit()) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            FindNextBlocksToDownload(pto->GetId(), state.BlocksInFlightLimit() - state.nBlocksInFlight, vToDownload, staller);
             for (const CBlockIndex *pindex : vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(*pto);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
@@ -12,6 +12,11 @@
 #include <net.h>
 #include <validationinterface.h>
 
+#include <array>
+#include <chrono>
+#include <map>
+#include <string>
+
 class CAddrMan;
 class CChainParams;
 class CTxMemPool;
@@ -21,6 +26,8 @@ class ChainstateManager;
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 /** Default number of orphan+recently-replaced txn to keep around for block reconstruction */
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
+/** Default for -blockreconstructionextratxnsize, maximum total size in kilobytes of the txn kept around for block reconstruction */
+static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN_SIZE = 10000;
 static const bool DEFAULT_PEERBLOOMFILTERS = false;
 static const bool DEFAULT_PEERBLOCKFILTERS = false;
 /** Threshold for marking a node to be discouraged, e.g. disconnected and added to the discouragement filter. */
@@ -38,14 +45,62 @@ static const unsigned int DEFAULT_HEADER_SPAM_FILTER_IGNORE_PORT = true;
  download */
 static const unsigned int DEFAULT_HEADER_SPAM_FILTER_DURING_IBD = false;
 
+/** The cost of processing the messages of one type (see getnetmsgstats) */
+struct MsgProcessingStats {
+    /** Upper bounds of the processing time histogram buckets; a last bucket holds the slower messages */
+    static constexpr std::array<std::chrono::microseconds, 8> TIME_BUCKETS{
+        std::chrono::microseconds{16}, std::chrono::microseconds{64}, std::chrono::microseconds{256}, std::chrono::microseconds{1024},
+        std::chrono::microseconds{4096}, std::chrono::microseconds{16384}, std::chrono::microseconds{65536}, std::chrono::microseconds{262144}};
+
+    uint64_t m_count = 0;
+    /** Total and maximum wall clock time spent in ProcessMessage */
+    std::chrono::microseconds m_time{0};
+    std::chrono::microseconds m_max_time{0};
+    /** Part of m_time spent waiting for cs_main, and how often it was held by another thread */
+    std::chrono::microseconds m_cs_main_wait{0};
+    uint64_t m_cs_main_contended = 0;
+    /** Number of messages per processing time bucket */
+    std::array<uint64_t, TIME_BUCKETS.size() + 1> m_time_histogram{};
+
+    void Add(std::chrono::microseconds time, std::chrono::microseconds cs_main_wait, uint64_t cs_main_contended);
+    MsgProcessingStats& operator+=(const MsgProcessingStats& other);
+};
+
+/** Message processing costs by message type */
+using MsgProcessingStatsMap = std::map<std::string, MsgProcessingStats>;
+
 struct CNodeStateStats {
     int nSyncHeight = -1;
     int nCommonHeight = -1;
     int m_starting_height = -1;
     std::chrono::microseconds m_ping_wait;
     std::vector<int> vHeightInFlight;
+    int m_blocks_in_flight_limit = 0;
+    double m_block_download_rate = 0;
+    std::chrono::duration<double> m_block_response_time{0};
     uint64_t m_addr_processed = 0;
     uint64_t m_addr_rate_limited = 0;
+    MsgProcessingStatsMap m_msg_processing;
+};
+
+/** Compact block reconstruction statistics */
+struct CompactBlockStats {
+    /** Compact blocks we tried to reconstruct */
+    uint64_t m_blocks = 0;
+    /** Blocks reconstructed without requesting any transaction */
+    uint64_t m_reconstructed = 0;
+    /** Blocks reconstructed after requesting the missing transactions */
+    uint64_t m_reconstructed_after_request = 0;
+    /** Blocks that had to be downloaded in full because of short ID collisions */
+    uint64_t m_failed = 0;
+    uint64_t m_txn_prefilled = 0;
+    uint64_t m_txn_from_mempool = 0;
+    uint64_t m_txn_from_extra = 0;
+    uint64_t m_txn_requested = 0;
+    /** Total time spent matching short IDs against the mempool and extra txn */
+    std::chrono::microseconds m_match_time{0};
+    size_t m_extra_txn_count = 0;
+    size_t m_extra_txn_bytes = 0;
 };
 
 class PeerManager : public CValidationInterface, public NetEventsInterface
@@ -56,9 +111,17 @@ public:
                                              CTxMemPool& pool, bool ignore_incoming_txs);
     virtual ~PeerManager() { }
 
+    const char* SubscriberName() const override { return "peerman"; }
+
     /** Get statistics from node state */
     virtual bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats) const = 0;
 
+    /** Get compact block reconstruction statistics */
+    virtual CompactBlockStats GetCompactBlockStats() const = 0;
+
+    /** Get the cost of processing messages from all peers since startup, by message type */
+    virtual MsgProcessingStatsMap GetMsgProcessingStats() const = 0;
+
     /** Whether this node ignores txs received over p2p. */
     virtual bool IgnoresIncomingTxs() = 0;
 
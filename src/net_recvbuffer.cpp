@@ -0,0 +1,143 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <net_recvbuffer.h>
+
+#include <net.h>
+#include <protocol.h>
+
+#include <algorithm>
+#include <array>
+#include <tuple>
+
+namespace {
+/** How far ahead of the received data a receive buffer may be allocated */
+constexpr size_t MAX_RECV_AHEAD{256 * 1024};
+
+struct SizeClass {
+    /** Minimum capacity of the buffers in this class */
+    size_t capacity;
+    /** Maximum number of buffers of this class kept in the pool */
+    size_t max_pooled;
+};
+
+/** Size classes, in increasing order. At most ~10 MB stays pooled. */
+constexpr std::array<SizeClass, 6> SIZE_CLASSES{{
+    {4 * 1024, 64},
+    {64 * 1024, 16},
+    {256 * 1024, 4},
+    {1024 * 1024, 2},
+    {2 * 1024 * 1024, 1},
+    {MAX_PROTOCOL_MESSAGE_LENGTH, 1},
+}};
+} // namespace
+
+RecvBufferPool g_recv_buffer_pool;
+
+RecvBufferPool::RecvBufferPool()
+    : m_pooled(SIZE_CLASSES.size())
+{
+}
+
+std::map<std::string, RecvBufferPool::MsgTypeStats>& RecvBufferPool::MsgTypeStatsMap() const
+{
+    // The message type names are globals in other translation units, so they
+    // can't be used from this (global) object's constructor
+    std::call_once(m_msg_type_stats_init, [this] {
+        for (const std::string& msg_type : getAllNetMessageTypes()) {
+            m_msg_type_stats.emplace(std::piecewise_construct, std::forward_as_tuple(msg_type), std::forward_as_tuple());
+        }
+        m_msg_type_stats.emplace(std::piecewise_construct, std::forward_as_tuple(NET_MESSAGE_COMMAND_OTHER), std::forward_as_tuple());
+    });
+    return m_msg_type_stats;
+}
+
+bool RecvBufferPool::Acquire(size_t size, CDataStream& stream)
+{
+    assert(stream.empty());
+    for (size_t i = 0; i < SIZE_CLASSES.size(); ++i) {
+        if (SIZE_CLASSES[i].capacity < size) continue;
+
+        // Buffers in larger classes would fit too, but are left for larger messages
+        LOCK(m_mutex);
+        if (m_pooled[i].empty()) return false;
+        const int type{stream.GetType()};
+        const int version{stream.GetVersion()};
+        stream = std::move(m_pooled[i].back());
+        m_pooled[i].pop_back();
+        m_pooled_bytes -= stream.capacity();
+        stream.SetType(type);
+        stream.SetVersion(version);
+        return true;
+    }
+    return false;
+}
+
+void RecvBufferPool::Release(CDataStream&& stream)
+{
+    stream.clear();
+    const size_t capacity{stream.capacity()};
+    for (size_t i = SIZE_CLASSES.size(); i-- > 0;) {
+        if (SIZE_CLASSES[i].capacity > capacity) continue;
+
+        LOCK(m_mutex);
+        if (m_pooled[i].size() < SIZE_CLASSES[i].max_pooled) {
+            m_pooled[i].push_back(std::move(stream));
+            m_pooled_bytes += capacity;
+        }
+        return;
+    }
+}
+
+size_t RecvBufferPool::RoundUp(size_t size, size_t limit)
+{
+    for (const SizeClass& size_class : SIZE_CLASSES) {
+        if (size_class.capacity >= size) {
+            return size_class.capacity <= limit ? size_class.capacity : size;
+        }
+    }
+    return size;
+}
+
+bool RecvBufferPool::Grow(CDataStream& stream, size_t size, size_t total)
+{
+    if (stream.size() >= size) return false;
+    const size_t ahead{size + MAX_RECV_AHEAD};
+    const size_t limit{std::min(total, ahead)};
+    bool reallocated{false};
+    if (stream.capacity() < limit) {
+        const size_t bound{std::max(2 * stream.capacity(), ahead)};
+        stream.reserve(RoundUp(std::min(total, std::max(2 * stream.capacity(), limit)), bound));
+        reallocated = true;
+    }
+    stream.resize(limit);
+    return reallocated;
+}
+
+void RecvBufferPool::RecordMessage(const std::string& msg_type, bool reused, uint32_t allocations)
+{
+    auto& stats_map = MsgTypeStatsMap();
+    auto it = stats_map.find(msg_type);
+    if (it == stats_map.end()) it = stats_map.find(NET_MESSAGE_COMMAND_OTHER);
+    MsgTypeStats& stats = it->second;
+    ++stats.messages;
+    if (reused) ++stats.reused;
+    stats.allocations += allocations;
+}
+
+size_t RecvBufferPool::GetPooledCount() const
+{
+    LOCK(m_mutex);
+    size_t count{0};
+    for (const auto& pooled : m_pooled) {
+        count += pooled.size();
+    }
+    return count;
+}
+
+size_t RecvBufferPool::GetPooledBytes() const
+{
+    LOCK(m_mutex);
+    return m_pooled_bytes;
+}
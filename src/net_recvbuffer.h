@@ -0,0 +1,95 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NET_RECVBUFFER_H
+#define BITCOIN_NET_RECVBUFFER_H
+
+#include <streams.h>
+#include <sync.h>
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Pool of buffers for receiving P2P message payloads, in a few size classes.
+ *
+ * Once a message header has been read, the transport deserializer takes a
+ * pooled buffer that can hold the whole payload, so the payload is received
+ * without (re)allocating. The buffer is moved into the CNetMessage and returned
+ * here when that message is destroyed after processing. Each size class keeps a
+ * bounded number of buffers; surplus buffers are freed as usual.
+ */
+class RecvBufferPool
+{
+public:
+    /** Receive buffer statistics for one message type */
+    struct MsgTypeStats {
+        /** Number of messages received */
+        std::atomic<uint64_t> messages{0};
+        /** Number of messages received into a buffer taken from the pool */
+        std::atomic<uint64_t> reused{0};
+        /** Number of buffer (re)allocations made while receiving messages */
+        std::atomic<uint64_t> allocations{0};
+    };
+
+    RecvBufferPool();
+
+    /**
+     * Replace stream's (empty) buffer by a pooled one that holds at least
+     * `size` bytes, keeping its serialization type and version.
+     *
+     * @returns whether such a buffer was available
+     */
+    bool Acquire(size_t size, CDataStream& stream);
+
+    /** Return a buffer to the pool, or free it if its size class is full. */
+    void Release(CDataStream&& stream);
+
+    /**
+     * Round an allocation of `size` bytes up to the smallest size class that
+     * holds it, as long as that does not exceed `limit`.
+     */
+    static size_t RoundUp(size_t size, size_t limit);
+
+    /**
+     * Grow stream, which receives a payload of `total` bytes, to hold at least
+     * `size` bytes. The buffer grows geometrically, up to `total`, so a large
+     * payload takes a few reallocations rather than one per chunk received.
+     * It never grows past twice its capacity or 256 KiB ahead of `size`,
+     * whichever is more: a peer announcing a large message has to send it to
+     * make us allocate for it. Within that bound, the capacity is rounded up
+     * to a size class so the buffer can be pooled.
+     *
+     * @returns whether the buffer was reallocated
+     */
+    static bool Grow(CDataStream& stream, size_t size, size_t total);
+
+    /** Account for a received message. */
+    void RecordMessage(const std::string& msg_type, bool reused, uint32_t allocations);
+
+    /** Number of buffers currently held by the pool */
+    size_t GetPooledCount() const;
+    /** Total capacity of the buffers currently held by the pool */
+    size_t GetPooledBytes() const;
+    /** Statistics for every message type */
+    const std::map<std::string, MsgTypeStats>& GetMsgTypeStats() const { return MsgTypeStatsMap(); }
+
+private:
+    mutable Mutex m_mutex;
+    /** Pooled buffers, per size class */
+    std::vector<std::vector<CDataStream>> m_pooled GUARDED_BY(m_mutex);
+    size_t m_pooled_bytes GUARDED_BY(m_mutex){0};
+    /** Keyed by all known message types; the keys don't change once initialized */
+    mutable std::map<std::string, MsgTypeStats> m_msg_type_stats;
+    mutable std::once_flag m_msg_type_stats_init;
+    std::map<std::string, MsgTypeStats>& MsgTypeStatsMap() const;
+};
+
+extern RecvBufferPool g_recv_buffer_pool;
+
+#endif // BITCOIN_NET_RECVBUFFER_H
@@ -722,35 +722,22 @@ Network CNetAddr::GetNetClass() const
     return m_net;
 }
 
-uint32_t CNetAddr::GetMappedAS(const std::vector<bool> &asmap) const {
+uint32_t CNetAddr::GetMappedAS(const CompiledASMap& asmap) const {
     uint32_t net_class = GetNetClass();
-    if (asmap.size() == 0 || (net_class != NET_IPV4 && net_class != NET_IPV6)) {
+    if (asmap.IsEmpty() || (net_class != NET_IPV4 && net_class != NET_IPV6)) {
         return 0; // Indicates not found, safe because AS0 is reserved per RFC7607.
     }
-    std::vector<bool> ip_bits(128);
+    uint8_t ip[ADDR_IPV6_SIZE];
     if (HasLinkedIPv4()) {
         // For lookup, treat as if it was just an IPv4 address (IPV4_IN_IPV6_PREFIX + IPv4 bits)
-        for (int8_t byte_i = 0; byte_i < 12; ++byte_i) {
-            for (uint8_t bit_i = 0; bit_i < 8; ++bit_i) {
-                ip_bits[byte_i * 8 + bit_i] = (IPV4_IN_IPV6_PREFIX[byte_i] >> (7 - bit_i)) & 1;
-            }
-        }
-        uint32_t ipv4 = GetLinkedIPv4();
-        for (int i = 0; i < 32; ++i) {
-            ip_bits[96 + i] = (ipv4 >> (31 - i)) & 1;
-        }
+        std::copy(IPV4_IN_IPV6_PREFIX.begin(), IPV4_IN_IPV6_PREFIX.end(), ip);
+        WriteBE32(ip + IPV4_IN_IPV6_PREFIX.size(), GetLinkedIPv4());
     } else {
         // Use all 128 bits of the IPv6 address otherwise
         assert(IsIPv6());
-        for (int8_t byte_i = 0; byte_i < 16; ++byte_i) {
-            uint8_t cur_byte = m_addr[byte_i];
-            for (uint8_t bit_i = 0; bit_i < 8; ++bit_i) {
-                ip_bits[byte_i * 8 + bit_i] = (cur_byte >> (7 - bit_i)) & 1;
-            }
-        }
+        std::copy(m_addr.begin(), m_addr.end(), ip);
     }
-    uint32_t mapped_as = Interpret(asmap, ip_bits);
-    return mapped_as;
+    return asmap.Lookup(ip);
 }
 
 /**
@@ -763,13 +750,17 @@ uint32_t CNetAddr::GetMappedAS(const std::vector<bool> &asmap) const {
  * @note No two connections will be attempted to addresses with the same network
  *       group.
  */
-std::vector<unsigned char> CNetAddr::GetGroup(const std::vector<bool> &asmap) const
+std::vector<unsigned char> CNetAddr::GetGroup(const CompiledASMap& asmap) const
 {
-    std::vector<unsigned char> vchRet;
-    uint32_t net_class = GetNetClass();
     // If non-empty asmap is supplied and the address is IPv4/IPv6,
     // return ASN to be used for bucketing.
-    uint32_t asn = GetMappedAS(asmap);
+    return GetGroupForAS(GetMappedAS(asmap));
+}
+
+std::vector<unsigned char> CNetAddr::GetGroupForAS(uint32_t asn) const
+{
+    std::vector<unsigned char> vchRet;
+    uint32_t net_class = GetNetClass();
     if (asn != 0) { // Either asmap was empty, or address has non-asmappable net class (e.g. TOR).
         vchRet.push_back(NET_IPV6); // IPv4 and IPv6 with same ASN should be in the same bucket
         for (int i = 0; i < 4; i++) {
@@ -1178,21 +1169,9 @@ std::string CSubNet::ToString() const
 
     switch (network.m_net) {
     case NET_IPV4:
-    case NET_IPV6: {
-        assert(network.m_addr.size() <= sizeof(netmask));
-
-        uint8_t cidr = 0;
-
-        for (size_t i = 0; i < network.m_addr.size(); ++i) {
-            if (netmask[i] == 0x00) {
-                break;
-            }
-            cidr += NetmaskBits(netmask[i]);
-        }
-
-        suffix = strprintf("/%u", cidr);
+    case NET_IPV6:
+        suffix = strprintf("/%u", GetPrefixLength());
         break;
-    }
     case NET_ONION:
     case NET_I2P:
     case NET_CJDNS:
@@ -1205,6 +1184,35 @@ std::string CSubNet::ToString() const
     return network.ToString() + suffix;
 }
 
+uint8_t CSubNet::GetPrefixLength() const
+{
+    switch (network.m_net) {
+    case NET_IPV4:
+    case NET_IPV6:
+        break;
+    case NET_ONION:
+    case NET_I2P:
+    case NET_CJDNS:
+    case NET_INTERNAL:
+    case NET_UNROUTABLE:
+    case NET_MAX:
+        return 0;
+    }
+
+    assert(network.m_addr.size() <= sizeof(netmask));
+
+    uint8_t cidr = 0;
+
+    for (size_t i = 0; i < network.m_addr.size(); ++i) {
+        if (netmask[i] == 0x00) {
+            break;
+        }
+        cidr += NetmaskBits(netmask[i]);
+    }
+
+    return cidr;
+}
+
 bool CSubNet::IsValid() const
 {
     return valid;
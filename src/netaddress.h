@@ -25,6 +25,8 @@
 #include <string>
 #include <vector>
 
+class CompiledASMap;
+
 /**
  * A flag that is ORed into the protocol version to designate that addresses
  * should be serialized in (unserialized from) v2 format (BIP155).
@@ -209,9 +211,11 @@ class CNetAddr
         // The AS on the BGP path to the node we use to diversify
         // peers in AddrMan bucketing based on the AS infrastructure.
         // The ip->AS mapping depends on how asmap is constructed.
-        uint32_t GetMappedAS(const std::vector<bool> &asmap) const;
+        uint32_t GetMappedAS(const CompiledASMap& asmap) const;
 
-        std::vector<unsigned char> GetGroup(const std::vector<bool> &asmap) const;
+        std::vector<unsigned char> GetGroup(const CompiledASMap& asmap) const;
+        //! GetGroup() for an address already known to map to mapped_as (0 if unmapped).
+        std::vector<unsigned char> GetGroupForAS(uint32_t mapped_as) const;
         std::vector<unsigned char> GetAddrBytes() const;
         int GetReachabilityFrom(const CNetAddr *paddrPartner = nullptr) const;
 
@@ -533,6 +537,12 @@ class CSubNet
         std::string ToString() const;
         bool IsValid() const;
 
+        /** The first address of the subnet, or the sole one for non-IPv[46] subnets. */
+        const CNetAddr& GetNetworkAddr() const { return network; }
+
+        /** The number of leading 1-bits of the netmask of an IPv4 or IPv6 subnet (0 otherwise). */
+        uint8_t GetPrefixLength() const;
+
         friend bool operator==(const CSubNet& a, const CSubNet& b);
         friend bool operator!=(const CSubNet& a, const CSubNet& b) { return !(a == b); }
         friend bool operator<(const CSubNet& a, const CSubNet& b);
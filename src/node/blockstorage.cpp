@@ -97,7 +97,7 @@ static bool UndoWriteToDisk(const CBlockUndo& blockundo, FlatFilePos& pos, const
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
 {
-    FlatFilePos pos = pindex->GetUndoPos();
+    const FlatFilePos pos{WITH_LOCK(cs_main, return pindex->GetUndoPos())};
     if (pos.IsNull()) {
         return error("%s: no undo data available", __func__);
     }
@@ -0,0 +1,240 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <pinsketch.h>
+
+#include <crypto/common.h>
+
+#include <algorithm>
+
+namespace {
+/** GF(2^32) is represented as GF(2)[x] / (x^32 + x^7 + x^3 + x^2 + 1). */
+constexpr uint32_t MODULUS{0x8D};
+
+uint32_t Mul(uint32_t a, uint32_t b)
+{
+    uint32_t r{0};
+    while (b) {
+        if (b & 1) r ^= a;
+        b >>= 1;
+        a = (a << 1) ^ (-(a >> 31) & MODULUS);
+    }
+    return r;
+}
+
+uint32_t Inv(uint32_t a)
+{
+    // a^(2^32 - 2) = a^-1
+    uint32_t r{1};
+    for (int i = 0; i < 31; ++i) {
+        a = Mul(a, a);
+        r = Mul(r, a);
+    }
+    return r;
+}
+
+/** Polynomial over GF(2^32), lowest degree coefficient first, without trailing zeros. */
+using Poly = std::vector<uint32_t>;
+
+void Trim(Poly& a)
+{
+    while (!a.empty() && a.back() == 0) a.pop_back();
+}
+
+/** Reduce a modulo mod (which must be non-zero), returning the quotient if requested. */
+void PolyMod(Poly& a, const Poly& mod, Poly* quotient = nullptr)
+{
+    Trim(a);
+    const uint32_t inv_lead{Inv(mod.back())};
+    if (quotient) quotient->assign(a.size() >= mod.size() ? a.size() - mod.size() + 1 : 0, 0);
+    while (a.size() >= mod.size()) {
+        const uint32_t factor{Mul(a.back(), inv_lead)};
+        const size_t shift{a.size() - mod.size()};
+        for (size_t i = 0; i < mod.size(); ++i) {
+            a[shift + i] ^= Mul(factor, mod[i]);
+        }
+        if (quotient) (*quotient)[shift] = factor;
+        Trim(a);
+    }
+}
+
+/** Square a modulo mod; squaring is linear in characteristic 2. */
+Poly SqrMod(const Poly& a, const Poly& mod)
+{
+    Poly r(a.empty() ? 0 : 2 * a.size() - 1);
+    for (size_t i = 0; i < a.size(); ++i) {
+        r[2 * i] = Mul(a[i], a[i]);
+    }
+    PolyMod(r, mod);
+    return r;
+}
+
+void MakeMonic(Poly& a)
+{
+    const uint32_t inv_lead{Inv(a.back())};
+    for (uint32_t& coef : a) coef = Mul(coef, inv_lead);
+}
+
+/** Monic greatest common divisor of a and b (not both zero). */
+Poly Gcd(Poly a, Poly b)
+{
+    Trim(a);
+    Trim(b);
+    while (!b.empty()) {
+        PolyMod(a, b);
+        std::swap(a, b);
+    }
+    MakeMonic(a);
+    return a;
+}
+
+/** Tr(beta * x) = sum((beta * x)^(2^i), i = 0..31) modulo f. */
+Poly Trace(uint32_t beta, const Poly& f)
+{
+    Poly y{0, beta};
+    PolyMod(y, f);
+    Poly t{y};
+    for (int i = 1; i < 32; ++i) {
+        y = SqrMod(y, f);
+        if (t.size() < y.size()) t.resize(y.size());
+        for (size_t j = 0; j < y.size(); ++j) t[j] ^= y[j];
+    }
+    Trim(t);
+    return t;
+}
+
+/**
+ * Find the roots of f, which must be monic and a product of distinct linear
+ * factors (Berlekamp trace algorithm). Tr(beta * x) is 0 for half of the
+ * field elements, so gcd(f, Tr(beta * x)) splits f unless its roots agree on
+ * Tr(beta * root). The trace form is non-degenerate, so some element of the
+ * basis {1, 2, 4, ...} tells apart any two distinct roots.
+ */
+bool FindRoots(const Poly& f, std::vector<uint32_t>& roots)
+{
+    if (f.size() == 2) {
+        roots.push_back(f[0]);
+        return true;
+    }
+    for (int i = 0; i < 32; ++i) {
+        Poly g{Gcd(f, Trace(uint32_t{1} << i, f))};
+        if (g.size() <= 1 || g.size() >= f.size()) continue;
+        Poly rest{f};
+        Poly h;
+        PolyMod(rest, g, &h);
+        MakeMonic(h);
+        return FindRoots(g, roots) && FindRoots(h, roots);
+    }
+    return false;
+}
+} // namespace
+
+void PinSketch::Add(uint32_t element)
+{
+    const uint32_t square{Mul(element, element)};
+    uint32_t power{element};
+    for (uint32_t& syndrome : m_syndromes) {
+        syndrome ^= power;
+        power = Mul(power, square);
+    }
+}
+
+void PinSketch::Merge(const PinSketch& other)
+{
+    if (other.Capacity() < Capacity()) m_syndromes.resize(other.Capacity());
+    for (size_t i = 0; i < m_syndromes.size(); ++i) {
+        m_syndromes[i] ^= other.m_syndromes[i];
+    }
+}
+
+std::vector<unsigned char> PinSketch::Serialize() const
+{
+    std::vector<unsigned char> data(4 * m_syndromes.size());
+    for (size_t i = 0; i < m_syndromes.size(); ++i) {
+        WriteLE32(data.data() + 4 * i, m_syndromes[i]);
+    }
+    return data;
+}
+
+std::optional<PinSketch> PinSketch::Deserialize(Span<const unsigned char> data)
+{
+    if (data.size() % 4 != 0) return std::nullopt;
+    PinSketch sketch(data.size() / 4);
+    for (size_t i = 0; i < sketch.m_syndromes.size(); ++i) {
+        sketch.m_syndromes[i] = ReadLE32(data.data() + 4 * i);
+    }
+    return sketch;
+}
+
+std::optional<std::vector<uint32_t>> PinSketch::Decode(size_t max_elements) const
+{
+    const size_t capacity{m_syndromes.size()};
+
+    // All power sums S_1..S_2c; the even ones follow from S_2i = S_i^2
+    std::vector<uint32_t> sums(2 * capacity + 1);
+    for (size_t i = 0; i < capacity; ++i) {
+        sums[2 * i + 1] = m_syndromes[i];
+    }
+    for (size_t j = 2; j <= 2 * capacity; j += 2) {
+        sums[j] = Mul(sums[j / 2], sums[j / 2]);
+    }
+
+    // Berlekamp-Massey finds the connection polynomial C(z) = prod(1 - x * z)
+    // over the elements x, as the shortest recurrence generating the sums
+    Poly c{1}, b{1};
+    size_t length{0}, shift{1};
+    uint32_t last_discrepancy{1};
+    for (size_t n = 0; n < 2 * capacity; ++n) {
+        uint32_t discrepancy{sums[n + 1]};
+        for (size_t i = 1; i <= length && i < c.size(); ++i) {
+            discrepancy ^= Mul(c[i], sums[n + 1 - i]);
+        }
+        if (discrepancy == 0) {
+            ++shift;
+            continue;
+        }
+        const uint32_t factor{Mul(discrepancy, Inv(last_discrepancy))};
+        Poly prev{c};
+        if (c.size() < b.size() + shift) c.resize(b.size() + shift);
+        for (size_t i = 0; i < b.size(); ++i) {
+            c[i + shift] ^= Mul(factor, b[i]);
+        }
+        if (2 * length <= n) {
+            length = n + 1 - length;
+            b = std::move(prev);
+            last_discrepancy = discrepancy;
+            shift = 1;
+        } else {
+            ++shift;
+        }
+    }
+    if (length == 0) return std::vector<uint32_t>{};
+    if (length > std::min(max_elements, capacity)) return std::nullopt;
+
+    // The elements are the roots of the reversed polynomial x^L * C(1/x),
+    // which is monic. Zero is not a valid element.
+    c.resize(length + 1);
+    const Poly f(c.rbegin(), c.rend());
+    if (f[0] == 0) return std::nullopt;
+
+    // f must have distinct roots, all in GF(2^32): x^(2^32) = x modulo f
+    Poly x{0, 1};
+    PolyMod(x, f);
+    Poly y{x};
+    for (int i = 0; i < 32; ++i) {
+        y = SqrMod(y, f);
+    }
+    if (y != x) return std::nullopt;
+
+    std::vector<uint32_t> elements;
+    if (!FindRoots(f, elements) || elements.size() != length) return std::nullopt;
+
+    // Only accept a result that reproduces the sketch
+    PinSketch check(capacity);
+    for (const uint32_t element : elements) {
+        check.Add(element);
+    }
+    if (!(check == *this)) return std::nullopt;
+    return elements;
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_PINSKETCH_H
+#define BITCOIN_PINSKETCH_H
+
+#include <span.h>
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+/**
+ * A set sketch of 32-bit elements (PinSketch, as in libminisketch).
+ *
+ * A sketch with capacity c consists of the odd power sums x, x^3, ...,
+ * x^(2c-1) of its elements in GF(2^32), so it takes 4c bytes regardless of the
+ * size of the set. Adding an element twice removes it again, and merging two
+ * sketches yields the sketch of the symmetric difference of their sets, which
+ * can be decoded as long as it has at most c elements. This makes it possible
+ * to find the difference between two sets by exchanging a single sketch.
+ *
+ * Elements must be non-zero.
+ */
+class PinSketch
+{
+public:
+    explicit PinSketch(size_t capacity) : m_syndromes(capacity) {}
+
+    size_t Capacity() const { return m_syndromes.size(); }
+
+    /** Add an element to the sketch, or remove it if it was added before. */
+    void Add(uint32_t element);
+
+    /**
+     * Merge in another sketch, so that this sketch represents the symmetric
+     * difference of both sets. The capacity is reduced to the smaller one.
+     */
+    void Merge(const PinSketch& other);
+
+    /** Serialize as 4 bytes per unit of capacity. */
+    std::vector<unsigned char> Serialize() const;
+
+    /** Deserialize a sketch; its capacity follows from the size of the data. */
+    static std::optional<PinSketch> Deserialize(Span<const unsigned char> data);
+
+    /**
+     * Recover the elements of the set, which succeeds if the set has at most
+     * max_elements <= Capacity() elements.
+     *
+     * A larger set can be mistaken for a different set of at most Capacity()
+     * elements: with probability ~1/c! for capacity c (so always for capacity
+     * 1). Decoding at most Capacity() - 1 elements reduces this to ~2^-32.
+     *
+     * @returns the elements, or nullopt if they could not be recovered
+     */
+    std::optional<std::vector<uint32_t>> Decode(size_t max_elements) const;
+
+    bool operator==(const PinSketch& other) const { return m_syndromes == other.m_syndromes; }
+
+private:
+    /** The power sums of the elements: m_syndromes[i] = sum(x^(2i+1)) */
+    std::vector<uint32_t> m_syndromes;
+};
+
+#endif // BITCOIN_PINSKETCH_H
@@ -22,6 +22,7 @@
 #include <primitives/transaction.h>
 #include <script/sign.h>
 #include <consensus/consensus.h>
+#include <util/trace.h>
 #include <stdio.h>
 
 using namespace std;
@@ -73,6 +74,14 @@ bool CheckStakeBlockTimestamp(int64_t nTimeBlock)
 //   quantities so as to generate blocks faster, degrading the system back into
 //   a proof-of-work situation.
 //
+uint256 ComputeStakeKernelHash(const uint256& nStakeModifier, uint32_t blockFromTime, const COutPoint& prevout, unsigned int nTimeTx)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << nStakeModifier;
+    ss << blockFromTime << prevout.hash << prevout.n << nTimeTx;
+    return ss.GetHash();
+}
+
 bool CheckStakeKernelHash(const CBlockIndex* pindexPrev, unsigned int nBits, uint32_t blockFromTime, CAmount prevoutValue, const COutPoint& prevout, unsigned int nTimeTx, bool fPrintProofOfStake)
 {
     if (nTimeTx < blockFromTime)  // Transaction timestamp violation
@@ -92,11 +101,7 @@ bool CheckStakeKernelHash(const CBlockIndex* pindexPrev, unsigned int nBits, uin
     uint256 nStakeModifier = pindexPrev->nStakeModifier;
 
     // Calculate hash
-    CHashWriter ss(SER_GETHASH, 0);
-    ss << nStakeModifier;
-    ss << blockFromTime << prevout.hash << prevout.n << nTimeTx;
-
-    uint256 hashProofOfStake = ss.GetHash();
+    uint256 hashProofOfStake = ComputeStakeKernelHash(nStakeModifier, blockFromTime, prevout, nTimeTx);
 
     if (fPrintProofOfStake)
     {
@@ -122,7 +127,7 @@ bool CheckStakeKernelHash(const CBlockIndex* pindexPrev, unsigned int nBits, uin
 }
 
 // Check kernel hash target and coinstake signature
-bool CheckProofOfStake(CBlockIndex* pindexPrev, const CTransaction& tx, unsigned int nBits, BlockValidationState& state, CCoinsViewCache& view, unsigned int nTimeTx)
+static bool VerifyProofOfStake(CBlockIndex* pindexPrev, const CTransaction& tx, unsigned int nBits, BlockValidationState& state, CCoinsViewCache& view, unsigned int nTimeTx)
 {
     if (!tx.IsCoinStake())
         return error("CheckProofOfStake() : called on non-coinstake %s", tx.GetHash().ToString());
@@ -156,6 +161,22 @@ bool CheckProofOfStake(CBlockIndex* pindexPrev, const CTransaction& tx, unsigned
     return true;
 }
 
+bool CheckProofOfStake(CBlockIndex* pindexPrev, const CTransaction& tx, unsigned int nBits, BlockValidationState& state, CCoinsViewCache& view, unsigned int nTimeTx)
+{
+    [[maybe_unused]] const auto start{std::chrono::steady_clock::now()};
+    const bool valid{VerifyProofOfStake(pindexPrev, tx, nBits, state, view, nTimeTx)};
+    TRACE7(pos, check_proof_of_stake,
+        tx.GetHash().data(),
+        tx.vin.empty() ? nullptr : tx.vin[0].prevout.hash.data(),
+        tx.vin.empty() ? 0 : tx.vin[0].prevout.n,
+        pindexPrev->nHeight + 1,
+        valid,
+        state.GetRejectReason().c_str(),
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() // in microseconds (µs)
+    );
+    return valid;
+}
+
 bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, uint32_t nTime, const COutPoint& prevout, CCoinsViewCache& view){
     std::map<COutPoint, CStakeCache> tmp;
     return CheckKernel(pindexPrev, nBits, nTime, prevout, view, tmp);
@@ -262,6 +262,26 @@ extern const char* CFCHECKPT;
  * @since protocol version 70016 as described by BIP 339.
  */
 extern const char* WTXIDRELAY;
+/**
+ * Contains a protocol version and a salt, to negotiate transaction
+ * reconciliation between VERSION and VERACK (BIP 330).
+ * Only sent to peers that signal NODE_TXRECONCILIATION.
+ */
+extern const char* SENDTXRCNCL;
+/**
+ * Requests a sketch of the peer's reconciliation set, providing the size of
+ * our own set and the estimated fraction of it missing from the peer's set.
+ */
+extern const char* REQRECON;
+/**
+ * Contains a sketch of the sender's reconciliation set, in response to reqrecon.
+ */
+extern const char* SKETCH;
+/**
+ * Concludes a reconciliation, indicating whether the difference could be
+ * decoded and the short IDs of the transactions the sender is missing.
+ */
+extern const char* RECONCILDIFF;
 }; // namespace NetMsgType
 
 /* Get a vector of all valid message types (see above) */
@@ -289,6 +309,13 @@ enum ServiceFlags : uint64_t {
     // serving the last 288 (2 day) blocks
     // See BIP159 for details on how this is implemented.
     NODE_NETWORK_LIMITED = (1 << 10),
+    // NODE_TXRECONCILIATION means the node supports reconciling transaction
+    // announcements (Erlay, BIP330) instead of announcing every transaction.
+    // This is an experiment, hence a bit from the experimental range.
+    NODE_TXRECONCILIATION = (1 << 24),
+    // NODE_P2P_V2 means the node accepts encrypted (v2 transport) connections.
+    // Also an experiment, so it is only used between nodes running this software.
+    NODE_P2P_V2 = (1 << 25),
 
     // Bits 24-31 are reserved for temporary experiments. Just pick a bit that
     // isn't getting used, or one not being used much, and notify the
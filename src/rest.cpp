@@ -10,6 +10,7 @@
 #include <index/txindex.h>
 #include <node/blockstorage.h>
 #include <node/context.h>
+#include <pos.h>
 #include <primitives/block.h>
 #include <primitives/transaction.h>
 #include <rpc/blockchain.h>
@@ -18,18 +19,24 @@
 #include <streams.h>
 #include <sync.h>
 #include <txmempool.h>
+#include <undo.h>
 #include <util/check.h>
 #include <util/system.h>
 #include <validation.h>
 #include <version.h>
 
 #include <any>
+#include <deque>
+#include <map>
+#include <optional>
 
 #include <boost/algorithm/string.hpp>
 
 #include <univalue.h>
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const int MAX_REST_DIFFICULTY_BLOCKS = 2016; //allow difficulty ranges over at most this many blocks
+static const size_t MAX_STAKE_KERNEL_CACHE = 1000; //number of stake kernels to keep cached
 
 enum class RetFormat {
     UNDEF,
@@ -705,6 +712,295 @@ static bool rest_blockhash_by_height(const std::any& context, HTTPRequest* req,
     }
 }
 
+/** Stake kernel of a proof-of-stake block */
+struct CStakeKernel {
+    uint256 hashBlock;
+    uint32_t nTime{0};
+    uint32_t nBits{0};
+    //! Stake modifier the kernel was hashed with, that of the previous block
+    uint256 nStakeModifier;
+    COutPoint prevout;
+    CAmount nValue{0};
+    int32_t nFromHeight{0};
+    uint32_t nFromTime{0};
+    uint256 hashProofOfStake;
+
+    SERIALIZE_METHODS(CStakeKernel, obj)
+    {
+        READWRITE(obj.hashBlock, obj.nTime, obj.nBits, obj.nStakeModifier, obj.prevout, obj.nValue, obj.nFromHeight, obj.nFromTime, obj.hashProofOfStake);
+    }
+};
+
+/** Difficulty range of the proof-of-work or proof-of-stake blocks in a window of the active chain */
+struct CDifficultyRange {
+    uint32_t nBlocks{0};
+    const CBlockIndex* pindexLast{nullptr};
+    const CBlockIndex* pindexMin{nullptr};
+    const CBlockIndex* pindexMax{nullptr};
+
+    /** Add a block, going from the tip backwards */
+    void Add(const CBlockIndex* pindex)
+    {
+        if (nBlocks++ == 0) {
+            pindexLast = pindexMin = pindexMax = pindex;
+            return;
+        }
+        const double difficulty = GetDifficulty(pindex);
+        if (difficulty < GetDifficulty(pindexMin)) pindexMin = pindex;
+        if (difficulty > GetDifficulty(pindexMax)) pindexMax = pindex;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        s << nBlocks;
+        for (const CBlockIndex* pindex : {pindexLast, pindexMin, pindexMax}) {
+            s << (pindex ? pindex->nBits : uint32_t{0});
+        }
+    }
+
+    UniValue ToJSON() const
+    {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("blocks", (uint64_t)nBlocks);
+        if (nBlocks > 0) {
+            obj.pushKV("current", GetDifficulty(pindexLast));
+            obj.pushKV("min", GetDifficulty(pindexMin));
+            obj.pushKV("max", GetDifficulty(pindexMax));
+        }
+        return obj;
+    }
+};
+
+/** Cache for the staking endpoints, so that polling them does not walk the
+ * chain or read from disk every time. Values that depend on the tip are
+ * dropped when it changes; stake kernels never change, so they are only
+ * limited in number. */
+static Mutex g_stake_cache_mutex;
+static const CBlockIndex* g_stake_cache_tip GUARDED_BY(g_stake_cache_mutex){nullptr};
+static std::optional<uint64_t> g_stake_cache_weight GUARDED_BY(g_stake_cache_mutex);
+static std::map<int, std::pair<CDifficultyRange, CDifficultyRange>> g_stake_cache_difficulty GUARDED_BY(g_stake_cache_mutex);
+static std::map<uint256, CStakeKernel> g_stake_cache_kernels GUARDED_BY(g_stake_cache_mutex);
+static std::deque<uint256> g_stake_cache_kernel_order GUARDED_BY(g_stake_cache_mutex);
+
+static void StakeCacheSetTip(const CBlockIndex* tip) EXCLUSIVE_LOCKS_REQUIRED(g_stake_cache_mutex)
+{
+    if (tip == g_stake_cache_tip) return;
+    g_stake_cache_tip = tip;
+    g_stake_cache_weight.reset();
+    g_stake_cache_difficulty.clear();
+}
+
+/** Get the tip of the active chain; block index entries in it do not change, so they can be read without cs_main */
+static const CBlockIndex* GetActiveTip(const std::any& context, HTTPRequest* req)
+{
+    ChainstateManager* maybe_chainman = GetChainman(context, req);
+    if (!maybe_chainman) return nullptr;
+    const CBlockIndex* tip = WITH_LOCK(cs_main, return maybe_chainman->ActiveChain().Tip());
+    if (!tip) RESTERR(req, HTTP_SERVICE_UNAVAILABLE, "No active chain");
+    return tip;
+}
+
+/** Reply with the binary or hex encoding of ss, or with json */
+static bool RESTReply(HTTPRequest* req, RetFormat rf, const CDataStream& ss, const UniValue& json)
+{
+    switch (rf) {
+    case RetFormat::BINARY: {
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, ss.str());
+        return true;
+    }
+    case RetFormat::HEX: {
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, HexStr(ss) + "\n");
+        return true;
+    }
+    case RetFormat::JSON: {
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, json.write() + "\n");
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+}
+
+static bool rest_stakemodifier(const std::any& context, HTTPRequest* req, const std::string& str_uri_part)
+{
+    if (!CheckWarmup(req)) return false;
+    std::string height_str;
+    const RetFormat rf = ParseDataFormat(height_str, str_uri_part);
+
+    int32_t height = -1;
+    if (!ParseInt32(height_str, &height) || height < 0) {
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height: " + SanitizeString(height_str));
+    }
+    const CBlockIndex* tip = GetActiveTip(context, req);
+    if (!tip) return false;
+    if (height > tip->nHeight) {
+        return RESTERR(req, HTTP_NOT_FOUND, "Block height out of range");
+    }
+    const CBlockIndex* pindex = tip->GetAncestor(height);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << pindex->GetBlockHash() << pindex->nStakeModifier << (uint32_t)pindex->nFlags;
+    UniValue json(UniValue::VOBJ);
+    json.pushKV("height", pindex->nHeight);
+    json.pushKV("blockhash", pindex->GetBlockHash().GetHex());
+    json.pushKV("modifier", pindex->nStakeModifier.GetHex());
+    json.pushKV("flags", pindex->IsProofOfStake() ? "proof-of-stake" : "proof-of-work");
+    return RESTReply(req, rf, ss, json);
+}
+
+static bool rest_stakekernel(const std::any& context, HTTPRequest* req, const std::string& str_uri_part)
+{
+    if (!CheckWarmup(req)) return false;
+    std::string hash_str;
+    const RetFormat rf = ParseDataFormat(hash_str, str_uri_part);
+
+    uint256 hash;
+    if (!ParseHashStr(hash_str, hash)) {
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hash_str);
+    }
+
+    std::optional<CStakeKernel> kernel;
+    {
+        LOCK(g_stake_cache_mutex);
+        auto it = g_stake_cache_kernels.find(hash);
+        if (it != g_stake_cache_kernels.end()) kernel = it->second;
+    }
+    if (!kernel) {
+        ChainstateManager* maybe_chainman = GetChainman(context, req);
+        if (!maybe_chainman) return false;
+        CBlock block;
+        CBlockUndo blockundo;
+        const CBlockIndex* pindex;
+        {
+            LOCK(cs_main);
+            pindex = maybe_chainman->m_blockman.LookupBlockIndex(hash);
+            if (!pindex) {
+                return RESTERR(req, HTTP_NOT_FOUND, hash_str + " not found");
+            }
+            if (!pindex->IsProofOfStake()) {
+                return RESTERR(req, HTTP_NOT_FOUND, hash_str + " is not a proof-of-stake block");
+            }
+            if (IsBlockPruned(pindex) || !(pindex->nStatus & BLOCK_HAVE_UNDO)) {
+                return RESTERR(req, HTTP_NOT_FOUND, hash_str + " not available (pruned or not connected)");
+            }
+        }
+        // Read without holding cs_main; the block may still be pruned in the meantime
+        if (!ReadBlockFromDisk(block, pindex, Params().GetConsensus()) || !UndoReadFromDisk(blockundo, pindex) ||
+            block.vtx.size() < 2 || blockundo.vtxundo.empty() || blockundo.vtxundo[0].vprevout.empty()) {
+            return RESTERR(req, HTTP_NOT_FOUND, hash_str + " not available (pruned or not connected)");
+        }
+        // The coinstake is the second transaction; the undo data has the coin it spent first
+        const Coin& coin = blockundo.vtxundo[0].vprevout[0];
+        const CBlockIndex* pindexFrom = pindex->pprev->GetAncestor(coin.nHeight);
+        kernel.emplace();
+        kernel->hashBlock = hash;
+        kernel->nTime = pindex->nTime;
+        kernel->nBits = pindex->nBits;
+        kernel->nStakeModifier = pindex->pprev->nStakeModifier;
+        kernel->prevout = block.vtx[1]->vin[0].prevout;
+        kernel->nValue = coin.out.nValue;
+        kernel->nFromHeight = coin.nHeight;
+        kernel->nFromTime = coin.nTime ? coin.nTime : (pindexFrom ? pindexFrom->nTime : 0);
+        kernel->hashProofOfStake = ComputeStakeKernelHash(kernel->nStakeModifier, kernel->nFromTime, kernel->prevout, kernel->nTime);
+
+        LOCK(g_stake_cache_mutex);
+        if (g_stake_cache_kernels.emplace(hash, *kernel).second) {
+            g_stake_cache_kernel_order.push_back(hash);
+            if (g_stake_cache_kernel_order.size() > MAX_STAKE_KERNEL_CACHE) {
+                g_stake_cache_kernels.erase(g_stake_cache_kernel_order.front());
+                g_stake_cache_kernel_order.pop_front();
+            }
+        }
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << *kernel;
+    UniValue json(UniValue::VOBJ);
+    json.pushKV("blockhash", kernel->hashBlock.GetHex());
+    json.pushKV("time", (uint64_t)kernel->nTime);
+    json.pushKV("bits", strprintf("%08x", kernel->nBits));
+    json.pushKV("modifier", kernel->nStakeModifier.GetHex());
+    json.pushKV("txid", kernel->prevout.hash.GetHex());
+    json.pushKV("vout", (uint64_t)kernel->prevout.n);
+    json.pushKV("value", ValueFromAmount(kernel->nValue));
+    json.pushKV("fromheight", kernel->nFromHeight);
+    json.pushKV("fromtime", (uint64_t)kernel->nFromTime);
+    json.pushKV("proofhash", kernel->hashProofOfStake.GetHex());
+    return RESTReply(req, rf, ss, json);
+}
+
+static bool rest_stakeweight(const std::any& context, HTTPRequest* req, const std::string& str_uri_part)
+{
+    if (!CheckWarmup(req)) return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, str_uri_part);
+    if (!param.empty()) {
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/stakeweight.<ext>");
+    }
+    const CBlockIndex* tip = GetActiveTip(context, req);
+    if (!tip) return false;
+
+    uint64_t weight;
+    {
+        LOCK(g_stake_cache_mutex);
+        StakeCacheSetTip(tip);
+        if (!g_stake_cache_weight) g_stake_cache_weight = 1.1429 * GetPoSKernelPS(tip);
+        weight = *g_stake_cache_weight;
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tip->nHeight << tip->GetBlockHash() << weight;
+    UniValue json(UniValue::VOBJ);
+    json.pushKV("height", tip->nHeight);
+    json.pushKV("blockhash", tip->GetBlockHash().GetHex());
+    json.pushKV("netstakeweight", weight);
+    return RESTReply(req, rf, ss, json);
+}
+
+static bool rest_difficulty(const std::any& context, HTTPRequest* req, const std::string& str_uri_part)
+{
+    if (!CheckWarmup(req)) return false;
+    std::string count_str;
+    const RetFormat rf = ParseDataFormat(count_str, str_uri_part);
+
+    int32_t count = 0;
+    if (!ParseInt32(count_str, &count) || count < 1 || count > MAX_REST_DIFFICULTY_BLOCKS) {
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + SanitizeString(count_str));
+    }
+    const CBlockIndex* tip = GetActiveTip(context, req);
+    if (!tip) return false;
+
+    CDifficultyRange pow, pos;
+    {
+        LOCK(g_stake_cache_mutex);
+        StakeCacheSetTip(tip);
+        auto it = g_stake_cache_difficulty.find(count);
+        if (it == g_stake_cache_difficulty.end()) {
+            CDifficultyRange range_pow, range_pos;
+            const CBlockIndex* pindex = tip;
+            for (int i = 0; i < count && pindex; ++i, pindex = pindex->pprev) {
+                (pindex->IsProofOfStake() ? range_pos : range_pow).Add(pindex);
+            }
+            it = g_stake_cache_difficulty.emplace(count, std::make_pair(range_pow, range_pos)).first;
+        }
+        std::tie(pow, pos) = it->second;
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tip->nHeight << tip->GetBlockHash() << pow << pos;
+    UniValue json(UniValue::VOBJ);
+    json.pushKV("height", tip->nHeight);
+    json.pushKV("blockhash", tip->GetBlockHash().GetHex());
+    json.pushKV("proof-of-work", pow.ToJSON());
+    json.pushKV("proof-of-stake", pos.ToJSON());
+    return RESTReply(req, rf, ss, json);
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(const std::any& context, HTTPRequest* req, const std::string& strReq);
@@ -718,6 +1014,10 @@ static const struct {
       {"/rest/headers/", rest_headers},
       {"/rest/getutxos", rest_getutxos},
       {"/rest/blockhashbyheight/", rest_blockhash_by_height},
+      {"/rest/stakemodifier/", rest_stakemodifier},
+      {"/rest/stakekernel/", rest_stakekernel},
+      {"/rest/stakeweight", rest_stakeweight},
+      {"/rest/difficulty/", rest_difficulty},
 };
 
 void StartREST(const std::any& context)
@@ -27,6 +27,7 @@
 #include <policy/policy.h>
 #include <pos.h>
 #include <primitives/transaction.h>
+#include <rpc/jsonwriter.h>
 #include <rpc/server.h>
 #include <rpc/util.h>
 #include <script/descriptor.h>
@@ -121,13 +122,17 @@ double GetDifficulty(const CBlockIndex* blockindex)
 }
 
 double GetPoSKernelPS()
+{
+    return GetPoSKernelPS(pindexBestHeader);
+}
+
+double GetPoSKernelPS(const CBlockIndex* pindex)
 {
     int nPoSInterval = 72;
     double dStakeKernelsTriedAvg = 0;
     int nStakesHandled = 0, nStakesTime = 0;
 
-    CBlockIndex* pindex = pindexBestHeader;
-    CBlockIndex* pindexPrevStake = nullptr;
+    const CBlockIndex* pindexPrevStake = nullptr;
 
     while (pindex && nStakesHandled < nPoSInterval)
     {
@@ -221,7 +226,7 @@ UniValue blockheaderToJSON(const CBlockIndex* tip, const CBlockIndex* blockindex
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* tip, const CBlockIndex* blockindex, bool txDetails)
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* tip, const CBlockIndex* blockindex, bool txDetails, JSONStreamWriter* writer)
 {
     UniValue result = blockheaderToJSON(tip, blockindex);
 
@@ -229,6 +234,21 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* tip, const CBlockIn
     result.pushKV("size", (int)::GetSerializeSize(block, PROTOCOL_VERSION));
     result.pushKV("weight", (int)::GetBlockWeight(block));
     UniValue txs(UniValue::VARR);
+    if (writer) {
+        // Write what we have so far, and the transactions as they are converted
+        writer->BeginObject();
+        writer->Members(result);
+        result.setObject();
+        writer->Key("tx");
+        writer->BeginArray();
+    }
+    const auto push_tx = [&](const UniValue& tx) {
+        if (writer) {
+            writer->Value(tx);
+        } else {
+            txs.push_back(tx);
+        }
+    };
     if (txDetails) {
         CBlockUndo blockUndo;
         const bool have_undo = !IsBlockPruned(blockindex) && UndoReadFromDisk(blockUndo, blockindex);
@@ -238,20 +258,29 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* tip, const CBlockIn
             const CTxUndo* txundo = (have_undo && i) ? &blockUndo.vtxundo.at(i - 1) : nullptr;
             UniValue objTx(UniValue::VOBJ);
             TxToUniv(*tx, uint256(), objTx, true, RPCSerializationFlags(), txundo);
-            txs.push_back(objTx);
+            push_tx(objTx);
         }
     } else {
         for (const CTransactionRef& tx : block.vtx) {
-            txs.push_back(tx->GetHash().GetHex());
+            push_tx(tx->GetHash().GetHex());
         }
     }
-    result.pushKV("tx", txs);
+    if (writer) {
+        writer->EndArray();
+    } else {
+        result.pushKV("tx", txs);
+    }
 
     result.pushKV("flags", strprintf("%s", blockindex->IsProofOfStake()? "proof-of-stake" : "proof-of-work"));
     result.pushKV("modifier", blockindex->nStakeModifier.GetHex());
     if (block.IsProofOfStake())
         result.pushKV("signature", HexStr(block.vchBlockSig));
 
+    if (writer) {
+        writer->Members(result);
+        writer->EndObject();
+        return NullUniValue;
+    }
     return result;
 }
 
@@ -563,22 +592,31 @@ static void entryToJSON(const CTxMemPool& pool, UniValue& info, const CTxMemPool
     info.pushKV("unbroadcast", pool.IsUnbroadcastTx(tx.GetHash()));
 }
 
-UniValue MempoolToJSON(const CTxMemPool& pool, bool verbose, bool include_mempool_sequence)
+UniValue MempoolToJSON(const CTxMemPool& pool, bool verbose, bool include_mempool_sequence, JSONStreamWriter* writer)
 {
     if (verbose) {
         if (include_mempool_sequence) {
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbose results cannot contain mempool sequence values.");
         }
-        LOCK(pool.cs);
         UniValue o(UniValue::VOBJ);
-        for (const CTxMemPoolEntry& e : pool.mapTx) {
-            const uint256& hash = e.GetTx().GetHash();
-            UniValue info(UniValue::VOBJ);
-            entryToJSON(pool, info, e);
-            // Mempool has unique entries so there is no advantage in using
-            // UniValue::pushKV, which checks if the key already exists in O(N).
-            // UniValue::__pushKV is used instead which currently is O(1).
-            o.__pushKV(hash.ToString(), info);
+        {
+            LOCK(pool.cs);
+            for (const CTxMemPoolEntry& e : pool.mapTx) {
+                const uint256& hash = e.GetTx().GetHash();
+                UniValue info(UniValue::VOBJ);
+                entryToJSON(pool, info, e);
+                // Mempool has unique entries so there is no advantage in using
+                // UniValue::pushKV, which checks if the key already exists in O(N).
+                // UniValue::__pushKV is used instead which currently is O(1).
+                o.__pushKV(hash.ToString(), info);
+            }
+        }
+        // Streaming waits for the client, so only start once the mempool is unlocked
+        if (writer) {
+            writer->BeginObject();
+            writer->Members(o);
+            writer->EndObject();
+            return NullUniValue;
         }
         return o;
     } else {
@@ -589,6 +627,14 @@ UniValue MempoolToJSON(const CTxMemPool& pool, bool verbose, bool include_mempoo
             pool.queryHashes(vtxid);
             mempool_sequence = pool.GetSequence();
         }
+        if (writer && !include_mempool_sequence) {
+            writer->BeginArray();
+            for (const uint256& hash : vtxid) {
+                writer->Value(hash.ToString());
+            }
+            writer->EndArray();
+            return NullUniValue;
+        }
         UniValue a(UniValue::VARR);
         for (const uint256& hash : vtxid)
             a.push_back(hash.ToString());
@@ -649,7 +695,7 @@ static RPCHelpMan getrawmempool()
         include_mempool_sequence = request.params[1].get_bool();
     }
 
-    return MempoolToJSON(EnsureAnyMemPool(request.context), fVerbose, include_mempool_sequence);
+    return MempoolToJSON(EnsureAnyMemPool(request.context), fVerbose, include_mempool_sequence, request.result_writer);
 },
     };
 }
@@ -1032,7 +1078,7 @@ static RPCHelpMan getblock()
         return strHex;
     }
 
-    return blockToJSON(block, tip, pblockindex, verbosity >= 2);
+    return blockToJSON(block, tip, pblockindex, verbosity >= 2, request.result_writer);
 },
     };
 }
@@ -21,6 +21,7 @@ class CBlockIndex;
 class CChainState;
 class CTxMemPool;
 class ChainstateManager;
+class JSONStreamWriter;
 class UniValue;
 struct NodeContext;
 
@@ -34,17 +35,24 @@ static constexpr int NUM_GETBLOCKSTATS_PERCENTILES = 5;
  */
 double GetDifficulty(const CBlockIndex* blockindex);
 
+/** Estimate the kernels tried per second by all stakers, from the last
+ * proof-of-stake blocks up to pindex. */
+double GetPoSKernelPS(const CBlockIndex* pindex);
+
 /** Callback for when block tip changed. */
 void RPCNotifyBlockChange(const CBlockIndex*);
 
-/** Block description to JSON */
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* tip, const CBlockIndex* blockindex, bool txDetails = false) LOCKS_EXCLUDED(cs_main);
+/**
+ * Block description to JSON. If a writer is given, the description is written
+ * there as it is built, transaction by transaction, and a null value is returned.
+ */
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* tip, const CBlockIndex* blockindex, bool txDetails = false, JSONStreamWriter* writer = nullptr) LOCKS_EXCLUDED(cs_main);
 
 /** Mempool information to JSON */
 UniValue MempoolInfoToJSON(const CTxMemPool& pool);
 
-/** Mempool to JSON */
-UniValue MempoolToJSON(const CTxMemPool& pool, bool verbose = false, bool include_mempool_sequence = false);
+/** Mempool to JSON. If a writer is given, the result is written there entry by entry and a null value is returned. */
+UniValue MempoolToJSON(const CTxMemPool& pool, bool verbose = false, bool include_mempool_sequence = false, JSONStreamWriter* writer = nullptr);
 
 /** Block header to JSON */
 UniValue blockheaderToJSON(const CBlockIndex* tip, const CBlockIndex* blockindex) LOCKS_EXCLUDED(cs_main);
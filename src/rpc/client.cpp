@@ -151,6 +151,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "reservebalance", 1, "amount" },
     { "burn", 0, "amount" },
     { "burnwallet", 1, "force" },
+    { "getlockstats", 0, "count" },
+    { "getlockstats", 1, "reset" },
     { "logging", 0, "include" },
     { "logging", 1, "exclude" },
     { "disconnectnode", 1, "nodeid" },
@@ -177,6 +179,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "loadwallet", 1, "load_on_startup"},
     { "unloadwallet", 1, "load_on_startup"},
     { "getnodeaddresses", 0, "count"},
+    { "getnetmsgstats", 0, "count"},
     { "addpeeraddress", 1, "port"},
     { "stop", 0, "wait" },
     { "staking", 0, "generate"},
@@ -0,0 +1,109 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <rpc/jsonwriter.h>
+
+#include <util/check.h>
+
+#include <univalue.h>
+
+JSONStreamWriter::JSONStreamWriter(Sink sink) : m_sink(std::move(sink))
+{
+    m_buffer.reserve(CHUNK_SIZE);
+}
+
+void JSONStreamWriter::BeginValue()
+{
+    if (m_levels.empty()) {
+        CHECK_NONFATAL(!m_done);
+    } else if (m_levels.back().object) {
+        CHECK_NONFATAL(m_after_key);
+        m_after_key = false;
+    } else {
+        if (!m_levels.back().empty) m_buffer += ',';
+        m_levels.back().empty = false;
+    }
+}
+
+void JSONStreamWriter::EndValue()
+{
+    if (m_levels.empty()) m_done = true;
+    MaybeFlush();
+}
+
+void JSONStreamWriter::MaybeFlush()
+{
+    if (m_buffer.size() < CHUNK_SIZE) return;
+    m_sink(m_buffer);
+    m_buffer.clear();
+}
+
+void JSONStreamWriter::BeginObject()
+{
+    BeginValue();
+    m_buffer += '{';
+    m_levels.push_back({/* object */ true});
+}
+
+void JSONStreamWriter::EndObject()
+{
+    CHECK_NONFATAL(!m_levels.empty() && m_levels.back().object && !m_after_key);
+    m_buffer += '}';
+    m_levels.pop_back();
+    EndValue();
+}
+
+void JSONStreamWriter::BeginArray()
+{
+    BeginValue();
+    m_buffer += '[';
+    m_levels.push_back({/* object */ false});
+}
+
+void JSONStreamWriter::EndArray()
+{
+    CHECK_NONFATAL(!m_levels.empty() && !m_levels.back().object);
+    m_buffer += ']';
+    m_levels.pop_back();
+    EndValue();
+}
+
+void JSONStreamWriter::Key(const std::string& key)
+{
+    CHECK_NONFATAL(!m_levels.empty() && m_levels.back().object && !m_after_key);
+    if (!m_levels.back().empty) m_buffer += ',';
+    m_levels.back().empty = false;
+    m_buffer += UniValue{key}.write();
+    m_buffer += ':';
+    m_after_key = true;
+}
+
+void JSONStreamWriter::Value(const UniValue& value)
+{
+    BeginValue();
+    m_buffer += value.write();
+    EndValue();
+}
+
+void JSONStreamWriter::Members(const UniValue& object)
+{
+    CHECK_NONFATAL(object.isObject());
+    for (size_t i = 0; i < object.size(); ++i) {
+        Key(object.getKeys()[i]);
+        Value(object.getValues()[i]);
+    }
+}
+
+bool JSONStreamWriter::ExpectsValue() const
+{
+    if (m_levels.empty()) return !m_done;
+    return m_levels.back().object ? m_after_key : true;
+}
+
+std::string JSONStreamWriter::TakeBuffered()
+{
+    std::string out;
+    out.swap(m_buffer);
+    return out;
+}
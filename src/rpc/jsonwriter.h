@@ -0,0 +1,71 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPC_JSONWRITER_H
+#define BITCOIN_RPC_JSONWRITER_H
+
+#include <span.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class UniValue;
+
+/**
+ * Writes a JSON document piece by piece, passing the output on in chunks.
+ *
+ * This lets large RPC results go out as they are produced rather than being
+ * built up as a whole UniValue tree and string first. Small parts, such as
+ * the entries of a large array, can still be built as UniValue and written
+ * with Value(). The output is byte for byte what UniValue::write() gives for
+ * the same document.
+ */
+class JSONStreamWriter
+{
+public:
+    /** Receives the output, in chunks of about CHUNK_SIZE bytes */
+    using Sink = std::function<void(Span<const char>)>;
+
+    static constexpr size_t CHUNK_SIZE{64 * 1024};
+
+    explicit JSONStreamWriter(Sink sink);
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+
+    /** Write the key of the next member of the current object */
+    void Key(const std::string& key);
+    /** Write a value, which may be a whole UniValue tree */
+    void Value(const UniValue& value);
+    /** Write all members of an object into the current object */
+    void Members(const UniValue& object);
+
+    /** Whether a value may be written next: at the start, after a key or inside an array */
+    bool ExpectsValue() const;
+
+    /** Return the output that has not been passed to the sink yet, and clear it */
+    std::string TakeBuffered();
+
+private:
+    /** Write a separator and check that a value can go here */
+    void BeginValue();
+    void EndValue();
+    void MaybeFlush();
+
+    Sink m_sink;
+    std::string m_buffer;
+    /** The open containers; for each whether it is an object, and whether it has any element yet */
+    struct Level {
+        bool object;
+        bool empty{true};
+    };
+    std::vector<Level> m_levels;
+    bool m_after_key{false};
+    bool m_done{false};
+};
+
+#endif // BITCOIN_RPC_JSONWRITER_H
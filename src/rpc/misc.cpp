@@ -19,11 +19,14 @@
 #include <rpc/util.h>
 #include <scheduler.h>
 #include <script/descriptor.h>
+#include <sync.h>
 #include <util/check.h>
 #include <util/message.h> // For MessageSign(), MessageVerify()
 #include <util/strencodings.h>
 #include <util/system.h>
 
+#include <algorithm>
+#include <map>
 #include <stdint.h>
 #include <tuple>
 #ifdef HAVE_MALLOC_INFO
@@ -529,6 +532,148 @@ static RPCHelpMan getmemoryinfo()
     };
 }
 
+static UniValue LockTimesToJSON(const LockSiteStats::Times& times)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("total_us", count_microseconds(std::chrono::duration_cast<std::chrono::microseconds>(times.total)));
+    obj.pushKV("max_us", count_microseconds(std::chrono::duration_cast<std::chrono::microseconds>(times.max)));
+    UniValue histogram(UniValue::VARR);
+    for (const uint64_t count : times.buckets) histogram.push_back(count);
+    obj.pushKV("histogram", histogram);
+    return obj;
+}
+
+static RPCHelpMan getlockstats()
+{
+    const std::vector<RPCResult> times_doc{
+        {RPCResult::Type::NUM, "total_us", "Total time in microseconds"},
+        {RPCResult::Type::NUM, "max_us", "Longest time in microseconds"},
+        {RPCResult::Type::ARR, "histogram", "Number of times per bucket of bucket_bounds_us, the last one for times above all bounds",
+            {{RPCResult::Type::NUM, "", ""}}},
+    };
+    return RPCHelpMan{"getlockstats",
+                "\nReturns contention statistics of the mutexes acquired through LOCK and friends, per mutex and per\n"
+                "place in the code that acquires them (site). The time spent waiting is measured when another thread\n"
+                "holds the mutex. The time a mutex is held is measured except at sites that wait on a condition variable.\n"
+                "Mutexes without a name are identified by the expression used to lock them.\n",
+                {
+                    {"count", RPCArg::Type::NUM, RPCArg::Default{10}, "Number of sites to return, those that waited the longest first"},
+                    {"reset", RPCArg::Type::BOOL, RPCArg::Default{false}, "Clear the statistics after returning them"},
+                },
+                RPCResult{
+                    RPCResult::Type::OBJ, "", "",
+                    {
+                        {RPCResult::Type::NUM_TIME, "since", "The " + UNIX_EPOCH_TIME + " since which the statistics are collected"},
+                        {RPCResult::Type::ARR, "bucket_bounds_us", "Upper bounds of the histogram buckets in microseconds",
+                            {{RPCResult::Type::NUM, "", ""}}},
+                        {RPCResult::Type::ARR, "mutexes", "Totals per mutex, those that waited the longest first",
+                        {
+                            {RPCResult::Type::OBJ, "", "",
+                            {
+                                {RPCResult::Type::STR, "name", "Name of the mutex"},
+                                {RPCResult::Type::NUM, "sites", "Number of sites that acquired it"},
+                                {RPCResult::Type::NUM, "acquisitions", "Number of times it was acquired"},
+                                {RPCResult::Type::NUM, "contentions", "Number of times it was held by another thread when acquired"},
+                                {RPCResult::Type::OBJ, "wait", "Time spent waiting for it", times_doc},
+                                {RPCResult::Type::OBJ, "hold", "Time it was held, at sites measuring it", times_doc},
+                            }},
+                        }},
+                        {RPCResult::Type::ARR, "sites", "Sites that waited the longest",
+                        {
+                            {RPCResult::Type::OBJ, "", "",
+                            {
+                                {RPCResult::Type::STR, "mutex", "Name of the mutex"},
+                                {RPCResult::Type::STR, "lock", "Expression locked, as written in the code"},
+                                {RPCResult::Type::STR, "file", "Source file"},
+                                {RPCResult::Type::NUM, "line", "Line in the source file"},
+                                {RPCResult::Type::NUM, "acquisitions", "Number of times it acquired the mutex"},
+                                {RPCResult::Type::NUM, "contentions", "Number of times the mutex was held by another thread"},
+                                {RPCResult::Type::OBJ, "wait", "Time spent waiting for the mutex", times_doc},
+                                {RPCResult::Type::OBJ, "hold", /* optional */ true, "Time the mutex was held, unless the site waits on a condition variable", times_doc},
+                            }},
+                        }},
+                    }
+                },
+                RPCExamples{
+                    HelpExampleCli("getlockstats", "")
+            + HelpExampleCli("getlockstats", "20 true")
+            + HelpExampleRpc("getlockstats", "20, true")
+                },
+        [&](const RPCHelpMan& self, const JSONRPCRequest& request) -> UniValue
+{
+    const int count{request.params[0].isNull() ? 10 : request.params[0].get_int()};
+    if (count < 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "count must not be negative");
+    }
+    const bool reset{!request.params[1].isNull() && request.params[1].get_bool()};
+
+    const std::chrono::seconds since{GetLockStatsStart()};
+    std::vector<LockSiteStats> sites{GetLockStats()};
+    if (reset) ResetLockStats();
+
+    struct MutexTotals {
+        size_t sites{0};
+        uint64_t acquisitions{0};
+        LockSiteStats::Times wait;
+        LockSiteStats::Times hold;
+    };
+    std::map<std::string, MutexTotals> mutexes;
+    for (const LockSiteStats& site : sites) {
+        MutexTotals& totals = mutexes[site.mutex];
+        ++totals.sites;
+        totals.acquisitions += site.acquisitions;
+        totals.wait.Add(site.wait);
+        totals.hold.Add(site.hold);
+    }
+    std::vector<std::pair<std::string, MutexTotals>> sorted_mutexes(mutexes.begin(), mutexes.end());
+    std::stable_sort(sorted_mutexes.begin(), sorted_mutexes.end(), [](const auto& a, const auto& b) {
+        return a.second.wait.total > b.second.wait.total;
+    });
+
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("since", count_seconds(since));
+    UniValue bounds(UniValue::VARR);
+    for (const int64_t bound : LockSite::BUCKET_BOUNDS) bounds.push_back(bound / 1000);
+    obj.pushKV("bucket_bounds_us", bounds);
+
+    UniValue mutexes_json(UniValue::VARR);
+    for (const auto& [name, totals] : sorted_mutexes) {
+        UniValue mutex(UniValue::VOBJ);
+        mutex.pushKV("name", name);
+        mutex.pushKV("sites", (uint64_t)totals.sites);
+        mutex.pushKV("acquisitions", totals.acquisitions);
+        mutex.pushKV("contentions", totals.wait.count);
+        mutex.pushKV("wait", LockTimesToJSON(totals.wait));
+        mutex.pushKV("hold", LockTimesToJSON(totals.hold));
+        mutexes_json.push_back(mutex);
+    }
+    obj.pushKV("mutexes", mutexes_json);
+
+    std::stable_sort(sites.begin(), sites.end(), [](const LockSiteStats& a, const LockSiteStats& b) {
+        return a.wait.total > b.wait.total;
+    });
+    UniValue sites_json(UniValue::VARR);
+    for (const LockSiteStats& site : sites) {
+        if (sites_json.size() >= (size_t)count) break;
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("mutex", site.mutex);
+        entry.pushKV("lock", site.lock);
+        // Sources are compiled with paths relative to the build directory or absolute ones
+        const size_t src{site.file.rfind("src/")};
+        entry.pushKV("file", src == std::string::npos ? site.file : site.file.substr(src + 4));
+        entry.pushKV("line", site.line);
+        entry.pushKV("acquisitions", site.acquisitions);
+        entry.pushKV("contentions", site.wait.count);
+        entry.pushKV("wait", LockTimesToJSON(site.wait));
+        if (site.hold_timed) entry.pushKV("hold", LockTimesToJSON(site.hold));
+        sites_json.push_back(entry);
+    }
+    obj.pushKV("sites", sites_json);
+    return obj;
+},
+    };
+}
+
 static void EnableOrDisableLogCategories(UniValue cats, bool enable) {
     cats = cats.get_array();
     for (unsigned int i = 0; i < cats.size(); ++i) {
@@ -753,6 +898,7 @@ static const CRPCCommand commands[] =
 { //  category              actor (function)
   //  --------------------- ------------------------
     { "control",            &getmemoryinfo,           },
+    { "control",            &getlockstats,            },
     { "control",            &logging,                 },
     { "util",               &validateaddress,         },
     { "util",               &createmultisig,          },
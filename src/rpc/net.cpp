@@ -11,6 +11,7 @@
 #include <net.h>
 #include <net_permissions.h>
 #include <net_processing.h>
+#include <net_recvbuffer.h>
 #include <net_types.h> // For banmap_t
 #include <netbase.h>
 #include <node/context.h>
@@ -28,7 +29,9 @@
 #include <version.h>
 #include <warnings.h>
 
+#include <algorithm>
 #include <optional>
+#include <tuple>
 
 #include <univalue.h>
 
@@ -150,6 +153,17 @@ static RPCHelpMan getpeerinfo()
                             {
                                 {RPCResult::Type::NUM, "n", "The heights of blocks we're currently asking from this peer"},
                             }},
+                            {RPCResult::Type::NUM, "inflight_limit", "The number of blocks we may ask from this peer at a time, adapted to its download rate"},
+                            {RPCResult::Type::NUM, "block_download_rate", "The average rate at which this peer sent us blocks we asked for, in bytes per second (0 if none yet)"},
+                            {RPCResult::Type::NUM, "block_response_time", "The average time between asking this peer for a block and receiving it, in seconds (0 if none yet)"},
+                            {RPCResult::Type::NUM, "processtime", "The total time spent processing messages from this peer, in microseconds"},
+                            {RPCResult::Type::NUM, "processtime_cs_main_wait", "The part of processtime spent waiting for cs_main, in microseconds"},
+                            {RPCResult::Type::OBJ_DYN, "processtime_per_msg", "",
+                            {
+                                {RPCResult::Type::NUM, "msg", "The total time spent processing messages from this peer, in microseconds, aggregated by message type\n"
+                                                              "Only message types that were received appear in this object; unknown ones\n"
+                                                              "are listed under '"+NET_MESSAGE_COMMAND_OTHER+"'. See getnetmsgstats for details."}
+                            }},
                             {RPCResult::Type::ARR, "permissions", "Any special permissions that have been granted to this peer",
                             {
                                 {RPCResult::Type::STR, "permission_type", Join(NET_PERMISSIONS_DOC, ",\n") + ".\n"},
@@ -171,6 +185,8 @@ static RPCHelpMan getpeerinfo()
                             {RPCResult::Type::STR, "connection_type", "Type of connection: \n" + Join(CONNECTION_TYPE_DOC, ",\n") + ".\n"
                                                                       "Please note this output is unlikely to be stable in upcoming releases as we iterate to\n"
                                                                       "best capture connection behaviors."},
+                            {RPCResult::Type::STR, "transport_protocol_type", "Type of transport protocol: \"v1\" (plaintext) or \"v2\" (encrypted, see -v2transport)"},
+                            {RPCResult::Type::STR, "session_id", "The session ID of an encrypted connection, or \"\" if not encrypted (yet)"},
                         }},
                     }},
                 },
@@ -242,8 +258,21 @@ static RPCHelpMan getpeerinfo()
                 heights.push_back(height);
             }
             obj.pushKV("inflight", heights);
+            obj.pushKV("inflight_limit", statestats.m_blocks_in_flight_limit);
+            obj.pushKV("block_download_rate", statestats.m_block_download_rate);
+            obj.pushKV("block_response_time", statestats.m_block_response_time.count());
             obj.pushKV("addr_processed", statestats.m_addr_processed);
             obj.pushKV("addr_rate_limited", statestats.m_addr_rate_limited);
+            std::chrono::microseconds process_time{0}, cs_main_wait{0};
+            UniValue process_time_per_msg(UniValue::VOBJ);
+            for (const auto& [msg_type, msg_stats] : statestats.m_msg_processing) {
+                process_time += msg_stats.m_time;
+                cs_main_wait += msg_stats.m_cs_main_wait;
+                process_time_per_msg.pushKV(msg_type, count_microseconds(msg_stats.m_time));
+            }
+            obj.pushKV("processtime", count_microseconds(process_time));
+            obj.pushKV("processtime_cs_main_wait", count_microseconds(cs_main_wait));
+            obj.pushKV("processtime_per_msg", process_time_per_msg);
         }
         UniValue permissions(UniValue::VARR);
         for (const auto& permission : NetPermissions::ToStrings(stats.m_permissionFlags)) {
@@ -266,6 +295,8 @@ static RPCHelpMan getpeerinfo()
         }
         obj.pushKV("bytesrecv_per_msg", recvPerMsgCmd);
         obj.pushKV("connection_type", ConnectionTypeAsString(stats.m_conn_type));
+        obj.pushKV("transport_protocol_type", stats.m_transport_type);
+        obj.pushKV("session_id", stats.m_session_id);
 
         ret.push_back(obj);
     }
@@ -619,6 +650,36 @@ static RPCHelpMan getnetworkinfo()
                                 {RPCResult::Type::NUM, "score", "relative score"},
                             }},
                         }},
+                        {RPCResult::Type::OBJ, "recvbuffers", "pooled buffers for receiving messages",
+                        {
+                            {RPCResult::Type::NUM, "pooled", "the number of buffers currently pooled"},
+                            {RPCResult::Type::NUM, "pooled_bytes", "the total capacity of the buffers currently pooled"},
+                            {RPCResult::Type::OBJ_DYN, "per_msg", "",
+                            {
+                                {RPCResult::Type::OBJ, "msg", "Receive buffer usage aggregated by message type\n"
+                                                              "When a message type is not listed in this json object, no such message was received.\n"
+                                                              "Unknown message types are listed under '"+NET_MESSAGE_COMMAND_OTHER+"'.",
+                                {
+                                    {RPCResult::Type::NUM, "messages", "the number of messages received"},
+                                    {RPCResult::Type::NUM, "reused", "the number of messages received into a pooled buffer"},
+                                    {RPCResult::Type::NUM, "allocations", "the number of buffer allocations made while receiving messages"},
+                                }},
+                            }},
+                        }},
+                        {RPCResult::Type::OBJ, "compactblocks", "compact block reconstruction statistics",
+                        {
+                            {RPCResult::Type::NUM, "blocks", "the number of compact blocks matched against the mempool and extra transactions"},
+                            {RPCResult::Type::NUM, "reconstructed", "the number of blocks reconstructed without requesting transactions"},
+                            {RPCResult::Type::NUM, "reconstructed_after_request", "the number of blocks reconstructed after requesting missing transactions"},
+                            {RPCResult::Type::NUM, "failed", "the number of blocks downloaded in full after a short ID collision"},
+                            {RPCResult::Type::NUM, "txn_prefilled", "the number of prefilled transactions"},
+                            {RPCResult::Type::NUM, "txn_from_mempool", "the number of transactions found in the mempool"},
+                            {RPCResult::Type::NUM, "txn_from_extra", "the number of transactions found among the extra transactions"},
+                            {RPCResult::Type::NUM, "txn_requested", "the number of missing transactions requested"},
+                            {RPCResult::Type::NUM, "match_time", "the total time spent matching short IDs, in microseconds"},
+                            {RPCResult::Type::NUM, "extra_txn", "the number of extra transactions kept for reconstruction"},
+                            {RPCResult::Type::NUM, "extra_txn_bytes", "the total size of the extra transactions kept for reconstruction"},
+                        }},
                         {RPCResult::Type::STR, "warnings", "any network and blockchain warnings"},
                     }
                 },
@@ -664,6 +725,36 @@ static RPCHelpMan getnetworkinfo()
         }
     }
     obj.pushKV("localaddresses", localAddresses);
+    UniValue recv_buffers(UniValue::VOBJ);
+    recv_buffers.pushKV("pooled", (uint64_t)g_recv_buffer_pool.GetPooledCount());
+    recv_buffers.pushKV("pooled_bytes", (uint64_t)g_recv_buffer_pool.GetPooledBytes());
+    UniValue per_msg(UniValue::VOBJ);
+    for (const auto& [msg_type, stats] : g_recv_buffer_pool.GetMsgTypeStats()) {
+        if (stats.messages == 0) continue;
+        UniValue msg_stats(UniValue::VOBJ);
+        msg_stats.pushKV("messages", stats.messages.load());
+        msg_stats.pushKV("reused", stats.reused.load());
+        msg_stats.pushKV("allocations", stats.allocations.load());
+        per_msg.pushKV(msg_type, msg_stats);
+    }
+    recv_buffers.pushKV("per_msg", per_msg);
+    obj.pushKV("recvbuffers", recv_buffers);
+    if (node.peerman) {
+        const CompactBlockStats cmpct_stats{node.peerman->GetCompactBlockStats()};
+        UniValue compact_blocks(UniValue::VOBJ);
+        compact_blocks.pushKV("blocks", cmpct_stats.m_blocks);
+        compact_blocks.pushKV("reconstructed", cmpct_stats.m_reconstructed);
+        compact_blocks.pushKV("reconstructed_after_request", cmpct_stats.m_reconstructed_after_request);
+        compact_blocks.pushKV("failed", cmpct_stats.m_failed);
+        compact_blocks.pushKV("txn_prefilled", cmpct_stats.m_txn_prefilled);
+        compact_blocks.pushKV("txn_from_mempool", cmpct_stats.m_txn_from_mempool);
+        compact_blocks.pushKV("txn_from_extra", cmpct_stats.m_txn_from_extra);
+        compact_blocks.pushKV("txn_requested", cmpct_stats.m_txn_requested);
+        compact_blocks.pushKV("match_time", count_microseconds(cmpct_stats.m_match_time));
+        compact_blocks.pushKV("extra_txn", (uint64_t)cmpct_stats.m_extra_txn_count);
+        compact_blocks.pushKV("extra_txn_bytes", (uint64_t)cmpct_stats.m_extra_txn_bytes);
+        obj.pushKV("compactblocks", compact_blocks);
+    }
     obj.pushKV("warnings",       GetWarnings(false).original);
     return obj;
 },
@@ -908,6 +999,130 @@ static RPCHelpMan getnodeaddresses()
     };
 }
 
+static UniValue MsgProcessingStatsToJSON(const MsgProcessingStats& stats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("count", stats.m_count);
+    obj.pushKV("time", count_microseconds(stats.m_time));
+    obj.pushKV("max_time", count_microseconds(stats.m_max_time));
+    obj.pushKV("cs_main_wait", count_microseconds(stats.m_cs_main_wait));
+    obj.pushKV("cs_main_contended", stats.m_cs_main_contended);
+    UniValue histogram(UniValue::VARR);
+    for (const uint64_t count : stats.m_time_histogram) {
+        histogram.push_back(count);
+    }
+    obj.pushKV("time_histogram", histogram);
+    return obj;
+}
+
+static RPCHelpMan getnetmsgstats()
+{
+    std::string buckets;
+    for (const auto bound : MsgProcessingStats::TIME_BUCKETS) {
+        buckets += strprintf("%d, ", count_microseconds(bound));
+    }
+    return RPCHelpMan{"getnetmsgstats",
+        "\nReturns the cost of processing the messages received from peers, to find costly or abusive peers.\n"
+        "Times are wall clock times of the message handler thread, in microseconds.\n",
+        {
+            {"count", RPCArg::Type::NUM, RPCArg::Default{10}, "The maximum number of peers to return, costliest first. Specify 0 to return all peers."},
+        },
+        RPCResult{
+            RPCResult::Type::OBJ, "", "",
+            {
+                {RPCResult::Type::OBJ_DYN, "msgtypes", "Processing costs of the messages from all peers since startup, by message type\n"
+                                                       "Unknown message types are listed under '"+NET_MESSAGE_COMMAND_OTHER+"'.",
+                {
+                    {RPCResult::Type::OBJ, "msg", "",
+                    {
+                        {RPCResult::Type::NUM, "count", "The number of messages processed"},
+                        {RPCResult::Type::NUM, "time", "The total time spent processing them"},
+                        {RPCResult::Type::NUM, "max_time", "The longest time spent processing one of them"},
+                        {RPCResult::Type::NUM, "cs_main_wait", "The part of time spent waiting for cs_main, held by another thread"},
+                        {RPCResult::Type::NUM, "cs_main_contended", "The number of times cs_main was held by another thread"},
+                        {RPCResult::Type::ARR_FIXED, "time_histogram", "The number of messages by processing time: taking less than " + buckets + "and at least " + strprintf("%d", count_microseconds(MsgProcessingStats::TIME_BUCKETS.back())) + " microseconds",
+                        {
+                            {RPCResult::Type::NUM, "", ""},
+                        }},
+                    }},
+                }},
+                {RPCResult::Type::ARR, "peers", "The connected peers, by the total time spent processing their messages",
+                {
+                    {RPCResult::Type::OBJ, "", "",
+                    {
+                        {RPCResult::Type::NUM, "id", "Peer index"},
+                        {RPCResult::Type::STR, "addr", "(host:port) The IP address and port of the peer"},
+                        {RPCResult::Type::NUM, "count", "The number of messages processed"},
+                        {RPCResult::Type::NUM, "time", "The total time spent processing them"},
+                        {RPCResult::Type::NUM, "cs_main_wait", "The part of time spent waiting for cs_main"},
+                        {RPCResult::Type::OBJ_DYN, "msgtypes", "Processing costs by message type, as above",
+                        {
+                            {RPCResult::Type::ELISION, "", ""},
+                        }},
+                    }},
+                }},
+            }
+        },
+        RPCExamples{
+            HelpExampleCli("getnetmsgstats", "")
+            + HelpExampleCli("getnetmsgstats", "3")
+            + HelpExampleRpc("getnetmsgstats", "3")
+        },
+        [&](const RPCHelpMan& self, const JSONRPCRequest& request) -> UniValue
+{
+    NodeContext& node = EnsureAnyNodeContext(request.context);
+    const CConnman& connman = EnsureConnman(node);
+    const PeerManager& peerman = EnsurePeerman(node);
+
+    const int count{request.params[0].isNull() ? 10 : request.params[0].get_int()};
+    if (count < 0) throw JSONRPCError(RPC_INVALID_PARAMETER, "Peer count out of range");
+
+    UniValue msg_types(UniValue::VOBJ);
+    for (const auto& [msg_type, msg_stats] : peerman.GetMsgProcessingStats()) {
+        msg_types.pushKV(msg_type, MsgProcessingStatsToJSON(msg_stats));
+    }
+
+    std::vector<CNodeStats> vstats;
+    connman.GetNodeStats(vstats);
+    std::vector<std::tuple<MsgProcessingStats, const CNodeStats*, MsgProcessingStatsMap>> peers;
+    for (const CNodeStats& stats : vstats) {
+        CNodeStateStats statestats;
+        if (!peerman.GetNodeStateStats(stats.nodeid, statestats)) continue;
+        MsgProcessingStats total;
+        for (const auto& [msg_type, msg_stats] : statestats.m_msg_processing) {
+            total += msg_stats;
+        }
+        peers.emplace_back(total, &stats, std::move(statestats.m_msg_processing));
+    }
+    std::sort(peers.begin(), peers.end(), [](const auto& a, const auto& b) {
+        return std::get<0>(a).m_time > std::get<0>(b).m_time;
+    });
+    if (count > 0 && peers.size() > size_t(count)) peers.resize(count);
+
+    UniValue peer_array(UniValue::VARR);
+    for (const auto& [total, stats, msg_processing] : peers) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("id", stats->nodeid);
+        obj.pushKV("addr", stats->addrName);
+        obj.pushKV("count", total.m_count);
+        obj.pushKV("time", count_microseconds(total.m_time));
+        obj.pushKV("cs_main_wait", count_microseconds(total.m_cs_main_wait));
+        UniValue peer_msg_types(UniValue::VOBJ);
+        for (const auto& [msg_type, msg_stats] : msg_processing) {
+            peer_msg_types.pushKV(msg_type, MsgProcessingStatsToJSON(msg_stats));
+        }
+        obj.pushKV("msgtypes", peer_msg_types);
+        peer_array.push_back(obj);
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("msgtypes", msg_types);
+    ret.pushKV("peers", peer_array);
+    return ret;
+},
+    };
+}
+
 static RPCHelpMan addpeeraddress()
 {
     return RPCHelpMan{"addpeeraddress",
@@ -973,6 +1188,7 @@ static const CRPCCommand commands[] =
     { "network",             &clearbanned,             },
     { "network",             &setnetworkactive,        },
     { "network",             &getnodeaddresses,        },
+    { "network",             &getnetmsgstats,          },
 
     { "hidden",              &addconnection,           },
     { "hidden",              &addpeeraddress,          },
@@ -11,6 +11,8 @@
 
 #include <univalue.h>
 
+class JSONStreamWriter;
+
 UniValue JSONRPCRequestObj(const std::string& strMethod, const UniValue& params, const UniValue& id);
 UniValue JSONRPCReplyObj(const UniValue& result, const UniValue& error, const UniValue& id);
 std::string JSONRPCReply(const UniValue& result, const UniValue& error, const UniValue& id);
@@ -36,6 +38,11 @@ public:
     std::string authUser;
     std::string peerAddr;
     std::any context;
+    /**
+     * Where a method may write a large result as it is produced, instead of
+     * returning it. Only set when the transport can stream the reply.
+     */
+    JSONStreamWriter* result_writer{nullptr};
 
     void parse(const UniValue& valRequest);
 };
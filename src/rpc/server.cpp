@@ -5,17 +5,22 @@
 
 #include <rpc/server.h>
 
+#include <httpserver.h>
 #include <rpc/util.h>
 #include <shutdown.h>
 #include <sync.h>
 #include <util/strencodings.h>
 #include <util/system.h>
+#include <util/time.h>
 
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/signals2/signal.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <memory> // for unique_ptr
 #include <mutex>
 #include <unordered_map>
@@ -220,6 +225,16 @@ static RPCHelpMan getrpcinfo()
                             }},
                         }},
                         {RPCResult::Type::STR, "logpath", "The complete file path to the debug log"},
+                        {RPCResult::Type::OBJ, "work_queue", /* optional */ true, "The HTTP work queue, if the HTTP server is running",
+                        {
+                            {RPCResult::Type::NUM, "depth", "The number of requests waiting for a worker thread"},
+                            {RPCResult::Type::NUM, "clients", "The number of clients with requests waiting"},
+                            {RPCResult::Type::NUM, "executed", "The number of requests handed to a worker thread"},
+                            {RPCResult::Type::NUM, "rejected", "The number of requests rejected because their client had too many waiting (see -rpcworkqueue)"},
+                            {RPCResult::Type::NUM, "total_wait", "The total time requests waited for a worker thread, in microseconds"},
+                            {RPCResult::Type::NUM, "max_wait", "The longest time a request waited for a worker thread, in microseconds"},
+                            {RPCResult::Type::NUM, "total_exec", "The total time requests ran on a worker thread, in microseconds"},
+                        }},
                     }
                 },
                 RPCExamples{
@@ -243,6 +258,19 @@ static RPCHelpMan getrpcinfo()
     UniValue log_path(UniValue::VSTR, path);
     result.pushKV("logpath", log_path);
 
+    HTTPWorkQueueStats stats;
+    if (GetHTTPWorkQueueStats(stats)) {
+        UniValue work_queue(UniValue::VOBJ);
+        work_queue.pushKV("depth", (uint64_t)stats.depth);
+        work_queue.pushKV("clients", (uint64_t)stats.clients);
+        work_queue.pushKV("executed", stats.executed);
+        work_queue.pushKV("rejected", stats.rejected);
+        work_queue.pushKV("total_wait", count_microseconds(stats.total_wait));
+        work_queue.pushKV("max_wait", count_microseconds(stats.max_wait));
+        work_queue.pushKV("total_exec", count_microseconds(stats.total_exec));
+        result.pushKV("work_queue", work_queue);
+    }
+
     return result;
 }
     };
@@ -379,12 +407,54 @@ static UniValue JSONRPCExecOne(JSONRPCRequest jreq, const UniValue& req)
     return rpc_result;
 }
 
-std::string JSONRPCExecBatch(const JSONRPCRequest& jreq, const UniValue& vReq)
+namespace {
+/** A batch request shared by the threads executing it */
+struct RPCBatch {
+    const JSONRPCRequest& jreq;
+    const UniValue& requests;
+    const size_t size;
+    //! Index of the next entry to be claimed by a thread
+    std::atomic<size_t> next{0};
+
+    Mutex mutex;
+    std::condition_variable cond;
+    std::vector<UniValue> replies GUARDED_BY(mutex);
+    size_t done GUARDED_BY(mutex){0};
+
+    RPCBatch(const JSONRPCRequest& jreq_in, const UniValue& requests_in)
+        : jreq(jreq_in), requests(requests_in), size(requests_in.size()), replies(size) {}
+
+    /** Execute entries until none are left to claim */
+    void Work()
+    {
+        // jreq and requests are only used for a claimed entry, and the
+        // batch is not finished while that entry is being executed.
+        for (size_t i; (i = next++) < size;) {
+            UniValue reply = JSONRPCExecOne(jreq, requests[i]);
+            LOCK(mutex);
+            replies[i] = std::move(reply);
+            if (++done == size) cond.notify_all();
+        }
+    }
+};
+} // namespace
+
+std::string JSONRPCExecBatch(const JSONRPCRequest& jreq, const UniValue& vReq, const RPCTaskRunner& run_task, int max_parallel)
 {
-    UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(jreq, vReq[reqIdx]));
+    // Helpers may start after the batch is done, so they share ownership
+    auto batch = std::make_shared<RPCBatch>(jreq, vReq);
+    if (run_task) {
+        const size_t helpers = std::min<size_t>(std::max(max_parallel, 1), batch->size) - 1;
+        for (size_t i = 0; i < helpers; ++i) {
+            if (!run_task([batch] { batch->Work(); })) break;
+        }
+    }
+    batch->Work();
 
+    UniValue ret(UniValue::VARR);
+    WAIT_LOCK(batch->mutex, lock);
+    while (batch->done < batch->size) batch->cond.wait(lock);
+    ret.push_backV(batch->replies);
     return ret.write() + "\n";
 }
 
@@ -18,6 +18,8 @@
 #include <univalue.h>
 
 static const unsigned int DEFAULT_RPC_SERIALIZE_VERSION = 1;
+/** Default for -rpcbatchparallel, the number of entries of a batch request executed at the same time */
+static const int DEFAULT_RPC_BATCH_PARALLEL = 1;
 
 class CRPCCommand;
 
@@ -175,7 +177,15 @@ extern double GetPoSKernelPS();
 void StartRPC();
 void InterruptRPC();
 void StopRPC();
-std::string JSONRPCExecBatch(const JSONRPCRequest& jreq, const UniValue& vReq);
+/** Runs a task on another thread, or returns false if it cannot do so right away */
+using RPCTaskRunner = std::function<bool(std::function<void()>)>;
+/**
+ * Execute a batch request. With a task runner, up to max_parallel entries are
+ * executed at the same time: the calling thread works through the batch
+ * together with the helpers the runner can start. The replies are in the
+ * order of the requests either way.
+ */
+std::string JSONRPCExecBatch(const JSONRPCRequest& jreq, const UniValue& vReq, const RPCTaskRunner& run_task = nullptr, int max_parallel = 1);
 
 // Retrieves any serialization flags requested in command line argument
 int RPCSerializationFlags();
@@ -4,6 +4,7 @@
 
 #include <key_io.h>
 #include <outputtype.h>
+#include <rpc/jsonwriter.h>
 #include <rpc/util.h>
 #include <script/descriptor.h>
 #include <script/signingprovider.h>
@@ -573,6 +574,8 @@ UniValue RPCHelpMan::HandleRequest(const JSONRPCRequest& request) const
         throw std::runtime_error(ToString());
     }
     const UniValue ret = m_fun(*this, request);
+    // A result the method streamed to the request's writer is not returned
+    if (request.result_writer && !request.result_writer->ExpectsValue()) return ret;
     CHECK_NONFATAL(std::any_of(m_results.m_results.begin(), m_results.m_results.end(), [&ret](const RPCResult& res) { return res.MatchesType(ret); }));
     return ret;
 }
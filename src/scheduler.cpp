@@ -131,29 +131,37 @@ bool CScheduler::AreThreadsServicingQueue() const
 }
 
 
-void SingleThreadedSchedulerClient::MaybeScheduleProcessQueue()
+void SingleThreadedSchedulerClient::MaybeScheduleProcessQueue(bool callback_finished)
 {
     {
         LOCK(m_cs_callbacks_pending);
+        // Clear the running flag under the same lock, so that IsIdle() can't
+        // return true before we are done with this object
+        if (callback_finished) m_are_callbacks_running = false;
         // Try to avoid scheduling too many copies here, but if we
         // accidentally have two ProcessQueue's scheduled at once its
         // not a big deal.
         if (m_are_callbacks_running) return;
+        if (m_suspended) return;
         if (m_callbacks_pending.empty()) return;
+        ++m_process_queue_scheduled;
     }
-    m_pscheduler->schedule(std::bind(&SingleThreadedSchedulerClient::ProcessQueue, this), std::chrono::system_clock::now());
+    m_pscheduler->schedule([this] { ProcessQueue(/* scheduled= */ true); }, std::chrono::system_clock::now());
 }
 
-void SingleThreadedSchedulerClient::ProcessQueue()
+void SingleThreadedSchedulerClient::ProcessQueue(bool scheduled)
 {
     std::function<void()> callback;
     {
         LOCK(m_cs_callbacks_pending);
+        if (scheduled) --m_process_queue_scheduled;
         if (m_are_callbacks_running) return;
+        if (m_suspended) return;
         if (m_callbacks_pending.empty()) return;
         m_are_callbacks_running = true;
 
-        callback = std::move(m_callbacks_pending.front());
+        callback = std::move(m_callbacks_pending.front().first);
+        m_suspended = m_callbacks_pending.front().second;
         m_callbacks_pending.pop_front();
     }
 
@@ -164,11 +172,7 @@ void SingleThreadedSchedulerClient::ProcessQueue()
         explicit RAIICallbacksRunning(SingleThreadedSchedulerClient* _instance) : instance(_instance) {}
         ~RAIICallbacksRunning()
         {
-            {
-                LOCK(instance->m_cs_callbacks_pending);
-                instance->m_are_callbacks_running = false;
-            }
-            instance->MaybeScheduleProcessQueue();
+            instance->MaybeScheduleProcessQueue(/* callback_finished= */ true);
         }
     } raiicallbacksrunning(this);
 
@@ -181,11 +185,28 @@ void SingleThreadedSchedulerClient::AddToProcessQueue(std::function<void()> func
 
     {
         LOCK(m_cs_callbacks_pending);
-        m_callbacks_pending.emplace_back(std::move(func));
+        m_callbacks_pending.emplace_back(std::move(func), false);
     }
     MaybeScheduleProcessQueue();
 }
 
+void SingleThreadedSchedulerClient::AddSuspendingCallback(std::function<void()> func)
+{
+    assert(m_pscheduler);
+
+    {
+        LOCK(m_cs_callbacks_pending);
+        m_callbacks_pending.emplace_back(std::move(func), true);
+    }
+    MaybeScheduleProcessQueue();
+}
+
+void SingleThreadedSchedulerClient::Resume()
+{
+    WITH_LOCK(m_cs_callbacks_pending, m_suspended = false);
+    MaybeScheduleProcessQueue();
+}
+
 void SingleThreadedSchedulerClient::EmptyQueue()
 {
     assert(!m_pscheduler->AreThreadsServicingQueue());
@@ -193,7 +214,7 @@ void SingleThreadedSchedulerClient::EmptyQueue()
     while (should_continue) {
         ProcessQueue();
         LOCK(m_cs_callbacks_pending);
-        should_continue = !m_callbacks_pending.empty();
+        should_continue = !m_callbacks_pending.empty() && !m_suspended;
     }
 }
 
@@ -202,3 +223,9 @@ size_t SingleThreadedSchedulerClient::CallbacksPending()
     LOCK(m_cs_callbacks_pending);
     return m_callbacks_pending.size();
 }
+
+bool SingleThreadedSchedulerClient::IsIdle()
+{
+    LOCK(m_cs_callbacks_pending);
+    return m_callbacks_pending.empty() && !m_are_callbacks_running && !m_suspended && m_process_queue_scheduled == 0;
+}
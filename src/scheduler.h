@@ -120,11 +120,15 @@ private:
     CScheduler* m_pscheduler;
 
     RecursiveMutex m_cs_callbacks_pending;
-    std::list<std::function<void()>> m_callbacks_pending GUARDED_BY(m_cs_callbacks_pending);
+    //! Callbacks, each with whether the queue is suspended when it is reached
+    std::list<std::pair<std::function<void()>, bool>> m_callbacks_pending GUARDED_BY(m_cs_callbacks_pending);
     bool m_are_callbacks_running GUARDED_BY(m_cs_callbacks_pending) = false;
+    bool m_suspended GUARDED_BY(m_cs_callbacks_pending) = false;
+    //! Number of ProcessQueue calls handed to the scheduler that have not started
+    int m_process_queue_scheduled GUARDED_BY(m_cs_callbacks_pending) = 0;
 
-    void MaybeScheduleProcessQueue();
-    void ProcessQueue();
+    void MaybeScheduleProcessQueue(bool callback_finished = false);
+    void ProcessQueue(bool scheduled = false);
 
 public:
     explicit SingleThreadedSchedulerClient(CScheduler* pschedulerIn) : m_pscheduler(pschedulerIn) {}
@@ -137,13 +141,29 @@ public:
      */
     void AddToProcessQueue(std::function<void()> func);
 
+    /**
+     * Add a callback after which the queue is suspended: callbacks added later
+     * only run once Resume() is called. Resume() may be called from func.
+     */
+    void AddSuspendingCallback(std::function<void()> func);
+
+    /** Run callbacks again after a suspending callback */
+    void Resume();
+
     /**
      * Processes all remaining queue members on the calling thread, blocking until queue is empty
+     * or suspended.
      * Must be called after the CScheduler has no remaining processing threads!
      */
     void EmptyQueue();
 
     size_t CallbacksPending();
+
+    /**
+     * Whether no callback is pending, running or about to run, so that the
+     * client can be destroyed while the scheduler keeps running.
+     */
+    bool IsIdle();
 };
 
 #endif
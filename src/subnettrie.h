@@ -0,0 +1,239 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUBNETTRIE_H
+#define BITCOIN_SUBNETTRIE_H
+
+#include <netaddress.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+/**
+ * A map from subnets to values, to find the subnets that contain an address
+ * without testing every subnet.
+ *
+ * IPv4 and IPv6 subnets are kept in a path-compressed binary trie per network
+ * (a radix trie, keyed by the bits of the network prefix), so that a lookup
+ * visits at most one node per prefix length that is present on the path to the
+ * address: O(32) or O(128) steps, regardless of the number of subnets. Other
+ * subnets are single addresses (see CSubNet), and looked up in a map.
+ *
+ * Lookups follow CSubNet::Match: an IPv6 subnet never contains an IPv4 address.
+ * Invalid subnets are ignored.
+ *
+ * This class is not thread-safe.
+ */
+template <typename T>
+class SubNetTrie
+{
+public:
+    /** Set the value of a subnet, replacing any previous one. */
+    void Insert(const CSubNet& subnet, T value)
+    {
+        if (!subnet.IsValid()) return;
+        Node* root{Root(subnet.GetNetworkAddr())};
+        if (root == nullptr) {
+            if (m_hosts.insert_or_assign(subnet.GetNetworkAddr(), std::move(value)).second) ++m_size;
+            return;
+        }
+        const Key key{MakeKey(subnet.GetNetworkAddr())};
+        const uint8_t len{subnet.GetPrefixLength()};
+
+        // Invariant: node's prefix is a prefix of key, and no longer than len
+        Node* node{root};
+        while (node->len < len) {
+            std::unique_ptr<Node>& child = node->children[Bit(key, node->len)];
+            if (!child) {
+                child = std::make_unique<Node>(key, len);
+                node = child.get();
+                break;
+            }
+            const uint8_t common{CommonPrefix(child->key, key, std::min(child->len, len))};
+            if (common < child->len) {
+                // Split the edge to child at the end of the common prefix
+                auto branch{std::make_unique<Node>(Mask(key, common), common)};
+                branch->children[Bit(child->key, common)] = std::move(child);
+                child = std::move(branch);
+            }
+            node = child.get();
+        }
+        if (!node->value) ++m_size;
+        node->value = std::move(value);
+    }
+
+    /** Remove a subnet. @returns whether it was present */
+    bool Erase(const CSubNet& subnet)
+    {
+        if (!subnet.IsValid()) return false;
+        Node* root{Root(subnet.GetNetworkAddr())};
+        if (root == nullptr) {
+            if (m_hosts.erase(subnet.GetNetworkAddr()) == 0) return false;
+            --m_size;
+            return true;
+        }
+        const Key key{MakeKey(subnet.GetNetworkAddr())};
+        const uint8_t len{subnet.GetPrefixLength()};
+
+        std::vector<std::unique_ptr<Node>*> path;
+        Node* node{root};
+        while (node->len < len) {
+            std::unique_ptr<Node>& child = node->children[Bit(key, node->len)];
+            if (!child || child->len > len || CommonPrefix(child->key, key, child->len) < child->len) return false;
+            path.push_back(&child);
+            node = child.get();
+        }
+        if (!node->value) return false;
+        node->value.reset();
+        --m_size;
+
+        // Remove nodes left without a value and with fewer than two children,
+        // moving a single child up in their place.
+        while (!path.empty()) {
+            std::unique_ptr<Node>& slot = *path.back();
+            path.pop_back();
+            if (slot->value || (slot->children[0] && slot->children[1])) break;
+            slot = std::move(slot->children[slot->children[0] ? 0 : 1]);
+        }
+        return true;
+    }
+
+    void Clear()
+    {
+        m_ipv4_root = Node{};
+        m_ipv6_root = Node{};
+        m_hosts.clear();
+        m_size = 0;
+    }
+
+    size_t Size() const { return m_size; }
+
+    /**
+     * Whether pred holds for the value of any subnet that contains addr. The
+     * subnets are visited from the shortest prefix to the longest.
+     */
+    template <typename Pred>
+    bool AnyMatch(const CNetAddr& addr, Pred pred) const
+    {
+        bool found{false};
+        ForEachMatch(addr, [&](const T& value) { return (found = pred(value)); });
+        return found;
+    }
+
+    /** The value of the most specific subnet that contains addr, if any. */
+    const T* LongestMatch(const CNetAddr& addr) const
+    {
+        const T* longest{nullptr};
+        ForEachMatch(addr, [&](const T& value) {
+            longest = &value;
+            return false;
+        });
+        return longest;
+    }
+
+private:
+    using Key = std::array<uint8_t, ADDR_IPV6_SIZE>;
+
+    struct Node {
+        /** The prefix, with the bits after len cleared */
+        Key key{};
+        uint8_t len{0};
+        std::optional<T> value;
+        /** Longer prefixes, by their first bit after this one */
+        std::unique_ptr<Node> children[2];
+
+        Node() = default;
+        Node(const Key& key_in, uint8_t len_in) : key(key_in), len(len_in) {}
+    };
+
+    /** The trie for an address, or nullptr if it is neither IPv4 nor IPv6 */
+    Node* Root(const CNetAddr& addr)
+    {
+        return const_cast<Node*>(static_cast<const SubNetTrie*>(this)->Root(addr));
+    }
+
+    const Node* Root(const CNetAddr& addr) const
+    {
+        if (addr.IsIPv4()) return &m_ipv4_root;
+        if (addr.IsIPv6()) return &m_ipv6_root;
+        return nullptr;
+    }
+
+    /** The address bits, from the most significant one */
+    static Key MakeKey(const CNetAddr& addr)
+    {
+        Key key{};
+        const std::vector<unsigned char> bytes{addr.GetAddrBytes()};
+        // IPv4 addresses come back as IPv4-mapped IPv6 addresses
+        const size_t size{addr.IsIPv4() ? ADDR_IPV4_SIZE : ADDR_IPV6_SIZE};
+        std::copy(bytes.end() - size, bytes.end(), key.begin());
+        return key;
+    }
+
+    static bool Bit(const Key& key, uint8_t pos)
+    {
+        return (key[pos / 8] >> (7 - pos % 8)) & 1;
+    }
+
+    static Key Mask(Key key, uint8_t len)
+    {
+        for (size_t i = 0; i < key.size(); ++i) {
+            const unsigned bits{i * 8 >= len ? 0U : std::min(8U, unsigned(len - i * 8))};
+            key[i] &= uint8_t(0xFF00 >> bits);
+        }
+        return key;
+    }
+
+    /** The length of the common prefix of a and b, up to max_len bits */
+    static uint8_t CommonPrefix(const Key& a, const Key& b, uint8_t max_len)
+    {
+        unsigned common{0};
+        for (size_t i = 0; common < max_len; ++i) {
+            const uint8_t diff = a[i] ^ b[i];
+            if (diff == 0) {
+                common += 8;
+                continue;
+            }
+            while (!(diff & (0x80 >> (common % 8)))) ++common;
+            break;
+        }
+        return uint8_t(std::min(common, unsigned{max_len}));
+    }
+
+    /** Call fn with the value of every subnet containing addr, until it returns true. */
+    template <typename Fn>
+    void ForEachMatch(const CNetAddr& addr, Fn fn) const
+    {
+        if (!addr.IsValid()) return;
+        const Node* node{Root(addr)};
+        if (node == nullptr) {
+            const auto it{m_hosts.find(addr)};
+            if (it != m_hosts.end()) fn(it->second);
+            return;
+        }
+        const Key key{MakeKey(addr)};
+        const uint8_t addr_len(addr.IsIPv4() ? ADDR_IPV4_SIZE * 8 : ADDR_IPV6_SIZE * 8);
+        while (true) {
+            if (node->value && fn(*node->value)) return;
+            if (node->len == addr_len) return;
+            const std::unique_ptr<Node>& child = node->children[Bit(key, node->len)];
+            if (!child || CommonPrefix(child->key, key, child->len) < child->len) return;
+            node = child.get();
+        }
+    }
+
+    Node m_ipv4_root;
+    Node m_ipv6_root;
+    /** Subnets of a single non-IPv[46] address */
+    std::map<CNetAddr, T> m_hosts;
+    size_t m_size{0};
+};
+
+#endif // BITCOIN_SUBNETTRIE_H
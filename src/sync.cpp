@@ -10,9 +10,12 @@
 
 #include <logging.h>
 #include <tinyformat.h>
+#include <util/metrics.h>
 #include <util/strencodings.h>
 #include <util/threadnames.h>
+#include <util/time.h>
 
+#include <algorithm>
 #include <map>
 #include <mutex>
 #include <set>
@@ -34,6 +37,139 @@ void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 }
 #endif /* DEBUG_LOCKCONTENTION */
 
+/** Contended acquisitions of any mutex through LOCK and friends */
+static metrics::Histogram& LockWaitMetric()
+{
+    static metrics::Histogram& histogram{metrics::Add<metrics::Histogram>(
+        "usdg_lock_wait_seconds", "Time blocked on a mutex held by another thread, per contended acquisition",
+        metrics::Histogram::DurationBuckets())};
+    return histogram;
+}
+// Export it from the start, not only after the first contention
+static const bool g_lock_wait_metric_exported{(LockWaitMetric(), true)};
+
+#if defined(HAVE_THREAD_LOCAL)
+/** Innermost LockWaitTracker of the current thread */
+static thread_local LockWaitTracker* g_lock_wait_tracker{nullptr};
+
+LockWaitTracker::LockWaitTracker(const void* mutex) : m_mutex(mutex), m_outer(g_lock_wait_tracker)
+{
+    g_lock_wait_tracker = this;
+}
+
+LockWaitTracker::~LockWaitTracker()
+{
+    g_lock_wait_tracker = m_outer;
+}
+
+void LockWaitTracker::Record(const void* mutex, std::chrono::nanoseconds waited)
+{
+    LockWaitMetric().ObserveDuration(waited);
+    if (g_lock_wait_tracker == nullptr) return;
+    for (LockWaitTracker* tracker = g_lock_wait_tracker; tracker != nullptr; tracker = tracker->m_outer) {
+        if (tracker->m_mutex != mutex) continue;
+        tracker->m_waited += waited;
+        ++tracker->m_contended;
+    }
+}
+#else
+LockWaitTracker::LockWaitTracker(const void* mutex) : m_mutex(mutex), m_outer(nullptr) {}
+LockWaitTracker::~LockWaitTracker() {}
+void LockWaitTracker::Record(const void* mutex, std::chrono::nanoseconds waited)
+{
+    LockWaitMetric().ObserveDuration(waited);
+}
+#endif
+
+/** Head of the list of the LockSites that acquired a mutex, most recent first. Sites are never removed. */
+static std::atomic<LockSite*> g_lock_sites{nullptr};
+static std::atomic<int64_t> g_lock_stats_start{GetTime()};
+
+void LockSite::Times::Record(std::chrono::nanoseconds duration)
+{
+    const uint64_t ns = duration.count();
+    size_t bucket{0};
+    while (bucket < BUCKET_BOUNDS.size() && int64_t(ns) > BUCKET_BOUNDS[bucket]) ++bucket;
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_total_ns.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max = m_max_ns.load(std::memory_order_relaxed);
+    while (ns > max && !m_max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+}
+
+void LockSite::Times::Reset()
+{
+    m_count.store(0, std::memory_order_relaxed);
+    m_total_ns.store(0, std::memory_order_relaxed);
+    m_max_ns.store(0, std::memory_order_relaxed);
+    for (auto& bucket : m_buckets) bucket.store(0, std::memory_order_relaxed);
+}
+
+void LockSite::Register(const char* mutex_name)
+{
+    if (mutex_name == nullptr) {
+        mutex_name = m_name;
+        if (mutex_name[0] == ':' && mutex_name[1] == ':') mutex_name += 2;
+    }
+    m_mutex_name.store(mutex_name, std::memory_order_relaxed);
+    // Only the first thread to get here adds the site to the list
+    if (m_registered.exchange(true, std::memory_order_acq_rel)) return;
+    m_next = g_lock_sites.load(std::memory_order_relaxed);
+    while (!g_lock_sites.compare_exchange_weak(m_next, this, std::memory_order_release, std::memory_order_relaxed)) {}
+}
+
+void LockSiteStats::Times::Add(const Times& other)
+{
+    count += other.count;
+    total += other.total;
+    max = std::max(max, other.max);
+    for (size_t i = 0; i < buckets.size(); ++i) buckets[i] += other.buckets[i];
+}
+
+static LockSiteStats::Times Snapshot(const LockSite::Times& times)
+{
+    LockSiteStats::Times stats;
+    stats.count = times.m_count.load(std::memory_order_relaxed);
+    stats.total = std::chrono::nanoseconds{times.m_total_ns.load(std::memory_order_relaxed)};
+    stats.max = std::chrono::nanoseconds{times.m_max_ns.load(std::memory_order_relaxed)};
+    for (size_t i = 0; i < stats.buckets.size(); ++i) stats.buckets[i] = times.m_buckets[i].load(std::memory_order_relaxed);
+    return stats;
+}
+
+std::vector<LockSiteStats> GetLockStats()
+{
+    std::vector<LockSiteStats> result;
+    for (const LockSite* site = g_lock_sites.load(std::memory_order_acquire); site != nullptr; site = site->m_next) {
+        LockSiteStats& stats = result.emplace_back();
+        stats.mutex = site->m_mutex_name.load(std::memory_order_relaxed);
+        stats.lock = site->m_name;
+        stats.file = site->m_file;
+        stats.line = site->m_line;
+        stats.hold_timed = site->m_time_hold;
+        stats.wait = Snapshot(site->m_wait);
+        stats.hold = Snapshot(site->m_hold);
+        stats.acquisitions = site->m_time_hold ? stats.hold.count : site->m_acquisitions.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+void ResetLockStats()
+{
+    // Acquisitions in progress are recorded after the reset, so the counts
+    // of a site can be briefly inconsistent with each other.
+    for (LockSite* site = g_lock_sites.load(std::memory_order_acquire); site != nullptr; site = site->m_next) {
+        site->m_acquisitions.store(0, std::memory_order_relaxed);
+        site->m_wait.Reset();
+        site->m_hold.Reset();
+    }
+    g_lock_stats_start.store(GetTime(), std::memory_order_relaxed);
+}
+
+std::chrono::seconds GetLockStatsStart()
+{
+    return std::chrono::seconds{g_lock_stats_start.load(std::memory_order_relaxed)};
+}
+
 #ifdef DEBUG_LOCKORDER
 //
 // Early deadlock detection.
@@ -9,10 +9,15 @@
 #include <threadsafety.h>
 #include <util/macros.h>
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 ////////////////////////////////////////////////
 //                                            //
@@ -89,10 +94,16 @@ template <typename PARENT>
 class LOCKABLE AnnotatedMixin : public PARENT
 {
 public:
+    AnnotatedMixin() = default;
+    /** name groups the lock statistics of all instances, e.g. "CNode::cs_vSend". See getlockstats. */
+    explicit AnnotatedMixin(const char* name) : m_name(name) {}
+
     ~AnnotatedMixin() {
         DeleteLock((void*)this);
     }
 
+    const char* Name() const { return m_name; }
+
     void lock() EXCLUSIVE_LOCK_FUNCTION()
     {
         PARENT::lock();
@@ -115,6 +126,9 @@ public:
     //! with the ! operator, to indicate that a mutex should not be held.
     const AnnotatedMixin& operator!() const { return *this; }
 #endif // __clang__
+
+private:
+    const char* const m_name{nullptr};
 };
 
 /**
@@ -130,57 +144,208 @@ typedef AnnotatedMixin<std::mutex> Mutex;
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/**
+ * While in scope, measure how long the current thread is blocked waiting for
+ * one mutex, e.g. for cs_main while processing a network message. Only
+ * contended acquisitions through LOCK and friends are timed, so uncontended
+ * ones cost nothing extra. Trackers can be nested.
+ *
+ * Without thread_local support, nothing is measured.
+ */
+class LockWaitTracker
+{
+public:
+    explicit LockWaitTracker(const void* mutex);
+    ~LockWaitTracker();
+    LockWaitTracker(const LockWaitTracker&) = delete;
+    LockWaitTracker& operator=(const LockWaitTracker&) = delete;
+
+    /** Total time spent blocked on the mutex */
+    std::chrono::nanoseconds Waited() const { return m_waited; }
+    /** Number of times the mutex was already held by another thread */
+    uint64_t Contended() const { return m_contended; }
+
+    /** Account for the current thread having blocked on mutex for waited. */
+    static void Record(const void* mutex, std::chrono::nanoseconds waited);
+
+private:
+    const void* const m_mutex;
+    LockWaitTracker* const m_outer;
+    std::chrono::nanoseconds m_waited{0};
+    uint64_t m_contended{0};
+};
+
+/**
+ * Statistics of the acquisitions through one LOCK, LOCK2, TRY_LOCK or
+ * WAIT_LOCK in the code. Each of them has its own static LockSite, so
+ * recording is a few relaxed atomic operations on it, without any lookup.
+ *
+ * The time spent waiting is measured for contended acquisitions only. The
+ * time the lock is held is measured for all acquisitions, except through
+ * WAIT_LOCK: its lock is usually handed to a condition variable, which
+ * releases it while waiting.
+ */
+class LockSite
+{
+public:
+    //! Upper bounds of the buckets of the time histograms, in nanoseconds. The last bucket has no bound.
+    static constexpr std::array<int64_t, 7> BUCKET_BOUNDS{1'000, 10'000, 100'000, 1'000'000, 10'000'000, 100'000'000, 1'000'000'000};
+    static constexpr size_t BUCKETS{BUCKET_BOUNDS.size() + 1};
+
+    /** Histogram of durations */
+    class Times
+    {
+    public:
+        void Record(std::chrono::nanoseconds duration);
+        void Reset();
+
+        std::atomic<uint64_t> m_count{0};
+        std::atomic<uint64_t> m_total_ns{0};
+        std::atomic<uint64_t> m_max_ns{0};
+        std::array<std::atomic<uint64_t>, BUCKETS> m_buckets{};
+    };
+
+    constexpr LockSite(const char* name, const char* file, int line, bool time_hold)
+        : m_name(name), m_file(file), m_line(line), m_time_hold(time_hold) {}
+
+    LockSite(const LockSite&) = delete;
+    LockSite& operator=(const LockSite&) = delete;
+
+    /** The mutex was acquired, after waiting for it if waited is not zero. */
+    void Acquired(const char* mutex_name, std::chrono::nanoseconds waited)
+    {
+        if (!m_registered.load(std::memory_order_acquire)) Register(mutex_name);
+        if (waited.count() > 0) m_wait.Record(waited);
+        if (!m_time_hold) m_acquisitions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /** The mutex was released after being held for held */
+    void Released(std::chrono::nanoseconds held) { m_hold.Record(held); }
+
+    bool TimesHold() const { return m_time_hold; }
+
+    //! Lock expression as written, e.g. "::cs_main", and its location
+    const char* const m_name;
+    const char* const m_file;
+    const int m_line;
+    const bool m_time_hold;
+    //! Name of the mutex if it has one, else m_name without a leading "::". Set on registration.
+    std::atomic<const char*> m_mutex_name{nullptr};
+    //! Acquisitions of sites not timing the hold, whose hold histogram stays empty
+    std::atomic<uint64_t> m_acquisitions{0};
+    Times m_wait;
+    Times m_hold;
+    //! Next registered site
+    LockSite* m_next{nullptr};
+
+private:
+    void Register(const char* mutex_name);
+
+    std::atomic<bool> m_registered{false};
+};
+
+/** Snapshot of the statistics of a LockSite */
+struct LockSiteStats {
+    struct Times {
+        uint64_t count{0};
+        std::chrono::nanoseconds total{0};
+        std::chrono::nanoseconds max{0};
+        std::array<uint64_t, LockSite::BUCKETS> buckets{};
+
+        void Add(const Times& other);
+    };
+
+    std::string mutex;
+    std::string lock;
+    std::string file;
+    int line{0};
+    bool hold_timed{false};
+    uint64_t acquisitions{0};
+    Times wait;
+    Times hold;
+};
+
+/** Statistics of all sites that acquired a mutex since startup */
+std::vector<LockSiteStats> GetLockStats();
+/** Clear the statistics of all sites */
+void ResetLockStats();
+/** Time of the last ResetLockStats, or of startup */
+std::chrono::seconds GetLockStatsStart();
+
 /** Wrapper around std::unique_lock style lock for Mutex. */
 template <typename Mutex, typename Base = typename Mutex::UniqueLock>
 class SCOPED_LOCKABLE UniqueLock : public Base
 {
 private:
-    void Enter(const char* pszName, const char* pszFile, int nLine)
+    void Enter(const char* pszName, const char* pszFile, int nLine, const char* mutex_name)
     {
         EnterCritical(pszName, pszFile, nLine, Base::mutex());
-#ifdef DEBUG_LOCKCONTENTION
+        std::chrono::nanoseconds waited{0};
         if (!Base::try_lock()) {
+#ifdef DEBUG_LOCKCONTENTION
             PrintLockContention(pszName, pszFile, nLine);
 #endif
+            const auto wait_start{std::chrono::steady_clock::now()};
             Base::lock();
-#ifdef DEBUG_LOCKCONTENTION
+            waited = std::chrono::steady_clock::now() - wait_start;
+            LockWaitTracker::Record(Base::mutex(), waited);
         }
-#endif
+        Acquired(mutex_name, waited);
     }
 
-    bool TryEnter(const char* pszName, const char* pszFile, int nLine)
+    bool TryEnter(const char* pszName, const char* pszFile, int nLine, const char* mutex_name)
     {
         EnterCritical(pszName, pszFile, nLine, Base::mutex(), true);
         Base::try_lock();
-        if (!Base::owns_lock())
+        if (!Base::owns_lock()) {
             LeaveCritical();
+        } else {
+            Acquired(mutex_name, std::chrono::nanoseconds{0});
+        }
         return Base::owns_lock();
     }
 
+    void Acquired(const char* mutex_name, std::chrono::nanoseconds waited)
+    {
+        if (!m_site) return;
+        m_site->Acquired(mutex_name, waited);
+        if (m_site->TimesHold()) m_locked = std::chrono::steady_clock::now();
+    }
+
+    void Releasing()
+    {
+        if (m_site && m_site->TimesHold()) m_site->Released(std::chrono::steady_clock::now() - m_locked);
+    }
+
+    LockSite* m_site{nullptr};
+    std::chrono::steady_clock::time_point m_locked;
+
 public:
-    UniqueLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : Base(mutexIn, std::defer_lock)
+    UniqueLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false, LockSite* site = nullptr) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : Base(mutexIn, std::defer_lock), m_site(site)
     {
         if (fTry)
-            TryEnter(pszName, pszFile, nLine);
+            TryEnter(pszName, pszFile, nLine, mutexIn.Name());
         else
-            Enter(pszName, pszFile, nLine);
+            Enter(pszName, pszFile, nLine, mutexIn.Name());
     }
 
-    UniqueLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn)
+    UniqueLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false, LockSite* site = nullptr) EXCLUSIVE_LOCK_FUNCTION(pmutexIn) : m_site(site)
     {
         if (!pmutexIn) return;
 
         *static_cast<Base*>(this) = Base(*pmutexIn, std::defer_lock);
         if (fTry)
-            TryEnter(pszName, pszFile, nLine);
+            TryEnter(pszName, pszFile, nLine, pmutexIn->Name());
         else
-            Enter(pszName, pszFile, nLine);
+            Enter(pszName, pszFile, nLine, pmutexIn->Name());
     }
 
     ~UniqueLock() UNLOCK_FUNCTION()
     {
-        if (Base::owns_lock())
+        if (Base::owns_lock()) {
+            Releasing();
             LeaveCritical();
+        }
     }
 
     operator bool()
@@ -200,6 +365,7 @@ public:
     public:
         explicit reverse_lock(UniqueLock& _lock, const char* _guardname, const char* _file, int _line) : lock(_lock), file(_file), line(_line) {
             CheckLastCritical((void*)lock.mutex(), lockname, _guardname, _file, _line);
+            lock.Releasing();
             lock.unlock();
             LeaveCritical();
             lock.swap(templock);
@@ -209,6 +375,7 @@ public:
             templock.swap(lock);
             EnterCritical(lockname.c_str(), file.c_str(), line, lock.mutex());
             lock.lock();
+            if (lock.m_site && lock.m_site->TimesHold()) lock.m_locked = std::chrono::steady_clock::now();
         }
 
      private:
@@ -229,12 +396,15 @@ public:
 template<typename MutexArg>
 using DebugLock = UniqueLock<typename std::remove_reference<typename std::remove_pointer<MutexArg>::type>::type>;
 
-#define LOCK(cs) DebugLock<decltype(cs)> PASTE2(criticalblock, __COUNTER__)(cs, #cs, __FILE__, __LINE__)
+//! The LockSite of the code it appears in. It is constant-initialized, so using it costs no guard check.
+#define LOCK_SITE(cs, time_hold) ([]() -> LockSite* { static LockSite site{#cs, __FILE__, __LINE__, time_hold}; return &site; }())
+
+#define LOCK(cs) DebugLock<decltype(cs)> PASTE2(criticalblock, __COUNTER__)(cs, #cs, __FILE__, __LINE__, false, LOCK_SITE(cs, true))
 #define LOCK2(cs1, cs2)                                               \
-    DebugLock<decltype(cs1)> criticalblock1(cs1, #cs1, __FILE__, __LINE__); \
-    DebugLock<decltype(cs2)> criticalblock2(cs2, #cs2, __FILE__, __LINE__);
-#define TRY_LOCK(cs, name) DebugLock<decltype(cs)> name(cs, #cs, __FILE__, __LINE__, true)
-#define WAIT_LOCK(cs, name) DebugLock<decltype(cs)> name(cs, #cs, __FILE__, __LINE__)
+    DebugLock<decltype(cs1)> criticalblock1(cs1, #cs1, __FILE__, __LINE__, false, LOCK_SITE(cs1, true)); \
+    DebugLock<decltype(cs2)> criticalblock2(cs2, #cs2, __FILE__, __LINE__, false, LOCK_SITE(cs2, true));
+#define TRY_LOCK(cs, name) DebugLock<decltype(cs)> name(cs, #cs, __FILE__, __LINE__, true, LOCK_SITE(cs, true))
+#define WAIT_LOCK(cs, name) DebugLock<decltype(cs)> name(cs, #cs, __FILE__, __LINE__, false, LOCK_SITE(cs, false))
 
 #define ENTER_CRITICAL_SECTION(cs)                            \
     {                                                         \
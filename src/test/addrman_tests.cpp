@@ -28,7 +28,7 @@ public:
             MakeDeterministic();
         }
         deterministic = makeDeterministic;
-        m_asmap = asmap;
+        SetAsmap(asmap);
     }
 
     //! Ensure that bucket placement is always the same for testing purposes.
@@ -464,7 +464,7 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_tried_bucket_legacy)
     uint256 nKey1 = (uint256)(CHashWriter(SER_GETHASH, 0) << 1).GetHash();
     uint256 nKey2 = (uint256)(CHashWriter(SER_GETHASH, 0) << 2).GetHash();
 
-    std::vector<bool> asmap; // use /16
+    CompiledASMap asmap; // use /16
 
     BOOST_CHECK_EQUAL(info1.GetTriedBucket(nKey1, asmap), 40);
 
@@ -518,7 +518,7 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_new_bucket_legacy)
     uint256 nKey1 = (uint256)(CHashWriter(SER_GETHASH, 0) << 1).GetHash();
     uint256 nKey2 = (uint256)(CHashWriter(SER_GETHASH, 0) << 2).GetHash();
 
-    std::vector<bool> asmap; // use /16
+    CompiledASMap asmap; // use /16
 
     // Test: Make sure the buckets are what we expect
     BOOST_CHECK_EQUAL(info1.GetNewBucket(nKey1, asmap), 786);
@@ -597,7 +597,7 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_tried_bucket)
     uint256 nKey1 = (uint256)(CHashWriter(SER_GETHASH, 0) << 1).GetHash();
     uint256 nKey2 = (uint256)(CHashWriter(SER_GETHASH, 0) << 2).GetHash();
 
-    std::vector<bool> asmap = FromBytes(asmap_raw, sizeof(asmap_raw) * 8);
+    CompiledASMap asmap{FromBytes(asmap_raw, sizeof(asmap_raw) * 8)};
 
     BOOST_CHECK_EQUAL(info1.GetTriedBucket(nKey1, asmap), 236);
 
@@ -651,7 +651,7 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_new_bucket)
     uint256 nKey1 = (uint256)(CHashWriter(SER_GETHASH, 0) << 1).GetHash();
     uint256 nKey2 = (uint256)(CHashWriter(SER_GETHASH, 0) << 2).GetHash();
 
-    std::vector<bool> asmap = FromBytes(asmap_raw, sizeof(asmap_raw) * 8);
+    CompiledASMap asmap{FromBytes(asmap_raw, sizeof(asmap_raw) * 8)};
 
     // Test: Make sure the buckets are what we expect
     BOOST_CHECK_EQUAL(info1.GetNewBucket(nKey1, asmap), 795);
@@ -717,6 +717,34 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_new_bucket)
 
 }
 
+BOOST_AUTO_TEST_CASE(compiled_asmap)
+{
+    const std::vector<bool> asmap_bits = FromBytes(asmap_raw, sizeof(asmap_raw) * 8);
+    const CompiledASMap asmap{asmap_bits};
+
+    BOOST_CHECK(CompiledASMap().IsEmpty());
+    BOOST_CHECK(!asmap.IsEmpty());
+    BOOST_CHECK_EQUAL(ResolveIP("250.1.1.1").GetMappedAS(asmap), 1000U);
+    BOOST_CHECK_EQUAL(ResolveIP("101.3.255.255").GetMappedAS(asmap), 3U);
+    BOOST_CHECK_EQUAL(ResolveIP("101.8.0.1").GetMappedAS(asmap), 8U);
+    BOOST_CHECK_EQUAL(ResolveIP("250.1.1.1").GetMappedAS(CompiledASMap()), 0U);
+
+    // The compiled asmap must agree with the interpreter, including on
+    // addresses that only share part of a prefix with a mapped range.
+    for (int i = 0; i < 10000; ++i) {
+        std::vector<uint8_t> ip = g_insecure_rand_ctx.randbytes(ADDR_IPV6_SIZE);
+        if (i % 2 == 0) {
+            std::copy(IPV4_IN_IPV6_PREFIX.begin(), IPV4_IN_IPV6_PREFIX.end(), ip.begin());
+            if (i % 4 == 0) ip[12] = InsecureRandBool() ? 101 : 250;
+        }
+        std::vector<bool> ip_bits(ip.size() * 8);
+        for (size_t bit = 0; bit < ip_bits.size(); ++bit) {
+            ip_bits[bit] = (ip[bit / 8] >> (7 - bit % 8)) & 1;
+        }
+        BOOST_CHECK_EQUAL(asmap.Lookup(ip), Interpret(asmap_bits, ip_bits));
+    }
+}
+
 BOOST_AUTO_TEST_CASE(addrman_serialization)
 {
     std::vector<bool> asmap1 = FromBytes(asmap_raw, sizeof(asmap_raw) * 8);
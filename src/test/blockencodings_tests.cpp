@@ -72,7 +72,7 @@ BOOST_AUTO_TEST_CASE(SimpleRoundTripTest)
         CBlockHeaderAndShortTxIDs shortIDs2;
         stream >> shortIDs2;
 
-        PartiallyDownloadedBlock partialBlock(&pool);
+        PartiallyDownloadedBlock partialBlock(&pool, m_node.chainman.get());
         BOOST_CHECK(partialBlock.InitData(shortIDs2, extra_txn) == READ_STATUS_OK);
         BOOST_CHECK( partialBlock.IsTxAvailable(0));
         BOOST_CHECK(!partialBlock.IsTxAvailable(1));
@@ -162,7 +162,7 @@ BOOST_AUTO_TEST_CASE(NonCoinbasePreforwardRTTest)
         CBlockHeaderAndShortTxIDs shortIDs2;
         stream >> shortIDs2;
 
-        PartiallyDownloadedBlock partialBlock(&pool);
+        PartiallyDownloadedBlock partialBlock(&pool, m_node.chainman.get());
         BOOST_CHECK(partialBlock.InitData(shortIDs2, extra_txn) == READ_STATUS_OK);
         BOOST_CHECK(!partialBlock.IsTxAvailable(0));
         BOOST_CHECK( partialBlock.IsTxAvailable(1));
@@ -232,7 +232,7 @@ BOOST_AUTO_TEST_CASE(SufficientPreforwardRTTest)
         CBlockHeaderAndShortTxIDs shortIDs2;
         stream >> shortIDs2;
 
-        PartiallyDownloadedBlock partialBlock(&pool);
+        PartiallyDownloadedBlock partialBlock(&pool, m_node.chainman.get());
         BOOST_CHECK(partialBlock.InitData(shortIDs2, extra_txn) == READ_STATUS_OK);
         BOOST_CHECK( partialBlock.IsTxAvailable(0));
         BOOST_CHECK( partialBlock.IsTxAvailable(1));
@@ -287,7 +287,7 @@ BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
         CBlockHeaderAndShortTxIDs shortIDs2;
         stream >> shortIDs2;
 
-        PartiallyDownloadedBlock partialBlock(&pool);
+        PartiallyDownloadedBlock partialBlock(&pool, m_node.chainman.get());
         BOOST_CHECK(partialBlock.InitData(shortIDs2, extra_txn) == READ_STATUS_OK);
         BOOST_CHECK(partialBlock.IsTxAvailable(0));
 
@@ -369,4 +369,46 @@ BOOST_AUTO_TEST_CASE(TransactionsRequestDeserializationOverflowTest) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(ExtraTxnPoolTest) {
+    std::vector<CTransactionRef> txs;
+    for (int i = 0; i < 4; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = InsecureRand256();
+        tx.vout.resize(1);
+        txs.push_back(MakeTransactionRef(tx));
+    }
+    const size_t tx_size = txs[0]->GetTotalSize();
+
+    // Count limit: the oldest transaction is dropped
+    ExtraTxnPool pool(3, 10 * tx_size);
+    for (const auto& tx : txs) pool.Add(tx);
+    pool.Add(txs[3]); // already present
+    BOOST_CHECK_EQUAL(pool.Count(), 3U);
+    BOOST_CHECK_EQUAL(pool.Bytes(), 3 * tx_size);
+    for (const auto& [wtxid, tx] : pool.GetTransactions()) {
+        BOOST_CHECK(tx && tx != txs[0] && wtxid == tx->GetWitnessHash());
+    }
+
+    pool.Remove(txs[2]->GetWitnessHash());
+    BOOST_CHECK_EQUAL(pool.Count(), 2U);
+    BOOST_CHECK_EQUAL(pool.Bytes(), 2 * tx_size);
+
+    // Size limit: the oldest transactions are dropped until the new one fits
+    ExtraTxnPool small_pool(10, 2 * tx_size);
+    for (const auto& tx : txs) small_pool.Add(tx);
+    BOOST_CHECK_EQUAL(small_pool.Count(), 2U);
+    BOOST_CHECK_EQUAL(small_pool.Bytes(), 2 * tx_size);
+    size_t found = 0;
+    for (const auto& entry : small_pool.GetTransactions()) {
+        if (entry.second == txs[2] || entry.second == txs[3]) found++;
+    }
+    BOOST_CHECK_EQUAL(found, 2U);
+
+    // Transactions larger than the limit are not kept
+    ExtraTxnPool tiny_pool(10, tx_size - 1);
+    tiny_pool.Add(txs[0]);
+    BOOST_CHECK_EQUAL(tiny_pool.Count(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
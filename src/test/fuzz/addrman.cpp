@@ -39,9 +39,9 @@ FUZZ_TARGET_INIT(addrman, initialize_addrman)
     CAddrManDeterministic addr_man;
     addr_man.MakeDeterministic(ConsumeUInt256(fuzzed_data_provider));
     if (fuzzed_data_provider.ConsumeBool()) {
-        addr_man.m_asmap = ConsumeRandomLengthBitVector(fuzzed_data_provider);
-        if (!SanityCheckASMap(addr_man.m_asmap)) {
-            addr_man.m_asmap.clear();
+        const std::vector<bool> asmap = ConsumeRandomLengthBitVector(fuzzed_data_provider);
+        if (SanityCheckASMap(asmap)) {
+            addr_man.SetAsmap(asmap);
         }
     }
     while (fuzzed_data_provider.ConsumeBool()) {
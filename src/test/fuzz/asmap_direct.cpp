@@ -44,6 +44,12 @@ FUZZ_TARGET(asmap_direct)
         }
         // No address input should trigger assertions in interpreter
         std::vector<bool> addr(buffer.begin() + sep_pos + 1, buffer.end());
-        (void)Interpret(asmap, addr);
+        const uint32_t asn = Interpret(asmap, addr);
+        // The compiled asmap must agree with the interpreter
+        std::vector<uint8_t> addr_bytes((addr.size() + 7) / 8);
+        for (size_t i = 0; i < addr.size(); ++i) {
+            addr_bytes[i / 8] |= addr[i] << (7 - i % 8);
+        }
+        assert(CompiledASMap(asmap).Lookup(addr_bytes) == asn);
     }
 }
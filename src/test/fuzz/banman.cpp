@@ -12,6 +12,7 @@
 #include <util/readwritefile.h>
 #include <util/system.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <limits>
@@ -79,7 +80,13 @@ FUZZ_TARGET_INIT(banman, initialize_banman)
                     ban_man.ClearBanned();
                 },
                 [&] {
-                    ban_man.IsBanned(ConsumeNetAddr(fuzzed_data_provider));
+                    const CNetAddr net_addr{ConsumeNetAddr(fuzzed_data_provider)};
+                    banmap_t banmap;
+                    ban_man.GetBanned(banmap);
+                    const bool banned{std::any_of(banmap.begin(), banmap.end(), [&](const auto& entry) {
+                        return GetTime() < entry.second.nBanUntil && entry.first.Match(net_addr);
+                    })};
+                    assert(ban_man.IsBanned(net_addr) == banned);
                 },
                 [&] {
                     ban_man.IsBanned(ConsumeSubNet(fuzzed_data_provider));
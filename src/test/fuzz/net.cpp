@@ -14,6 +14,7 @@
 #include <test/fuzz/util.h>
 #include <test/util/net.h>
 #include <test/util/setup_common.h>
+#include <util/asmap.h>
 
 #include <cstdint>
 #include <optional>
@@ -46,7 +47,7 @@ FUZZ_TARGET_INIT(net, initialize_net)
                     return;
                 }
                 CNodeStats stats;
-                node.copyStats(stats, asmap);
+                node.copyStats(stats, CompiledASMap(asmap));
             },
             [&] {
                 const CNode* add_ref_node = node.AddRef();
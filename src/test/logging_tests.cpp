@@ -5,11 +5,28 @@
 #include <logging.h>
 #include <logging/timer.h>
 #include <test/util/setup_common.h>
+#include <uint256.h>
+#include <util/threadnames.h>
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
 
 #include <boost/test/unit_test.hpp>
 
+namespace {
+//! Formats as the name of the thread that formats it
+enum class ThreadProbe {};
+std::ostream& operator<<(std::ostream& os, ThreadProbe) { return os << util::ThreadGetInternalName(); }
+//! Same, but not deferrable, so formatted by the caller
+struct CallerThreadProbe {};
+std::ostream& operator<<(std::ostream& os, const CallerThreadProbe&) { return os << util::ThreadGetInternalName(); }
+} // namespace
+
 BOOST_FIXTURE_TEST_SUITE(logging_tests, BasicTestingSetup)
 
 BOOST_AUTO_TEST_CASE(logging_timer)
@@ -30,4 +47,107 @@ BOOST_AUTO_TEST_CASE(logging_timer)
     BOOST_CHECK_EQUAL(micro_timer.LogMsg("test micros"), "tests: test micros (1000000.00μs)");
 }
 
+BOOST_AUTO_TEST_CASE(logging_async)
+{
+    BCLog::Logger& logger = LogInstance();
+    std::vector<std::string> lines;
+    // Only called by the writer thread, which holds the logger's lock
+    auto callback = logger.PushBackCallback([&](const std::string& s) { lines.push_back(s); });
+
+    logger.StartAsync();
+    BOOST_CHECK(logger.Async());
+    const std::string str{"str"};
+    LogPrintf("async %d %s %s\n", 1, str, "lit");
+    LogPrintf(std::string{"async %d\n"}.c_str(), 2);
+    LogPrintf("async %s\n", uint256::ONE.GetHex());
+    LogPrintf("async partial ");
+    LogPrintf("line\n");
+    LogPrintf("async %d %d\n", 3);
+    logger.StopAsync();
+    BOOST_CHECK(!logger.Async());
+    LogPrintf("sync %d\n", 4);
+    logger.DeleteCallback(callback);
+
+    BOOST_REQUIRE_EQUAL(lines.size(), 7U);
+    BOOST_CHECK(lines[0].find("async 1 str lit\n") != std::string::npos);
+    BOOST_CHECK(lines[1].find("async 2\n") != std::string::npos);
+    BOOST_CHECK(lines[2].find("async " + uint256::ONE.GetHex() + "\n") != std::string::npos);
+    BOOST_CHECK(lines[3].find("async partial ") != std::string::npos);
+    // A continued line gets no timestamp
+    BOOST_CHECK_EQUAL(lines[4], "line\n");
+    BOOST_CHECK(lines[5].find("Error \"tinyformat: Too many conversion specifiers in format string\" while formatting log message: async %d %d\n") != std::string::npos);
+    BOOST_CHECK(lines[6].find("sync 4\n") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(logging_async_dropped)
+{
+    BCLog::Logger& logger = LogInstance();
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool writer_blocked{false};
+    bool release_writer{false};
+    std::vector<std::string> lines;
+    auto callback = logger.PushBackCallback([&](const std::string& s) {
+        std::unique_lock<std::mutex> lock(mutex);
+        lines.push_back(s);
+        if (s.find("block writer") == std::string::npos) return;
+        writer_blocked = true;
+        cv.notify_all();
+        cv.wait(lock, [&] { return release_writer; });
+    });
+
+    const uint64_t dropped_before{logger.DroppedMessages()};
+    logger.StartAsync();
+    LogPrintf("block writer\n");
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return writer_blocked; });
+    }
+    // Logging must not wait for the blocked writer: what does not fit in the buffer is dropped
+    for (size_t i = 0; i < 2 * LOG_BUFFER_MESSAGES; ++i) {
+        LogPrintf("message %u\n", i);
+    }
+    BOOST_CHECK_EQUAL(logger.DroppedMessages() - dropped_before, LOG_BUFFER_MESSAGES);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        release_writer = true;
+    }
+    cv.notify_all();
+    logger.StopAsync();
+    logger.DeleteCallback(callback);
+
+    // The drops are reported once, after the batch the writer was writing when it noticed them
+    const auto report = std::find_if(lines.begin(), lines.end(), [](const std::string& s) { return s.find("Log buffer full") != std::string::npos; });
+    BOOST_REQUIRE(report != lines.end());
+    BOOST_CHECK(report->find(strprintf("Log buffer full, dropped %u messages\n", LOG_BUFFER_MESSAGES)) != std::string::npos);
+    lines.erase(report);
+    BOOST_REQUIRE_EQUAL(lines.size(), 1 + LOG_BUFFER_MESSAGES);
+    BOOST_CHECK(lines[1].find(strprintf("message %u\n", 0)) != std::string::npos);
+    BOOST_CHECK(lines.back().find(strprintf("message %u\n", LOG_BUFFER_MESSAGES - 1)) != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(logging_async_deferred)
+{
+    BCLog::Logger& logger = LogInstance();
+    std::vector<std::string> lines;
+    auto callback = logger.PushBackCallback([&](const std::string& s) { lines.push_back(s); });
+
+    logger.StartAsync();
+    LogPrintf("formatted on %s\n", ThreadProbe{});
+    {
+        // The format is copied, so it may be gone before the writer formats the message
+        std::string format{"formatted on %s, format copied\n"};
+        LogPrintf(format.c_str(), ThreadProbe{});
+        format.assign(format.size(), 'x');
+    }
+    LogPrintf("formatted on %s\n", CallerThreadProbe{});
+    logger.StopAsync();
+    logger.DeleteCallback(callback);
+
+    BOOST_REQUIRE_EQUAL(lines.size(), 3U);
+    BOOST_CHECK(lines[0].find("formatted on logwriter\n") != std::string::npos);
+    BOOST_CHECK(lines[1].find("formatted on logwriter, format copied\n") != std::string::npos);
+    BOOST_CHECK(lines[2].find("formatted on " + util::ThreadGetInternalName() + "\n") != std::string::npos);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,8 +8,10 @@
 #include <clientversion.h>
 #include <cstdint>
 #include <net.h>
+#include <net_recvbuffer.h>
 #include <netaddress.h>
 #include <netbase.h>
+#include <netmessagemaker.h>
 #include <serialize.h>
 #include <span.h>
 #include <streams.h>
@@ -26,6 +28,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
 using namespace std::literals;
 
@@ -835,4 +838,276 @@ BOOST_AUTO_TEST_CASE(LocalAddress_BasicLifecycle)
     BOOST_CHECK_EQUAL(IsLocal(addr), false);
 }
 
+BOOST_AUTO_TEST_CASE(recv_buffer_pool)
+{
+    RecvBufferPool pool;
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+
+    // Nothing pooled yet
+    BOOST_CHECK(!pool.Acquire(1000, stream));
+
+    // Sizes are rounded up to a size class within the limit only
+    BOOST_CHECK_EQUAL(RecvBufferPool::RoundUp(1000, 1000), 1000U);
+    BOOST_CHECK_EQUAL(RecvBufferPool::RoundUp(1000, 1000000), 4096U);
+    BOOST_CHECK_EQUAL(RecvBufferPool::RoundUp(5000, 1000000), 65536U);
+
+    // A released buffer is handed out again for a payload it can hold, with
+    // the type and version of the stream it replaces
+    CDataStream released(SER_DISK, 0);
+    released.reserve(65536);
+    released << uint32_t{1};
+    pool.Release(std::move(released));
+    BOOST_CHECK_EQUAL(pool.GetPooledCount(), 1U);
+    BOOST_CHECK(pool.GetPooledBytes() >= 65536U);
+    BOOST_CHECK(!pool.Acquire(100000, stream));
+    BOOST_CHECK(pool.Acquire(5000, stream));
+    BOOST_CHECK(stream.empty());
+    BOOST_CHECK(stream.capacity() >= 65536U);
+    BOOST_CHECK_EQUAL(stream.GetType(), SER_NETWORK);
+    BOOST_CHECK_EQUAL(stream.GetVersion(), PROTOCOL_VERSION);
+    BOOST_CHECK_EQUAL(pool.GetPooledCount(), 0U);
+    BOOST_CHECK_EQUAL(pool.GetPooledBytes(), 0U);
+
+    // Buffers smaller than the smallest size class are not pooled
+    CDataStream small(SER_NETWORK, PROTOCOL_VERSION);
+    small.reserve(100);
+    pool.Release(std::move(small));
+    BOOST_CHECK_EQUAL(pool.GetPooledCount(), 0U);
+
+    // Each size class holds a bounded number of buffers
+    for (int i = 0; i < 100; ++i) {
+        CDataStream buffer(SER_NETWORK, PROTOCOL_VERSION);
+        buffer.reserve(4096);
+        pool.Release(std::move(buffer));
+    }
+    BOOST_CHECK_EQUAL(pool.GetPooledCount(), 64U);
+}
+
+BOOST_AUTO_TEST_CASE(recv_buffer_grow)
+{
+    // A large payload received in small chunks takes a few reallocations,
+    // each at most doubling the buffer or going 256 KiB ahead of the data
+    const size_t total{4000000};
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    unsigned int reallocations{0};
+    for (size_t size = 64 * 1024; size < total + 64 * 1024; size += 64 * 1024) {
+        const size_t needed{std::min(size, total)};
+        const size_t capacity{stream.capacity()};
+        if (RecvBufferPool::Grow(stream, needed, total)) ++reallocations;
+        BOOST_CHECK(stream.size() >= needed);
+        BOOST_CHECK(stream.size() <= total);
+        BOOST_CHECK(stream.capacity() <= std::max(2 * capacity, needed + 256 * 1024));
+    }
+    BOOST_CHECK_EQUAL(stream.size(), total);
+    BOOST_CHECK(reallocations <= 5);
+
+    // Nothing to do when the buffer already holds the data
+    BOOST_CHECK(!RecvBufferPool::Grow(stream, total, total));
+}
+
+BOOST_AUTO_TEST_CASE(recv_buffer_reuse)
+{
+    V1TransportDeserializer deserializer{Params(), /* node_id */ 0, SER_NETWORK, INIT_PROTO_VERSION};
+    V1TransportSerializer serializer;
+    const RecvBufferPool::MsgTypeStats& stats{g_recv_buffer_pool.GetMsgTypeStats().at(NetMsgType::TX)};
+
+    const auto receive = [&] {
+        CSerializedNetMsg msg{CNetMsgMaker{INIT_PROTO_VERSION}.Make(NetMsgType::TX, std::vector<uint8_t>(3000, 0x42))};
+        std::vector<unsigned char> header;
+        serializer.prepareForTransport(msg, header);
+        Span<const uint8_t> header_bytes{header};
+        Span<const uint8_t> data_bytes{msg.data};
+        while (!header_bytes.empty()) BOOST_REQUIRE(deserializer.Read(header_bytes) > 0);
+        while (!data_bytes.empty()) BOOST_REQUIRE(deserializer.Read(data_bytes) > 0);
+        BOOST_REQUIRE(deserializer.Complete());
+        uint32_t err_raw_size{0};
+        std::optional<CNetMessage> received{deserializer.GetMessage(std::chrono::microseconds{0}, err_raw_size)};
+        BOOST_REQUIRE(received);
+        BOOST_CHECK_EQUAL(received->m_command, NetMsgType::TX);
+        BOOST_CHECK_EQUAL(received->m_message_size, msg.data.size());
+        BOOST_CHECK(std::equal(received->m_recv.begin(), received->m_recv.end(), msg.data.begin()));
+    };
+
+    // The first message's buffer is allocated once, rounded up to a size class,
+    // and returned to the pool after the message is gone
+    receive();
+    const uint64_t messages{stats.messages};
+    const uint64_t reused{stats.reused};
+    const uint64_t allocations{stats.allocations};
+    BOOST_CHECK(g_recv_buffer_pool.GetPooledCount() > 0);
+
+    // The second message is received into the pooled buffer, without allocating
+    receive();
+    BOOST_CHECK_EQUAL(stats.messages, messages + 1);
+    BOOST_CHECK_EQUAL(stats.reused, reused + 1);
+    BOOST_CHECK_EQUAL(stats.allocations, allocations);
+}
+
+namespace {
+/** Feed bytes to a deserializer, returning the messages completed (nullopt if it fails) */
+std::optional<std::vector<CNetMessage>> ReceiveBytes(TransportDeserializer& deserializer, Span<const uint8_t> bytes, size_t chunk_size)
+{
+    std::vector<CNetMessage> messages;
+    while (!bytes.empty()) {
+        Span<const uint8_t> chunk{bytes.first(std::min(chunk_size, bytes.size()))};
+        bytes = bytes.subspan(chunk.size());
+        while (!chunk.empty()) {
+            if (deserializer.Read(chunk) < 0) return std::nullopt;
+            if (deserializer.Complete()) {
+                uint32_t err_raw_size{0};
+                std::optional<CNetMessage> msg{deserializer.GetMessage(std::chrono::microseconds{0}, err_raw_size)};
+                if (msg) messages.push_back(std::move(*msg));
+            }
+        }
+    }
+    return messages;
+}
+
+/** Prepare a message for a serializer, returning the bytes to send */
+std::vector<unsigned char> PrepareBytes(TransportSerializer& serializer, CSerializedNetMsg&& msg)
+{
+    std::vector<unsigned char> bytes;
+    serializer.prepareForTransport(msg, bytes);
+    bytes.insert(bytes.end(), msg.Payload().begin(), msg.Payload().end());
+    return bytes;
+}
+} // namespace
+
+BOOST_AUTO_TEST_CASE(v2_transport)
+{
+    const CNetMsgMaker msg_maker{INIT_PROTO_VERSION};
+    auto initiator_session = std::make_shared<V2TransportSession>(Params(), /* initiator */ true);
+    auto responder_session = std::make_shared<V2TransportSession>(Params(), /* initiator */ false);
+    V2TransportSerializer initiator_serializer{initiator_session}, responder_serializer{responder_session};
+    V2TransportDeserializer initiator_deserializer{initiator_session, Params(), /* node_id */ 0, SER_NETWORK, INIT_PROTO_VERSION};
+    V2TransportDeserializer responder_deserializer{responder_session, Params(), /* node_id */ 1, SER_NETWORK, INIT_PROTO_VERSION};
+
+    // The initiator's first message is held back; only its public key is sent
+    std::vector<unsigned char> to_responder{PrepareBytes(initiator_serializer, msg_maker.Make(NetMsgType::VERSION, std::vector<uint8_t>(100, 0x01)))};
+    BOOST_CHECK_EQUAL(to_responder.size(), V2TransportSession::KEY_SIZE);
+    BOOST_CHECK_EQUAL(initiator_serializer.GetTransportType(), "v2");
+    BOOST_CHECK_EQUAL(initiator_serializer.GetSessionId(), "");
+
+    // A peer closing the connection now may not speak v2 after all
+    BOOST_CHECK(initiator_deserializer.ShouldReconnectV1());
+    BOOST_CHECK(!responder_deserializer.ShouldReconnectV1());
+
+    // Receiving it, the responder completes the key exchange and has its own key to send
+    auto received{ReceiveBytes(responder_deserializer, to_responder, 7)};
+    BOOST_REQUIRE(received && received->empty());
+    BOOST_REQUIRE(responder_serializer.HasTransportBytes());
+    std::vector<unsigned char> to_initiator;
+    responder_serializer.GetTransportBytes(to_initiator);
+    BOOST_CHECK_EQUAL(to_initiator.size(), V2TransportSession::KEY_SIZE);
+    BOOST_CHECK(!responder_serializer.HasTransportBytes());
+
+    // Then the initiator can send the held back message, encrypted
+    received = ReceiveBytes(initiator_deserializer, to_initiator, 1);
+    BOOST_REQUIRE(received && received->empty());
+    BOOST_CHECK(!initiator_deserializer.ShouldReconnectV1());
+    BOOST_REQUIRE(initiator_serializer.HasTransportBytes());
+    to_responder.clear();
+    initiator_serializer.GetTransportBytes(to_responder);
+    BOOST_CHECK_EQUAL(to_responder.size(), V2TransportSession::LENGTH_SIZE + 1 + strlen(NetMsgType::VERSION) + 101 + V2TransportSession::TAG_SIZE);
+    BOOST_CHECK_EQUAL(initiator_serializer.GetSessionId(), responder_serializer.GetSessionId());
+    BOOST_CHECK(!initiator_serializer.GetSessionId().empty());
+
+    // Messages arrive intact in either direction, however the bytes are split up
+    const std::vector<uint8_t> data(300000, 0x42);
+    for (size_t chunk_size : {1, 1000, 1000000}) {
+        std::vector<unsigned char> bytes{PrepareBytes(initiator_serializer, msg_maker.Make(NetMsgType::BLOCK, data))};
+        const auto pong{PrepareBytes(initiator_serializer, msg_maker.Make(NetMsgType::PONG, uint64_t{7}))};
+        bytes.insert(bytes.end(), pong.begin(), pong.end());
+        if (chunk_size == 1) bytes.insert(bytes.begin(), to_responder.begin(), to_responder.end());
+        received = ReceiveBytes(responder_deserializer, bytes, chunk_size);
+        BOOST_REQUIRE(received);
+        BOOST_REQUIRE_EQUAL(received->size(), chunk_size == 1 ? 3U : 2U);
+        const CNetMessage& block = received->at(received->size() - 2);
+        BOOST_CHECK_EQUAL(block.m_command, NetMsgType::BLOCK);
+        BOOST_CHECK_EQUAL(block.m_message_size, data.size() + GetSizeOfCompactSize(data.size()));
+        BOOST_CHECK(std::equal(block.m_recv.begin() + GetSizeOfCompactSize(data.size()), block.m_recv.end(), data.begin(), data.end()));
+        BOOST_CHECK_EQUAL(received->back().m_command, NetMsgType::PONG);
+
+        received = ReceiveBytes(initiator_deserializer, PrepareBytes(responder_serializer, msg_maker.Make(NetMsgType::PING, uint64_t{7})), chunk_size);
+        BOOST_REQUIRE(received && received->size() == 1);
+        BOOST_CHECK_EQUAL(received->front().m_command, NetMsgType::PING);
+    }
+
+    // A modified packet fails authentication
+    std::vector<unsigned char> bytes{PrepareBytes(initiator_serializer, msg_maker.Make(NetMsgType::PING, uint64_t{7}))};
+    bytes[V2TransportSession::LENGTH_SIZE + 2] ^= 1;
+    BOOST_CHECK(!ReceiveBytes(responder_deserializer, bytes, 100));
+}
+
+BOOST_AUTO_TEST_CASE(v2_transport_v1_peer)
+{
+    const CNetMsgMaker msg_maker{INIT_PROTO_VERSION};
+    auto session = std::make_shared<V2TransportSession>(Params(), /* initiator */ false);
+    V2TransportSerializer serializer{session};
+    V2TransportDeserializer deserializer{session, Params(), /* node_id */ 0, SER_NETWORK, INIT_PROTO_VERSION};
+    V1TransportSerializer v1_serializer;
+
+    // A responder falls back to v1 when the peer starts with a version message
+    std::vector<unsigned char> bytes{PrepareBytes(v1_serializer, msg_maker.Make(NetMsgType::VERSION, std::vector<uint8_t>(100, 0x01)))};
+    const auto verack{PrepareBytes(v1_serializer, msg_maker.Make(NetMsgType::VERACK))};
+    bytes.insert(bytes.end(), verack.begin(), verack.end());
+    for (size_t chunk_size : {1, 1000}) {
+        auto received{ReceiveBytes(deserializer, bytes, chunk_size)};
+        BOOST_REQUIRE(received && received->size() == 2);
+        BOOST_CHECK_EQUAL(received->front().m_command, NetMsgType::VERSION);
+        BOOST_CHECK_EQUAL(received->back().m_command, NetMsgType::VERACK);
+    }
+    BOOST_CHECK_EQUAL(serializer.GetTransportType(), "v1");
+    BOOST_CHECK(!serializer.HasTransportBytes());
+
+    // and sends in v1 as well
+    BOOST_CHECK(PrepareBytes(serializer, msg_maker.Make(NetMsgType::VERACK)) == verack);
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(send_shared_payload)
+{
+    CAddrMan addrman;
+    CConnman connman{0x1337, 0x1337, addrman};
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    CNode node{/* id */ 0, NODE_NETWORK, static_cast<SOCKET>(fds[0]), CAddress{}, /* nKeyedNetGroupIn */ 0,
+               /* nLocalHostNonceIn */ 0, CAddress{}, /* pszDest */ "", ConnectionType::OUTBOUND_FULL_RELAY,
+               /* inbound_onion */ false};
+    const CNetMsgMaker msg_maker{PROTOCOL_VERSION};
+    V1TransportSerializer serializer;
+
+    // One serialization is shared by several messages; they are sent together
+    // with their headers and an unshared message in between
+    CSerializedNetMsg original{msg_maker.Make(NetMsgType::TX, std::vector<uint8_t>(5000, 0x42))};
+    std::vector<unsigned char> expected;
+    for (int i = 0; i < 3; ++i) {
+        CSerializedNetMsg msg{i == 1 ? msg_maker.Make(NetMsgType::PING, uint64_t{42}) : original.Share()};
+        std::vector<unsigned char> header;
+        serializer.prepareForTransport(msg, header);
+        expected.insert(expected.end(), header.begin(), header.end());
+        expected.insert(expected.end(), msg.Payload().begin(), msg.Payload().end());
+        connman.PushMessage(&node, std::move(msg));
+    }
+    BOOST_CHECK(original.data.empty());
+    BOOST_REQUIRE(original.m_shared_data);
+    BOOST_CHECK_EQUAL(original.Payload().size(), 5000U + GetSizeOfCompactSize(5000));
+
+    std::vector<unsigned char> received(expected.size());
+    size_t received_size{0};
+    while (received_size < received.size()) {
+        const ssize_t ret{recv(fds[1], received.data() + received_size, received.size() - received_size, 0)};
+        BOOST_REQUIRE(ret > 0);
+        received_size += ret;
+    }
+    BOOST_CHECK(received == expected);
+
+    // Sent buffers are released, including the references to the shared payload
+    BOOST_CHECK(WITH_LOCK(node.cs_vSend, return node.vSendMsg.empty()));
+    BOOST_CHECK_EQUAL(WITH_LOCK(node.cs_vSend, return node.nSendSize), 0U);
+    BOOST_CHECK_EQUAL(original.m_shared_data.use_count(), 1);
+    close(fds[1]);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include <serialize.h>
 #include <streams.h>
 #include <test/util/setup_common.h>
+#include <util/asmap.h>
 #include <util/strencodings.h>
 #include <util/translation.h>
 #include <version.h>
@@ -315,7 +316,7 @@ BOOST_AUTO_TEST_CASE(subnet_test)
 
 BOOST_AUTO_TEST_CASE(netbase_getgroup)
 {
-    std::vector<bool> asmap; // use /16
+    CompiledASMap asmap; // use /16
     BOOST_CHECK(ResolveIP("127.0.0.1").GetGroup(asmap) == std::vector<unsigned char>({0})); // Local -> !Routable()
     BOOST_CHECK(ResolveIP("257.0.0.1").GetGroup(asmap) == std::vector<unsigned char>({0})); // !Valid -> !Routable()
     BOOST_CHECK(ResolveIP("10.0.0.1").GetGroup(asmap) == std::vector<unsigned char>({0})); // RFC1918 -> !Routable()
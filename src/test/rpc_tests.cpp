@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <rpc/client.h>
+#include <rpc/jsonwriter.h>
 #include <rpc/server.h>
 #include <rpc/util.h>
 
@@ -11,8 +12,10 @@
 #include <node/context.h>
 #include <test/util/setup_common.h>
 #include <util/time.h>
+#include <validation.h>
 
 #include <any>
+#include <thread>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/test/unit_test.hpp>
@@ -24,10 +27,10 @@
 class RPCTestingSetup : public TestingSetup
 {
 public:
-    UniValue CallRPC(std::string args);
+    UniValue CallRPC(std::string args, JSONStreamWriter* writer = nullptr);
 };
 
-UniValue RPCTestingSetup::CallRPC(std::string args)
+UniValue RPCTestingSetup::CallRPC(std::string args, JSONStreamWriter* writer)
 {
     std::vector<std::string> vArgs;
     boost::split(vArgs, args, boost::is_any_of(" \t"));
@@ -37,6 +40,7 @@ UniValue RPCTestingSetup::CallRPC(std::string args)
     request.context = &m_node;
     request.strMethod = strMethod;
     request.params = RPCConvertValues(strMethod, vArgs);
+    request.result_writer = writer;
     if (RPCIsInWarmup(nullptr)) SetRPCWarmupFinished();
     try {
         UniValue result = tableRPC.execute(request);
@@ -473,4 +477,113 @@ BOOST_AUTO_TEST_CASE(help_example)
     BOOST_CHECK_NE(HelpExampleRpcNamed("foo", {{"arg", true}}), HelpExampleRpcNamed("foo", {{"arg", "true"}}));
 }
 
+BOOST_AUTO_TEST_CASE(json_stream_writer)
+{
+    UniValue doc(UniValue::VOBJ);
+    doc.pushKV("a", 1);
+    doc.pushKV("b\"", "x\n");
+    UniValue arr(UniValue::VARR);
+    arr.push_back(UniValue(UniValue::VOBJ));
+    arr.push_back(UniValue(UniValue::VARR));
+    arr.push_back(NullUniValue);
+    arr.push_back(true);
+    doc.pushKV("c", arr);
+
+    std::string out;
+    int chunks{0};
+    const auto sink = [&](Span<const char> chunk) {
+        out.append(chunk.begin(), chunk.end());
+        ++chunks;
+    };
+    JSONStreamWriter writer{sink};
+    BOOST_CHECK(writer.ExpectsValue());
+    writer.BeginObject();
+    BOOST_CHECK(!writer.ExpectsValue());
+    writer.Key("a");
+    BOOST_CHECK(writer.ExpectsValue());
+    writer.Value(1);
+    writer.Key("b\"");
+    writer.Value("x\n");
+    writer.Key("c");
+    writer.BeginArray();
+    writer.BeginObject();
+    writer.EndObject();
+    writer.BeginArray();
+    writer.EndArray();
+    writer.Value(NullUniValue);
+    writer.Value(true);
+    writer.EndArray();
+    writer.EndObject();
+    BOOST_CHECK(!writer.ExpectsValue());
+    BOOST_CHECK_EQUAL(chunks, 0);
+    BOOST_CHECK_EQUAL(writer.TakeBuffered(), doc.write());
+
+    // Larger output is passed on in chunks
+    JSONStreamWriter large{sink};
+    arr.setArray();
+    large.BeginArray();
+    for (int i = 0; i < 100000; ++i) {
+        arr.push_back(i);
+        large.Value(i);
+    }
+    large.EndArray();
+    BOOST_CHECK_GT(chunks, 1);
+    out += large.TakeBuffered();
+    BOOST_CHECK_EQUAL(out, arr.write());
+
+    // Misuse is caught
+    JSONStreamWriter bad{sink};
+    bad.BeginObject();
+    BOOST_CHECK_THROW(bad.Value(1), NonFatalCheckError);
+    BOOST_CHECK_THROW(bad.EndArray(), NonFatalCheckError);
+    bad.Key("k");
+    BOOST_CHECK_THROW(bad.Key("l"), NonFatalCheckError);
+    BOOST_CHECK_THROW(bad.EndObject(), NonFatalCheckError);
+    bad.Value(1);
+    bad.EndObject();
+    BOOST_CHECK_THROW(bad.Value(1), NonFatalCheckError);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_result_writer)
+{
+    // Methods that can stream their result write what they would otherwise return
+    const std::string genesis{WITH_LOCK(::cs_main, return m_node.chainman->ActiveChain().Genesis()->GetBlockHash().GetHex())};
+    for (const std::string& args : {"getblock " + genesis + " 1", "getblock " + genesis + " 2", std::string{"getrawmempool false"}, std::string{"getrawmempool true"}}) {
+        std::string streamed;
+        JSONStreamWriter writer{[&](Span<const char> chunk) { streamed.append(chunk.begin(), chunk.end()); }};
+        BOOST_CHECK(CallRPC(args, &writer).isNull());
+        streamed += writer.TakeBuffered();
+        BOOST_CHECK_EQUAL(streamed, CallRPC(args).write());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch_parallel)
+{
+    if (RPCIsInWarmup(nullptr)) SetRPCWarmupFinished();
+    UniValue batch(UniValue::VARR);
+    for (int i = 0; i < 100; ++i) {
+        UniValue params(UniValue::VARR);
+        params.push_back(i);
+        batch.push_back(JSONRPCRequestObj("echo", params, i));
+    }
+    batch.push_back(JSONRPCRequestObj("nosuchmethod", UniValue(UniValue::VARR), 100));
+    JSONRPCRequest request;
+    request.context = &m_node;
+    const std::string sequential{JSONRPCExecBatch(request, batch)};
+
+    // Entries executed by several threads are replied to in order
+    std::vector<std::thread> threads;
+    const RPCTaskRunner run_task{[&](std::function<void()> task) {
+        threads.emplace_back(std::move(task));
+        return true;
+    }};
+    const std::string parallel{JSONRPCExecBatch(request, batch, run_task, 8)};
+    for (auto& thread : threads) thread.join();
+    BOOST_CHECK_EQUAL(threads.size(), 7U);
+    BOOST_CHECK_EQUAL(parallel, sequential);
+
+    // The calling thread does all the work if no helper can be started
+    BOOST_CHECK_EQUAL(JSONRPCExecBatch(request, batch, [](std::function<void()>) { return false; }, 8), sequential);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,7 +8,9 @@
 
 #include <boost/test/unit_test.hpp>
 
+#include <atomic>
 #include <functional>
+#include <future>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -169,6 +171,37 @@ BOOST_AUTO_TEST_CASE(singlethreadedscheduler_ordered)
     BOOST_CHECK_EQUAL(counter2, 100);
 }
 
+BOOST_AUTO_TEST_CASE(singlethreadedscheduler_suspend)
+{
+    CScheduler scheduler;
+    std::thread thread{[&] { scheduler.serviceQueue(); }};
+    SingleThreadedSchedulerClient queue(&scheduler);
+    BOOST_CHECK(queue.IsIdle());
+
+    std::promise<void> suspended;
+    std::atomic<int> counter{0};
+    queue.AddToProcessQueue([&] { ++counter; });
+    queue.AddSuspendingCallback([&] { suspended.set_value(); });
+    queue.AddToProcessQueue([&] { ++counter; });
+    suspended.get_future().wait();
+
+    // Callbacks after the suspending one only run once the queue is resumed
+    UninterruptibleSleep(std::chrono::milliseconds{10});
+    BOOST_CHECK_EQUAL(counter, 1);
+    BOOST_CHECK_EQUAL(queue.CallbacksPending(), 1U);
+    BOOST_CHECK(!queue.IsIdle());
+
+    std::promise<void> done;
+    queue.AddToProcessQueue([&] { done.set_value(); });
+    queue.Resume();
+    done.get_future().wait();
+    BOOST_CHECK_EQUAL(counter, 2);
+
+    scheduler.StopWhenDrained();
+    thread.join();
+    BOOST_CHECK(queue.IsIdle());
+}
+
 BOOST_AUTO_TEST_CASE(mockforward)
 {
     CScheduler scheduler;
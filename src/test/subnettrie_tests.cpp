@@ -0,0 +1,125 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <netaddress.h>
+#include <netbase.h>
+#include <subnettrie.h>
+
+#include <test/util/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+BOOST_FIXTURE_TEST_SUITE(subnettrie_tests, BasicTestingSetup)
+
+static CNetAddr ResolveIP(const std::string& ip)
+{
+    CNetAddr addr;
+    BOOST_REQUIRE(LookupHost(ip, addr, false));
+    return addr;
+}
+
+static CSubNet ResolveSubNet(const std::string& subnet)
+{
+    CSubNet ret;
+    BOOST_REQUIRE(LookupSubNet(subnet, ret));
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(subnettrie_match)
+{
+    SubNetTrie<int> trie;
+    trie.Insert(ResolveSubNet("1.2.0.0/16"), 16);
+    trie.Insert(ResolveSubNet("1.2.3.0/24"), 24);
+    trie.Insert(ResolveSubNet("1.2.3.4"), 32);
+    trie.Insert(ResolveSubNet("1.3.0.0/16"), 116);
+    trie.Insert(ResolveSubNet("2001:db8::/32"), 32);
+    trie.Insert(CSubNet(ResolveIP("pg6mmjiyjmcrsslvykfwnntlaru7p5svn6y2ymmju6nubxndf4pscryd.onion")), 1);
+    trie.Insert(CSubNet{}, 0);
+    BOOST_CHECK_EQUAL(trie.Size(), 6U);
+
+    BOOST_CHECK_EQUAL(*trie.LongestMatch(ResolveIP("1.2.3.4")), 32);
+    BOOST_CHECK_EQUAL(*trie.LongestMatch(ResolveIP("1.2.3.5")), 24);
+    BOOST_CHECK_EQUAL(*trie.LongestMatch(ResolveIP("1.2.4.5")), 16);
+    BOOST_CHECK_EQUAL(*trie.LongestMatch(ResolveIP("1.3.4.5")), 116);
+    BOOST_CHECK(!trie.LongestMatch(ResolveIP("1.4.0.1")));
+    BOOST_CHECK_EQUAL(*trie.LongestMatch(ResolveIP("2001:db8::1")), 32);
+    BOOST_CHECK_EQUAL(*trie.LongestMatch(ResolveIP("pg6mmjiyjmcrsslvykfwnntlaru7p5svn6y2ymmju6nubxndf4pscryd.onion")), 1);
+    // As with CSubNet::Match, IPv6 subnets don't contain IPv4-mapped addresses
+    trie.Insert(ResolveSubNet("::/0"), 0);
+    BOOST_CHECK(!trie.LongestMatch(ResolveIP("1.4.0.1")));
+    BOOST_CHECK(!trie.LongestMatch(ResolveIP("::ffff:1.4.0.1")));
+    BOOST_CHECK_EQUAL(*trie.LongestMatch(ResolveIP("2002::1")), 0);
+
+    // All matches are visited, from the shortest prefix
+    std::vector<int> matches;
+    trie.AnyMatch(ResolveIP("1.2.3.4"), [&](int value) {
+        matches.push_back(value);
+        return false;
+    });
+    BOOST_CHECK(matches == std::vector<int>({16, 24, 32}));
+    BOOST_CHECK(trie.AnyMatch(ResolveIP("1.2.3.4"), [](int value) { return value == 24; }));
+    BOOST_CHECK(!trie.AnyMatch(ResolveIP("1.2.3.5"), [](int value) { return value == 32; }));
+
+    // Replacing and erasing
+    trie.Insert(ResolveSubNet("1.2.3.0/24"), 25);
+    BOOST_CHECK_EQUAL(*trie.LongestMatch(ResolveIP("1.2.3.5")), 25);
+    BOOST_CHECK(trie.Erase(ResolveSubNet("1.2.3.0/24")));
+    BOOST_CHECK(!trie.Erase(ResolveSubNet("1.2.3.0/24")));
+    BOOST_CHECK(!trie.Erase(ResolveSubNet("1.2.0.0/15")));
+    BOOST_CHECK_EQUAL(*trie.LongestMatch(ResolveIP("1.2.3.5")), 16);
+    BOOST_CHECK_EQUAL(*trie.LongestMatch(ResolveIP("1.2.3.4")), 32);
+    BOOST_CHECK_EQUAL(trie.Size(), 6U);
+    trie.Clear();
+    BOOST_CHECK_EQUAL(trie.Size(), 0U);
+    BOOST_CHECK(!trie.LongestMatch(ResolveIP("1.2.3.4")));
+}
+
+BOOST_AUTO_TEST_CASE(subnettrie_random)
+{
+    // Compare with testing every subnet, for subnets that share prefixes
+    const auto random_addr = [](bool ipv4) {
+        if (ipv4) {
+            in_addr addr;
+            const uint32_t bits{htonl(0x0a000000U | (InsecureRand32() & 0xF0F0F))};
+            memcpy(&addr, &bits, sizeof(addr));
+            return CNetAddr{addr};
+        }
+        in6_addr addr{};
+        addr.s6_addr[0] = 0x20;
+        addr.s6_addr[1] = InsecureRandBits(2);
+        addr.s6_addr[8] = InsecureRandBits(3);
+        addr.s6_addr[15] = InsecureRandBits(2);
+        return CNetAddr{addr};
+    };
+
+    SubNetTrie<int> trie;
+    std::map<CSubNet, int> subnets;
+    for (int i = 0; i < 3000; ++i) {
+        const bool ipv4{InsecureRandBool()};
+        const CSubNet subnet(random_addr(ipv4), InsecureRandRange(ipv4 ? 33 : 129));
+        if (InsecureRandRange(3) == 0) {
+            BOOST_CHECK_EQUAL(trie.Erase(subnet), subnets.erase(subnet) > 0);
+        } else {
+            trie.Insert(subnet, i);
+            subnets[subnet] = i;
+        }
+        BOOST_CHECK_EQUAL(trie.Size(), subnets.size());
+
+        const CNetAddr addr{random_addr(InsecureRandBool())};
+        const CSubNet* longest{nullptr};
+        for (const auto& [subnet, value] : subnets) {
+            if (subnet.Match(addr) && (!longest || subnet.GetPrefixLength() > longest->GetPrefixLength())) longest = &subnet;
+        }
+        const int* match{trie.LongestMatch(addr)};
+        BOOST_CHECK_EQUAL(match != nullptr, longest != nullptr);
+        if (match && longest) BOOST_CHECK_EQUAL(*match, subnets[*longest]);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,13 +2,22 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
 #include <sync.h>
 #include <test/util/setup_common.h>
 
 #include <boost/test/unit_test.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <mutex>
+#include <numeric>
 #include <stdexcept>
+#include <thread>
 
 namespace {
 template <typename MutexType>
@@ -140,4 +149,104 @@ BOOST_AUTO_TEST_CASE(inconsistent_lock_order_detected)
 #endif // DEBUG_LOCKORDER
 }
 
+BOOST_AUTO_TEST_CASE(lock_wait_tracker)
+{
+    Mutex mutex, other_mutex;
+    LockWaitTracker tracker{&mutex};
+    {
+        LockWaitTracker other_tracker{&other_mutex};
+        // Uncontended
+        { LOCK(mutex); }
+        BOOST_CHECK_EQUAL(tracker.Contended(), 0U);
+
+        std::atomic<bool> locked{false};
+        std::thread holder([&] {
+            LOCK(mutex);
+            locked = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds{20});
+        });
+        while (!locked) std::this_thread::yield();
+        { LOCK(mutex); }
+        holder.join();
+        BOOST_CHECK_EQUAL(other_tracker.Contended(), 0U);
+        BOOST_CHECK(other_tracker.Waited() == std::chrono::nanoseconds{0});
+    }
+#if defined(HAVE_THREAD_LOCAL)
+    BOOST_CHECK_EQUAL(tracker.Contended(), 1U);
+    BOOST_CHECK(tracker.Waited() > std::chrono::milliseconds{1});
+#endif
+}
+
+static std::vector<LockSiteStats> SitesOf(const std::string& mutex)
+{
+    std::vector<LockSiteStats> sites{GetLockStats()};
+    sites.erase(std::remove_if(sites.begin(), sites.end(), [&](const LockSiteStats& site) { return site.mutex != mutex; }), sites.end());
+    return sites;
+}
+
+BOOST_AUTO_TEST_CASE(lock_stats)
+{
+    Mutex mutex{"sync_tests::mutex"};
+    Mutex unnamed;
+
+    for (int i = 0; i < 3; ++i) {
+        LOCK(mutex);
+    }
+    {
+        WAIT_LOCK(mutex, lock);
+    }
+    { LOCK(unnamed); }
+
+    std::vector<LockSiteStats> sites{SitesOf("sync_tests::mutex")};
+    BOOST_REQUIRE_EQUAL(sites.size(), 2U);
+    for (const LockSiteStats& site : sites) {
+        BOOST_CHECK_EQUAL(site.file.substr(site.file.size() - std::string{"sync_tests.cpp"}.size()), "sync_tests.cpp");
+        BOOST_CHECK_EQUAL(site.wait.count, 0U);
+        if (site.hold_timed) {
+            BOOST_CHECK_EQUAL(site.lock, "mutex");
+            BOOST_CHECK_EQUAL(site.acquisitions, 3U);
+            BOOST_CHECK_EQUAL(site.hold.count, 3U);
+        } else {
+            // WAIT_LOCK counts acquisitions, but does not time the hold
+            BOOST_CHECK_EQUAL(site.acquisitions, 1U);
+            BOOST_CHECK_EQUAL(site.hold.count, 0U);
+        }
+    }
+    BOOST_CHECK_EQUAL(SitesOf("unnamed").size(), 1U);
+
+    std::atomic<bool> locked{false};
+    std::thread holder([&] {
+        LOCK(mutex);
+        locked = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds{20});
+    });
+    while (!locked) std::this_thread::yield();
+    { LOCK(mutex); }
+    holder.join();
+
+    uint64_t acquisitions{0}, contentions{0};
+    LockSiteStats::Times wait, hold;
+    for (const LockSiteStats& site : SitesOf("sync_tests::mutex")) {
+        acquisitions += site.acquisitions;
+        contentions += site.wait.count;
+        wait.Add(site.wait);
+        hold.Add(site.hold);
+    }
+    BOOST_CHECK_EQUAL(acquisitions, 6U);
+    BOOST_CHECK_EQUAL(contentions, 1U);
+    BOOST_CHECK(wait.total > std::chrono::milliseconds{1});
+    BOOST_CHECK(wait.max == wait.total);
+    BOOST_CHECK(hold.max >= std::chrono::milliseconds{20});
+    BOOST_CHECK_EQUAL(std::accumulate(hold.buckets.begin(), hold.buckets.end(), uint64_t{0}), hold.count);
+    // 20ms falls in the bucket up to 100ms
+    BOOST_CHECK(hold.buckets[5] >= 1U);
+
+    ResetLockStats();
+    for (const LockSiteStats& site : SitesOf("sync_tests::mutex")) {
+        BOOST_CHECK_EQUAL(site.acquisitions, 0U);
+        BOOST_CHECK_EQUAL(site.wait.count, 0U);
+        BOOST_CHECK(site.hold.total == std::chrono::nanoseconds{0});
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,281 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <pinsketch.h>
+#include <protocol.h>
+#include <txreconciliation.h>
+
+#include <test/util/setup_common.h>
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <set>
+
+BOOST_FIXTURE_TEST_SUITE(txreconciliation_tests, BasicTestingSetup)
+
+static std::set<uint32_t> RandomElements(size_t count)
+{
+    std::set<uint32_t> elements;
+    while (elements.size() < count) {
+        const uint32_t element{InsecureRand32()};
+        if (element != 0) elements.insert(element);
+    }
+    return elements;
+}
+
+BOOST_AUTO_TEST_CASE(pinsketch_decode)
+{
+    for (size_t capacity = 1; capacity <= 32; capacity += 7) {
+        for (size_t count = 0; count < capacity; ++count) {
+            // Elements in both sketches cancel out
+            const std::set<uint32_t> common{RandomElements(20)};
+            const std::set<uint32_t> difference{RandomElements(count)};
+            PinSketch sketch(capacity), other(capacity + 3);
+            for (const uint32_t element : common) {
+                sketch.Add(element);
+                other.Add(element);
+            }
+            for (const uint32_t element : difference) {
+                (InsecureRandBool() ? sketch : other).Add(element);
+            }
+            sketch.Merge(other);
+            BOOST_CHECK_EQUAL(sketch.Capacity(), capacity);
+
+            const auto deserialized{PinSketch::Deserialize(sketch.Serialize())};
+            BOOST_REQUIRE(deserialized);
+            BOOST_CHECK(*deserialized == sketch);
+            const auto decoded{deserialized->Decode(capacity)};
+            BOOST_REQUIRE(decoded);
+            BOOST_CHECK(std::set<uint32_t>(decoded->begin(), decoded->end()) == difference);
+        }
+    }
+
+    // Too many elements to decode: a margin of one makes false positives negligible
+    for (int i = 0; i < 20; ++i) {
+        PinSketch sketch(10);
+        for (const uint32_t element : RandomElements(10 + InsecureRandRange(10))) {
+            sketch.Add(element);
+        }
+        BOOST_CHECK(!sketch.Decode(9));
+    }
+
+    BOOST_CHECK(!PinSketch::Deserialize(std::vector<unsigned char>(7)));
+}
+
+BOOST_AUTO_TEST_CASE(txreconciliation_register)
+{
+    TxReconciliationTracker tracker;
+    // A peer can only register after we sent it our salt
+    BOOST_CHECK(!tracker.RegisterPeer(/* peer_id */ 0, /* is_peer_inbound */ true, TXRECONCILIATION_VERSION, 1));
+    tracker.PreRegisterPeer(0);
+    BOOST_CHECK(!tracker.RegisterPeer(0, true, /* peer_recon_version */ 0, 1));
+    BOOST_CHECK(!tracker.IsPeerRegistered(0));
+
+    tracker.PreRegisterPeer(1);
+    BOOST_CHECK(tracker.RegisterPeer(1, true, TXRECONCILIATION_VERSION + 1, 1));
+    BOOST_CHECK(tracker.IsPeerRegistered(1));
+    BOOST_CHECK(tracker.AddToSet(1, InsecureRand256()));
+    tracker.ForgetPeer(1);
+    BOOST_CHECK(!tracker.IsPeerRegistered(1));
+    BOOST_CHECK(!tracker.AddToSet(1, InsecureRand256()));
+}
+
+/** An initiator and a responder that registered each other, as peer 0 of each other. */
+struct ReconcilingPeers {
+    TxReconciliationTracker initiator;
+    TxReconciliationTracker responder;
+    /** Payload bytes sent for reconciliation, without the announcements */
+    size_t m_bytes{0};
+
+    ReconcilingPeers()
+    {
+        const uint64_t initiator_salt{initiator.PreRegisterPeer(0)};
+        const uint64_t responder_salt{responder.PreRegisterPeer(0)};
+        BOOST_REQUIRE(initiator.RegisterPeer(0, /* is_peer_inbound */ false, TXRECONCILIATION_VERSION, responder_salt));
+        BOOST_REQUIRE(responder.RegisterPeer(0, /* is_peer_inbound */ true, TXRECONCILIATION_VERSION, initiator_salt));
+    }
+
+    /**
+     * Run one reconciliation; return the wtxids the initiator announces and
+     * the ones the responder announces.
+     */
+    std::pair<std::vector<uint256>, std::vector<uint256>> Reconcile(std::chrono::microseconds& now)
+    {
+        BOOST_REQUIRE(!initiator.MaybeRequestReconciliation(0, now));
+        now += RECON_REQUEST_INTERVAL;
+        const auto request{initiator.MaybeRequestReconciliation(0, now)};
+        BOOST_REQUIRE(request);
+        // A request is outstanding
+        BOOST_CHECK(!initiator.MaybeRequestReconciliation(0, now + RECON_REQUEST_INTERVAL));
+        m_bytes += 4;
+
+        const auto sketch{responder.HandleReconciliationRequest(0, request->first, request->second, now)};
+        BOOST_REQUIRE(sketch);
+        m_bytes += GetSizeOfCompactSize(sketch->size()) + sketch->size();
+
+        auto difference{initiator.HandleSketch(0, *sketch)};
+        BOOST_REQUIRE(difference);
+        m_bytes += 1 + GetSizeOfCompactSize(difference->m_ask_shortids.size()) + 4 * difference->m_ask_shortids.size();
+
+        const auto responder_announces{responder.HandleReconciliationDifference(0, difference->m_success, difference->m_ask_shortids)};
+        BOOST_REQUIRE(responder_announces);
+        return {difference->m_announce_wtxids, *responder_announces};
+    }
+};
+
+BOOST_AUTO_TEST_CASE(txreconciliation_roundtrip)
+{
+    ReconcilingPeers peers;
+    std::chrono::microseconds now{1000000};
+
+    // Messages out of order violate the protocol
+    BOOST_CHECK(!peers.initiator.HandleSketch(0, std::vector<unsigned char>(4)));
+    BOOST_CHECK(!peers.responder.HandleReconciliationDifference(0, true, {}));
+    BOOST_CHECK(!peers.initiator.HandleReconciliationRequest(0, 0, 0, now));
+
+    std::vector<uint256> common, initiator_only, responder_only;
+    for (int i = 0; i < 50; ++i) common.push_back(InsecureRand256());
+    for (int i = 0; i < 3; ++i) initiator_only.push_back(InsecureRand256());
+    for (int i = 0; i < 5; ++i) responder_only.push_back(InsecureRand256());
+    for (const uint256& wtxid : common) {
+        BOOST_CHECK(peers.initiator.AddToSet(0, wtxid));
+        BOOST_CHECK(peers.responder.AddToSet(0, wtxid));
+    }
+    for (const uint256& wtxid : initiator_only) BOOST_CHECK(peers.initiator.AddToSet(0, wtxid));
+    for (const uint256& wtxid : responder_only) BOOST_CHECK(peers.responder.AddToSet(0, wtxid));
+    // Adding twice is fine; a transaction the peer announced is not reconciled
+    BOOST_CHECK(peers.initiator.AddToSet(0, common[0]));
+    const uint256 announced_by_peer{InsecureRand256()};
+    BOOST_CHECK(peers.initiator.AddToSet(0, announced_by_peer));
+    peers.initiator.TryRemoveFromSet(0, announced_by_peer);
+
+    auto [initiator_announces, responder_announces] = peers.Reconcile(now);
+    std::sort(initiator_announces.begin(), initiator_announces.end());
+    std::sort(responder_announces.begin(), responder_announces.end());
+    std::sort(initiator_only.begin(), initiator_only.end());
+    std::sort(responder_only.begin(), responder_only.end());
+    BOOST_CHECK(initiator_announces == initiator_only);
+    BOOST_CHECK(responder_announces == responder_only);
+
+    // The sets are empty after reconciling; a new transaction is found again
+    const uint256 wtxid{InsecureRand256()};
+    BOOST_CHECK(peers.responder.AddToSet(0, wtxid));
+    const auto [none, announces] = peers.Reconcile(now);
+    BOOST_CHECK(none.empty());
+    BOOST_CHECK(announces == std::vector<uint256>{wtxid});
+
+    // If the difference exceeds the sketch capacity, both sides announce everything
+    for (size_t i = 0; i < MAX_SKETCH_CAPACITY + 10; ++i) {
+        BOOST_CHECK(peers.responder.AddToSet(0, InsecureRand256()));
+    }
+    BOOST_CHECK(peers.initiator.AddToSet(0, wtxid));
+    const auto [initiator_fallback, responder_fallback] = peers.Reconcile(now);
+    BOOST_CHECK(initiator_fallback == std::vector<uint256>{wtxid});
+    BOOST_CHECK_EQUAL(responder_fallback.size(), MAX_SKETCH_CAPACITY + 10);
+}
+
+BOOST_AUTO_TEST_CASE(txreconciliation_timeout)
+{
+    ReconcilingPeers peers;
+    std::chrono::microseconds now{1000000};
+
+    // The initiator's request is never answered: its set is announced once the round times out
+    std::vector<uint256> initiator_set;
+    for (int i = 0; i < 5; ++i) {
+        initiator_set.push_back(InsecureRand256());
+        BOOST_CHECK(peers.initiator.AddToSet(0, initiator_set.back()));
+    }
+    BOOST_CHECK(!peers.initiator.MaybeRequestReconciliation(0, now));
+    now += RECON_REQUEST_INTERVAL;
+    const auto request{peers.initiator.MaybeRequestReconciliation(0, now)};
+    BOOST_REQUIRE(request);
+    // Transactions added while the request is outstanding are announced too
+    initiator_set.push_back(InsecureRand256());
+    BOOST_CHECK(peers.initiator.AddToSet(0, initiator_set.back()));
+    BOOST_CHECK(peers.initiator.ExpireReconciliation(0, now + RECON_RESPONSE_TIMEOUT - 1us).empty());
+    now += RECON_RESPONSE_TIMEOUT;
+    std::vector<uint256> expired{peers.initiator.ExpireReconciliation(0, now)};
+    std::sort(expired.begin(), expired.end());
+    std::sort(initiator_set.begin(), initiator_set.end());
+    BOOST_CHECK(expired == initiator_set);
+    BOOST_CHECK(peers.initiator.ExpireReconciliation(0, now + RECON_RESPONSE_TIMEOUT).empty());
+    // A sketch arriving after the round was abandoned is ignored, once
+    BOOST_CHECK(!peers.initiator.HandleLateResponse(0, /* is_sketch */ false));
+    BOOST_CHECK(peers.initiator.HandleLateResponse(0, /* is_sketch */ true));
+    BOOST_CHECK(!peers.initiator.HandleLateResponse(0, /* is_sketch */ true));
+    BOOST_CHECK(!peers.initiator.HandleSketch(0, std::vector<unsigned char>(4)));
+    // The next request waits until the peer has abandoned the round too
+    BOOST_CHECK(!peers.initiator.MaybeRequestReconciliation(0, now + RECON_RESPONSE_TIMEOUT - 1us));
+    BOOST_CHECK(peers.initiator.MaybeRequestReconciliation(0, now + RECON_RESPONSE_TIMEOUT));
+
+    // The responder's sketch is never answered: the snapshot and what was added since are announced
+    const uint256 snapshot_wtxid{InsecureRand256()};
+    BOOST_CHECK(peers.responder.AddToSet(0, snapshot_wtxid));
+    BOOST_REQUIRE(peers.responder.HandleReconciliationRequest(0, 0, 0, now));
+    const uint256 added_wtxid{InsecureRand256()};
+    BOOST_CHECK(peers.responder.AddToSet(0, added_wtxid));
+    BOOST_CHECK(peers.responder.ExpireReconciliation(0, now + RECON_RESPONSE_TIMEOUT - 1us).empty());
+    expired = peers.responder.ExpireReconciliation(0, now + RECON_RESPONSE_TIMEOUT);
+    std::vector<uint256> responder_set{snapshot_wtxid, added_wtxid};
+    std::sort(expired.begin(), expired.end());
+    std::sort(responder_set.begin(), responder_set.end());
+    BOOST_CHECK(expired == responder_set);
+    BOOST_CHECK(!peers.responder.HandleReconciliationDifference(0, true, {}));
+    // Once the next round starts, the answer to the abandoned one is no longer expected
+    BOOST_REQUIRE(peers.responder.HandleReconciliationRequest(0, 0, 0, now + RECON_RESPONSE_TIMEOUT));
+    BOOST_CHECK(!peers.responder.HandleLateResponse(0, /* is_sketch */ false));
+    BOOST_CHECK_EQUAL(peers.responder.ExpireReconciliation(0, now + 2 * RECON_RESPONSE_TIMEOUT).size(), 0U);
+    BOOST_CHECK(peers.responder.HandleLateResponse(0, /* is_sketch */ false));
+    // A full set is flushed as well, after which transactions are reconciled again
+    for (size_t i = 0; i < MAX_RECON_SET_SIZE; ++i) {
+        BOOST_CHECK(peers.responder.AddToSet(0, InsecureRand256()));
+    }
+    BOOST_CHECK(!peers.responder.AddToSet(0, InsecureRand256()));
+    now += 2 * RECON_RESPONSE_TIMEOUT;
+    BOOST_REQUIRE(peers.responder.HandleReconciliationRequest(0, 0, 0, now));
+    BOOST_CHECK_EQUAL(peers.responder.ExpireReconciliation(0, now + RECON_RESPONSE_TIMEOUT).size(), MAX_RECON_SET_SIZE);
+    BOOST_CHECK(peers.responder.AddToSet(0, InsecureRand256()));
+}
+
+BOOST_AUTO_TEST_CASE(txreconciliation_bandwidth)
+{
+    // Simulate the link between a relay node (the responder) and one of its
+    // inbound peers. Every interval, new transactions reach the relay node,
+    // and most of them reach the peer through its other connections too.
+    // Compare the bytes spent announcing transactions over this link with
+    // those needed to announce each transaction over it just once by inv,
+    // which is what flooding takes at the very least.
+    static constexpr int INTERVALS{50};
+    static constexpr int TXS_PER_INTERVAL{60};
+    static constexpr int PEER_KNOWS_PERCENT{90};
+    static constexpr size_t MESSAGE_HEADER_SIZE{24};
+    static constexpr size_t INV_ENTRY_SIZE{36};
+
+    ReconcilingPeers peers;
+    std::chrono::microseconds now{1000000};
+    size_t recon_bytes{0};
+    size_t flood_bytes{0};
+    for (int interval = 0; interval < INTERVALS; ++interval) {
+        for (int i = 0; i < TXS_PER_INTERVAL; ++i) {
+            const uint256 wtxid{InsecureRand256()};
+            BOOST_CHECK(peers.responder.AddToSet(0, wtxid));
+            if (InsecureRandRange(100) < PEER_KNOWS_PERCENT) BOOST_CHECK(peers.initiator.AddToSet(0, wtxid));
+        }
+        flood_bytes += MESSAGE_HEADER_SIZE + GetSizeOfCompactSize(TXS_PER_INTERVAL) + TXS_PER_INTERVAL * INV_ENTRY_SIZE;
+
+        const size_t bytes_before{peers.m_bytes};
+        const auto [initiator_announces, responder_announces] = peers.Reconcile(now);
+        BOOST_CHECK(initiator_announces.empty());
+        recon_bytes += 3 * MESSAGE_HEADER_SIZE + peers.m_bytes - bytes_before;
+        if (!responder_announces.empty()) {
+            recon_bytes += MESSAGE_HEADER_SIZE + GetSizeOfCompactSize(responder_announces.size()) + responder_announces.size() * INV_ENTRY_SIZE;
+        }
+    }
+    BOOST_TEST_MESSAGE(strprintf("announcement bytes per peer and interval: %u with reconciliation, at least %u with flooding",
+                                 recon_bytes / INTERVALS, flood_bytes / INTERVALS));
+    BOOST_CHECK_LT(recon_bytes * 3, flood_bytes);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -12,9 +12,12 @@
 #include <test/util/setup_common.h>
 #include <test/util/str.h>
 #include <uint256.h>
+#include <util/fairqueue.h>
 #include <util/getuniquepath.h>
 #include <util/message.h> // For MessageSign(), MessageVerify(), MESSAGE_MAGIC
+#include <util/metrics.h>
 #include <util/moneystr.h>
+#include <util/mpmcqueue.h>
 #include <util/spanparsing.h>
 #include <util/strencodings.h>
 #include <util/string.h>
@@ -22,6 +25,7 @@
 #include <util/vector.h>
 
 #include <array>
+#include <atomic>
 #include <optional>
 #include <stdint.h>
 #include <string.h>
@@ -2319,4 +2323,157 @@ BOOST_AUTO_TEST_CASE(remove_prefix)
     BOOST_CHECK_EQUAL(RemovePrefix("", ""), "");
 }
 
+BOOST_AUTO_TEST_CASE(mpmc_queue)
+{
+    MPMCQueue<std::unique_ptr<int>> queue(3);
+    BOOST_CHECK_EQUAL(queue.Capacity(), 4U);
+    std::unique_ptr<int> value;
+    BOOST_CHECK(!queue.TryPop(value));
+    for (int i = 0; i < 4; ++i) {
+        auto item = std::make_unique<int>(i);
+        BOOST_CHECK(queue.TryPush(std::move(item)));
+        BOOST_CHECK(!item);
+    }
+    BOOST_CHECK_EQUAL(queue.SizeApprox(), 4U);
+    // A failed push leaves the value alone
+    auto extra = std::make_unique<int>(4);
+    BOOST_CHECK(!queue.TryPush(std::move(extra)));
+    BOOST_CHECK(extra && *extra == 4);
+    for (int i = 0; i < 4; ++i) {
+        BOOST_CHECK(queue.TryPop(value));
+        BOOST_CHECK_EQUAL(*value, i);
+    }
+    BOOST_CHECK(!queue.TryPop(value));
+    BOOST_CHECK_EQUAL(queue.SizeApprox(), 0U);
+
+    // Every pushed element comes out exactly once with several producers and consumers
+    MPMCQueue<int> shared(16);
+    constexpr int THREADS{4};
+    constexpr int PER_THREAD{20000};
+    std::atomic<int64_t> sum{0};
+    std::atomic<int> popped{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&, t] {
+            for (int i = 1; i <= PER_THREAD; ++i) {
+                int v = t * PER_THREAD + i;
+                while (!shared.TryPush(std::move(v))) std::this_thread::yield();
+            }
+        });
+        threads.emplace_back([&] {
+            int v;
+            while (popped.load() < THREADS * PER_THREAD) {
+                if (shared.TryPop(v)) {
+                    sum += v;
+                    ++popped;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    const int64_t n{THREADS * PER_THREAD};
+    BOOST_CHECK_EQUAL(popped.load(), n);
+    BOOST_CHECK_EQUAL(sum.load(), n * (n + 1) / 2);
+}
+
+BOOST_AUTO_TEST_CASE(fair_queue)
+{
+    FairQueue<std::string, int> queue(2);
+    int value{0};
+    const auto take = [&value](int& item) { value = item; return true; };
+    BOOST_CHECK(!queue.PopIf(take));
+
+    // Client a queues up before b and c, but they all take turns
+    for (int item : {1, 2}) BOOST_CHECK(queue.Push("a", item));
+    int extra{3};
+    BOOST_CHECK(!queue.Push("a", extra));
+    BOOST_CHECK_EQUAL(extra, 3);
+    for (int item : {10, 11}) BOOST_CHECK(queue.Push("b", item));
+    int item{20};
+    BOOST_CHECK(queue.Push("c", item));
+    BOOST_CHECK_EQUAL(queue.Size(), 5U);
+    BOOST_CHECK_EQUAL(queue.Clients(), 3U);
+
+    std::vector<int> order;
+    for (int i = 0; i < 3; ++i) {
+        BOOST_CHECK(queue.PopIf(take));
+        order.push_back(value);
+    }
+    BOOST_CHECK(order == std::vector<int>({1, 10, 20}));
+    BOOST_CHECK_EQUAL(queue.Clients(), 2U);
+
+    // An item that is not taken keeps its turn
+    BOOST_CHECK(!queue.PopIf([](int&) { return false; }));
+    BOOST_CHECK(queue.PopIf(take));
+    BOOST_CHECK_EQUAL(value, 2);
+    // a has room again
+    int again{4};
+    BOOST_CHECK(queue.Push("a", again));
+    BOOST_CHECK(queue.PopIf(take));
+    BOOST_CHECK_EQUAL(value, 11);
+
+    std::vector<int> cleared;
+    queue.Clear([&cleared](int& item) { cleared.push_back(item); });
+    BOOST_CHECK(cleared == std::vector<int>({4}));
+    BOOST_CHECK_EQUAL(queue.Size(), 0U);
+    BOOST_CHECK_EQUAL(queue.Clients(), 0U);
+    BOOST_CHECK(!queue.PopIf(take));
+}
+
+BOOST_AUTO_TEST_CASE(metrics_render)
+{
+    metrics::Counter counter;
+    counter.Inc();
+    counter.Inc(41);
+    std::string out;
+    counter.Write(out, "c", "");
+    BOOST_CHECK_EQUAL(out, "c 42\n");
+
+    metrics::Gauge gauge;
+    gauge.Set(5);
+    gauge.Add(-7);
+    out.clear();
+    gauge.Write(out, "g", "a=\"b\"");
+    BOOST_CHECK_EQUAL(out, "g{a=\"b\"} -2\n");
+
+    // Buckets are cumulative and a value on a bound falls into that bucket
+    metrics::Histogram histogram({1, 2});
+    histogram.Observe(0.5);
+    histogram.Observe(1);
+    histogram.Observe(1.5);
+    histogram.Observe(3);
+    BOOST_CHECK_EQUAL(histogram.Count(), 4U);
+    BOOST_CHECK_EQUAL(histogram.Sum(), 6);
+    out.clear();
+    histogram.Write(out, "h", "");
+    BOOST_CHECK_EQUAL(out,
+        "h_bucket{le=\"1\"} 2\n"
+        "h_bucket{le=\"2\"} 3\n"
+        "h_bucket{le=\"+Inf\"} 4\n"
+        "h_sum 6\n"
+        "h_count 4\n");
+
+    // Values outside of the set of a family are accounted together
+    metrics::Family<metrics::Counter> family("type", {"tx", "block"});
+    family.Get("tx").Inc();
+    family.Get("foo").Inc(2);
+    family.Get("bar").Inc(3);
+    BOOST_CHECK_EQUAL(family.Get("block").Value(), 0U);
+    BOOST_CHECK_EQUAL(family.Get(metrics::Family<metrics::Counter>::OTHER).Value(), 5U);
+    out.clear();
+    family.Write(out, "f", "");
+    BOOST_CHECK_EQUAL(out, "f{type=\"*other*\"} 5\nf{type=\"block\"} 0\nf{type=\"tx\"} 1\n");
+
+    // Registered metrics are rendered with their help and type. Names are
+    // registered once per process, however often the test runs.
+    static metrics::Counter& registered{metrics::Add<metrics::Counter>("test_metrics_render_total", "Test counter")};
+    registered.Inc(3);
+    const std::string rendered{metrics::Render()};
+    BOOST_CHECK(rendered.find("# HELP test_metrics_render_total Test counter\n"
+                              "# TYPE test_metrics_render_total counter\n"
+                              "test_metrics_render_total " + ToString(registered.Value()) + "\n") != std::string::npos);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
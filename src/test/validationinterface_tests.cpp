@@ -3,13 +3,20 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <boost/test/unit_test.hpp>
+#include <chain.h>
 #include <consensus/validation.h>
 #include <primitives/block.h>
 #include <scheduler.h>
 #include <test/util/setup_common.h>
 #include <util/check.h>
+#include <util/time.h>
 #include <validationinterface.h>
 
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+
 BOOST_FIXTURE_TEST_SUITE(validationinterface_tests, TestingSetup)
 
 struct TestSubscriberNoop final : public CValidationInterface {
@@ -91,4 +98,94 @@ BOOST_AUTO_TEST_CASE(unregister_all_during_call)
     BOOST_CHECK(destroyed);
 }
 
+struct TestSubscriberTip final : public CValidationInterface {
+    explicit TestSubscriberTip(std::function<void()> on_tip = nullptr) : m_on_tip(std::move(on_tip)) {}
+    void UpdatedBlockTip(const CBlockIndex*, const CBlockIndex*, bool) override
+    {
+        if (m_on_tip) m_on_tip();
+        ++m_tips;
+    }
+    std::function<void()> m_on_tip;
+    std::atomic<int> m_tips{0};
+};
+
+BOOST_AUTO_TEST_CASE(slow_subscriber_does_not_block_others)
+{
+    // The first subscriber blocks on its first notification
+    std::promise<void> release;
+    std::shared_future<void> released{release.get_future()};
+    auto slow = std::make_shared<TestSubscriberTip>([released] { released.wait(); });
+    std::promise<void> fast_done;
+    int fast_calls{0};
+    auto fast = std::make_shared<TestSubscriberTip>([&] {
+        if (++fast_calls == 4) fast_done.set_value();
+    });
+    RegisterSharedValidationInterface(slow);
+    RegisterSharedValidationInterface(fast);
+
+    // Every notification reaches the other subscriber in the meantime
+    CBlockIndex index;
+    for (int i = 0; i < 4; ++i) {
+        GetMainSignals().UpdatedBlockTip(&index, nullptr, false);
+    }
+    fast_done.get_future().wait();
+    BOOST_CHECK_EQUAL(slow->m_tips, 0);
+    BOOST_CHECK_GE(GetMainSignals().CallbacksPending(), 3U);
+
+    // Syncing waits for both subscribers
+    release.set_value();
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK_EQUAL(slow->m_tips, 4);
+    BOOST_CHECK_EQUAL(fast->m_tips, 4);
+
+    UnregisterSharedValidationInterface(slow);
+    UnregisterSharedValidationInterface(fast);
+}
+
+BOOST_AUTO_TEST_CASE(unregister_waits_for_running_callback)
+{
+    std::promise<void> started;
+    std::promise<void> release;
+    std::shared_future<void> released{release.get_future()};
+    auto sub = std::make_unique<TestSubscriberTip>([&started, released] {
+        started.set_value();
+        released.wait();
+    });
+    RegisterValidationInterface(sub.get());
+
+    // The second notification is still queued when unregistering
+    CBlockIndex index;
+    GetMainSignals().UpdatedBlockTip(&index, nullptr, false);
+    GetMainSignals().UpdatedBlockTip(&index, nullptr, false);
+    started.get_future().wait();
+    std::atomic<bool> unregistered{false};
+    std::thread unregister{[&] {
+        UnregisterValidationInterface(sub.get());
+        unregistered = true;
+    }};
+    UninterruptibleSleep(std::chrono::milliseconds{100});
+    BOOST_CHECK(!unregistered);
+    release.set_value();
+    unregister.join();
+    BOOST_CHECK_EQUAL(sub->m_tips, 1);
+
+    // Nothing calls the subscriber anymore, so it can be destroyed
+    sub.reset();
+    SyncWithValidationInterfaceQueue();
+}
+
+BOOST_AUTO_TEST_CASE(unregister_from_own_callback)
+{
+    TestSubscriberTip* self{nullptr};
+    auto sub = std::make_unique<TestSubscriberTip>([&self] { UnregisterValidationInterface(self); });
+    self = sub.get();
+    RegisterValidationInterface(sub.get());
+
+    CBlockIndex index;
+    GetMainSignals().UpdatedBlockTip(&index, nullptr, false);
+    GetMainSignals().UpdatedBlockTip(&index, nullptr, false);
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK_EQUAL(sub->m_tips, 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
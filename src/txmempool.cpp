@@ -13,9 +13,11 @@
 #include <policy/settings.h>
 #include <reverse_iterator.h>
 #include <timedata.h>
+#include <util/metrics.h>
 #include <util/moneystr.h>
 #include <util/system.h>
 #include <util/time.h>
+#include <util/trace.h>
 #include <validation.h>
 #include <validationinterface.h>
 
@@ -356,6 +358,32 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
     nTransactionsUpdated += n;
 }
 
+std::string RemovalReasonToString(MemPoolRemovalReason reason) noexcept
+{
+    switch (reason) {
+    case MemPoolRemovalReason::EXPIRY: return "expiry";
+    case MemPoolRemovalReason::SIZELIMIT: return "sizelimit";
+    case MemPoolRemovalReason::REORG: return "reorg";
+    case MemPoolRemovalReason::BLOCK: return "block";
+    case MemPoolRemovalReason::CONFLICT: return "conflict";
+    case MemPoolRemovalReason::REPLACED: return "replaced";
+    } // no default case, so the compiler can warn about missing cases
+    assert(false);
+}
+
+static metrics::Gauge& g_metric_transactions{metrics::Add<metrics::Gauge>(
+    "usdg_mempool_transactions", "Number of transactions in the mempool")};
+static metrics::Gauge& g_metric_size{metrics::Add<metrics::Gauge>(
+    "usdg_mempool_size_bytes", "Total virtual size of the transactions in the mempool")};
+static metrics::Counter& g_metric_added{metrics::Add<metrics::Counter>(
+    "usdg_mempool_added_total", "Transactions added to the mempool")};
+static metrics::Family<metrics::Counter>& g_metric_removed{metrics::Add<metrics::Family<metrics::Counter>>(
+    "usdg_mempool_removed_total", "Transactions removed from the mempool",
+    "reason", std::vector<std::string>{
+        RemovalReasonToString(MemPoolRemovalReason::EXPIRY), RemovalReasonToString(MemPoolRemovalReason::SIZELIMIT),
+        RemovalReasonToString(MemPoolRemovalReason::REORG), RemovalReasonToString(MemPoolRemovalReason::BLOCK),
+        RemovalReasonToString(MemPoolRemovalReason::CONFLICT), RemovalReasonToString(MemPoolRemovalReason::REPLACED)})};
+
 void CTxMemPool::addUnchecked(const CTxMemPoolEntry &entry, setEntries &setAncestors, bool validFeeEstimate)
 {
     // Add to memory pool without checking anything.
@@ -400,9 +428,18 @@ void CTxMemPool::addUnchecked(const CTxMemPoolEntry &entry, setEntries &setAnces
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
     m_total_fee += entry.GetFee();
+    g_metric_transactions.Set(mapTx.size());
+    g_metric_size.Set(totalTxSize);
+    g_metric_added.Inc();
 
     vTxHashes.emplace_back(tx.GetWitnessHash(), newit);
     newit->vTxHashesIdx = vTxHashes.size() - 1;
+
+    TRACE3(mempool, added,
+        tx.GetHash().data(),
+        entry.GetTxSize(),
+        entry.GetFee()
+    );
 }
 
 void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
@@ -420,6 +457,14 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
     }
 
     const uint256 hash = it->GetTx().GetHash();
+    TRACE5(mempool, removed,
+        hash.data(),
+        RemovalReasonToString(reason).c_str(),
+        it->GetTxSize(),
+        it->GetFee(),
+        count_seconds(it->GetTime())
+    );
+
     for (const CTxIn& txin : it->GetTx().vin)
         mapNextTx.erase(txin.prevout);
 
@@ -436,9 +481,12 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
 
     totalTxSize -= it->GetTxSize();
     m_total_fee -= it->GetFee();
+    g_metric_removed.Get(RemovalReasonToString(reason)).Inc();
     cachedInnerUsage -= it->DynamicMemoryUsage();
     cachedInnerUsage -= memusage::DynamicUsage(it->GetMemPoolParentsConst()) + memusage::DynamicUsage(it->GetMemPoolChildrenConst());
     mapTx.erase(it);
+    g_metric_transactions.Set(mapTx.size());
+    g_metric_size.Set(totalTxSize);
     nTransactionsUpdated++;
 }
 
@@ -596,6 +644,8 @@ void CTxMemPool::_clear()
     totalTxSize = 0;
     m_total_fee = 0;
     cachedInnerUsage = 0;
+    g_metric_transactions.Set(0);
+    g_metric_size.Set(0);
     lastRollingFeeUpdate = GetTime();
     rollingMinimumFeeRate = 0;
     ++nTransactionsUpdated;
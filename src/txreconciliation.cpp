@@ -0,0 +1,244 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <txreconciliation.h>
+
+#include <crypto/siphash.h>
+#include <hash.h>
+#include <pinsketch.h>
+#include <random.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+/** Tag for the hash of both salts, from which the short ID keys are derived */
+const std::string RECON_SALT_HASH_TAG{"Tx Relay Salting"};
+} // namespace
+
+uint32_t TxReconciliationTracker::ReconciliationState::ShortId(const uint256& wtxid) const
+{
+    // Short IDs must be non-zero to be added to a sketch
+    return 1 + SipHashUint256(m_k0, m_k1, wtxid) % 0xFFFFFFFF;
+}
+
+uint64_t TxReconciliationTracker::PreRegisterPeer(NodeId peer_id)
+{
+    const uint64_t local_salt{GetRand(std::numeric_limits<uint64_t>::max())};
+    LOCK(m_mutex);
+    m_local_salts[peer_id] = local_salt;
+    return local_salt;
+}
+
+bool TxReconciliationTracker::RegisterPeer(NodeId peer_id, bool is_peer_inbound, uint32_t peer_recon_version, uint64_t remote_salt)
+{
+    LOCK(m_mutex);
+    const auto salt_it = m_local_salts.find(peer_id);
+    if (salt_it == m_local_salts.end()) return false;
+    const uint64_t local_salt{salt_it->second};
+    m_local_salts.erase(salt_it);
+    // All versions are compatible with version 1
+    if (peer_recon_version < 1) return false;
+
+    const uint256 salt_hash{(TaggedHash(RECON_SALT_HASH_TAG) << std::min(local_salt, remote_salt) << std::max(local_salt, remote_salt)).GetSHA256()};
+    ReconciliationState state;
+    state.m_we_initiate = !is_peer_inbound;
+    state.m_k0 = salt_hash.GetUint64(0);
+    state.m_k1 = salt_hash.GetUint64(1);
+    return m_states.emplace(peer_id, std::move(state)).second;
+}
+
+void TxReconciliationTracker::ForgetPeer(NodeId peer_id)
+{
+    LOCK(m_mutex);
+    m_local_salts.erase(peer_id);
+    m_states.erase(peer_id);
+}
+
+bool TxReconciliationTracker::IsPeerRegistered(NodeId peer_id) const
+{
+    LOCK(m_mutex);
+    return m_states.count(peer_id) > 0;
+}
+
+bool TxReconciliationTracker::AddToSet(NodeId peer_id, const uint256& wtxid)
+{
+    LOCK(m_mutex);
+    const auto it = m_states.find(peer_id);
+    if (it == m_states.end()) return false;
+    ReconciliationState& state = it->second;
+    if (state.m_local_set.size() >= MAX_RECON_SET_SIZE) return false;
+    const auto [set_it, inserted] = state.m_local_set.emplace(state.ShortId(wtxid), wtxid);
+    return inserted || set_it->second == wtxid;
+}
+
+void TxReconciliationTracker::TryRemoveFromSet(NodeId peer_id, const uint256& wtxid)
+{
+    LOCK(m_mutex);
+    const auto it = m_states.find(peer_id);
+    if (it == m_states.end()) return;
+    ReconciliationState& state = it->second;
+    const auto set_it = state.m_local_set.find(state.ShortId(wtxid));
+    if (set_it != state.m_local_set.end() && set_it->second == wtxid) state.m_local_set.erase(set_it);
+}
+
+std::optional<std::pair<uint16_t, uint16_t>> TxReconciliationTracker::MaybeRequestReconciliation(NodeId peer_id, std::chrono::microseconds now)
+{
+    LOCK(m_mutex);
+    const auto it = m_states.find(peer_id);
+    if (it == m_states.end()) return std::nullopt;
+    ReconciliationState& state = it->second;
+    if (!state.m_we_initiate || state.m_in_progress) return std::nullopt;
+    if (state.m_next_request == std::chrono::microseconds{0}) {
+        state.m_next_request = now + RECON_REQUEST_INTERVAL;
+        return std::nullopt;
+    }
+    if (now < state.m_next_request) return std::nullopt;
+
+    state.m_in_progress = true;
+    state.m_round_start = now;
+    state.m_expired = false;
+    state.m_next_request = now + RECON_REQUEST_INTERVAL;
+    return std::make_pair(uint16_t(state.m_local_set.size()), uint16_t(state.m_q * RECON_Q_PRECISION));
+}
+
+size_t TxReconciliationTracker::EstimateSketchCapacity(size_t local_set_size, size_t remote_set_size, double q)
+{
+    // BIP 330: |local - remote| + q * min(local, remote) + 1. As the sketch
+    // is only decoded up to one element less than its capacity (see
+    // PinSketch::Decode), that is one more than the estimated difference.
+    const size_t size_difference{std::max(local_set_size, remote_set_size) - std::min(local_set_size, remote_set_size)};
+    const size_t capacity{size_difference + size_t(std::ceil(q * std::min(local_set_size, remote_set_size))) + 1};
+    return std::min(capacity, MAX_SKETCH_CAPACITY);
+}
+
+std::optional<std::vector<unsigned char>> TxReconciliationTracker::HandleReconciliationRequest(NodeId peer_id, uint16_t peer_set_size, uint16_t peer_q, std::chrono::microseconds now)
+{
+    LOCK(m_mutex);
+    const auto it = m_states.find(peer_id);
+    if (it == m_states.end()) return std::nullopt;
+    ReconciliationState& state = it->second;
+    if (state.m_we_initiate || state.m_in_progress) return std::nullopt;
+
+    const double q{peer_q / RECON_Q_PRECISION};
+    PinSketch sketch(EstimateSketchCapacity(state.m_local_set.size(), peer_set_size, q));
+    for (const auto& [shortid, wtxid] : state.m_local_set) {
+        sketch.Add(shortid);
+    }
+    state.m_snapshot = std::move(state.m_local_set);
+    state.m_local_set.clear();
+    state.m_in_progress = true;
+    state.m_round_start = now;
+    state.m_expired = false;
+    return sketch.Serialize();
+}
+
+std::optional<ReconciliationDifference> TxReconciliationTracker::HandleSketch(NodeId peer_id, Span<const unsigned char> sketch_data)
+{
+    LOCK(m_mutex);
+    const auto it = m_states.find(peer_id);
+    if (it == m_states.end()) return std::nullopt;
+    ReconciliationState& state = it->second;
+    if (!state.m_we_initiate || !state.m_in_progress) return std::nullopt;
+    std::optional<PinSketch> sketch{PinSketch::Deserialize(sketch_data)};
+    if (!sketch || sketch->Capacity() == 0 || sketch->Capacity() > MAX_SKETCH_CAPACITY) return std::nullopt;
+    state.m_in_progress = false;
+
+    PinSketch local_sketch(sketch->Capacity());
+    for (const auto& [shortid, wtxid] : state.m_local_set) {
+        local_sketch.Add(shortid);
+    }
+    sketch->Merge(local_sketch);
+
+    ReconciliationDifference result;
+    const std::optional<std::vector<uint32_t>> difference{sketch->Decode(sketch->Capacity() - 1)};
+    result.m_success = difference.has_value();
+    if (result.m_success) {
+        for (const uint32_t shortid : *difference) {
+            const auto set_it = state.m_local_set.find(shortid);
+            if (set_it != state.m_local_set.end()) {
+                result.m_announce_wtxids.push_back(set_it->second);
+            } else {
+                result.m_ask_shortids.push_back(shortid);
+            }
+        }
+        // BIP 330: q = (difference - |local - remote|) / min(local, remote)
+        const size_t local_size{state.m_local_set.size()};
+        const size_t remote_size{local_size - result.m_announce_wtxids.size() + result.m_ask_shortids.size()};
+        if (std::min(local_size, remote_size) > 0) {
+            const double q{2.0 * std::min(result.m_announce_wtxids.size(), result.m_ask_shortids.size()) / std::min(local_size, remote_size)};
+            state.m_q = std::clamp(q, 0.0, 2.0);
+        }
+    } else {
+        for (const auto& [shortid, wtxid] : state.m_local_set) {
+            result.m_announce_wtxids.push_back(wtxid);
+        }
+    }
+    state.m_local_set.clear();
+    return result;
+}
+
+std::optional<std::vector<uint256>> TxReconciliationTracker::HandleReconciliationDifference(NodeId peer_id, bool success, const std::vector<uint32_t>& ask_shortids)
+{
+    LOCK(m_mutex);
+    const auto it = m_states.find(peer_id);
+    if (it == m_states.end()) return std::nullopt;
+    ReconciliationState& state = it->second;
+    if (state.m_we_initiate || !state.m_in_progress) return std::nullopt;
+    state.m_in_progress = false;
+
+    std::vector<uint256> announce;
+    if (success) {
+        for (const uint32_t shortid : ask_shortids) {
+            const auto set_it = state.m_snapshot.find(shortid);
+            if (set_it != state.m_snapshot.end()) announce.push_back(set_it->second);
+        }
+    } else {
+        for (const auto& [shortid, wtxid] : state.m_snapshot) {
+            announce.push_back(wtxid);
+        }
+    }
+    state.m_snapshot.clear();
+    return announce;
+}
+
+std::vector<uint256> TxReconciliationTracker::ExpireReconciliation(NodeId peer_id, std::chrono::microseconds now)
+{
+    LOCK(m_mutex);
+    const auto it = m_states.find(peer_id);
+    if (it == m_states.end()) return {};
+    ReconciliationState& state = it->second;
+    if (!state.m_in_progress || now < state.m_round_start + RECON_RESPONSE_TIMEOUT) return {};
+    state.m_in_progress = false;
+    state.m_expired = true;
+    // Give the peer time to expire its side of the round before the next request
+    if (state.m_we_initiate) state.m_next_request = now + RECON_RESPONSE_TIMEOUT;
+
+    // The initiator's set kept growing during the round; the responder's is
+    // split between the snapshot it sent a sketch of and what was added since
+    std::vector<uint256> announce;
+    announce.reserve(state.m_local_set.size() + state.m_snapshot.size());
+    for (const auto& [shortid, wtxid] : state.m_snapshot) {
+        announce.push_back(wtxid);
+    }
+    for (const auto& [shortid, wtxid] : state.m_local_set) {
+        announce.push_back(wtxid);
+    }
+    state.m_snapshot.clear();
+    state.m_local_set.clear();
+    return announce;
+}
+
+bool TxReconciliationTracker::HandleLateResponse(NodeId peer_id, bool is_sketch)
+{
+    LOCK(m_mutex);
+    const auto it = m_states.find(peer_id);
+    if (it == m_states.end()) return false;
+    ReconciliationState& state = it->second;
+    // The initiator is answered with a sketch, the responder with a reconcildiff
+    if (!state.m_expired || state.m_we_initiate != is_sketch) return false;
+    state.m_expired = false;
+    return true;
+}
@@ -0,0 +1,170 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXRECONCILIATION_H
+#define BITCOIN_TXRECONCILIATION_H
+
+#include <net.h> // For NodeId
+#include <span.h>
+#include <sync.h>
+#include <uint256.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <utility>
+#include <vector>
+
+/** Supported transaction reconciliation protocol version */
+static constexpr uint32_t TXRECONCILIATION_VERSION{1};
+/** Default for -txreconciliation, whether to reconcile transactions with peers that support it */
+static constexpr bool DEFAULT_TXRECONCILIATION_ENABLE{false};
+/** Interval between reconciliation requests to each peer we initiate reconciliations with */
+static constexpr std::chrono::seconds RECON_REQUEST_INTERVAL{8};
+/**
+ * Time a peer has to answer our reqrecon with a sketch, or our sketch with a
+ * reconcildiff. After that, the round is abandoned and the transactions that
+ * were to be reconciled are announced.
+ */
+static constexpr std::chrono::seconds RECON_RESPONSE_TIMEOUT{2 * RECON_REQUEST_INTERVAL};
+/** Maximum number of transactions to reconcile with a peer; further ones are announced right away */
+static constexpr size_t MAX_RECON_SET_SIZE{3000};
+/** Maximum capacity of a sketch, which takes 4 bytes per unit of capacity */
+static constexpr size_t MAX_SKETCH_CAPACITY{128};
+/** Initial estimate of q, the fraction of the smaller set that is missing from the larger one */
+static constexpr double RECON_Q_DEFAULT{0.25};
+/** q is sent as a fixed-point number in [0, 2] with this scale */
+static constexpr double RECON_Q_PRECISION{(2 << 14) - 1};
+
+/**
+ * The outcome of reconciling with a peer, for the side that initiated it.
+ */
+struct ReconciliationDifference {
+    /** Whether the set difference could be decoded from the sketch */
+    bool m_success;
+    /** Short IDs of the transactions the peer has and we are missing */
+    std::vector<uint32_t> m_ask_shortids;
+    /** Transactions to announce to the peer: those it is missing, or our whole set on failure */
+    std::vector<uint256> m_announce_wtxids;
+};
+
+/**
+ * Transaction reconciliation (BIP 330, "Erlay"): instead of announcing every
+ * transaction to every peer, peers periodically find the difference between
+ * the transactions they would have announced to each other, by exchanging a
+ * sketch (see PinSketch) of the short IDs of those transactions, and only
+ * announce that difference.
+ *
+ * Peers that signal NODE_TXRECONCILIATION negotiate it by exchanging a
+ * sendtxrcncl message with a salt before verack. The side that made the
+ * connection initiates the reconciliations:
+ * - it sends reqrecon with the size of its set, every RECON_REQUEST_INTERVAL;
+ * - the other side answers with a sketch of its set, with a capacity based on
+ *   the estimated size of the difference, and keeps a snapshot of its set;
+ * - the initiator decodes the difference, announces the transactions the
+ *   other side is missing, and asks for the short IDs it is missing with
+ *   reconcildiff, which the other side answers by announcing them.
+ * If the difference can't be decoded, both sides announce their whole sets,
+ * as they do when the other side doesn't answer within RECON_RESPONSE_TIMEOUT.
+ *
+ * This class is thread-safe.
+ */
+class TxReconciliationTracker
+{
+public:
+    /** Generate (and keep) our salt for reconciliations with a peer, to be sent in sendtxrcncl. */
+    uint64_t PreRegisterPeer(NodeId peer_id);
+
+    /**
+     * Register a peer that sent us sendtxrcncl, after we sent it ours.
+     * @returns whether reconciliation with the peer is enabled
+     */
+    bool RegisterPeer(NodeId peer_id, bool is_peer_inbound, uint32_t peer_recon_version, uint64_t remote_salt);
+
+    void ForgetPeer(NodeId peer_id);
+
+    bool IsPeerRegistered(NodeId peer_id) const;
+
+    /**
+     * Add a transaction to be reconciled with a peer.
+     * @returns false if the transaction must be announced right away instead
+     *          (the set is full, or a short ID collides)
+     */
+    bool AddToSet(NodeId peer_id, const uint256& wtxid);
+
+    /** Stop reconciling a transaction the peer announced to us. */
+    void TryRemoveFromSet(NodeId peer_id, const uint256& wtxid);
+
+    /**
+     * For peers we initiate reconciliations with: whether to send a reqrecon
+     * now, with the returned set size and q.
+     */
+    std::optional<std::pair<uint16_t, uint16_t>> MaybeRequestReconciliation(NodeId peer_id, std::chrono::microseconds now);
+
+    /**
+     * Answer a reqrecon with a sketch of our set.
+     * @returns the serialized sketch, or nullopt if the request violates the protocol
+     */
+    std::optional<std::vector<unsigned char>> HandleReconciliationRequest(NodeId peer_id, uint16_t peer_set_size, uint16_t peer_q, std::chrono::microseconds now);
+
+    /**
+     * Find the difference between our set and the sketch of the peer's set,
+     * sent in response to our reqrecon.
+     * @returns nullopt if the sketch violates the protocol
+     */
+    std::optional<ReconciliationDifference> HandleSketch(NodeId peer_id, Span<const unsigned char> sketch);
+
+    /**
+     * Handle a reconcildiff in response to our sketch.
+     * @returns the transactions to announce, or nullopt if the message violates the protocol
+     */
+    std::optional<std::vector<uint256>> HandleReconciliationDifference(NodeId peer_id, bool success, const std::vector<uint32_t>& ask_shortids);
+
+    /**
+     * Abandon a reconciliation the peer has not answered for RECON_RESPONSE_TIMEOUT.
+     * @returns the transactions to announce instead, empty if the round has not timed out
+     */
+    std::vector<uint256> ExpireReconciliation(NodeId peer_id, std::chrono::microseconds now);
+
+    /**
+     * Check whether a sketch (is_sketch) or reconcildiff from the peer is the
+     * late answer to the last round, which ExpireReconciliation abandoned.
+     * Such an answer is to be ignored; only one is accepted per abandoned round.
+     */
+    bool HandleLateResponse(NodeId peer_id, bool is_sketch);
+
+    /** The sketch capacity for a difference between sets of the given sizes, as estimated from q. */
+    static size_t EstimateSketchCapacity(size_t local_set_size, size_t remote_set_size, double q);
+
+private:
+    struct ReconciliationState {
+        /** Whether we initiate reconciliations (the peer is outbound) */
+        bool m_we_initiate;
+        /** SipHash keys for short IDs, derived from both salts */
+        uint64_t m_k0, m_k1;
+        /** Transactions to reconcile, by short ID */
+        std::map<uint32_t, uint256> m_local_set;
+        /** The set we sent a sketch of, when responding */
+        std::map<uint32_t, uint256> m_snapshot;
+        /** Whether a reconciliation is in progress (reqrecon sent, or sketch sent) */
+        bool m_in_progress{false};
+        /** When the reconciliation in progress started */
+        std::chrono::microseconds m_round_start{0};
+        /** Whether the last round timed out, and the peer's answer to it may still arrive */
+        bool m_expired{false};
+        std::chrono::microseconds m_next_request{0};
+        /** When initiating, estimated fraction of the smaller set missing from the larger one */
+        double m_q{RECON_Q_DEFAULT};
+
+        uint32_t ShortId(const uint256& wtxid) const;
+    };
+
+    mutable Mutex m_mutex;
+    /** Salts we sent to peers that haven't registered (yet) */
+    std::map<NodeId, uint64_t> m_local_salts GUARDED_BY(m_mutex);
+    std::map<NodeId, ReconciliationState> m_states GUARDED_BY(m_mutex);
+};
+
+#endif // BITCOIN_TXRECONCILIATION_H
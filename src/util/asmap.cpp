@@ -2,6 +2,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <util/asmap.h>
+
+#include <atomic>
 #include <map>
 #include <vector>
 #include <assert.h>
@@ -183,3 +186,71 @@ bool SanityCheckASMap(const std::vector<bool>& asmap, int bits)
     }
     return false; // Reached EOF without RETURN instruction
 }
+
+CompiledASMap::CompiledASMap(const std::vector<bool>& asmap)
+{
+    static std::atomic<uint64_t> g_next_id{1};
+    m_root = Compile(asmap.begin(), asmap.end(), 0);
+    m_nodes.shrink_to_fit();
+    m_id = g_next_id++;
+}
+
+uint32_t CompiledASMap::Compile(std::vector<bool>::const_iterator pos, const std::vector<bool>::const_iterator& endpos, uint32_t default_asn)
+{
+    // Follows Interpret, taking both sides of every JUMP. Jumps never
+    // intersect in a sane asmap, so every instruction is visited once.
+    while (pos != endpos) {
+        const Instruction opcode = DecodeType(pos, endpos);
+        if (opcode == Instruction::RETURN) {
+            const uint32_t asn = DecodeASN(pos, endpos);
+            assert(asn != INVALID);
+            return LEAF | asn;
+        } else if (opcode == Instruction::JUMP) {
+            const uint32_t jump = DecodeJump(pos, endpos);
+            assert(jump != INVALID && int64_t{jump} < int64_t{endpos - pos});
+            const uint32_t node = m_nodes.size();
+            m_nodes.emplace_back();
+            const uint32_t zero = Compile(pos, endpos, default_asn);
+            const uint32_t one = Compile(pos + jump, endpos, default_asn);
+            m_nodes[node] = {zero, one};
+            return node;
+        } else if (opcode == Instruction::MATCH) {
+            const uint32_t match = DecodeMatch(pos, endpos);
+            assert(match != INVALID);
+            const uint32_t matchlen = CountBits(match) - 1;
+            // A chain of nodes, one per matched bit, where a mismatch ends
+            // the lookup at the current default ASN.
+            const uint32_t first = m_nodes.size();
+            for (uint32_t bit = 0; bit < matchlen; bit++) {
+                const bool expected = (match >> (matchlen - 1 - bit)) & 1;
+                std::array<uint32_t, 2> children;
+                children[!expected] = LEAF | default_asn;
+                children[expected] = first + bit + 1;
+                m_nodes.push_back(children);
+            }
+            const uint32_t last = first + matchlen - 1;
+            const bool expected = match & 1;
+            m_nodes[last][expected] = Compile(pos, endpos, default_asn);
+            return first;
+        } else if (opcode == Instruction::DEFAULT) {
+            default_asn = DecodeASN(pos, endpos);
+            assert(default_asn != INVALID);
+        } else {
+            break;
+        }
+    }
+    assert(false); // Should have been caught by SanityCheckASMap
+    return LEAF;
+}
+
+uint32_t CompiledASMap::Lookup(Span<const uint8_t> ip) const
+{
+    uint32_t entry = m_root;
+    size_t bit = 0;
+    while (!(entry & LEAF)) {
+        assert(bit < ip.size() * 8);
+        entry = m_nodes[entry][(ip[bit / 8] >> (7 - bit % 8)) & 1];
+        ++bit;
+    }
+    return entry & ~LEAF;
+}
@@ -5,6 +5,9 @@
 #ifndef BITCOIN_UTIL_ASMAP_H
 #define BITCOIN_UTIL_ASMAP_H
 
+#include <span.h>
+
+#include <array>
 #include <stdint.h>
 #include <vector>
 
@@ -12,4 +15,52 @@ uint32_t Interpret(const std::vector<bool> &asmap, const std::vector<bool> &ip);
 
 bool SanityCheckASMap(const std::vector<bool>& asmap, int bits);
 
+/**
+ * An asmap compiled into a binary trie of IP prefixes.
+ *
+ * Interpret() decodes the asmap bytecode bit by bit on every lookup. The
+ * bytecode is a tree of JUMP and MATCH instructions, so it can be unfolded
+ * once into a flat array of nodes, each holding one child per value of the
+ * next address bit. A lookup then walks at most one node per bit of the
+ * address, reading the bits straight from the address bytes.
+ */
+class CompiledASMap
+{
+public:
+    /** An empty asmap, which maps every address to AS0. */
+    CompiledASMap() = default;
+
+    /**
+     * Compile an asmap. It must have passed SanityCheckASMap for at most as
+     * many bits as are passed to Lookup().
+     */
+    explicit CompiledASMap(const std::vector<bool>& asmap);
+
+    bool IsEmpty() const { return m_id == 0; }
+
+    /**
+     * Identifies the asmap this was compiled from, so that results looked up
+     * in it can be cached. Copies share the id; 0 for the empty asmap.
+     */
+    uint64_t GetId() const { return m_id; }
+
+    /** Look up the AS of an address, such as the 16 bytes of an IPv6 (or IPv4-mapped) address. */
+    uint32_t Lookup(Span<const uint8_t> ip) const;
+
+    /** Number of trie nodes, for memory usage accounting. */
+    size_t GetNodeCount() const { return m_nodes.size(); }
+
+private:
+    //! Entries with this bit set are leaves holding an ASN, others index m_nodes.
+    static constexpr uint32_t LEAF = 0x80000000;
+
+    //! Children of each node, indexed by the value of the next address bit.
+    std::vector<std::array<uint32_t, 2>> m_nodes;
+    //! Entry for the first address bit.
+    uint32_t m_root{LEAF};
+    uint64_t m_id{0};
+
+    uint32_t Compile(std::vector<bool>::const_iterator pos, const std::vector<bool>::const_iterator& endpos, uint32_t default_asn);
+};
+
 #endif // BITCOIN_UTIL_ASMAP_H
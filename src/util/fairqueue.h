@@ -0,0 +1,91 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTIL_FAIRQUEUE_H
+#define BITCOIN_UTIL_FAIRQUEUE_H
+
+#include <cassert>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <utility>
+
+/**
+ * Items waiting for their turn, per client. Clients take turns in
+ * round-robin order, one item at a time, so a client with many items waiting
+ * does not hold up the others, and each client can only have a bounded number
+ * of items waiting.
+ *
+ * Not thread-safe.
+ */
+template <typename Key, typename T>
+class FairQueue
+{
+private:
+    std::map<Key, std::deque<T>> m_waiting;
+    //! Clients in m_waiting, in the order in which they get their next turn
+    std::deque<Key> m_turns;
+    size_t m_size{0};
+    const size_t m_max_per_client;
+
+public:
+    explicit FairQueue(size_t max_per_client) : m_max_per_client(max_per_client) {}
+
+    /** Add an item for client. Returns false, leaving item untouched, if the client has too many waiting. */
+    bool Push(const Key& client, T& item)
+    {
+        auto it = m_waiting.find(client);
+        if (it == m_waiting.end()) {
+            it = m_waiting.emplace(client, std::deque<T>{}).first;
+            m_turns.push_back(client);
+        } else if (it->second.size() >= m_max_per_client) {
+            return false;
+        }
+        it->second.push_back(std::move(item));
+        ++m_size;
+        return true;
+    }
+
+    /**
+     * Offer the item whose turn it is to take, which returns whether it took
+     * (moved from) the item. If it did, the item's client gets its next turn
+     * after all others. Returns whether an item was taken.
+     */
+    template <typename Fn>
+    bool PopIf(Fn&& take)
+    {
+        if (m_turns.empty()) return false;
+        auto it = m_waiting.find(m_turns.front());
+        assert(it != m_waiting.end());
+        if (!take(it->second.front())) return false;
+        it->second.pop_front();
+        m_turns.pop_front();
+        --m_size;
+        if (it->second.empty()) {
+            m_waiting.erase(it);
+        } else {
+            m_turns.push_back(it->first);
+        }
+        return true;
+    }
+
+    /** Remove all items, passing each to fn first */
+    template <typename Fn>
+    void Clear(Fn&& fn)
+    {
+        for (auto& [client, items] : m_waiting) {
+            for (T& item : items) fn(item);
+        }
+        m_waiting.clear();
+        m_turns.clear();
+        m_size = 0;
+    }
+
+    /** Number of items waiting */
+    size_t Size() const { return m_size; }
+    /** Number of clients with items waiting */
+    size_t Clients() const { return m_waiting.size(); }
+};
+
+#endif // BITCOIN_UTIL_FAIRQUEUE_H
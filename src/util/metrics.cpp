@@ -0,0 +1,110 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <util/metrics.h>
+
+#include <tinyformat.h>
+
+#include <algorithm>
+#include <cassert>
+#include <mutex>
+
+namespace metrics {
+namespace {
+
+struct Entry {
+    std::string help;
+    std::unique_ptr<Metric> metric;
+};
+
+struct Registry {
+    //! Not a Mutex, as lock contention in sync.cpp is itself a metric
+    std::mutex mutex;
+    std::map<std::string, Entry> entries;
+};
+
+Registry& GetRegistry()
+{
+    // Metrics are registered while other globals are initialized
+    static Registry registry;
+    return registry;
+}
+
+std::string Sample(const std::string& name, const std::string& labels)
+{
+    return labels.empty() ? name : name + "{" + labels + "}";
+}
+
+} // namespace
+
+void Counter::Write(std::string& out, const std::string& name, const std::string& labels) const
+{
+    out += strprintf("%s %d\n", Sample(name, labels), Value());
+}
+
+void Gauge::Write(std::string& out, const std::string& name, const std::string& labels) const
+{
+    out += strprintf("%s %d\n", Sample(name, labels), Value());
+}
+
+std::vector<double> Histogram::DurationBuckets()
+{
+    return {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+}
+
+Histogram::Histogram(std::vector<double> bounds)
+    : m_bounds(std::move(bounds)), m_buckets(new std::atomic<uint64_t>[m_bounds.size() + 1])
+{
+    assert(std::is_sorted(m_bounds.begin(), m_bounds.end()));
+    for (size_t i = 0; i <= m_bounds.size(); ++i) {
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::Observe(double value)
+{
+    const size_t bucket = std::lower_bound(m_bounds.begin(), m_bounds.end(), value) - m_bounds.begin();
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    double sum = m_sum.load(std::memory_order_relaxed);
+    while (!m_sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed)) {}
+}
+
+void Histogram::Write(std::string& out, const std::string& name, const std::string& labels) const
+{
+    const std::string prefix{labels.empty() ? "" : labels + ","};
+    uint64_t cumulative{0};
+    for (size_t i = 0; i < m_bounds.size(); ++i) {
+        cumulative += m_buckets[i].load(std::memory_order_relaxed);
+        out += strprintf("%s_bucket{%sle=\"%g\"} %d\n", name, prefix, m_bounds[i], cumulative);
+    }
+    cumulative += m_buckets[m_bounds.size()].load(std::memory_order_relaxed);
+    out += strprintf("%s_bucket{%sle=\"+Inf\"} %d\n", name, prefix, cumulative);
+    out += strprintf("%s %.9g\n", Sample(name + "_sum", labels), Sum());
+    // The count is the total of the buckets, so that it matches the +Inf bucket
+    out += strprintf("%s %d\n", Sample(name + "_count", labels), cumulative);
+}
+
+void Register(std::string name, std::string help, std::unique_ptr<Metric> metric)
+{
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    const bool inserted = registry.entries.emplace(std::move(name), Entry{std::move(help), std::move(metric)}).second;
+    assert(inserted);
+}
+
+std::string Render()
+{
+    Registry& registry = GetRegistry();
+    std::string out;
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const auto& [name, entry] : registry.entries) {
+        out += strprintf("# HELP %s %s\n", name, entry.help);
+        out += strprintf("# TYPE %s %s\n", name, entry.metric->Type());
+        entry.metric->Write(out, name, "");
+    }
+    return out;
+}
+
+} // namespace metrics
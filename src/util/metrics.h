@@ -0,0 +1,159 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTIL_METRICS_H
+#define BITCOIN_UTIL_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Counters, gauges and histograms that are updated where things happen and
+ * exported in the Prometheus text format.
+ *
+ * Updating a metric is a few relaxed atomic operations, so they can be used
+ * on hot paths. Nothing is computed when the metrics are rendered, apart from
+ * formatting the current values.
+ */
+namespace metrics {
+
+class Metric
+{
+public:
+    virtual ~Metric() = default;
+    /** Prometheus type of the metric */
+    virtual const char* Type() const = 0;
+    /** Append the samples of the metric. labels is empty or a list like `type="tx"`. */
+    virtual void Write(std::string& out, const std::string& name, const std::string& labels) const = 0;
+};
+
+/** Value that only goes up */
+class Counter final : public Metric
+{
+public:
+    static constexpr const char* TYPE{"counter"};
+
+    void Inc(uint64_t n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t Value() const { return m_value.load(std::memory_order_relaxed); }
+
+    const char* Type() const override { return TYPE; }
+    void Write(std::string& out, const std::string& name, const std::string& labels) const override;
+
+private:
+    std::atomic<uint64_t> m_value{0};
+};
+
+/** Value that can go up and down */
+class Gauge final : public Metric
+{
+public:
+    static constexpr const char* TYPE{"gauge"};
+
+    void Set(int64_t value) { m_value.store(value, std::memory_order_relaxed); }
+    void Add(int64_t n) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    int64_t Value() const { return m_value.load(std::memory_order_relaxed); }
+
+    const char* Type() const override { return TYPE; }
+    void Write(std::string& out, const std::string& name, const std::string& labels) const override;
+
+private:
+    std::atomic<int64_t> m_value{0};
+};
+
+/** Distribution of observed values over fixed buckets */
+class Histogram final : public Metric
+{
+public:
+    static constexpr const char* TYPE{"histogram"};
+
+    /** Buckets for durations in seconds, from 100 microseconds to 10 seconds */
+    static std::vector<double> DurationBuckets();
+
+    /** bounds are the inclusive upper bounds of the buckets, in increasing order */
+    explicit Histogram(std::vector<double> bounds);
+
+    void Observe(double value);
+    template <typename Rep, typename Period>
+    void ObserveDuration(std::chrono::duration<Rep, Period> duration)
+    {
+        Observe(std::chrono::duration_cast<std::chrono::duration<double>>(duration).count());
+    }
+
+    uint64_t Count() const { return m_count.load(std::memory_order_relaxed); }
+    double Sum() const { return m_sum.load(std::memory_order_relaxed); }
+
+    const char* Type() const override { return TYPE; }
+    void Write(std::string& out, const std::string& name, const std::string& labels) const override;
+
+private:
+    const std::vector<double> m_bounds;
+    //! Number of values per bucket, the last one for values above all bounds
+    const std::unique_ptr<std::atomic<uint64_t>[]> m_buckets;
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<double> m_sum{0};
+};
+
+/** One metric per value of a label, for a set of values fixed on construction */
+template <typename M>
+class Family final : public Metric
+{
+public:
+    /** Label value that values outside of the set are accounted under */
+    static constexpr const char* OTHER{"*other*"};
+
+    template <typename... Args>
+    Family(std::string label, const std::vector<std::string>& values, const Args&... args) : m_label(std::move(label))
+    {
+        for (const std::string& value : values) {
+            m_metrics.try_emplace(value, args...);
+        }
+        m_other = &m_metrics.try_emplace(OTHER, args...).first->second;
+    }
+
+    M& Get(const std::string& value)
+    {
+        auto it = m_metrics.find(value);
+        return it == m_metrics.end() ? *m_other : it->second;
+    }
+
+    const char* Type() const override { return M::TYPE; }
+    void Write(std::string& out, const std::string& name, const std::string& labels) const override
+    {
+        for (const auto& [value, metric] : m_metrics) {
+            metric.Write(out, name, (labels.empty() ? "" : labels + ",") + m_label + "=\"" + value + "\"");
+        }
+    }
+
+private:
+    const std::string m_label;
+    //! Not changed after construction, so lookups need no lock
+    std::map<std::string, M> m_metrics;
+    M* m_other;
+};
+
+/** Export metric under name. The metric has to live until the end of the program. */
+void Register(std::string name, std::string help, std::unique_ptr<Metric> metric);
+
+/** Create a metric and export it under name */
+template <typename M, typename... Args>
+M& Add(std::string name, std::string help, Args&&... args)
+{
+    auto metric = std::make_unique<M>(std::forward<Args>(args)...);
+    M& ref = *metric;
+    Register(std::move(name), std::move(help), std::move(metric));
+    return ref;
+}
+
+/** All exported metrics in the Prometheus text format, version 0.0.4 */
+std::string Render();
+
+} // namespace metrics
+
+#endif // BITCOIN_UTIL_METRICS_H
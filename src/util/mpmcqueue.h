@@ -0,0 +1,114 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTIL_MPMCQUEUE_H
+#define BITCOIN_UTIL_MPMCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+/**
+ * Bounded queue that any number of threads can push to and pop from without
+ * locking (Dmitry Vyukov's bounded MPMC queue).
+ *
+ * Each cell carries a sequence number that tells whether it is ready to be
+ * written or read for the current lap around the ring, so a push or pop is a
+ * single compare-and-swap on the shared position plus the data move. Neither
+ * operation blocks: TryPush fails when the queue is full, TryPop when it is
+ * empty.
+ */
+template <typename T>
+class MPMCQueue
+{
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    const size_t m_mask;
+    const std::unique_ptr<Cell[]> m_cells;
+    // Keep the positions on separate cache lines, as producers and consumers write them
+    alignas(64) std::atomic<size_t> m_push_pos{0};
+    alignas(64) std::atomic<size_t> m_pop_pos{0};
+
+    static size_t RoundUpCapacity(size_t capacity)
+    {
+        size_t size{2};
+        while (size < capacity) size <<= 1;
+        return size;
+    }
+
+public:
+    /** Create a queue for at least capacity elements (rounded up to a power of two) */
+    explicit MPMCQueue(size_t capacity)
+        : m_mask(RoundUpCapacity(capacity) - 1), m_cells(new Cell[m_mask + 1])
+    {
+        for (size_t i = 0; i <= m_mask; ++i) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MPMCQueue(const MPMCQueue&) = delete;
+    MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+    /** Add an element at the back. Returns false, leaving value untouched, if the queue is full. */
+    bool TryPush(T&& value)
+    {
+        size_t pos = m_push_pos.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = m_cells[pos & m_mask];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (m_push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // the cell still holds an element from the previous lap
+            } else {
+                pos = m_push_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /** Take the element at the front. Returns false if the queue is empty. */
+    bool TryPop(T& value)
+    {
+        size_t pos = m_pop_pos.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = m_cells[pos & m_mask];
+            const size_t seq = cell.sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (m_pop_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.data);
+                    cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // the cell has not been written for this lap yet
+            } else {
+                pos = m_pop_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t Capacity() const { return m_mask + 1; }
+
+    /** Number of elements, which may be out of date by the time it is returned */
+    size_t SizeApprox() const
+    {
+        const size_t pop = m_pop_pos.load(std::memory_order_relaxed);
+        const size_t push = m_push_pos.load(std::memory_order_relaxed);
+        return push > pop ? push - pop : 0;
+    }
+};
+
+#endif // BITCOIN_UTIL_MPMCQUEUE_H
@@ -49,9 +49,11 @@
 #include <undo.h>
 #include <util/check.h> // For NDEBUG compile time check
 #include <util/hasher.h>
+#include <util/metrics.h>
 #include <util/moneystr.h>
 #include <util/strencodings.h>
 #include <util/system.h>
+#include <util/trace.h>
 #include <util/translation.h>
 #include <validationinterface.h>
 #include <warnings.h>
@@ -115,7 +117,7 @@ bool CBlockIndexWorkComparator::operator()(const CBlockIndex *pa, const CBlockIn
  * The transaction pool has a separate lock to allow reading from it and the
  * chainstate at the same time.
  */
-RecursiveMutex cs_main;
+RecursiveMutex cs_main{"cs_main"};
 
 CBlockIndex *pindexBestHeader = nullptr;
 Mutex g_best_block_mutex;
@@ -899,6 +901,11 @@ static MempoolAcceptResult AcceptToMemoryPoolWithTime(const CChainParams& chainp
 
     const MempoolAcceptResult result = MemPoolAccept(pool, active_chainstate).AcceptSingleTransaction(tx, args);
     if (result.m_result_type != MempoolAcceptResult::ResultType::VALID) {
+        TRACE2(mempool, rejected,
+            tx->GetHash().data(),
+            result.m_state.GetRejectReason().c_str()
+        );
+
         // Remove coins that were not present in the coins cache before calling
         // AcceptSingleTransaction(); this is to prevent memory DoS in case we receive a large
         // number of invalid transactions that attempt to overrun the in-memory coins cache
@@ -1002,9 +1009,26 @@ CoinsViews::CoinsViews(
                             gArgs.GetDataDirNet() / ldb_name, cache_size_bytes, in_memory, should_wipe),
                         m_catcherview(&m_dbview) {}
 
+static metrics::Histogram& g_metric_block_connect{metrics::Add<metrics::Histogram>(
+    "usdg_validation_block_connect_seconds", "Time to connect a block to the active chain, including writing the chain state if needed",
+    metrics::Histogram::DurationBuckets())};
+static metrics::Histogram& g_metric_coins_flush{metrics::Add<metrics::Histogram>(
+    "usdg_validation_coins_flush_seconds", "Time to write the coins cache to disk", metrics::Histogram::DurationBuckets())};
+static metrics::Gauge& g_metric_tip_height{metrics::Add<metrics::Gauge>(
+    "usdg_validation_tip_height", "Height of the active chain tip")};
+static metrics::Counter& g_metric_coins_hits{metrics::Add<metrics::Counter>(
+    "usdg_coins_cache_hits_total", "Coin lookups served from the chain state coins cache")};
+static metrics::Counter& g_metric_coins_misses{metrics::Add<metrics::Counter>(
+    "usdg_coins_cache_misses_total", "Coin lookups that had to read from the coins database")};
+static metrics::Gauge& g_metric_coins_entries{metrics::Add<metrics::Gauge>(
+    "usdg_coins_cache_entries", "Number of coins in the chain state coins cache")};
+static metrics::Gauge& g_metric_coins_memory{metrics::Add<metrics::Gauge>(
+    "usdg_coins_cache_memory_bytes", "Memory used by the chain state coins cache")};
+
 void CoinsViews::InitCache()
 {
     m_cacheview = std::make_unique<CCoinsViewCache>(&m_catcherview);
+    m_cacheview->SetLookupCounters(&g_metric_coins_hits, &g_metric_coins_misses);
 }
 
 CChainState::CChainState(CTxMemPool* mempool, BlockManager& blockman, std::optional<uint256> from_snapshot_blockhash)
@@ -1490,6 +1514,12 @@ bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state,
     assert(*pindex->phashBlock == block.GetHash());
     int64_t nTimeStart = GetTimeMicros();
 
+    TRACE3(validation, block_connect_begin,
+        pindex->phashBlock->data(),
+        pindex->nHeight,
+        fJustCheck
+    );
+
     // Check it again in case a previous version let a bad block in
     // NOTE: We don't currently (re-)invoke ContextualCheckBlock() or
     // ContextualCheckBlockHeader() here. This means that if we add a new
@@ -1739,6 +1769,16 @@ bool CChainState::ConnectBlock(const CBlock& block, BlockValidationState& state,
     int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
     LogPrint(BCLog::BENCH, "    - Callbacks: %.2fms [%.2fs (%.2fms/blk)]\n", MILLI * (nTime6 - nTime5), nTimeCallbacks * MICRO, nTimeCallbacks * MILLI / nBlocksTotal);
 
+    TRACE7(validation, block_connected,
+        pindex->phashBlock->data(),
+        pindex->nHeight,
+        block.vtx.size(),
+        nInputs,
+        nSigOpsCost,
+        block.IsProofOfStake(),
+        nTime6 - nTimeStart // in microseconds (µs)
+    );
+
     return true;
 }
 
@@ -1786,6 +1826,8 @@ bool CChainState::FlushStateToDisk(
 
     const size_t coins_count = CoinsTip().GetCacheSize();
     const size_t coins_mem_usage = CoinsTip().DynamicMemoryUsage();
+    g_metric_coins_entries.Set(coins_count);
+    g_metric_coins_memory.Set(coins_mem_usage);
 
     try {
     {
@@ -1866,8 +1908,18 @@ bool CChainState::FlushStateToDisk(
                 return AbortNode(state, "Disk space is too low!", _("Disk space is too low!"));
             }
             // Flush the chainstate (which may refer to block index entries).
+            const auto flush_start{std::chrono::steady_clock::now()};
             if (!CoinsTip().Flush())
                 return AbortNode(state, "Failed to write to coin database");
+            const auto flush_duration{std::chrono::steady_clock::now() - flush_start};
+            g_metric_coins_flush.ObserveDuration(flush_duration);
+            TRACE5(utxocache, flush,
+                std::chrono::duration_cast<std::chrono::microseconds>(flush_duration).count(), // in microseconds (µs)
+                (uint32_t)mode,
+                (uint64_t)coins_count,
+                (uint64_t)coins_mem_usage,
+                fCacheLarge || fCacheCritical
+            );
             nLastFlush = nNow;
             full_flush_completed = true;
         }
@@ -2115,6 +2167,8 @@ bool CChainState::ConnectTip(BlockValidationState& state, CBlockIndex* pindexNew
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint(BCLog::BENCH, "  - Connect postprocess: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime5) * MILLI, nTimePostConnect * MICRO, nTimePostConnect * MILLI / nBlocksTotal);
     LogPrint(BCLog::BENCH, "- Connect block: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime6 - nTime1) * MILLI, nTimeTotal * MICRO, nTimeTotal * MILLI / nBlocksTotal);
+    g_metric_block_connect.ObserveDuration(std::chrono::microseconds{nTime6 - nTime1});
+    g_metric_tip_height.Set(pindexNew->nHeight);
 
     connectTrace.BlockConnected(pindexNew, std::move(pthisBlock));
     return true;
@@ -2734,21 +2788,19 @@ bool SignBlock(CBlock& block, const CWallet& keystore)
 }
 #endif
 
-static bool CheckBlockSignature(const CBlock& block)
+/** Check the signature of a proof-of-stake block with the given hash, made by the key of its coinstake */
+static bool CheckStakeBlockSignature(const uint256& hash, const std::vector<unsigned char>& vchBlockSig, const CTransaction& coinstake)
 {
-    if (block.IsProofOfWork())
-        return block.vchBlockSig.empty();
-
-    if (block.vchBlockSig.empty())
+    if (vchBlockSig.empty())
         return false;
 
     std::vector<valtype> vSolutions;
-    const CTxOut& txout = block.vtx[1]->vout[1];
+    const CTxOut& txout = coinstake.vout[1];
     TxoutType whichType = Solver(txout.scriptPubKey, vSolutions);
 
     if (whichType == TxoutType::PUBKEY) {
         std::vector<unsigned char>& vchPubKey = vSolutions[0];
-        return CPubKey(vchPubKey).Verify(block.GetHash(), block.vchBlockSig);
+        return CPubKey(vchPubKey).Verify(hash, vchBlockSig);
     }
     else {
         // Block signing key also can be encoded in the nonspendable output
@@ -2758,8 +2810,6 @@ static bool CheckBlockSignature(const CBlock& block)
         opcodetype opcode;
         std::vector<unsigned char> vchPushValue;
 
-        uint256 hash = block.GetHash();
-
         if (!script.GetOp(pc, opcode, vchPushValue))
             return false;
         if (opcode != OP_RETURN)
@@ -2768,12 +2818,33 @@ static bool CheckBlockSignature(const CBlock& block)
             return false;
         if (!IsCompressedOrUncompressedPubKey(vchPushValue))
             return false;
-        return CPubKey(vchPushValue).Verify(hash, block.vchBlockSig);
+        return CPubKey(vchPushValue).Verify(hash, vchBlockSig);
     }
 
     return false;
 }
 
+static bool CheckBlockSignature(const CBlock& block)
+{
+    if (block.IsProofOfWork())
+        return block.vchBlockSig.empty();
+
+    return CheckStakeBlockSignature(block.GetHash(), block.vchBlockSig, *block.vtx[1]);
+}
+
+bool CheckBlockStake(const CBlockHeader& header, const std::vector<unsigned char>& vchBlockSig, const CTransaction& coinstake, CChainState& chainstate, BlockValidationState& state)
+{
+    AssertLockHeld(cs_main);
+    CBlockIndex* pindexPrev = chainstate.m_chain.Tip();
+    assert(pindexPrev && header.hashPrevBlock == pindexPrev->GetBlockHash());
+
+    if (!coinstake.IsCoinStake())
+        return state.Invalid(BlockValidationResult::BLOCK_CONSENSUS, "bad-cs-missing", "second tx is not coinstake");
+    if (!IsLowDERSignature(vchBlockSig, nullptr, false) || !CheckStakeBlockSignature(header.GetHash(), vchBlockSig, coinstake))
+        return state.Invalid(BlockValidationResult::BLOCK_CONSENSUS, "bad-blk-sig", "bad proof-of-stake block signature");
+    return CheckProofOfStake(pindexPrev, coinstake, header.nBits, state, chainstate.CoinsTip(), coinstake.nTime ? coinstake.nTime : header.nTime);
+}
+
 static bool CheckBlockHeader(const CBlockHeader& block, BlockValidationState& state, const Consensus::Params& consensusParams, CChainState& chainstate, bool fCheckPOW = true, bool fOldClient = false)
 {
     // Check proof of work hash
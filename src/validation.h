@@ -353,6 +353,13 @@ bool SignBlock(CBlock& block, const CWallet& keystore);
 bool CheckBlock(const CBlock& block, BlockValidationState& state, const Consensus::Params& consensusParams, CChainState& chainstate, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true);
 bool CheckCanonicalBlockSignature(const std::shared_ptr<const CBlock>& pblock);
 
+/**
+ * Check the block signature and proof of stake of a proof-of-stake block
+ * building on the active chain tip, given only its header and coinstake. This
+ * allows relaying a compact block before its other transactions are known.
+ */
+bool CheckBlockStake(const CBlockHeader& header, const std::vector<unsigned char>& vchBlockSig, const CTransaction& coinstake, CChainState& chainstate, BlockValidationState& state) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 /** Check a block is completely valid from start to finish (only works on top of our current best block) */
 bool TestBlockValidity(BlockValidationState& state,
                        const CChainParams& chainparams,
@@ -11,10 +11,34 @@
 #include <primitives/block.h>
 #include <primitives/transaction.h>
 #include <scheduler.h>
-
+#include <tinyformat.h>
+#include <util/metrics.h>
+#include <util/threadnames.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <future>
+#include <string>
+#include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
+
+namespace {
+
+//! Subscribers whose callbacks are reported separately in the metrics, see CValidationInterface::SubscriberName()
+const std::vector<std::string> SUBSCRIBER_NAMES{"peerman", "wallet", "zmq", "websocket", "txindex", "coinstatsindex", "blockfilterindex"};
+
+metrics::Family<metrics::Gauge>& g_metric_callbacks_pending{metrics::Add<metrics::Family<metrics::Gauge>>(
+    "usdg_validation_callbacks_pending", "Validation notifications queued for a subscriber, by subscriber",
+    "subscriber", SUBSCRIBER_NAMES)};
+metrics::Family<metrics::Histogram>& g_metric_callback_seconds{metrics::Add<metrics::Family<metrics::Histogram>>(
+    "usdg_validation_callback_seconds", "Time a subscriber takes to handle a validation notification, by subscriber",
+    "subscriber", SUBSCRIBER_NAMES, metrics::Histogram::DurationBuckets())};
+
+} // namespace
 
 //! The MainSignalsInstance manages a list of shared_ptr<CValidationInterface>
 //! callbacks.
@@ -23,54 +47,172 @@
 //! registered, and a std::list is to used to store the callbacks that are
 //! currently registered as well as any callbacks that are just unregistered
 //! and about to be deleted when they are done executing.
+//!
+//! Background callbacks are queued per subscriber, so that a slow subscriber
+//! only holds up its own notifications. The queues run on a pool of threads
+//! of their own.
 struct MainSignalsInstance {
 private:
+    //! Background callbacks of one subscriber
+    struct Queue {
+        Queue(CScheduler* scheduler, std::shared_ptr<CValidationInterface> callbacks_in)
+            : client(scheduler), callbacks(std::move(callbacks_in)), name(callbacks->SubscriberName()),
+              pending(g_metric_callbacks_pending.Get(name)), duration(g_metric_callback_seconds.Get(name)) {}
+
+        SingleThreadedSchedulerClient client;
+        const std::shared_ptr<CValidationInterface> callbacks;
+        const std::string name;
+        //! Cleared on unregistration, after which the queued callbacks are skipped
+        std::atomic<bool> registered{true};
+        metrics::Gauge& pending;
+        metrics::Histogram& duration;
+
+        Mutex m_running_mutex;
+        std::condition_variable m_running_cond;
+        //! Thread that is running a callback, if any
+        std::thread::id m_running GUARDED_BY(m_running_mutex);
+
+        /** Run a callback, unless the subscriber was unregistered */
+        template <typename F>
+        void Run(const F& event)
+        {
+            {
+                LOCK(m_running_mutex);
+                if (!registered) return;
+                m_running = std::this_thread::get_id();
+            }
+            const auto start{std::chrono::steady_clock::now()};
+            event(*callbacks);
+            duration.ObserveDuration(std::chrono::steady_clock::now() - start);
+            LOCK(m_running_mutex);
+            m_running = std::thread::id{};
+            m_running_cond.notify_all();
+        }
+
+        /** Skip the queued callbacks from now on */
+        void Unregister()
+        {
+            LOCK(m_running_mutex);
+            registered = false;
+        }
+
+        /** Wait for a running callback to return, unless the caller is running it */
+        void WaitForCallback()
+        {
+            WAIT_LOCK(m_running_mutex, lock);
+            while (m_running != std::thread::id{} && m_running != std::this_thread::get_id()) {
+                m_running_cond.wait(lock);
+            }
+        }
+    };
+
+    //! Called when every queue has reached it, with all of them suspended
+    struct Barrier {
+        std::function<void()> func;
+        std::vector<SingleThreadedSchedulerClient*> clients;
+        std::atomic<size_t> remaining{0};
+    };
+
     Mutex m_mutex;
     //! List entries consist of a callback pointer and reference count. The
     //! count is equal to the number of current executions of that entry, plus 1
     //! if it's registered. It cannot be 0 because that would imply it is
     //! unregistered and also not being executed (so shouldn't exist).
-    struct ListEntry { std::shared_ptr<CValidationInterface> callbacks; int count = 1; };
+    struct ListEntry { std::shared_ptr<CValidationInterface> callbacks; int count = 1; std::shared_ptr<Queue> queue; };
     std::list<ListEntry> m_list GUARDED_BY(m_mutex);
     std::unordered_map<CValidationInterface*, std::list<ListEntry>::iterator> m_map GUARDED_BY(m_mutex);
+    //! Queues of the registered subscribers, and of unregistered ones until they are idle
+    std::list<std::shared_ptr<Queue>> m_queues GUARDED_BY(m_mutex);
+
+    CScheduler m_pool;
+    std::vector<std::thread> m_pool_threads;
+
+    //! Drop the queues of unregistered subscribers that have nothing left to run
+    void PruneQueues() EXCLUSIVE_LOCKS_REQUIRED(m_mutex)
+    {
+        m_queues.remove_if([](const std::shared_ptr<Queue>& queue) { return !queue->registered && queue->client.IsIdle(); });
+    }
+
+    void StopThreads()
+    {
+        m_pool.stop();
+        for (std::thread& thread : m_pool_threads) thread.join();
+        m_pool_threads.clear();
+    }
 
 public:
     // We are not allowed to assume the scheduler only runs in one thread,
     // but must ensure all callbacks happen in-order, so we end up creating
     // our own queue here :(
+    // This one only takes part in barriers, so that they complete without
+    // any subscriber.
     SingleThreadedSchedulerClient m_schedulerClient;
 
-    explicit MainSignalsInstance(CScheduler *pscheduler) : m_schedulerClient(pscheduler) {}
+    MainSignalsInstance(CScheduler* pscheduler, int threads) : m_schedulerClient(pscheduler)
+    {
+        for (int i = 0; i < std::max(threads, 1); ++i) {
+            m_pool_threads.emplace_back([this, i] {
+                util::ThreadRename(strprintf("signals.%i", i));
+                m_pool.serviceQueue();
+            });
+        }
+    }
+
+    ~MainSignalsInstance()
+    {
+        StopThreads();
+    }
 
     void Register(std::shared_ptr<CValidationInterface> callbacks)
     {
         LOCK(m_mutex);
+        PruneQueues();
         auto inserted = m_map.emplace(callbacks.get(), m_list.end());
-        if (inserted.second) inserted.first->second = m_list.emplace(m_list.end());
+        if (inserted.second) {
+            inserted.first->second = m_list.emplace(m_list.end());
+            inserted.first->second->queue = m_queues.emplace_back(std::make_shared<Queue>(&m_pool, callbacks));
+        }
         inserted.first->second->callbacks = std::move(callbacks);
     }
 
+    //! Waits for a background callback of the subscriber that is running on
+    //! another thread, as the subscriber may be destroyed right after.
     void Unregister(CValidationInterface* callbacks)
     {
-        LOCK(m_mutex);
-        auto it = m_map.find(callbacks);
-        if (it != m_map.end()) {
-            if (!--it->second->count) m_list.erase(it->second);
-            m_map.erase(it);
+        std::shared_ptr<Queue> queue;
+        {
+            LOCK(m_mutex);
+            auto it = m_map.find(callbacks);
+            if (it != m_map.end()) {
+                queue = it->second->queue;
+                queue->Unregister();
+                if (!--it->second->count) m_list.erase(it->second);
+                m_map.erase(it);
+            }
+            PruneQueues();
         }
+        // The callback may need locks that are taken together with m_mutex
+        if (queue) queue->WaitForCallback();
     }
 
     //! Clear unregisters every previously registered callback, erasing every
     //! map entry. After this call, the list may still contain callbacks that
     //! are currently executing, but it will be cleared when they are done
-    //! executing.
+    //! executing. Background callbacks are waited for, as in Unregister().
     void Clear()
     {
-        LOCK(m_mutex);
-        for (const auto& entry : m_map) {
-            if (!--entry.second->count) m_list.erase(entry.second);
+        std::vector<std::shared_ptr<Queue>> queues;
+        {
+            LOCK(m_mutex);
+            for (const auto& entry : m_map) {
+                queues.push_back(entry.second->queue);
+                entry.second->queue->Unregister();
+                if (!--entry.second->count) m_list.erase(entry.second);
+            }
+            m_map.clear();
+            PruneQueues();
         }
-        m_map.clear();
+        for (const auto& queue : queues) queue->WaitForCallback();
     }
 
     template<typename F> void Iterate(F&& f)
@@ -85,14 +227,87 @@ public:
             it = --it->count ? std::next(it) : m_list.erase(it);
         }
     }
+
+    //! Queue event(CValidationInterface&) for every registered subscriber
+    template<typename F> void Enqueue(const F& event)
+    {
+        LOCK(m_mutex);
+        PruneQueues();
+        for (const auto& queue_ptr : m_queues) {
+            Queue& queue = *queue_ptr;
+            if (!queue.registered) continue;
+            queue.pending.Add(1);
+            // The queue outlives the callback, as it is not idle until the
+            // callback has run
+            queue.client.AddToProcessQueue([&queue, event] {
+                queue.pending.Add(-1);
+                queue.Run(event);
+            });
+        }
+    }
+
+    //! Call func once every queue is done with the callbacks queued so far.
+    //! The queues don't run later callbacks until func returns.
+    void AddBarrier(std::function<void()> func)
+    {
+        auto barrier = std::make_shared<Barrier>();
+        barrier->func = std::move(func);
+        LOCK(m_mutex);
+        PruneQueues();
+        // Include unregistered subscribers that are still running a callback,
+        // so that waiting for the barrier after unregistering is enough to
+        // know that the subscriber won't be called any more
+        barrier->clients.push_back(&m_schedulerClient);
+        for (const auto& queue : m_queues) barrier->clients.push_back(&queue->client);
+        barrier->remaining = barrier->clients.size();
+        for (SingleThreadedSchedulerClient* client : barrier->clients) {
+            // Each queue suspends itself on reaching the barrier, and is not
+            // idle, so not destroyed, until it is resumed
+            client->AddSuspendingCallback([barrier] {
+                if (--barrier->remaining > 0) return;
+                barrier->func();
+                for (SingleThreadedSchedulerClient* client : barrier->clients) client->Resume();
+            });
+        }
+    }
+
+    //! Stop the pool threads and run the remaining callbacks on the calling thread
+    void Flush()
+    {
+        StopThreads();
+        // A queue stops at a barrier until every other queue has reached it,
+        // so go round the queues until none of them has anything left to run
+        bool pending{true};
+        while (pending) {
+            std::vector<std::shared_ptr<Queue>> queues;
+            WITH_LOCK(m_mutex, queues.assign(m_queues.begin(), m_queues.end()));
+            m_schedulerClient.EmptyQueue();
+            pending = m_schedulerClient.CallbacksPending() > 0;
+            for (const auto& queue : queues) {
+                queue->client.EmptyQueue();
+                pending |= queue->client.CallbacksPending() > 0;
+            }
+        }
+    }
+
+    //! Backlog of the subscriber that is furthest behind
+    size_t CallbacksPending()
+    {
+        LOCK(m_mutex);
+        size_t pending{m_schedulerClient.CallbacksPending()};
+        for (const auto& queue : m_queues) {
+            pending = std::max(pending, queue->client.CallbacksPending());
+        }
+        return pending;
+    }
 };
 
 static CMainSignals g_signals;
 
-void CMainSignals::RegisterBackgroundSignalScheduler(CScheduler& scheduler)
+void CMainSignals::RegisterBackgroundSignalScheduler(CScheduler& scheduler, int threads)
 {
     assert(!m_internals);
-    m_internals.reset(new MainSignalsInstance(&scheduler));
+    m_internals.reset(new MainSignalsInstance(&scheduler, threads));
 }
 
 void CMainSignals::UnregisterBackgroundSignalScheduler()
@@ -103,14 +318,14 @@ void CMainSignals::UnregisterBackgroundSignalScheduler()
 void CMainSignals::FlushBackgroundCallbacks()
 {
     if (m_internals) {
-        m_internals->m_schedulerClient.EmptyQueue();
+        m_internals->Flush();
     }
 }
 
 size_t CMainSignals::CallbacksPending()
 {
     if (!m_internals) return 0;
-    return m_internals->m_schedulerClient.CallbacksPending();
+    return m_internals->CallbacksPending();
 }
 
 CMainSignals& GetMainSignals()
@@ -154,7 +369,7 @@ void UnregisterAllValidationInterfaces()
 
 void CallFunctionInValidationInterfaceQueue(std::function<void()> func)
 {
-    g_signals.m_internals->m_schedulerClient.AddToProcessQueue(std::move(func));
+    g_signals.m_internals->AddBarrier(std::move(func));
 }
 
 void SyncWithValidationInterfaceQueue()
@@ -172,14 +387,14 @@ void SyncWithValidationInterfaceQueue()
 // evaluating arguments when logging is not enabled.
 //
 // NOTE: The lambda captures all local variables by value.
-#define ENQUEUE_AND_LOG_EVENT(event, fmt, name, ...)           \
-    do {                                                       \
-        auto local_name = (name);                              \
-        LOG_EVENT("Enqueuing " fmt, local_name, __VA_ARGS__);  \
-        m_internals->m_schedulerClient.AddToProcessQueue([=] { \
-            LOG_EVENT(fmt, local_name, __VA_ARGS__);           \
-            event();                                           \
-        });                                                    \
+#define ENQUEUE_AND_LOG_EVENT(event, fmt, name, ...)                     \
+    do {                                                                 \
+        auto local_name = (name);                                        \
+        LOG_EVENT("Enqueuing " fmt, local_name, __VA_ARGS__);            \
+        m_internals->Enqueue([=](CValidationInterface& callbacks) {      \
+            LOG_EVENT(fmt, local_name, __VA_ARGS__);                     \
+            event(callbacks);                                            \
+        });                                                              \
     } while (0)
 
 #define LOG_EVENT(fmt, ...) \
@@ -190,8 +405,8 @@ void CMainSignals::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockInd
     // the chain actually updates. One way to ensure this is for the caller to invoke this signal
     // in the same critical section where the chain is updated
 
-    auto event = [pindexNew, pindexFork, fInitialDownload, this] {
-        m_internals->Iterate([&](CValidationInterface& callbacks) { callbacks.UpdatedBlockTip(pindexNew, pindexFork, fInitialDownload); });
+    auto event = [pindexNew, pindexFork, fInitialDownload](CValidationInterface& callbacks) {
+        callbacks.UpdatedBlockTip(pindexNew, pindexFork, fInitialDownload);
     };
     ENQUEUE_AND_LOG_EVENT(event, "%s: new block hash=%s fork block hash=%s (in IBD=%s)", __func__,
                           pindexNew->GetBlockHash().ToString(),
@@ -200,8 +415,8 @@ void CMainSignals::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockInd
 }
 
 void CMainSignals::TransactionAddedToMempool(const CTransactionRef& tx, uint64_t mempool_sequence) {
-    auto event = [tx, mempool_sequence, this] {
-        m_internals->Iterate([&](CValidationInterface& callbacks) { callbacks.TransactionAddedToMempool(tx, mempool_sequence); });
+    auto event = [tx, mempool_sequence](CValidationInterface& callbacks) {
+        callbacks.TransactionAddedToMempool(tx, mempool_sequence);
     };
     ENQUEUE_AND_LOG_EVENT(event, "%s: txid=%s wtxid=%s", __func__,
                           tx->GetHash().ToString(),
@@ -209,8 +424,8 @@ void CMainSignals::TransactionAddedToMempool(const CTransactionRef& tx, uint64_t
 }
 
 void CMainSignals::TransactionRemovedFromMempool(const CTransactionRef& tx, MemPoolRemovalReason reason, uint64_t mempool_sequence) {
-    auto event = [tx, reason, mempool_sequence, this] {
-        m_internals->Iterate([&](CValidationInterface& callbacks) { callbacks.TransactionRemovedFromMempool(tx, reason, mempool_sequence); });
+    auto event = [tx, reason, mempool_sequence](CValidationInterface& callbacks) {
+        callbacks.TransactionRemovedFromMempool(tx, reason, mempool_sequence);
     };
     ENQUEUE_AND_LOG_EVENT(event, "%s: txid=%s wtxid=%s", __func__,
                           tx->GetHash().ToString(),
@@ -218,8 +433,8 @@ void CMainSignals::TransactionRemovedFromMempool(const CTransactionRef& tx, MemP
 }
 
 void CMainSignals::BlockConnected(const std::shared_ptr<const CBlock> &pblock, const CBlockIndex *pindex) {
-    auto event = [pblock, pindex, this] {
-        m_internals->Iterate([&](CValidationInterface& callbacks) { callbacks.BlockConnected(pblock, pindex); });
+    auto event = [pblock, pindex](CValidationInterface& callbacks) {
+        callbacks.BlockConnected(pblock, pindex);
     };
     ENQUEUE_AND_LOG_EVENT(event, "%s: block hash=%s block height=%d", __func__,
                           pblock->GetHash().ToString(),
@@ -228,8 +443,8 @@ void CMainSignals::BlockConnected(const std::shared_ptr<const CBlock> &pblock, c
 
 void CMainSignals::BlockDisconnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex)
 {
-    auto event = [pblock, pindex, this] {
-        m_internals->Iterate([&](CValidationInterface& callbacks) { callbacks.BlockDisconnected(pblock, pindex); });
+    auto event = [pblock, pindex](CValidationInterface& callbacks) {
+        callbacks.BlockDisconnected(pblock, pindex);
     };
     ENQUEUE_AND_LOG_EVENT(event, "%s: block hash=%s block height=%d", __func__,
                           pblock->GetHash().ToString(),
@@ -237,8 +452,8 @@ void CMainSignals::BlockDisconnected(const std::shared_ptr<const CBlock>& pblock
 }
 
 void CMainSignals::ChainStateFlushed(const CBlockLocator &locator) {
-    auto event = [locator, this] {
-        m_internals->Iterate([&](CValidationInterface& callbacks) { callbacks.ChainStateFlushed(locator); });
+    auto event = [locator](CValidationInterface& callbacks) {
+        callbacks.ChainStateFlushed(locator);
     };
     ENQUEUE_AND_LOG_EVENT(event, "%s: block hash=%s", __func__,
                           locator.IsNull() ? "null" : locator.vHave.front().ToString());
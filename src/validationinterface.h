@@ -23,9 +23,12 @@ class uint256;
 class CScheduler;
 enum class MemPoolRemovalReason;
 
+/** Default number of threads the callbacks of the subscribers run on */
+static constexpr int DEFAULT_CALLBACK_THREADS{2};
+
 /** Register subscriber */
 void RegisterValidationInterface(CValidationInterface* callbacks);
-/** Unregister subscriber. DEPRECATED. This is not safe to use when the RPC server or main message handler thread is running. */
+/** Unregister subscriber, waiting for a background callback it is running on another thread. DEPRECATED. This is not safe to use when the RPC server or main message handler thread is running. */
 void UnregisterValidationInterface(CValidationInterface* callbacks);
 /** Unregister all subscribers */
 void UnregisterAllValidationInterfaces();
@@ -76,6 +79,13 @@ void SyncWithValidationInterfaceQueue() LOCKS_EXCLUDED(cs_main);
  * ValidationInterface() subscribers.
  */
 class CValidationInterface {
+public:
+    /**
+     * Name the callback backlog of this subscriber is reported under in the
+     * metrics, see SUBSCRIBER_NAMES in validationinterface.cpp.
+     */
+    virtual const char* SubscriberName() const { return ""; }
+
 protected:
     /**
      * Protected destructor so that instances can only be deleted by derived classes.
@@ -187,13 +197,18 @@ private:
     friend void ::CallFunctionInValidationInterfaceQueue(std::function<void ()> func);
 
 public:
-    /** Register a CScheduler to give callbacks which should run in the background (may only be called once) */
-    void RegisterBackgroundSignalScheduler(CScheduler& scheduler);
+    /**
+     * Register a CScheduler to give callbacks which should run in the background (may only be called once).
+     * The callbacks of each subscriber run in order on the given number of threads, in parallel with the
+     * callbacks of other subscribers.
+     */
+    void RegisterBackgroundSignalScheduler(CScheduler& scheduler, int threads = DEFAULT_CALLBACK_THREADS);
     /** Unregister a CScheduler to give callbacks which should run in the background - these callbacks will now be dropped! */
     void UnregisterBackgroundSignalScheduler();
-    /** Call any remaining callbacks on the calling thread */
+    /** Stop the background threads, and call any remaining callbacks on the calling thread */
     void FlushBackgroundCallbacks();
 
+    /** Number of callbacks the subscriber that is furthest behind has yet to run */
     size_t CallbacksPending();
 
 
@@ -12,6 +12,7 @@
 #include <policy/feerate.h>
 #include <policy/fees.h>
 #include <policy/policy.h>
+#include <rpc/jsonwriter.h>
 #include <rpc/rawtransaction_util.h>
 #include <rpc/server.h>
 #include <rpc/util.h>
@@ -1479,6 +1480,14 @@ static RPCHelpMan listtransactions()
         nCount = ret.size() - nFrom;
 
     const std::vector<UniValue>& txs = ret.getValues();
+    if (JSONStreamWriter* writer = request.result_writer) {
+        writer->BeginArray();
+        for (auto it = txs.rend() - nFrom - nCount; it != txs.rend() - nFrom; ++it) {
+            writer->Value(*it);
+        }
+        writer->EndArray();
+        return NullUniValue;
+    }
     UniValue result{UniValue::VARR};
     result.push_backV({ txs.rend() - nFrom - nCount, txs.rend() - nFrom }); // Return oldest to newest
     return result;
@@ -2975,82 +2984,93 @@ static RPCHelpMan listunspent()
         pwallet->AvailableCoins(vecOutputs, &cctl, nMinimumAmount, nMaximumAmount, nMinimumSumAmount, nMaximumCount);
     }
 
-    LOCK(pwallet->cs_wallet);
+    {
+        LOCK(pwallet->cs_wallet);
 
-    const bool avoid_reuse = pwallet->IsWalletFlagSet(WALLET_FLAG_AVOID_REUSE);
+        const bool avoid_reuse = pwallet->IsWalletFlagSet(WALLET_FLAG_AVOID_REUSE);
 
-    for (const COutput& out : vecOutputs) {
-        CTxDestination address;
-        const CScript& scriptPubKey = out.tx->tx->vout[out.i].scriptPubKey;
-        bool fValidAddress = ExtractDestination(scriptPubKey, address);
-        bool reused = avoid_reuse && pwallet->IsSpentKey(out.tx->GetHash(), out.i);
+        for (const COutput& out : vecOutputs) {
+            CTxDestination address;
+            const CScript& scriptPubKey = out.tx->tx->vout[out.i].scriptPubKey;
+            bool fValidAddress = ExtractDestination(scriptPubKey, address);
+            bool reused = avoid_reuse && pwallet->IsSpentKey(out.tx->GetHash(), out.i);
 
-        if (destinations.size() && (!fValidAddress || !destinations.count(address)))
-            continue;
+            if (destinations.size() && (!fValidAddress || !destinations.count(address)))
+                continue;
 
-        UniValue entry(UniValue::VOBJ);
-        entry.pushKV("txid", out.tx->GetHash().GetHex());
-        entry.pushKV("vout", out.i);
+            UniValue entry(UniValue::VOBJ);
+            entry.pushKV("txid", out.tx->GetHash().GetHex());
+            entry.pushKV("vout", out.i);
 
-        if (fValidAddress) {
-            entry.pushKV("address", EncodeDestination(address));
+            if (fValidAddress) {
+                entry.pushKV("address", EncodeDestination(address));
 
-            const auto* address_book_entry = pwallet->FindAddressBookEntry(address);
-            if (address_book_entry) {
-                entry.pushKV("label", address_book_entry->GetLabel());
-            }
+                const auto* address_book_entry = pwallet->FindAddressBookEntry(address);
+                if (address_book_entry) {
+                    entry.pushKV("label", address_book_entry->GetLabel());
+                }
 
-            std::unique_ptr<SigningProvider> provider = pwallet->GetSolvingProvider(scriptPubKey);
-            if (provider) {
-                if (scriptPubKey.IsPayToScriptHash()) {
-                    const CScriptID& hash = CScriptID(std::get<ScriptHash>(address));
-                    CScript redeemScript;
-                    if (provider->GetCScript(hash, redeemScript)) {
-                        entry.pushKV("redeemScript", HexStr(redeemScript));
-                        // Now check if the redeemScript is actually a P2WSH script
-                        CTxDestination witness_destination;
-                        if (redeemScript.IsPayToWitnessScriptHash()) {
-                            bool extracted = ExtractDestination(redeemScript, witness_destination);
-                            CHECK_NONFATAL(extracted);
-                            // Also return the witness script
-                            const WitnessV0ScriptHash& whash = std::get<WitnessV0ScriptHash>(witness_destination);
-                            CScriptID id;
-                            CRIPEMD160().Write(whash.begin(), whash.size()).Finalize(id.begin());
-                            CScript witnessScript;
-                            if (provider->GetCScript(id, witnessScript)) {
-                                entry.pushKV("witnessScript", HexStr(witnessScript));
+                std::unique_ptr<SigningProvider> provider = pwallet->GetSolvingProvider(scriptPubKey);
+                if (provider) {
+                    if (scriptPubKey.IsPayToScriptHash()) {
+                        const CScriptID& hash = CScriptID(std::get<ScriptHash>(address));
+                        CScript redeemScript;
+                        if (provider->GetCScript(hash, redeemScript)) {
+                            entry.pushKV("redeemScript", HexStr(redeemScript));
+                            // Now check if the redeemScript is actually a P2WSH script
+                            CTxDestination witness_destination;
+                            if (redeemScript.IsPayToWitnessScriptHash()) {
+                                bool extracted = ExtractDestination(redeemScript, witness_destination);
+                                CHECK_NONFATAL(extracted);
+                                // Also return the witness script
+                                const WitnessV0ScriptHash& whash = std::get<WitnessV0ScriptHash>(witness_destination);
+                                CScriptID id;
+                                CRIPEMD160().Write(whash.begin(), whash.size()).Finalize(id.begin());
+                                CScript witnessScript;
+                                if (provider->GetCScript(id, witnessScript)) {
+                                    entry.pushKV("witnessScript", HexStr(witnessScript));
+                                }
                             }
                         }
-                    }
-                } else if (scriptPubKey.IsPayToWitnessScriptHash()) {
-                    const WitnessV0ScriptHash& whash = std::get<WitnessV0ScriptHash>(address);
-                    CScriptID id;
-                    CRIPEMD160().Write(whash.begin(), whash.size()).Finalize(id.begin());
-                    CScript witnessScript;
-                    if (provider->GetCScript(id, witnessScript)) {
-                        entry.pushKV("witnessScript", HexStr(witnessScript));
+                    } else if (scriptPubKey.IsPayToWitnessScriptHash()) {
+                        const WitnessV0ScriptHash& whash = std::get<WitnessV0ScriptHash>(address);
+                        CScriptID id;
+                        CRIPEMD160().Write(whash.begin(), whash.size()).Finalize(id.begin());
+                        CScript witnessScript;
+                        if (provider->GetCScript(id, witnessScript)) {
+                            entry.pushKV("witnessScript", HexStr(witnessScript));
+                        }
                     }
                 }
             }
-        }
 
-        entry.pushKV("scriptPubKey", HexStr(scriptPubKey));
-        entry.pushKV("amount", ValueFromAmount(out.tx->tx->vout[out.i].nValue));
-        entry.pushKV("confirmations", out.nDepth);
-        entry.pushKV("spendable", out.fSpendable);
-        entry.pushKV("solvable", out.fSolvable);
-        if (out.fSolvable) {
-            std::unique_ptr<SigningProvider> provider = pwallet->GetSolvingProvider(scriptPubKey);
-            if (provider) {
-                auto descriptor = InferDescriptor(scriptPubKey, *provider);
-                entry.pushKV("desc", descriptor->ToString());
+            entry.pushKV("scriptPubKey", HexStr(scriptPubKey));
+            entry.pushKV("amount", ValueFromAmount(out.tx->tx->vout[out.i].nValue));
+            entry.pushKV("confirmations", out.nDepth);
+            entry.pushKV("spendable", out.fSpendable);
+            entry.pushKV("solvable", out.fSolvable);
+            if (out.fSolvable) {
+                std::unique_ptr<SigningProvider> provider = pwallet->GetSolvingProvider(scriptPubKey);
+                if (provider) {
+                    auto descriptor = InferDescriptor(scriptPubKey, *provider);
+                    entry.pushKV("desc", descriptor->ToString());
+                }
             }
+            if (avoid_reuse) entry.pushKV("reused", reused);
+            entry.pushKV("safe", out.fSafe);
+            results.push_back(entry);
         }
-        if (avoid_reuse) entry.pushKV("reused", reused);
-        entry.pushKV("safe", out.fSafe);
-        results.push_back(entry);
     }
 
+    // Streaming waits for the client, so only start once the wallet is unlocked
+    if (JSONStreamWriter* writer = request.result_writer) {
+        writer->BeginArray();
+        for (const UniValue& entry : results.getValues()) {
+            writer->Value(entry);
+        }
+        writer->EndArray();
+        return NullUniValue;
+    }
     return results;
 },
     };
@@ -348,7 +348,7 @@ public:
      * Main wallet lock.
      * This lock protects all the fields added by CWallet.
      */
-    mutable RecursiveMutex cs_wallet;
+    mutable RecursiveMutex cs_wallet{"CWallet::cs_wallet"};
 
     WalletDatabase& GetDatabase() const override
     {
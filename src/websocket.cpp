@@ -0,0 +1,324 @@
+// Copyright (c) 2021 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <httprpc.h>
+
+#include <chain.h>
+#include <httpserver.h>
+#include <interfaces/handler.h>
+#include <interfaces/wallet.h>
+#include <logging.h>
+#include <node/context.h>
+#include <policy/policy.h>
+#include <primitives/block.h>
+#include <primitives/transaction.h>
+#include <rpc/protocol.h>
+#include <rpc/request.h>
+#include <sync.h>
+#include <txmempool.h>
+#include <util/system.h>
+#include <util/ui_change_type.h>
+#include <validationinterface.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <univalue.h>
+
+/** Bytes that may be waiting to be sent to a subscriber before notifications to it are dropped */
+static const size_t WEBSOCKET_SEND_BUFFER = 4 * 1024 * 1024;
+
+namespace {
+
+enum Topic : uint32_t {
+    TOPIC_TIP = 1 << 0,
+    TOPIC_MEMPOOL = 1 << 1,
+    TOPIC_WALLET = 1 << 2,
+    TOPIC_STAKE = 1 << 3,
+};
+
+const std::map<std::string, Topic> TOPICS{
+    {"tip", TOPIC_TIP},
+    {"mempool", TOPIC_MEMPOOL},
+    {"wallet", TOPIC_WALLET},
+    {"stake", TOPIC_STAKE},
+};
+
+UniValue TopicNames(uint32_t topics)
+{
+    UniValue names(UniValue::VARR);
+    for (const auto& [name, topic] : TOPICS) {
+        if (topics & topic) names.push_back(name);
+    }
+    return names;
+}
+
+/**
+ * Pushes node events to the WebSocket clients that subscribed to them.
+ *
+ * Every subscriber has a bounded send buffer. When a client reads too slowly
+ * for it, notifications to that client are dropped rather than queued without
+ * limit or slowing down the node, and the client is told how many it missed
+ * once there is room again.
+ */
+class WebSocketNotifier final : public CValidationInterface, public std::enable_shared_from_this<WebSocketNotifier>
+{
+public:
+    explicit WebSocketNotifier(NodeContext* node)
+    {
+        if (node && node->wallet_client) {
+            for (auto& wallet : node->wallet_client->getWallets()) {
+                WatchWallet(*wallet);
+            }
+            m_load_wallet_handler = node->wallet_client->handleLoadWallet([this](std::unique_ptr<interfaces::Wallet> wallet) {
+                WatchWallet(*wallet);
+            });
+        }
+    }
+
+    /** Accept a WebSocket handshake and add the client as a subscriber */
+    void Accept(HTTPRequest* req)
+    {
+        // The callbacks run on the event loop thread, possibly after the notifier is gone
+        std::weak_ptr<WebSocketNotifier> weak_self{shared_from_this()};
+        // Callbacks only start once AcceptWebSocket has returned, and take the lock
+        LOCK(m_mutex);
+        const uint64_t id{m_next_id++};
+        auto socket = req->AcceptWebSocket(
+            WEBSOCKET_SEND_BUFFER,
+            [weak_self, id](const std::string& message) {
+                if (auto self = weak_self.lock()) self->HandleMessage(id, message);
+            },
+            [weak_self, id] {
+                if (auto self = weak_self.lock()) self->Remove(id);
+            });
+        if (socket) m_subscribers.emplace(id, Subscriber{socket});
+    }
+
+    /** Stop watching wallets */
+    void ReleaseWallets()
+    {
+        m_load_wallet_handler.reset();
+        LOCK(m_wallets_mutex);
+        m_wallet_handlers.clear();
+    }
+
+    const char* SubscriberName() const override { return "websocket"; }
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindexNew, const CBlockIndex* pindexFork, bool fInitialDownload) override
+    {
+        if (!Wanted(TOPIC_TIP)) return;
+        UniValue data(UniValue::VOBJ);
+        data.pushKV("hash", pindexNew->GetBlockHash().GetHex());
+        data.pushKV("height", pindexNew->nHeight);
+        data.pushKV("time", int64_t{pindexNew->GetBlockTime()});
+        data.pushKV("proofofstake", pindexNew->IsProofOfStake());
+        data.pushKV("forkheight", pindexFork ? pindexFork->nHeight : -1);
+        data.pushKV("initialblockdownload", fInitialDownload);
+        Publish(TOPIC_TIP, "tip", data);
+    }
+
+    void TransactionAddedToMempool(const CTransactionRef& tx, uint64_t mempool_sequence) override
+    {
+        if (!Wanted(TOPIC_MEMPOOL)) return;
+        UniValue data(UniValue::VOBJ);
+        data.pushKV("event", "added");
+        data.pushKV("txid", tx->GetHash().GetHex());
+        data.pushKV("wtxid", tx->GetWitnessHash().GetHex());
+        data.pushKV("vsize", GetVirtualTransactionSize(*tx));
+        data.pushKV("sequence", mempool_sequence);
+        Publish(TOPIC_MEMPOOL, "mempool", data);
+    }
+
+    void TransactionRemovedFromMempool(const CTransactionRef& tx, MemPoolRemovalReason reason, uint64_t mempool_sequence) override
+    {
+        if (!Wanted(TOPIC_MEMPOOL)) return;
+        UniValue data(UniValue::VOBJ);
+        data.pushKV("event", "removed");
+        data.pushKV("txid", tx->GetHash().GetHex());
+        data.pushKV("wtxid", tx->GetWitnessHash().GetHex());
+        data.pushKV("reason", RemovalReasonToString(reason));
+        data.pushKV("sequence", mempool_sequence);
+        Publish(TOPIC_MEMPOOL, "mempool", data);
+    }
+
+    void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex) override
+    {
+        if (!Wanted(TOPIC_STAKE) || !block->IsProofOfStake()) return;
+        const CTransaction& coinstake{*block->vtx[1]};
+        UniValue kernel(UniValue::VOBJ);
+        kernel.pushKV("txid", coinstake.vin[0].prevout.hash.GetHex());
+        kernel.pushKV("vout", uint64_t{coinstake.vin[0].prevout.n});
+        UniValue data(UniValue::VOBJ);
+        data.pushKV("hash", pindex->GetBlockHash().GetHex());
+        data.pushKV("height", pindex->nHeight);
+        data.pushKV("time", int64_t{pindex->GetBlockTime()});
+        data.pushKV("coinstake", coinstake.GetHash().GetHex());
+        data.pushKV("kernel", kernel);
+        Publish(TOPIC_STAKE, "stake", data);
+    }
+
+private:
+    struct Subscriber {
+        std::shared_ptr<WebSocket> socket;
+        uint32_t topics{0};
+        //! Notifications dropped since the last one that was sent
+        uint64_t dropped{0};
+    };
+
+    Mutex m_mutex;
+    std::map<uint64_t, Subscriber> m_subscribers GUARDED_BY(m_mutex);
+    uint64_t m_next_id GUARDED_BY(m_mutex){0};
+    //! Topics that any subscriber wants, so that nothing is formatted for nobody
+    std::atomic<uint32_t> m_wanted{0};
+
+    Mutex m_wallets_mutex;
+    std::unique_ptr<interfaces::Handler> m_load_wallet_handler;
+    std::vector<std::unique_ptr<interfaces::Handler>> m_wallet_handlers GUARDED_BY(m_wallets_mutex);
+
+    bool Wanted(Topic topic) const { return m_wanted.load(std::memory_order_relaxed) & topic; }
+
+    void UpdateWanted() EXCLUSIVE_LOCKS_REQUIRED(m_mutex)
+    {
+        uint32_t wanted{0};
+        for (const auto& [id, subscriber] : m_subscribers) {
+            wanted |= subscriber.topics;
+        }
+        m_wanted = wanted;
+    }
+
+    void Publish(Topic topic, const std::string& name, const UniValue& data)
+    {
+        UniValue notification(UniValue::VOBJ);
+        notification.pushKV("topic", name);
+        notification.pushKV("data", data);
+        const std::string message{notification.write()};
+        LOCK(m_mutex);
+        for (auto& [id, subscriber] : m_subscribers) {
+            if (!(subscriber.topics & topic)) continue;
+            if (subscriber.dropped > 0) {
+                UniValue dropped(UniValue::VOBJ);
+                dropped.pushKV("count", subscriber.dropped);
+                UniValue notice(UniValue::VOBJ);
+                notice.pushKV("topic", "dropped");
+                notice.pushKV("data", dropped);
+                if (!subscriber.socket->Send(notice.write())) {
+                    ++subscriber.dropped;
+                    continue;
+                }
+                subscriber.dropped = 0;
+            }
+            if (!subscriber.socket->Send(message)) ++subscriber.dropped;
+        }
+    }
+
+    /** Handle a request of a subscriber, which has the JSON-RPC format */
+    void HandleMessage(uint64_t id, const std::string& message)
+    {
+        UniValue request;
+        UniValue request_id;
+        UniValue reply;
+        try {
+            if (!request.read(message) || !request.isObject()) {
+                throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
+            }
+            request_id = find_value(request, "id");
+            const UniValue& method{find_value(request, "method")};
+            const UniValue& params{find_value(request, "params")};
+            if (!method.isStr() || (method.get_str() != "subscribe" && method.get_str() != "unsubscribe")) {
+                throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found, expected subscribe or unsubscribe");
+            }
+            if (!params.isArray()) {
+                throw JSONRPCError(RPC_INVALID_PARAMS, "Expected an array of topics as params");
+            }
+            uint32_t topics{0};
+            for (const UniValue& param : params.getValues()) {
+                auto topic = param.isStr() ? TOPICS.find(param.get_str()) : TOPICS.end();
+                if (topic == TOPICS.end()) {
+                    throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown topic " + param.write());
+                }
+                topics |= topic->second;
+            }
+            LOCK(m_mutex);
+            auto it = m_subscribers.find(id);
+            if (it == m_subscribers.end()) return;
+            if (method.get_str() == "subscribe") {
+                it->second.topics |= topics;
+            } else {
+                it->second.topics &= ~topics;
+            }
+            UpdateWanted();
+            reply = JSONRPCReplyObj(TopicNames(it->second.topics), NullUniValue, request_id);
+        } catch (const UniValue& error) {
+            reply = JSONRPCReplyObj(NullUniValue, error, request_id);
+        }
+        LOCK(m_mutex);
+        auto it = m_subscribers.find(id);
+        if (it != m_subscribers.end() && !it->second.socket->Send(reply.write())) {
+            // A client that does not read its replies cannot be served
+            it->second.socket->Close(WS_CLOSE_POLICY_VIOLATION, "Send buffer full");
+        }
+    }
+
+    void Remove(uint64_t id)
+    {
+        LOCK(m_mutex);
+        m_subscribers.erase(id);
+        UpdateWanted();
+    }
+
+    void WatchWallet(interfaces::Wallet& wallet)
+    {
+        const std::string name{wallet.getWalletName()};
+        // The handler only refers to the signal of the wallet, so the wallet can still be unloaded
+        auto handler = wallet.handleTransactionChanged([this, name](const uint256& txid, ChangeType status) {
+            if (!Wanted(TOPIC_WALLET)) return;
+            UniValue data(UniValue::VOBJ);
+            data.pushKV("wallet", name);
+            data.pushKV("txid", txid.GetHex());
+            data.pushKV("status", status == CT_NEW ? "new" : status == CT_UPDATED ? "updated" : "deleted");
+            Publish(TOPIC_WALLET, "wallet", data);
+        });
+        LOCK(m_wallets_mutex);
+        m_wallet_handlers.push_back(std::move(handler));
+    }
+};
+
+std::shared_ptr<WebSocketNotifier> g_websocket_notifier;
+
+bool HTTPReq_WebSocket(WebSocketNotifier& notifier, HTTPRequest* req)
+{
+    std::string user;
+    if (!HTTPRPCAuthorize(req, user)) return false;
+    if (HTTPRPCUserRestricted(user)) {
+        req->WriteReply(HTTP_FORBIDDEN, "Users limited by -rpcwhitelist cannot subscribe to notifications");
+        return false;
+    }
+    notifier.Accept(req);
+    return true;
+}
+
+} // namespace
+
+void StartWebSocket(const std::any& context)
+{
+    LogPrint(BCLog::HTTP, "Starting WebSocket notifications\n");
+    g_websocket_notifier = std::make_shared<WebSocketNotifier>(util::AnyPtr<NodeContext>(context));
+    RegisterSharedValidationInterface(g_websocket_notifier);
+    RegisterHTTPHandler("/ws", true, [notifier = g_websocket_notifier](HTTPRequest* req, const std::string&) {
+        return HTTPReq_WebSocket(*notifier, req);
+    });
+}
+
+void StopWebSocket()
+{
+    if (!g_websocket_notifier) return;
+    UnregisterHTTPHandler("/ws", true);
+    UnregisterSharedValidationInterface(g_websocket_notifier);
+    g_websocket_notifier->ReleaseWallets();
+    g_websocket_notifier.reset();
+}
@@ -6,9 +6,12 @@
 #define BITCOIN_ZMQ_ZMQABSTRACTNOTIFIER_H
 
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <string>
 
+class CBlock;
 class CBlockIndex;
 class CTransaction;
 class CZMQAbstractNotifier;
@@ -19,6 +22,7 @@ class CZMQAbstractNotifier
 {
 public:
     static const int DEFAULT_ZMQ_SNDHWM {1000};
+    static const bool DEFAULT_ZMQ_NODROP {false};
 
     CZMQAbstractNotifier() : psocket(nullptr), outbound_message_high_water_mark(DEFAULT_ZMQ_SNDHWM) { }
     virtual ~CZMQAbstractNotifier();
@@ -40,13 +44,20 @@ public:
         }
     }
 
+    bool GetNoDrop() const { return nodrop; }
+    void SetNoDrop(bool n) { nodrop = n; }
+
+    uint64_t GetMessagesSent() const { return messages_sent.load(std::memory_order_relaxed); }
+    uint64_t GetMessagesDropped() const { return messages_dropped.load(std::memory_order_relaxed); }
+
     virtual bool Initialize(void *pcontext) = 0;
     virtual void Shutdown() = 0;
 
-    // Notifies of ConnectTip result, i.e., new active tip only
-    virtual bool NotifyBlock(const CBlockIndex *pindex);
+    // Notifies of ConnectTip result, i.e., new active tip only. block is the
+    // block that was just connected if it is still in memory, or nullptr.
+    virtual bool NotifyBlock(const CBlockIndex *pindex, const CBlock *block);
     // Notifies of every block connection
-    virtual bool NotifyBlockConnect(const CBlockIndex *pindex);
+    virtual bool NotifyBlockConnect(const CBlockIndex *pindex, const CBlock &block);
     // Notifies of every block disconnection
     virtual bool NotifyBlockDisconnect(const CBlockIndex *pindex);
     // Notifies of every mempool acceptance
@@ -61,6 +72,11 @@ protected:
     std::string type;
     std::string address;
     int outbound_message_high_water_mark; // aka SNDHWM
+    //! Whether the socket reports messages over the high water mark instead of dropping them for the subscriber (ZMQ_XPUB_NODROP)
+    bool nodrop{DEFAULT_ZMQ_NODROP};
+    //! Messages queued for the subscribers, and messages refused at the high water mark, which are only known with nodrop
+    std::atomic<uint64_t> messages_sent{0};
+    std::atomic<uint64_t> messages_dropped{0};
 };
 
 #endif // BITCOIN_ZMQ_ZMQABSTRACTNOTIFIER_H
@@ -37,6 +37,8 @@ CZMQNotificationInterface* CZMQNotificationInterface::Create()
     factories["pubrawblock"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
     factories["pubsequence"] = CZMQAbstractNotifier::Create<CZMQPublishSequenceNotifier>;
+    factories["pubhashstake"] = CZMQAbstractNotifier::Create<CZMQPublishHashStakeNotifier>;
+    factories["pubrawstake"] = CZMQAbstractNotifier::Create<CZMQPublishRawStakeNotifier>;
 
     std::list<std::unique_ptr<CZMQAbstractNotifier>> notifiers;
     for (const auto& entry : factories)
@@ -48,6 +50,7 @@ CZMQNotificationInterface* CZMQNotificationInterface::Create()
             notifier->SetType(entry.first);
             notifier->SetAddress(address);
             notifier->SetOutboundMessageHighWaterMark(static_cast<int>(gArgs.GetArg(arg + "hwm", CZMQAbstractNotifier::DEFAULT_ZMQ_SNDHWM)));
+            notifier->SetNoDrop(gArgs.GetBoolArg("-zmqnodrop", CZMQAbstractNotifier::DEFAULT_ZMQ_NODROP));
             notifiers.push_back(std::move(notifier));
         }
     }
@@ -131,11 +134,19 @@ void TryForEachAndRemoveFailed(std::list<std::unique_ptr<CZMQAbstractNotifier>>&
 
 void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
 {
+    // The new tip is the block connected last, unless it was connected
+    // before this interface was registered
+    const std::shared_ptr<const CBlock> block{std::move(m_last_connected_block)};
+    const CBlockIndex* const block_index{m_last_connected_index};
+    m_last_connected_block.reset();
+    m_last_connected_index = nullptr;
+
     if (fInitialDownload || pindexNew == pindexFork) // In IBD or blocks were disconnected without any new ones
         return;
 
-    TryForEachAndRemoveFailed(notifiers, [pindexNew](CZMQAbstractNotifier* notifier) {
-        return notifier->NotifyBlock(pindexNew);
+    const CBlock* tip_block = block_index == pindexNew ? block.get() : nullptr;
+    TryForEachAndRemoveFailed(notifiers, [pindexNew, tip_block](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyBlock(pindexNew, tip_block);
     });
 }
 
@@ -168,9 +179,14 @@ void CZMQNotificationInterface::BlockConnected(const std::shared_ptr<const CBloc
     }
 
     // Next we notify BlockConnect listeners for *all* blocks
-    TryForEachAndRemoveFailed(notifiers, [pindexConnected](CZMQAbstractNotifier* notifier) {
-        return notifier->NotifyBlockConnect(pindexConnected);
+    const CBlock& block = *pblock;
+    TryForEachAndRemoveFailed(notifiers, [pindexConnected, &block](CZMQAbstractNotifier* notifier) {
+        return notifier->NotifyBlockConnect(pindexConnected, block);
     });
+
+    // Keep the block for UpdatedBlockTip, so rawblock doesn't read it back from disk
+    m_last_connected_block = pblock;
+    m_last_connected_index = pindexConnected;
 }
 
 void CZMQNotificationInterface::BlockDisconnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindexDisconnected)
@@ -17,6 +17,8 @@ class CZMQNotificationInterface final : public CValidationInterface
 public:
     virtual ~CZMQNotificationInterface();
 
+    const char* SubscriberName() const override { return "zmq"; }
+
     std::list<const CZMQAbstractNotifier*> GetActiveNotifiers() const;
 
     static CZMQNotificationInterface* Create();
@@ -37,6 +39,10 @@ private:
 
     void *pcontext;
     std::list<std::unique_ptr<CZMQAbstractNotifier>> notifiers;
+
+    //! Block connected last, only accessed from the validation interface callbacks
+    std::shared_ptr<const CBlock> m_last_connected_block;
+    const CBlockIndex* m_last_connected_index{nullptr};
 };
 
 extern CZMQNotificationInterface* g_zmq_notification_interface;
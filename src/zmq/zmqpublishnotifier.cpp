@@ -9,12 +9,15 @@
 #include <node/blockstorage.h>
 #include <rpc/server.h>
 #include <streams.h>
+#include <util/metrics.h>
 #include <util/system.h>
 #include <validation.h> // For cs_main
 #include <zmq/zmqutil.h>
 
 #include <zmq.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <cstdarg>
 #include <cstddef>
 #include <map>
@@ -29,6 +32,18 @@ static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
 static const char *MSG_SEQUENCE  = "sequence";
+static const char *MSG_HASHSTAKE = "hashstake";
+static const char *MSG_RAWSTAKE  = "rawstake";
+
+static metrics::Family<metrics::Counter>& g_metric_zmq_sent{metrics::Add<metrics::Family<metrics::Counter>>(
+    "usdg_zmq_messages_total", "ZMQ messages queued for the subscribers, by topic",
+    "topic", std::vector<std::string>{MSG_HASHBLOCK, MSG_HASHTX, MSG_RAWBLOCK, MSG_RAWTX, MSG_SEQUENCE, MSG_HASHSTAKE, MSG_RAWSTAKE})};
+static metrics::Family<metrics::Counter>& g_metric_zmq_dropped{metrics::Add<metrics::Family<metrics::Counter>>(
+    "usdg_zmq_dropped_total", "ZMQ messages refused at the high water mark of a subscriber with -zmqnodrop, by topic",
+    "topic", std::vector<std::string>{MSG_HASHBLOCK, MSG_HASHTX, MSG_RAWBLOCK, MSG_RAWTX, MSG_SEQUENCE, MSG_HASHSTAKE, MSG_RAWSTAKE})};
+
+//! Returned by zmq_send_multipart when the message was not queued because of the high water mark
+static constexpr int ZMQ_SEND_DROPPED{1};
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -36,6 +51,7 @@ static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
     va_list args;
     va_start(args, size);
 
+    bool first_part{true};
     while (1)
     {
         zmq_msg_t msg;
@@ -53,7 +69,15 @@ static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
 
         data = va_arg(args, const void*);
 
-        rc = zmq_msg_send(&msg, sock, data ? ZMQ_SNDMORE : 0);
+        // Never block validation on a slow subscriber. Once the first part
+        // is queued, the high water mark does not apply to the other parts.
+        rc = zmq_msg_send(&msg, sock, (data ? ZMQ_SNDMORE : 0) | ZMQ_DONTWAIT);
+        if (rc == -1 && first_part && zmq_errno() == EAGAIN)
+        {
+            zmq_msg_close(&msg);
+            va_end(args);
+            return ZMQ_SEND_DROPPED;
+        }
         if (rc == -1)
         {
             zmqError("Unable to send ZMQ msg");
@@ -63,6 +87,7 @@ static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
         }
 
         zmq_msg_close(&msg);
+        first_part = false;
 
         if (!data)
             break;
@@ -99,6 +124,24 @@ bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
             return false;
         }
 
+        if (nodrop) {
+#ifdef ZMQ_XPUB_NODROP
+            // Report messages over the high water mark to the sender instead
+            // of dropping them silently, so that they are accounted for. This
+            // refuses a message for all subscribers of the socket as soon as
+            // one of them is at its high water mark.
+            const int nodrop_option {1};
+            rc = zmq_setsockopt(psocket, ZMQ_XPUB_NODROP, &nodrop_option, sizeof(nodrop_option));
+            if (rc != 0) {
+                zmqError("Failed to set ZMQ_XPUB_NODROP");
+                zmq_close(psocket);
+                return false;
+            }
+#else
+            LogPrintf("zmq: -zmqnodrop is not supported by this version of libzmq, messages for %s at %s are dropped silently\n", type, address);
+#endif
+        }
+
         const int so_keepalive_option {1};
         rc = zmq_setsockopt(psocket, ZMQ_TCP_KEEPALIVE, &so_keepalive_option, sizeof(so_keepalive_option));
         if (rc != 0) {
@@ -173,13 +216,22 @@ bool CZMQAbstractPublishNotifier::SendZmqMessage(const char *command, const void
     if (rc == -1)
         return false;
 
+    if (rc == ZMQ_SEND_DROPPED) {
+        LogPrint(BCLog::ZMQ, "zmq: High water mark reached, dropped %s message %d to %s\n", command, nSequence, address);
+        messages_dropped.fetch_add(1, std::memory_order_relaxed);
+        g_metric_zmq_dropped.Get(command).Inc();
+    } else {
+        messages_sent.fetch_add(1, std::memory_order_relaxed);
+        g_metric_zmq_sent.Get(command).Inc();
+    }
+
     /* increment memory only sequence number after sending */
     nSequence++;
 
     return true;
 }
 
-bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex, const CBlock * /*block*/)
 {
     uint256 hash = pindex->GetBlockHash();
     LogPrint(BCLog::ZMQ, "zmq: Publish hashblock %s to %s\n", hash.GetHex(), this->address);
@@ -199,22 +251,24 @@ bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &t
     return SendZmqMessage(MSG_HASHTX, data, 32);
 }
 
-bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex, const CBlock *block)
 {
     LogPrint(BCLog::ZMQ, "zmq: Publish rawblock %s to %s\n", pindex->GetBlockHash().GetHex(), this->address);
 
-    const Consensus::Params& consensusParams = Params().GetConsensus();
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    {
+    if (block) {
+        ss << *block;
+    } else {
+        const Consensus::Params& consensusParams = Params().GetConsensus();
         LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex, consensusParams))
+        CBlock disk_block;
+        if(!ReadBlockFromDisk(disk_block, pindex, consensusParams))
         {
             zmqError("Can't read block from disk");
             return false;
         }
 
-        ss << block;
+        ss << disk_block;
     }
 
     return SendZmqMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
@@ -242,7 +296,7 @@ static bool SendSequenceMsg(CZMQAbstractPublishNotifier& notifier, uint256 hash,
     return notifier.SendZmqMessage(MSG_SEQUENCE, data, sequence ? sizeof(data) : sizeof(hash) + sizeof(label));
 }
 
-bool CZMQPublishSequenceNotifier::NotifyBlockConnect(const CBlockIndex *pindex)
+bool CZMQPublishSequenceNotifier::NotifyBlockConnect(const CBlockIndex *pindex, const CBlock & /*block*/)
 {
     uint256 hash = pindex->GetBlockHash();
     LogPrint(BCLog::ZMQ, "zmq: Publish sequence block connect %s to %s\n", hash.GetHex(), this->address);
@@ -269,3 +323,46 @@ bool CZMQPublishSequenceNotifier::NotifyTransactionRemoval(const CTransaction &t
     LogPrint(BCLog::ZMQ, "zmq: Publish hashtx mempool removal %s to %s\n", hash.GetHex(), this->address);
     return SendSequenceMsg(*this, hash, /* Mempool (R)emoval */ 'R', mempool_sequence);
 }
+
+// Helper function to write a hash in the byte order it is displayed in
+static unsigned char* WriteReversedHash(unsigned char* out, const uint256& hash)
+{
+    std::reverse_copy(hash.begin(), hash.end(), out);
+    return out + hash.size();
+}
+
+bool CZMQPublishHashStakeNotifier::NotifyBlockConnect(const CBlockIndex *pindex, const CBlock &block)
+{
+    if (!block.IsProofOfStake()) return true;
+
+    // <32-byte block hash> | <32-byte coinstake txid> | <32-byte kernel txid> | <4-byte LE kernel output index> | <4-byte LE height>
+    const CTransaction& coinstake = *block.vtx[1];
+    const COutPoint& kernel = coinstake.vin[0].prevout;
+    LogPrint(BCLog::ZMQ, "zmq: Publish hashstake %s to %s\n", pindex->GetBlockHash().GetHex(), this->address);
+    unsigned char data[3 * 32 + 2 * sizeof(uint32_t)];
+    unsigned char* out = WriteReversedHash(data, pindex->GetBlockHash());
+    out = WriteReversedHash(out, coinstake.GetHash());
+    out = WriteReversedHash(out, kernel.hash);
+    WriteLE32(out, kernel.n);
+    WriteLE32(out + sizeof(uint32_t), pindex->nHeight);
+    return SendZmqMessage(MSG_HASHSTAKE, data, sizeof(data));
+}
+
+bool CZMQPublishRawStakeNotifier::NotifyBlockConnect(const CBlockIndex *pindex, const CBlock &block)
+{
+    if (!block.IsProofOfStake()) return true;
+
+    // <32-byte block hash> | <4-byte LE height> | <4-byte LE block time> | <32-byte kernel stake modifier> | <coinstake>
+    LogPrint(BCLog::ZMQ, "zmq: Publish rawstake %s to %s\n", pindex->GetBlockHash().GetHex(), this->address);
+    unsigned char header[2 * 32 + 2 * sizeof(uint32_t)];
+    unsigned char* out = WriteReversedHash(header, pindex->GetBlockHash());
+    WriteLE32(out, pindex->nHeight);
+    WriteLE32(out + sizeof(uint32_t), pindex->nTime);
+    // The kernel of a block is checked against the stake modifier of its parent
+    WriteReversedHash(out + 2 * sizeof(uint32_t), pindex->pprev ? pindex->pprev->nStakeModifier : uint256());
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+    ss.write(reinterpret_cast<const char*>(header), sizeof(header));
+    ss << *block.vtx[1];
+    return SendZmqMessage(MSG_RAWSTAKE, &(*ss.begin()), ss.size());
+}
@@ -21,6 +21,10 @@ public:
           * command
           * data
           * message sequence number
+       With -zmqnodrop, a message that can not be queued because the high
+       water mark of a subscriber is reached is counted as dropped, and
+       still uses up a sequence number so that subscribers can detect the
+       gap. Otherwise libzmq drops it for that subscriber only, unnoticed.
     */
     bool SendZmqMessage(const char *command, const void* data, size_t size);
 
@@ -31,7 +35,7 @@ public:
 class CZMQPublishHashBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex) override;
+    bool NotifyBlock(const CBlockIndex *pindex, const CBlock *block) override;
 };
 
 class CZMQPublishHashTransactionNotifier : public CZMQAbstractPublishNotifier
@@ -43,7 +47,7 @@ public:
 class CZMQPublishRawBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex) override;
+    bool NotifyBlock(const CBlockIndex *pindex, const CBlock *block) override;
 };
 
 class CZMQPublishRawTransactionNotifier : public CZMQAbstractPublishNotifier
@@ -55,10 +59,22 @@ public:
 class CZMQPublishSequenceNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlockConnect(const CBlockIndex *pindex) override;
+    bool NotifyBlockConnect(const CBlockIndex *pindex, const CBlock &block) override;
     bool NotifyBlockDisconnect(const CBlockIndex *pindex) override;
     bool NotifyTransactionAcceptance(const CTransaction &transaction, uint64_t mempool_sequence) override;
     bool NotifyTransactionRemoval(const CTransaction &transaction, uint64_t mempool_sequence) override;
 };
 
+class CZMQPublishHashStakeNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyBlockConnect(const CBlockIndex *pindex, const CBlock &block) override;
+};
+
+class CZMQPublishRawStakeNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyBlockConnect(const CBlockIndex *pindex, const CBlock &block) override;
+};
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H
@@ -26,6 +26,8 @@ static RPCHelpMan getzmqnotifications()
                             {RPCResult::Type::STR, "type", "Type of notification"},
                             {RPCResult::Type::STR, "address", "Address of the publisher"},
                             {RPCResult::Type::NUM, "hwm", "Outbound message high water mark"},
+                            {RPCResult::Type::NUM, "sent", "Number of messages queued for the subscribers"},
+                            {RPCResult::Type::NUM, "dropped", "Number of messages refused because a subscriber reached the high water mark. Only counted with -zmqnodrop, otherwise such messages are dropped for that subscriber without notice"},
                         }},
                     }
                 },
@@ -42,6 +44,8 @@ static RPCHelpMan getzmqnotifications()
             obj.pushKV("type", n->GetType());
             obj.pushKV("address", n->GetAddress());
             obj.pushKV("hwm", n->GetOutboundMessageHighWaterMark());
+            obj.pushKV("sent", n->GetMessagesSent());
+            obj.pushKV("dropped", n->GetMessagesDropped());
             result.push_back(obj);
         }
     }
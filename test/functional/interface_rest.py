@@ -265,6 +265,38 @@ class RESTTest (BitcoinTestFramework):
         assert_equal(resp.read().decode('utf-8').rstrip(), "Invalid height: -1")
         self.test_rest_request("/blockhashbyheight/", ret_type=RetType.OBJ, status=400)
 
+        self.log.info("Test the /stakemodifier, /stakekernel, /stakeweight and /difficulty URIs")
+        height = block_json_obj['height']
+        json_obj = self.test_rest_request("/stakemodifier/{}".format(height))
+        assert_equal(json_obj['blockhash'], bb_hash)
+        assert_equal(json_obj['modifier'], block_json_obj['modifier'])
+        assert_equal(json_obj['flags'], 'proof-of-work')
+        resp_bytes = self.test_rest_request("/stakemodifier/{}".format(height), req_type=ReqType.BIN, ret_type=RetType.BYTES)
+        assert_equal(len(resp_bytes), 68)
+        assert_equal(resp_bytes[:32][::-1].hex(), bb_hash)
+        assert_equal(resp_bytes[32:64][::-1].hex(), block_json_obj['modifier'])
+        self.test_rest_request("/stakemodifier/1000000", ret_type=RetType.OBJ, status=404)
+        self.test_rest_request("/stakemodifier/abc", ret_type=RetType.OBJ, status=400)
+
+        # Regtest blocks here are all proof-of-work
+        resp = self.test_rest_request("/stakekernel/{}".format(bb_hash), ret_type=RetType.OBJ, status=404)
+        assert_equal(resp.read().decode('utf-8').rstrip(), "{} is not a proof-of-stake block".format(bb_hash))
+        self.test_rest_request("/stakekernel/abc", ret_type=RetType.OBJ, status=400)
+
+        json_obj = self.test_rest_request("/stakeweight")
+        assert_equal(json_obj['blockhash'], bb_hash)
+        assert_equal(json_obj['netstakeweight'], 0)
+        assert_equal(len(self.test_rest_request("/stakeweight", req_type=ReqType.BIN, ret_type=RetType.BYTES)), 44)
+
+        json_obj = self.test_rest_request("/difficulty/10")
+        assert_equal(json_obj['height'], height)
+        assert_equal(json_obj['proof-of-work']['blocks'], 10)
+        assert_equal(json_obj['proof-of-work']['current'], block_json_obj['difficulty'])
+        assert_equal(json_obj['proof-of-stake'], {'blocks': 0})
+        assert_equal(len(self.test_rest_request("/difficulty/10", req_type=ReqType.BIN, ret_type=RetType.BYTES)), 68)
+        self.test_rest_request("/difficulty/0", ret_type=RetType.OBJ, status=400)
+        self.test_rest_request("/difficulty/2017", ret_type=RetType.OBJ, status=400)
+
         # Compare with json block header
         json_obj = self.test_rest_request("/headers/1/{}".format(bb_hash))
         assert_equal(len(json_obj), 1)  # ensure that there is one header in the json response
@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+# Copyright (c) 2021 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test the WebSocket notification interface."""
+
+import base64
+import json
+import os
+import socket
+import struct
+import urllib.parse
+
+from test_framework.address import ADDRESS_BCRT1_UNSPENDABLE
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, str_to_b64str
+
+
+class WebSocketClient:
+    """Minimal client side of RFC 6455, enough to test the server."""
+
+    def __init__(self, url, auth=True, extra=b""):
+        self.sock = socket.create_connection((url.hostname, url.port), timeout=30)
+        self.buf = b""
+        key = base64.b64encode(os.urandom(16)).decode()
+        request = ("GET /ws HTTP/1.1\r\nHost: {}\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                   "Sec-WebSocket-Key: {}\r\nSec-WebSocket-Version: 13\r\n").format(url.hostname, key)
+        if auth:
+            request += "Authorization: Basic {}\r\n".format(str_to_b64str(url.username + ':' + url.password))
+        self.sock.sendall(request.encode() + b"\r\n" + extra)
+        while b"\r\n\r\n" not in self.buf:
+            self._recv()
+        headers, self.buf = self.buf.split(b"\r\n\r\n", 1)
+        self.status = int(headers.split(b" ")[1])
+
+    def _recv(self):
+        data = self.sock.recv(65536)
+        if not data:
+            raise EOFError
+        self.buf += data
+
+    def _need(self, n):
+        while len(self.buf) < n:
+            self._recv()
+
+    @staticmethod
+    def frame(opcode, payload, fin=True):
+        mask = os.urandom(4)
+        header = bytes([(0x80 if fin else 0) | opcode])
+        if len(payload) < 126:
+            header += bytes([0x80 | len(payload)])
+        else:
+            header += bytes([0x80 | 126]) + struct.pack(">H", len(payload))
+        return header + mask + bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+
+    def send(self, opcode, payload, fin=True):
+        self.sock.sendall(self.frame(opcode, payload, fin))
+
+    def request(self, id, method, params):
+        self.send(0x1, json.dumps({"id": id, "method": method, "params": params}).encode())
+        return self.receive()
+
+    def receive_frame(self):
+        self._need(2)
+        opcode, size, header_size = self.buf[0] & 0x0f, self.buf[1] & 0x7f, 2
+        if size == 126:
+            self._need(4)
+            size, header_size = struct.unpack(">H", self.buf[2:4])[0], 4
+        elif size == 127:
+            self._need(10)
+            size, header_size = struct.unpack(">Q", self.buf[2:10])[0], 10
+        self._need(header_size + size)
+        payload = self.buf[header_size:header_size + size]
+        self.buf = self.buf[header_size + size:]
+        return opcode, payload
+
+    def receive(self):
+        opcode, payload = self.receive_frame()
+        assert_equal(opcode, 0x1)
+        return json.loads(payload)
+
+
+class WebSocketTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.num_nodes = 1
+        self.extra_args = [["-websocket"]]
+        self.supports_cli = False
+
+    def run_test(self):
+        node = self.nodes[0]
+        url = urllib.parse.urlparse(node.url)
+
+        self.log.info("Test that the handshake requires the RPC credentials")
+        assert_equal(WebSocketClient(url, auth=False).status, 401)
+
+        self.log.info("Test the handshake, with a ping sent right after it")
+        client = WebSocketClient(url, extra=WebSocketClient.frame(0x9, b"ping"))
+        assert_equal(client.status, 101)
+        assert_equal(client.receive_frame(), (0xa, b"ping"))
+
+        self.log.info("Test subscribing")
+        reply = client.request(1, "subscribe", ["tip", "unknown"])
+        assert_equal(reply["error"]["code"], -8)
+        reply = client.request(2, "subscribe", ["tip", "mempool"])
+        assert_equal(reply, {"result": ["mempool", "tip"], "error": None, "id": 2})
+        client.send(0x1, b"not json")
+        assert_equal(client.receive()["error"]["code"], -32700)
+
+        self.log.info("Test a request sent in fragments")
+        message = json.dumps({"id": 3, "method": "unsubscribe", "params": ["mempool"]}).encode()
+        client.send(0x1, message[:10], fin=False)
+        client.send(0x0, message[10:])
+        assert_equal(client.receive(), {"result": ["tip"], "error": None, "id": 3})
+
+        self.log.info("Test tip notifications")
+        hashes = node.generatetoaddress(2, ADDRESS_BCRT1_UNSPENDABLE)
+        for height, block_hash in enumerate(hashes, start=1):
+            notification = client.receive()
+            assert_equal(notification["topic"], "tip")
+            assert_equal(notification["data"]["hash"], block_hash)
+            assert_equal(notification["data"]["height"], height)
+
+        self.log.info("Test that text messages with invalid UTF-8 close the connection")
+        invalid = WebSocketClient(url)
+        invalid.send(0x1, b'{"id": 4, "method": "\xc0\xae"}')
+        assert_equal(invalid.receive_frame(), (0x8, struct.pack(">H", 1007) + b"Invalid UTF-8"))
+        # A character split over fragments is fine
+        client.send(0x1, b"\xe2\x82", fin=False)
+        client.send(0x0, b"\xac")
+        assert_equal(client.receive()["error"]["code"], -32700)
+
+        self.log.info("Test that binary messages close the connection")
+        client.send(0x2, b"binary")
+        assert_equal(client.receive_frame(), (0x8, struct.pack(">H", 1003) + b"Binary messages are not supported"))
+
+        self.log.info("Test that open connections are closed on shutdown")
+        client = WebSocketClient(url)
+        self.stop_node(0)
+        assert_equal(client.receive_frame()[0], 0x8)
+
+
+if __name__ == '__main__':
+    WebSocketTest().main()
@@ -25,7 +25,7 @@ from test_framework.util import (
     assert_raises_rpc_error,
 )
 from io import BytesIO
-from time import sleep
+from time import sleep, time
 
 # Test may be skipped and not have zmq installed
 try:
@@ -119,6 +119,7 @@ class ZMQTest (BitcoinTestFramework):
             self.test_mempool_sync()
             self.test_reorg()
             self.test_multiple_interfaces()
+            self.test_stake()
         finally:
             # Destroy the ZMQ context.
             self.log.debug("Destroying ZMQ context")
@@ -233,12 +234,16 @@ class ZMQTest (BitcoinTestFramework):
 
 
         self.log.info("Test the getzmqnotifications RPC")
-        assert_equal(self.nodes[0].getzmqnotifications(), [
-            {"type": "pubhashblock", "address": address, "hwm": 1000},
-            {"type": "pubhashtx", "address": address, "hwm": 1000},
-            {"type": "pubrawblock", "address": address, "hwm": 1000},
-            {"type": "pubrawtx", "address": address, "hwm": 1000},
+        notifications = self.nodes[0].getzmqnotifications()
+        assert_equal([(n["type"], n["address"], n["hwm"]) for n in notifications], [
+            ("pubhashblock", address, 1000),
+            ("pubhashtx", address, 1000),
+            ("pubrawblock", address, 1000),
+            ("pubrawtx", address, 1000),
         ])
+        for n in notifications:
+            assert n["sent"] > 0
+            assert_equal(n["dropped"], 0)
 
         assert_equal(self.nodes[1].getzmqnotifications(), [])
 
@@ -568,5 +573,66 @@ class ZMQTest (BitcoinTestFramework):
         assert_equal(self.nodes[0].getbestblockhash(), subscribers[0].receive().hex())
         assert_equal(self.nodes[0].getbestblockhash(), subscribers[1].receive().hex())
 
+    def test_stake(self):
+        if not self.is_wallet_compiled() or self.options.descriptors:
+            self.log.info("Skipping the stake topics test, staking needs a legacy wallet")
+            return
+
+        self.log.info("Test the hashstake and rawstake topics on a proof-of-stake block")
+        node = self.nodes[0]
+        # Enough mature coins for the staker to find a kernel within a few timestamps
+        node.generatetoaddress(100, node.getnewaddress())
+
+        address = 'tcp://127.0.0.1:28332'
+        hashstake, rawstake = [ZMQSubscriber(self.ctx.socket(zmq.SUB), topic) for topic in [b"hashstake", b"rawstake"]]
+        for sub in [hashstake, rawstake]:
+            sub.socket.set(zmq.RCVTIMEO, 1000)
+            # The socket keeps trying to connect until the node has bound the address
+            sub.socket.connect(address)
+        self.restart_node(0, ["-zmqpubhashstake=%s" % address, "-zmqpubrawstake=%s" % address,
+                              "-txindex", "-staking=1"] + self.extra_args[0])
+
+        # Both topics are published for every proof-of-stake block, but a
+        # subscriber may miss the first ones while it connects. The staker only
+        # tries timestamps it did not try before, so move the clock forward.
+        hash_bodies = {}
+        raw_bodies = {}
+        mocktime = int(time())
+        for _ in range(600):
+            if hash_bodies.keys() & raw_bodies.keys():
+                break
+            mocktime += 16
+            node.setmocktime(mocktime)
+            for sub, bodies in [(hashstake, hash_bodies), (rawstake, raw_bodies)]:
+                try:
+                    body = sub.receive()
+                    bodies[body[:32].hex()] = body
+                except zmq.error.Again:
+                    pass
+        assert hash_bodies.keys() & raw_bodies.keys(), "No proof-of-stake block was published on both topics"
+        block_hash = min(hash_bodies.keys() & raw_bodies.keys())
+        block = node.getblock(block_hash, 2)
+        assert_equal(block["flags"], "proof-of-stake")
+        coinstake = block["tx"][1]
+
+        # <block hash> | <coinstake txid> | <kernel txid> | <kernel output index> | <height>
+        body = hash_bodies[block_hash]
+        assert_equal(len(body), 3 * 32 + 2 * 4)
+        assert_equal(body[32:64].hex(), coinstake["txid"])
+        assert_equal(body[64:96].hex(), coinstake["vin"][0]["txid"])
+        assert_equal(struct.unpack("<II", body[96:]), (coinstake["vin"][0]["vout"], block["height"]))
+
+        # <block hash> | <height> | <block time> | <stake modifier> | <coinstake>
+        body = raw_bodies[block_hash]
+        assert_equal(struct.unpack("<II", body[32:40]), (block["height"], block["time"]))
+        # The kernel is checked against the stake modifier of the parent
+        assert_equal(body[40:72].hex(), node.getblock(block["previousblockhash"])["modifier"])
+        assert_equal(body[72:].hex(), coinstake["hex"])
+
+        for n in node.getzmqnotifications():
+            assert n["sent"] > 0
+            assert_equal(n["dropped"], 0)
+
+
 if __name__ == '__main__':
     ZMQTest().main()
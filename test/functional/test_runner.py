@@ -162,6 +162,7 @@ BASE_SCRIPTS = [
     'wallet_watchonly.py --usecli --legacy-wallet',
     'wallet_reorgsrestore.py',
     'interface_http.py',
+    'interface_websocket.py',
     'interface_rpc.py',
     'rpc_psbt.py --legacy-wallet',
     'rpc_psbt.py --descriptors',